@@ -11,6 +11,7 @@
 #include "opdi_AbstractProtocol.h"
 #include "opdi_IBasicProtocol.h"
 #include "opdi_StringTools.h"
+#include "opdi_PortFactory.h"
 
 #include "opdi_BasicDeviceCapabilities.h"
 
@@ -18,10 +19,19 @@ BasicDeviceCapabilities::BasicDeviceCapabilities(IBasicProtocol* protocol, int c
 {
 	int PORTS_PART = 1;
 	unsigned int PART_COUNT = 2;
-		
+	unsigned int PAGE_PART_COUNT = 3;
+
+	this->protocol = protocol;
+	this->nextPage = "0";
+
 	// decode the serial representation
 	std::vector<std::string> parts;
 	StringTools::split(serialForm, ':', parts);
+	if (parts.size() == PAGE_PART_COUNT) {
+		// the device sends the port infos in pages
+		addPage(serialForm);
+		return;
+	}
 	if (parts.size() != PART_COUNT) 
 		throw ProtocolException("BasicDeviceCapabilities message invalid");
 	if (parts[0] != OPDI_BASIC_DEVICE_CAPABILITIES_MAGIC)
@@ -40,6 +50,53 @@ BasicDeviceCapabilities::BasicDeviceCapabilities(IBasicProtocol* protocol, int c
 	}
 }
 
+void BasicDeviceCapabilities::addPortInfos(std::string records)
+{
+	// each record consists of the number of parts and the parts of a port info message
+	std::vector<std::string> items;
+	StringTools::split(records, ',', items);
+	// an empty page contains a blank
+	if ((items.size() == 1) && (items[0] == ""))
+		return;
+	size_t i = 0;
+	while (i < items.size()) {
+		int count = AbstractProtocol::parseInt(items[i], "part count", 1, 255);
+		if (i + count >= items.size())
+			throw ProtocolException("BasicDeviceCapabilities message invalid: incomplete port info");
+		std::vector<std::string> parts(items.begin() + i + 1, items.begin() + i + 1 + count);
+		// let the factory create the port; ignore unknown port types
+		OPDIPort* port = PortFactory::createPort(*protocol, parts);
+		if (port)
+			ports.push_back(port);
+		i += count + 1;
+	}
+}
+
+std::string BasicDeviceCapabilities::getNextPage()
+{
+	return nextPage;
+}
+
+void BasicDeviceCapabilities::addPage(std::string serialForm)
+{
+	int NEXT_PART = 1;
+	int RECORDS_PART = 2;
+	unsigned int PART_COUNT = 3;
+
+	std::vector<std::string> parts;
+	StringTools::split(serialForm, ':', parts);
+	if (parts.size() != PART_COUNT) 
+		throw ProtocolException("BasicDeviceCapabilities message invalid");
+	if (parts[0] != OPDI_BASIC_DEVICE_CAPABILITIES_MAGIC)
+		throw ProtocolException("BasicDeviceCapabilities message invalid: incorrect magic: " + parts[0]);
+	// the position must advance unless it is the last page
+	int next = AbstractProtocol::parseInt(parts[NEXT_PART], "next page", 0, 65535);
+	if ((next != 0) && (next <= AbstractProtocol::parseInt(nextPage, "next page", 0, 65535)))
+		throw ProtocolException("BasicDeviceCapabilities message invalid: page does not advance");
+	addPortInfos(parts[RECORDS_PART]);
+	nextPage = parts[NEXT_PART];
+}
+
 OPDIPort* BasicDeviceCapabilities::findPortByID(std::string portID) {
 	for (std::vector<OPDIPort*>::iterator iter = ports.begin(); iter != ports.end(); iter++) {
 		if ((*iter)->getID() == portID)
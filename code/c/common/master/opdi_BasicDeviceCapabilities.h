@@ -25,9 +25,27 @@ class BasicDeviceCapabilities {
 
 protected:
 	std::vector<OPDIPort*> ports;
+	IBasicProtocol* protocol;
+	// the position of the next page of port infos; "0" if there are no more pages
+	std::string nextPage;
+
+	// creates the ports from the info records of a page
+	void addPortInfos(std::string records);
 	
 public:
+	/** Decodes the reply to a device capabilities request. If it contains the list of port IDs,
+	 * the info of each port is requested. If it contains a page of port info records (BDC:next:records),
+	 * the ports are created from the records; the further pages must be added using addPage().
+	 */
 	BasicDeviceCapabilities(IBasicProtocol* protocol, int channel, std::string serialForm);
+
+	/** Returns the position of the next page of port infos, or "0" if all ports have been received.
+	 */
+	std::string getNextPage();
+
+	/** Adds the ports of the reply to the request for the page returned by getNextPage().
+	 */
+	void addPage(std::string serialForm);
 	
 	OPDIPort* findPortByID(std::string portID);
 
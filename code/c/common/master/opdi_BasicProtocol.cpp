@@ -193,14 +193,22 @@ BasicDeviceCapabilities* BasicProtocol::getDeviceCapabilities()
 
 	int channel = getSynchronousChannel();
 		
-	// request device capabilities from the slave
-	send(new OPDIMessage(channel, OPDI_getDeviceCaps));
+	// request device capabilities from the slave, with the port infos in pages
+	// devices that do not support pages send the list of port IDs
+	send(new OPDIMessage(channel, StringTools::join(AbstractProtocol::SEPARATOR, OPDI_getDeviceCaps, "0", OPDI_getPortInfo)));
 	OPDIMessage* capResult = expect(channel, DEFAULT_TIMEOUT);
 		
 	// decode the serial form
 	// this may issue callbacks on the protocol which do not have to be threaded
 	deviceCaps = new BasicDeviceCapabilities(this, channel, capResult->getPayload());
 
+	// request the remaining pages
+	while (deviceCaps->getNextPage() != "0") {
+		send(new OPDIMessage(channel, StringTools::join(AbstractProtocol::SEPARATOR, OPDI_getDeviceCaps, deviceCaps->getNextPage(), OPDI_getPortInfo)));
+		capResult = expect(channel, DEFAULT_TIMEOUT);
+		deviceCaps->addPage(capResult->getPayload());
+	}
+
 	return deviceCaps;
 }
 
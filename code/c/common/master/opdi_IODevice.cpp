@@ -25,6 +25,9 @@
 static OPDIMessage msgDisagreement(0, OPDI_Disagreement);
 static OPDIMessage msgDisconnect(0, OPDI_Disconnect);
 
+// the encryption method of the handshake; its modes are denoted by suffixes
+static const std::string ENCRYPTION_METHOD("AES");
+
 class IODevice;
 
 class ConnectingListener : public IDeviceListener 
@@ -186,6 +189,12 @@ void IODevice::connect(IDeviceListener *listener)
 		
 	// all connections begin without encryption
 	clearEncryption();
+	// and without multi-message or binary frames or fragments or CRC-32C, and with the traditional frame length
+	setMultiMessage(false);
+	setBinaryFraming(false);
+	setFragmentation(false);
+	setCRC32C(false);
+	setFrameSize(0);
 		
 	connectRunner = ConnectRunner(this, new ConnectingListener(this, listener));
 
@@ -292,10 +301,17 @@ void IODevice::expectAgreement()
 
 IBasicProtocol* IODevice::handshake(ICredentialsCallback* credCallback)
 {
-	std::string supportedEncryptions = ""; // (this.tryToUseEncryption() ? StringTools::join(',', std::vector<std::string>("AES")) : "");
+	std::string supportedEncryptions = "";
+	if (tryToUseEncryption()) {
+		// offer the modes in the order of preference; the counter modes carry the nonce of the master
+		std::string nonce = std::string(1, OPDI_ENCRYPTION_NONCE_SEPARATOR) + newEncryptionNonce();
+		supportedEncryptions = StringTools::join(',', ENCRYPTION_METHOD + OPDI_ENCRYPTION_GCM_SUFFIX + nonce,
+			ENCRYPTION_METHOD + OPDI_ENCRYPTION_CTR_SUFFIX + nonce, ENCRYPTION_METHOD);
+	}
 	
-	// send handshake message
-	OPDIMessage handshake(0, StringTools::join(AbstractProtocol::SEPARATOR, OPDI_Handshake, OPDI_Handshake_version, Poco::NumberFormatter::format(flags), supportedEncryptions));
+	// send handshake message; this master accepts multi-message and binary frames and fragmented messages
+	// and announces its frame length
+	OPDIMessage handshake(0, StringTools::join(AbstractProtocol::SEPARATOR, OPDI_Handshake, OPDI_Handshake_version, Poco::NumberFormatter::format(flags | OPDI_FLAG_MULTIMESSAGE | OPDI_FLAG_BINARY_FRAMING | OPDI_FLAG_FRAGMENTATION | OPDI_FLAG_CRC32C | OPDI_FLAG_FRAME_SIZE), supportedEncryptions));
 		
 	////////////////////////////////////////////////////////////
 	///// Send: Handshake
@@ -313,6 +329,7 @@ IBasicProtocol* IODevice::handshake(ICredentialsCallback* credCallback)
 	int ENCRYPTION = 3;
 	int FLAGS = 4;
 	int PROTOCOLS = 5;
+	int FRAME_SIZE = 6;
 	int PART_COUNT = 6;
 
 	std::vector<std::string> parts;
@@ -350,22 +367,6 @@ IBasicProtocol* IODevice::handshake(ICredentialsCallback* credCallback)
 		*/
 	}
 		
-	// encryption specified?
-	if (parts[ENCRYPTION] != "") {
-		/*
-		// find encryption
-		try {
-			Encryption encryption = Encryption.valueOf(parts[ENCRYPTION]);
-			// encryption to use for future messages
-			setEncryption(encryption);
-		} catch (DeviceException e) {
-			throw e;			
-		} catch (Exception e) {
-			throw new ProtocolException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_NOT_SUPPORTED) + parts[ENCRYPTION]);
-		}
-		*/
-	}
-		
 	int deviceFlags = 0;
 	try {
 		deviceFlags = AbstractProtocol::parseInt(parts[FLAGS], "flags", std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max());
@@ -373,6 +374,48 @@ IBasicProtocol* IODevice::handshake(ICredentialsCallback* credCallback)
 		throw ProtocolException("Flags invalid"); // + parts[FLAGS]);
 	}
 		
+	// encryption specified?
+	if (parts[ENCRYPTION] != "") {
+		// find encryption; the counter modes are followed by the nonce of the device
+		std::string method = parts[ENCRYPTION];
+		std::string nonce;
+		size_t pos = method.find(OPDI_ENCRYPTION_NONCE_SEPARATOR);
+		if (pos != std::string::npos) {
+			nonce = method.substr(pos + 1);
+			method = method.substr(0, pos);
+		}
+		Encryption encryption = NO_ENCRYPTION;
+		if (method == ENCRYPTION_METHOD && pos == std::string::npos)
+			encryption = AES;
+		else if (method == ENCRYPTION_METHOD + OPDI_ENCRYPTION_CTR_SUFFIX && pos != std::string::npos)
+			encryption = AES_CTR;
+		else if (method == ENCRYPTION_METHOD + OPDI_ENCRYPTION_GCM_SUFFIX && pos != std::string::npos)
+			encryption = AES_GCM;
+		else {
+			// send error message to the device
+			sendSynchronous(&msgDisagreement);
+			throw ProtocolException("Encryption not supported: " + parts[ENCRYPTION]);
+		}
+		// encryption to use for future messages
+		setEncryption(encryption, nonce, (deviceFlags & OPDI_FLAG_SESSION_KEY) == OPDI_FLAG_SESSION_KEY);
+	}
+		
+	// does the device send multi-message frames?
+	setMultiMessage((deviceFlags & OPDI_FLAG_MULTIMESSAGE) == OPDI_FLAG_MULTIMESSAGE);
+	// are the following messages exchanged as binary frames?
+	setBinaryFraming((deviceFlags & OPDI_FLAG_BINARY_FRAMING) == OPDI_FLAG_BINARY_FRAMING);
+	// are long messages exchanged as fragments?
+	setFragmentation((deviceFlags & OPDI_FLAG_FRAGMENTATION) == OPDI_FLAG_FRAGMENTATION);
+	// do the following text messages end with a CRC-32C?
+	setCRC32C((deviceFlags & OPDI_FLAG_CRC32C) == OPDI_FLAG_CRC32C);
+	// has the device announced its frame length?
+	bool frameSizeExchange = ((deviceFlags & OPDI_FLAG_FRAME_SIZE) == OPDI_FLAG_FRAME_SIZE);
+	if (frameSizeExchange) {
+		if ((int)parts.size() <= FRAME_SIZE)
+			throw ProtocolException("Frame length missing");
+		setFrameSize(AbstractProtocol::parseInt(parts[FRAME_SIZE], "frame length", OPDI_MIN_FRAME_SIZE, MASTER_MAX_FRAME_SIZE));
+	}
+
 	// check flags
 	if ((flags & OPDI_FLAG_ENCRYPTION_REQUIRED) == OPDI_FLAG_ENCRYPTION_REQUIRED) {
 		if (getEncryption() == NO_ENCRYPTION)
@@ -414,7 +457,10 @@ IBasicProtocol* IODevice::handshake(ICredentialsCallback* credCallback)
 		
 	std::string preferredLanguages = getPreferredLocalesString();
 
-	OPDIMessage protocolSelect(0, StringTools::join(AbstractProtocol::SEPARATOR, prot->getMagic(), preferredLanguages, getMasterName()));
+	// the master's frame length is appended if the device has announced its own
+	OPDIMessage protocolSelect(0, frameSizeExchange ?
+		StringTools::join(AbstractProtocol::SEPARATOR, prot->getMagic(), preferredLanguages, getMasterName(), Poco::NumberFormatter::format(MASTER_MAX_FRAME_SIZE)) :
+		StringTools::join(AbstractProtocol::SEPARATOR, prot->getMagic(), preferredLanguages, getMasterName()));
 
 	sendSynchronous(&protocolSelect);
 		
@@ -8,7 +8,17 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include <string.h>
+#include <sstream>
+#include <iomanip>
+
+#include "Poco/NumberFormatter.h"
+
 #include "opdi_platformfuncs.h"
+#include "opdi_protocol_constants.h"
+#include "opdi_constants.h"
+#include "opdi_strings.h"
+#include "opdi_config.h"
 
 #include "opdi_MessageQueueDevice.h"
 #include "opdi_IODevice.h"
@@ -22,7 +32,25 @@
 
 using Poco::Mutex;
 
-#define BUFFER_SIZE			32
+// the maximum number of bytes that are read from the device at once; large frames arrive in few reads
+#define BUFFER_SIZE			1024
+
+// maximum length of a reassembled message payload
+#define MAX_FRAGMENTED_LENGTH	65536
+
+// payloads that are longer are sent as fragments of this length if the device accepts them
+// and does not announce its frame length
+#define FRAGMENT_LENGTH			200
+
+// the maximum number of bytes that a text frame or binary frame adds to the payload of a fragment:
+// channel, separators, fragment header, checksum or CRC and terminator
+#define FRAME_OVERHEAD			20
+
+// a record number of AES-GCM must not be used twice; the highest bit marks the records of the device
+#define GCM_MAX_RECORDS			0x80000000UL
+
+// the checksum and the terminator of a text message that are replaced by the tag of an AES-GCM record
+#define TEXT_TRAILER_SIZE		6
 
 MessageProcessor::MessageProcessor(MessageQueueDevice* device, IBasicProtocol* protocol)
 {
@@ -30,6 +58,9 @@ MessageProcessor::MessageProcessor(MessageQueueDevice* device, IBasicProtocol* p
 	this->protocol = protocol;
 	this->stop = false;
 	this->hasMessagesToSend = false;
+	this->fragmentChannel = 0;
+	this->fragmented = false;
+	this->fragmentOverflow = false;
 }
 
 /**
@@ -48,60 +79,63 @@ void MessageProcessor::run()
 	while (!stop || hasMessagesToSend) {
         try {
 			if ((device->getEncryption() == 0 ? device->hasBytes() > 0 : device->has_block())) {
-        		int bytes = (device->getEncryption() == 0 ? device->read(buffer, BUFFER_SIZE) : device->read_block(buffer));
-				// append received bytes to message until terminator character
-				int terminatorPos = -1;
-				int bufferEnd = 0;
-				for (; bufferEnd < bytes; bytesProcessed++, bufferEnd++) {
-        			if (buffer[bufferEnd] == OPDIMessage::TERMINATOR) {
-        				terminatorPos = bytesProcessed;
-						// signal end of message string
-						message.push_back('\0');
-						break;
-        			}
-					else
-						message.push_back(buffer[bufferEnd]);
-				}
-        		
-        		// at least one complete message?
-        		while (terminatorPos > -1) {
-        			int msgLen = terminatorPos;
-        			// copy current part
-					std::vector<char> part(message.begin(), message.begin() + msgLen + 1);
-					// try to decode the message
-					try {
-						OPDIMessage* msg = OPDIMessage::decode(&part[0]); //, getEncoding());
-                		device->logDebug("Message received: " + msg->toString());
-						// message is valid
-						// let the protocol dispatch the message in case it contains streaming data
-						if (!protocol->dispatch(msg))
-							// add the message to the input queue
-							device->enqueueIn(msg);
-					} catch (MessageException e) {
-						device->logDebug("Invalid message: " + e.displayText());
-                		device->logDebug("Invalid message content: " + (bytesProcessed == 0 ? std::string("<empty>") : std::string(&part[0])));
+        		int bytes = (device->getEncryption() == 0 ? device->read(buffer, BUFFER_SIZE) : device->read_block(buffer, BUFFER_SIZE));
+				if (device->usesBinaryFraming()) {
+					// binary frames carry their length; there is no need to look for terminators
+					message.insert(message.end(), buffer, buffer + bytes);
+					processBinaryFrames(message);
+				} else {
+					// messages in a multi-message frame are separated by a special character
+					bool multiMessage = device->usesMultiMessage();
+					// append received bytes to message until terminator character
+					int terminatorPos = -1;
+					int bufferEnd = 0;
+					for (; bufferEnd < bytes; bytesProcessed++, bufferEnd++) {
+	        			if (buffer[bufferEnd] == OPDIMessage::TERMINATOR || (multiMessage && buffer[bufferEnd] == OPDI_MULTIMESSAGE_SEPARATOR)) {
+	        				terminatorPos = bytesProcessed;
+							// signal end of message string
+							message.push_back('\0');
+							break;
+	        			}
+						else
+							message.push_back(buffer[bufferEnd]);
 					}
-					// start over with a new message
-					bytesProcessed = 0;
-					terminatorPos = -1;
-					message.clear();
-					// there may be remaining characters in buffer after the terminator
-					if (bytes > ++bufferEnd) {
-						// only if encryption is off - in this case we discard the remaining buffer because
-						// we deal with a certain block size
-						if (device->getEncryption() == 0) {
+        		
+	        		// at least one complete message?
+	        		while (terminatorPos > -1) {
+	        			int msgLen = terminatorPos;
+	        			// copy current part
+						std::vector<char> part(message.begin(), message.begin() + msgLen + 1);
+						// try to decode the message
+						try {
+							// the payloads of fragments are taken as they are
+							OPDIMessage* msg = OPDIMessage::decode(&part[0], device->usesFragmentation(), device->usesCRC32C()); //, getEncoding());
+	                		device->logDebug("Message received: " + msg->toString());
+							// message is valid
+							processMessage(msg);
+						} catch (MessageException e) {
+							device->logDebug("Invalid message: " + e.displayText());
+	                		device->logDebug("Invalid message content: " + (bytesProcessed == 0 ? std::string("<empty>") : std::string(&part[0])));
+						}
+						// start over with a new message
+						bytesProcessed = 0;
+						terminatorPos = -1;
+						message.clear();
+						// there may be remaining characters in buffer after the terminator
+						// (the padding of encrypted blocks has already been removed by read_block)
+						if (bytes > ++bufferEnd) {
 							for (; bufferEnd < bytes; bytesProcessed++, bufferEnd++) {
-        						if (buffer[bufferEnd] == OPDIMessage::TERMINATOR) {
-        							terminatorPos = bytesProcessed;
+	        					if (buffer[bufferEnd] == OPDIMessage::TERMINATOR || (multiMessage && buffer[bufferEnd] == OPDI_MULTIMESSAGE_SEPARATOR)) {
+	        						terminatorPos = bytesProcessed;
 									// signal end of message string
 									message.push_back('\0');
 									break;
-        						}
+	        					}
 								else
 									message.push_back(buffer[bufferEnd]);
 							}
-						}
-					}        	
+						}        	
+					}
 				}
 			}
 			// are there messages to send?
@@ -237,6 +271,86 @@ void MessageProcessor::run()
 */
 }
 
+/** Decodes and dispatches the complete binary frames at the start of frames.
+	* Removes the processed bytes; an incomplete frame remains for the next call.
+	*/
+void MessageProcessor::processBinaryFrames(std::vector<char>& frames)
+{
+	size_t pos = 0;
+	while (pos < frames.size()) {
+		int length;
+		try {
+			length = OPDIMessage::binaryFrameLength(&frames[pos], (int)(frames.size() - pos));
+		} catch (MessageException e) {
+			device->logDebug("Invalid message: " + e.displayText());
+			// the frame boundaries are lost; discard the received bytes
+			frames.clear();
+			return;
+		}
+		// frame not yet complete?
+		if ((length == 0) || (frames.size() - pos < (size_t)length))
+			break;
+		try {
+			OPDIMessage* msg = OPDIMessage::decodeBinary(&frames[pos], length);
+			device->logDebug("Message received: " + msg->toString());
+			// message is valid
+			processMessage(msg);
+		} catch (MessageException e) {
+			device->logDebug("Invalid message: " + e.displayText());
+		}
+		pos += length;
+	}
+	frames.erase(frames.begin(), frames.begin() + pos);
+}
+
+/** Collects the payloads of fragments until the last fragment of a message has been received.
+	* Complete messages are passed to the protocol or added to the input queue.
+	*/
+void MessageProcessor::processMessage(OPDIMessage* msg)
+{
+	if (device->usesFragmentation()) {
+		std::string payload = msg->getPayload();
+		bool continued = (payload.size() > 0) && (payload[0] == OPDI_FRAGMENT_MARKER);
+		if (fragmented && (msg->getChannel() != fragmentChannel)) {
+			device->logDebug("Incomplete fragmented message discarded");
+			fragmented = false;
+		}
+		if (continued || fragmented) {
+			if (!fragmented) {
+				// the first fragment
+				fragmented = true;
+				fragmentChannel = msg->getChannel();
+				fragmentOverflow = false;
+				fragments.clear();
+			}
+			delete msg;
+			// the memory used for reassembly is limited
+			if (fragments.size() + payload.size() > MAX_FRAGMENTED_LENGTH) {
+				fragmentOverflow = true;
+				fragments.clear();
+			} else if (!fragmentOverflow)
+				fragments.append(payload, (continued ? 1 : 0), std::string::npos);
+			if (continued)
+				return;
+
+			// the last fragment
+			fragmented = false;
+			if (fragmentOverflow) {
+				device->logDebug("Fragmented message too long; ignored");
+				return;
+			}
+			msg = new OPDIMessage(fragmentChannel, fragments);
+			fragments.clear();
+			device->logDebug("Message reassembled: " + msg->toString());
+		}
+	}
+
+	// let the protocol dispatch the message in case it contains streaming data
+	if (!protocol->dispatch(msg))
+		// add the message to the input queue
+		device->enqueueIn(msg);
+}
+
 void MessageProcessor::stopProcessing()
 {
 	stop = true;
@@ -245,6 +359,15 @@ void MessageProcessor::stopProcessing()
 MessageQueueDevice::MessageQueueDevice(std::string id): IDevice(id)
 {
 	status = DS_DISCONNECTED;
+	multiMessage = false;
+	binaryFraming = false;
+	fragmentation = false;
+	crc32c = false;
+	frameSize = 0;
+	encryption = NO_ENCRYPTION;
+	cipher = NULL;
+	plainPos = 0;
+	memset(masterNonce, 0, sizeof(masterNonce));
 }
 
 void MessageQueueDevice::sendMessage(OPDIMessage* message)
@@ -432,6 +555,68 @@ void MessageQueueDevice::setEncoding(int encoding) {
 void MessageQueueDevice::clearEncryption() 
 {
 	this->encryption = NO_ENCRYPTION;
+	opdi_cipher_free(cipher);
+	cipher = NULL;
+	cipherIn.clear();
+	plainIn.clear();
+	plainPos = 0;
+}
+
+bool MessageQueueDevice::usesMultiMessage()
+{
+	return multiMessage;
+}
+
+void MessageQueueDevice::setMultiMessage(bool multiMessage)
+{
+	this->multiMessage = multiMessage;
+}
+
+bool MessageQueueDevice::usesBinaryFraming()
+{
+	return binaryFraming;
+}
+
+void MessageQueueDevice::setBinaryFraming(bool binaryFraming)
+{
+	this->binaryFraming = binaryFraming;
+}
+
+bool MessageQueueDevice::usesFragmentation()
+{
+	return fragmentation;
+}
+
+void MessageQueueDevice::setFragmentation(bool fragmentation)
+{
+	this->fragmentation = fragmentation;
+}
+
+bool MessageQueueDevice::usesCRC32C()
+{
+	return crc32c;
+}
+
+void MessageQueueDevice::setCRC32C(bool crc32c)
+{
+	this->crc32c = crc32c;
+}
+
+int MessageQueueDevice::getFrameSize()
+{
+	return frameSize;
+}
+
+void MessageQueueDevice::setFrameSize(int frameSize)
+{
+	this->frameSize = frameSize;
+}
+
+size_t MessageQueueDevice::getFragmentLength()
+{
+	if (frameSize == 0)
+		return FRAGMENT_LENGTH;
+	return frameSize - FRAME_OVERHEAD;
 }
 
 MessageQueueDevice::Encryption MessageQueueDevice::getEncryption()
@@ -439,33 +624,246 @@ MessageQueueDevice::Encryption MessageQueueDevice::getEncryption()
 	return encryption;
 }
 
-void MessageQueueDevice::setEncryption(Encryption encryption) 
-{
-	/*
-		random = new Random();
-		if (encryption == null)
-			clearEncryption();
-		else
-			switch (encryption) {
-			case AES:
-				if (getEncryptionKey() == null || getEncryptionKey().isEmpty())
-					throw new DeviceException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_KEY_INVALID));
-				
-				skeySpec = new SecretKeySpec(getEncryptionKey().getBytes(), "AES");
-	
-				// Instantiate the cipher
-				try {
-					cipher = Cipher.getInstance("AES/ECB/NoPadding");
-				} catch (Exception e) {
-					throw new DeviceException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_ERROR_INITIALIZING) + e);
-				}
-				this.encryption = encryption;
-				break;
-			default: throw new IllegalArgumentException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_NOT_SUPPORTED) + encryption);
-			}		
+/** Returns the value of a hexadecimal digit or -1 if the character is not a digit.
 	*/
+static int hexDigit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+void MessageQueueDevice::setEncryption(Encryption encryption, std::string deviceNonce, bool sessionKey) 
+{
+	clearEncryption();
+	if (encryption == NO_ENCRYPTION)
+		return;
+
+	std::string key = getEncryptionKey();
+	if (key.size() != AES_BLOCKSIZE)
+		throw DeviceException("Encryption key invalid; it must consist of " + Poco::NumberFormatter::format(AES_BLOCKSIZE) + " bytes");
+	cipher = opdi_cipher_create((const uint8_t *)key.c_str());
+	if (cipher == NULL)
+		throw DeviceException("Error initializing the encryption");
+
+	if (encryption == AES_CTR || encryption == AES_GCM) {
+		// the nonce of the device distinguishes the key streams of this connection
+		if (deviceNonce.size() != 2 * AES_NONCE_SIZE)
+			throw DeviceException("Encryption nonce invalid: " + deviceNonce);
+		for (int i = 0; i < AES_NONCE_SIZE; i++) {
+			int high = hexDigit(deviceNonce[2 * i]);
+			int low = hexDigit(deviceNonce[2 * i + 1]);
+			if (high < 0 || low < 0)
+				throw DeviceException("Encryption nonce invalid: " + deviceNonce);
+			this->deviceNonce[i] = (uint8_t)((high << 4) | low);
+		}
+
+		if (sessionKey) {
+			// the session key is the encryption of both nonces with the key of the device
+			uint8_t block[AES_BLOCKSIZE];
+			memcpy(block, this->deviceNonce, AES_NONCE_SIZE);
+			memcpy(block + AES_NONCE_SIZE, masterNonce, AES_NONCE_SIZE);
+			encryptBlocks(block, block, 1);
+			opdi_cipher_free(cipher);
+			cipher = opdi_cipher_create(block);
+			memset(block, 0, sizeof(block));
+			if (cipher == NULL)
+				throw DeviceException("Error initializing the encryption");
+		}
+
+		// the direction of the key streams is seen from the device
+		resetKeyStream(ksIn, OPDI_DIR_OUTGOING);
+		resetKeyStream(ksOut, OPDI_DIR_INCOMING);
+		recordsIn = 0;
+		recordsOut = 0;
+		if (encryption == AES_GCM)
+			prepareGHash();
+	}
+	this->encryption = encryption;
 }
 
+std::string MessageQueueDevice::newEncryptionNonce()
+{
+	random.read((char *)masterNonce, AES_NONCE_SIZE);
+
+	std::string result;
+	for (int i = 0; i < AES_NONCE_SIZE; i++)
+		result += Poco::NumberFormatter::formatHex(masterNonce[i], 2);
+	return result;
+}
+
+void MessageQueueDevice::encryptBlocks(uint8_t *dest, const uint8_t *src, int count)
+{
+	if (opdi_cipher_encrypt_blocks(cipher, dest, src, (uint16_t)count) != OPDI_STATUS_OK)
+		throw DeviceException("Error encrypting blocks");
+}
+
+void MessageQueueDevice::setPrefixNonce(KeyStream& ks)
+{
+	for (int i = 0; i < AES_NONCE_SIZE; i++)
+		ks.prefix[i] = deviceNonce[i] ^ masterNonce[i];
+}
+
+void MessageQueueDevice::resetKeyStream(KeyStream& ks, uint8_t direction)
+{
+	// the prefix of the counter blocks consists of the nonce and the direction
+	memset(ks.prefix, 0, sizeof(ks.prefix));
+	setPrefixNonce(ks);
+	ks.prefix[AES_NONCE_SIZE] = direction;
+	ks.counter = 0;
+	ks.used = AES_BLOCKSIZE;
+}
+
+void MessageQueueDevice::applyKeyStream(KeyStream& ks, uint8_t *bytes, int length)
+{
+	// use the rest of the current block
+	while (length > 0 && ks.used < AES_BLOCKSIZE) {
+		*bytes++ ^= ks.block[ks.used++];
+		length--;
+	}
+	if (length == 0)
+		return;
+
+	// encrypt the counter blocks for all remaining bytes at once
+	int count = (length + AES_BLOCKSIZE - 1) / AES_BLOCKSIZE;
+	blocks.resize(count * AES_BLOCKSIZE);
+	for (int i = 0; i < count; i++, ks.counter++) {
+		uint8_t *counter = &blocks[i * AES_BLOCKSIZE];
+		memcpy(counter, ks.prefix, AES_BLOCKSIZE - 4);
+		counter[AES_BLOCKSIZE - 4] = (uint8_t)(ks.counter >> 24);
+		counter[AES_BLOCKSIZE - 3] = (uint8_t)(ks.counter >> 16);
+		counter[AES_BLOCKSIZE - 2] = (uint8_t)(ks.counter >> 8);
+		counter[AES_BLOCKSIZE - 1] = (uint8_t)ks.counter;
+	}
+	encryptBlocks(&blocks[0], &blocks[0], count);
+
+	for (int i = 0; i < length; i++)
+		bytes[i] ^= blocks[i];
+	// keep the rest of the last block
+	memcpy(ks.block, &blocks[(count - 1) * AES_BLOCKSIZE], AES_BLOCKSIZE);
+	ks.used = length - (count - 1) * AES_BLOCKSIZE;
+}
+
+// the reduction constants of the 4 bit GHASH multiplication
+static const uint16_t ghashLast4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+void MessageQueueDevice::prepareGHash()
+{
+	// the hash key is the encrypted zero block
+	uint8_t key[AES_BLOCKSIZE];
+	memset(key, 0, sizeof(key));
+	encryptBlocks(key, key, 1);
+
+	uint64_t high = 0;
+	uint64_t low = 0;
+	for (int i = 0; i < 8; i++) {
+		high = (high << 8) | key[i];
+		low = (low << 8) | key[i + 8];
+	}
+
+	// the table entry for the bit pattern 1000 is the key itself
+	ghashHigh[0] = 0;
+	ghashLow[0] = 0;
+	ghashHigh[8] = high;
+	ghashLow[8] = low;
+	for (int i = 4; i > 0; i >>= 1) {
+		uint32_t t = (uint32_t)(low & 1) * 0xe1000000UL;
+		low = (high << 63) | (low >> 1);
+		high = (high >> 1) ^ ((uint64_t)t << 32);
+		ghashHigh[i] = high;
+		ghashLow[i] = low;
+	}
+	for (int i = 2; i <= 8; i *= 2) {
+		for (int j = 1; j < i; j++) {
+			ghashHigh[i + j] = ghashHigh[i] ^ ghashHigh[j];
+			ghashLow[i + j] = ghashLow[i] ^ ghashLow[j];
+		}
+	}
+}
+
+void MessageQueueDevice::multiplyGHash(uint8_t *y)
+{
+	uint64_t high = 0;
+	uint64_t low = 0;
+
+	for (int i = 15; i >= 0; i--) {
+		// the low nibble first, then the high nibble
+		for (int shift = 0; shift <= 4; shift += 4) {
+			uint8_t nibble = (y[i] >> shift) & 0x0f;
+			if (i != 15 || shift != 0) {
+				uint8_t rem = (uint8_t)(low & 0x0f);
+				low = (high << 60) | (low >> 4);
+				high = (high >> 4) ^ ((uint64_t)ghashLast4[rem] << 48);
+			}
+			high ^= ghashHigh[nibble];
+			low ^= ghashLow[nibble];
+		}
+	}
+	for (int i = 7; i >= 0; i--) {
+		y[i] = (uint8_t)high;
+		y[i + 8] = (uint8_t)low;
+		high >>= 8;
+		low >>= 8;
+	}
+}
+
+void MessageQueueDevice::startRecord(KeyStream& ks, bool fromDevice, uint8_t *tag)
+{
+	uint32_t& count = (fromDevice ? recordsIn : recordsOut);
+	// a record number must not be used twice
+	if (count >= GCM_MAX_RECORDS)
+		throw DeviceException("Too many encrypted records; the connection must be renewed");
+	uint32_t number = count++;
+	if (fromDevice)
+		number |= GCM_MAX_RECORDS;
+
+	// the prefix of the counter blocks consists of the nonce and the record number
+	setPrefixNonce(ks);
+	ks.prefix[AES_NONCE_SIZE] = (uint8_t)(number >> 24);
+	ks.prefix[AES_NONCE_SIZE + 1] = (uint8_t)(number >> 16);
+	ks.prefix[AES_NONCE_SIZE + 2] = (uint8_t)(number >> 8);
+	ks.prefix[AES_NONCE_SIZE + 3] = (uint8_t)number;
+	ks.counter = 1;
+	ks.used = AES_BLOCKSIZE;
+
+	// the first counter block masks the tag
+	memset(tag, 0, AES_GCM_TAG_SIZE);
+	applyKeyStream(ks, tag, AES_GCM_TAG_SIZE);
+}
+
+void MessageQueueDevice::authenticateRecord(const uint8_t *header, const uint8_t *bytes, int length, uint8_t *tag)
+{
+	uint8_t y[AES_BLOCKSIZE];
+	memset(y, 0, sizeof(y));
+
+	for (int i = 0; i < AES_GCM_HEADER_SIZE; i++)
+		y[i] ^= header[i];
+	multiplyGHash(y);
+	for (int pos = 0; pos < length; pos += AES_BLOCKSIZE) {
+		for (int i = 0; i < AES_BLOCKSIZE && pos + i < length; i++)
+			y[i] ^= bytes[pos + i];
+		multiplyGHash(y);
+	}
+
+	// the lengths of the header and of the message in bits
+	y[6] ^= (uint8_t)((AES_GCM_HEADER_SIZE * 8) >> 8);
+	y[7] ^= (uint8_t)(AES_GCM_HEADER_SIZE * 8);
+	y[12] ^= (uint8_t)(length >> 21);
+	y[13] ^= (uint8_t)(length >> 13);
+	y[14] ^= (uint8_t)(length >> 5);
+	y[15] ^= (uint8_t)(length << 3);
+	multiplyGHash(y);
+
+	for (int i = 0; i < AES_GCM_TAG_SIZE; i++)
+		tag[i] ^= y[i];
+}
 
 Poco::NotificationQueue* MessageQueueDevice::getInputMessages()
 {
@@ -503,86 +901,152 @@ bool MessageQueueDevice::processOutQueue()
 // Returns true if there are enough bytes for a block to be read and decoded
 bool MessageQueueDevice::has_block()
 {
-	/*
+	if (plainPos < plainIn.size())
+		return true;
 	switch (encryption) {
-		case AES: return hasBytes() >= AES_BLOCKSIZE; 
-		default: throw new IllegalArgumentException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_NOT_SUPPORTED) + encryption);
+	case AES: return cipherIn.size() + hasBytes() >= AES_BLOCKSIZE;
+	case AES_CTR: return hasBytes() > 0;
+	// a record may be incomplete; read_block returns 0 in this case
+	case AES_GCM: return hasBytes() > 0;
+	default: throw DeviceException("Encryption not supported");
 	}
-	*/
-	return false;
 }
-	
-// read and decrypt an encrypted block from the wire
-int MessageQueueDevice::read_block(char buffer[])
+
+void MessageQueueDevice::decryptReceived()
 {
-	/*
-	try {
-		switch (encryption) {
-		case AES:
-			byte[] bytes = new byte[AES_BLOCKSIZE];
-			// read the block
-			for (int i = 0; i < AES_BLOCKSIZE; i++)
-				bytes[i] = read();
-
-			// decrypt the block
-			cipher.init(Cipher.DECRYPT_MODE, skeySpec);
-			byte[] out = cipher.doFinal(bytes);
-			System.arraycopy(out, 0, buffer, 0, AES_BLOCKSIZE);
-			return AES_BLOCKSIZE;
-		default: throw new IllegalArgumentException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_NOT_SUPPORTED) + encryption);
+	plainIn.clear();
+	plainPos = 0;
+
+	// read all available bytes
+	size_t received = cipherIn.size();
+	int available = hasBytes();
+	if (available > 0) {
+		cipherIn.resize(received + available);
+		cipherIn.resize(received + read_bytes((char *)&cipherIn[received], available));
+	}
+
+	switch (encryption) {
+	case AES: {
+		// decrypt all complete blocks with one call
+		int count = (int)(cipherIn.size() / AES_BLOCKSIZE);
+		if (count == 0)
+			return;
+		blocks.resize(count * AES_BLOCKSIZE);
+		if (opdi_cipher_decrypt_blocks(cipher, &blocks[0], &cipherIn[0], (uint16_t)count) != OPDI_STATUS_OK)
+			throw DeviceException("Error decrypting blocks");
+		cipherIn.erase(cipherIn.begin(), cipherIn.begin() + count * AES_BLOCKSIZE);
+		// a message ends with the terminator; the rest of its last block is padding
+		for (int i = 0; i < count; i++) {
+			const char *block = (const char *)&blocks[i * AES_BLOCKSIZE];
+			int length = AES_BLOCKSIZE;
+			while (length > 0 && block[length - 1] != OPDIMessage::TERMINATOR)
+				length--;
+			plainIn.insert(plainIn.end(), block, block + (length > 0 ? length : AES_BLOCKSIZE));
 		}
-	} catch (BadPaddingException e) {
-		throw new DeviceException("Error decrypting block: " + e);
-	} catch (InvalidKeyException e) {
-		throw new DeviceException("Error decrypting block: " + e);
-	} catch (IllegalBlockSizeException e) {
-		throw new DeviceException("Error decrypting block: " + e);
+		break;
+	}
+	case AES_CTR:
+		// the messages are not padded; all bytes are decrypted
+		if (cipherIn.empty())
+			return;
+		applyKeyStream(ksIn, &cipherIn[0], (int)cipherIn.size());
+		plainIn.assign(cipherIn.begin(), cipherIn.end());
+		cipherIn.clear();
+		break;
+	case AES_GCM: {
+		// decrypt the complete records
+		size_t pos = 0;
+		while (cipherIn.size() - pos >= AES_GCM_HEADER_SIZE) {
+			const uint8_t *header = &cipherIn[pos];
+			int length = (header[0] << 8) | header[1];
+			if (cipherIn.size() - pos < (size_t)(AES_GCM_HEADER_SIZE + length + AES_GCM_TAG_SIZE))
+				break;
+			uint8_t *message = &cipherIn[pos + AES_GCM_HEADER_SIZE];
+			pos += AES_GCM_HEADER_SIZE + length + AES_GCM_TAG_SIZE;
+
+			uint8_t expected[AES_GCM_TAG_SIZE];
+			startRecord(ksIn, true, expected);
+			authenticateRecord(header, message, length, expected);
+			// compare the tags in constant time
+			uint8_t difference = 0;
+			for (int i = 0; i < AES_GCM_TAG_SIZE; i++)
+				difference |= message[length + i] ^ expected[i];
+			if (difference != 0) {
+				// ignore forged or damaged records
+				logDebug("Invalid message: Authentication of the encrypted record failed");
+				continue;
+			}
+			applyKeyStream(ksIn, message, length);
+
+			// the record contains "channel:payload"; add checksum and terminator of the text form
+			opdi_FrameScan scan;
+			strings_scan_frame(message, length, OPDIMessage::TERMINATOR, OPDIMessage::SEPARATOR, &scan);
+			std::stringstream trailer;
+			trailer << OPDIMessage::SEPARATOR << std::setfill('0') << std::setw(4) << std::hex << (scan.sum & 0xffff) << OPDIMessage::TERMINATOR;
+			plainIn.insert(plainIn.end(), (const char *)message, (const char *)message + length);
+			std::string text = trailer.str();
+			plainIn.insert(plainIn.end(), text.begin(), text.end());
+		}
+		cipherIn.erase(cipherIn.begin(), cipherIn.begin() + pos);
+		break;
+	}
+	default: throw DeviceException("Encryption not supported");
 	}
-	*/
-	return 0;
+}
+
+int MessageQueueDevice::read_block(char buffer[], int maxlength)
+{
+	if (plainPos >= plainIn.size())
+		decryptReceived();
+
+	int count = (int)(plainIn.size() - plainPos);
+	if (count > maxlength)
+		count = maxlength;
+	if (count > 0)
+		memcpy(buffer, &plainIn[plainPos], count);
+	plainPos += count;
+	return count;
 }
 	
 void MessageQueueDevice::write_blocks(char bytes[], int length)
 {
-	/*
-		try {
-			switch (encryption) {
-			case AES:
-				cipher.init(Cipher.ENCRYPT_MODE, skeySpec);
-				byte[] block = new byte[AES_BLOCKSIZE];
-				
-				int b = 0;
-				while (bytes.length > b * AES_BLOCKSIZE) {
-					for (int i = 0; i < AES_BLOCKSIZE; i++) {
-						// source position
-						int pos = b * AES_BLOCKSIZE + i;
-						if (pos < bytes.length)
-							block[i] = bytes[pos];
-						else
-							// pad with random byte; terminator may not occur
-							do { 
-								block[i] = (byte)random.nextInt(); 
-							} while (block[i] == Message.TERMINATOR);
-							
-					}
-					
-					// encrypt the block
-					byte[] toSend = cipher.doFinal(block);
-					write(toSend);
-					// next block
-					b++;
-				}
-				break;
-			default: throw new IllegalArgumentException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_NOT_SUPPORTED) + encryption);
-			}
-		} catch (BadPaddingException e) {
-			throw new DeviceException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_ERROR_BLOCK) + e);
-		} catch (InvalidKeyException e) {
-			throw new DeviceException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_ERROR_BLOCK) + e);
-		} catch (IllegalBlockSizeException e) {
-			throw new DeviceException(ResourceFactory.instance.getString(ResourceFactory.ENCRYPTION_ERROR_BLOCK) + e);
-		}
-		*/
+	switch (encryption) {
+	case AES: {
+		// pad to whole blocks with random bytes; the terminator may not occur
+		int count = (length + AES_BLOCKSIZE - 1) / AES_BLOCKSIZE;
+		blocks.resize(count * AES_BLOCKSIZE);
+		memcpy(&blocks[0], bytes, length);
+		if (count * AES_BLOCKSIZE > length)
+			random.read((char *)&blocks[length], count * AES_BLOCKSIZE - length);
+		for (int i = length; i < count * AES_BLOCKSIZE; i++)
+			while (blocks[i] == OPDIMessage::TERMINATOR)
+				blocks[i] = (uint8_t)random.get();
+		encryptBlocks(&blocks[0], &blocks[0], count);
+		write((char *)&blocks[0], count * AES_BLOCKSIZE);
+		break;
+	}
+	case AES_CTR:
+		applyKeyStream(ksOut, (uint8_t *)bytes, length);
+		write(bytes, length);
+		break;
+	case AES_GCM: {
+		// the authentication tag replaces the checksum and the terminator
+		if (length < TEXT_TRAILER_SIZE)
+			throw DeviceException("Message too short for encryption");
+		length -= TEXT_TRAILER_SIZE;
+		std::vector<uint8_t> record(AES_GCM_HEADER_SIZE + length + AES_GCM_TAG_SIZE);
+		uint8_t *message = &record[AES_GCM_HEADER_SIZE];
+		record[0] = (uint8_t)(length >> 8);
+		record[1] = (uint8_t)length;
+		memcpy(message, bytes, length);
+		startRecord(ksOut, false, message + length);
+		applyKeyStream(ksOut, message, length);
+		authenticateRecord(&record[0], message, length, message + length);
+		write((char *)&record[0], (int)record.size());
+		break;
+	}
+	default: throw DeviceException("Encryption not supported");
+	}
 }
 	
 	
@@ -601,21 +1065,36 @@ void MessageQueueDevice::close()
 	* @throws DeviceException 
 	*/
 void MessageQueueDevice::sendSynchronous(OPDIMessage* message) {
-#define MESSAGE_MAXLENGTH		1024
-	char bytes[MESSAGE_MAXLENGTH];
-	int length = message->encode(0, bytes, MESSAGE_MAXLENGTH); 
-
-    // write the bytes
-	if (encryption == NO_ENCRYPTION)
-		write(bytes, length);
-	else
-		write_blocks(bytes, length);
+	std::string payload = message->getPayload();
+	size_t fragmentLength = getFragmentLength();
+	if (fragmentation && (payload.size() > fragmentLength)) {
+		// send the payload in fragments; all but the last start with the fragment header
+		for (size_t pos = 0; pos < payload.size(); pos += fragmentLength) {
+			bool last = (pos + fragmentLength >= payload.size());
+			OPDIMessage fragment(message->getChannel(), (last ? "" : std::string(1, OPDI_FRAGMENT_MARKER)) + payload.substr(pos, fragmentLength));
+			writeMessage(&fragment);
+		}
+	} else
+		writeMessage(message);
 		
 	lastSendTimeMS = opdi_get_time_ms();
 	
     logDebug("Message sent: " + message->toString());
 }	
 
+void MessageQueueDevice::writeMessage(OPDIMessage* message) {
+	// the frame is the payload plus the channel and the framing bytes
+	int maxlength = (int)message->getPayload().size() + FRAME_OVERHEAD;
+	std::vector<char> bytes(maxlength);
+	int length = (binaryFraming ? message->encodeBinary(&bytes[0], maxlength) : message->encode(0, &bytes[0], maxlength, crc32c));
+
+    // write the bytes
+	if (encryption == NO_ENCRYPTION)
+		write(&bytes[0], length);
+	else
+		write_blocks(&bytes[0], length);
+}
+
 	/** Waits for a message until the timeout expires, the operation is aborted or a valid message
 	 * is actually received.
 	 * @param timeout
@@ -637,7 +1116,24 @@ OPDIMessage* MessageQueueDevice::receiveHandshakeMessage(int timeout /* , IAbort
 
 	while (counter++ < timeout /* && (abortable == null || !abortable.isAborted()) */) {
         if ((encryption == 0 ? hasBytes() > 0 : has_block())) {
-        	int bytes = (encryption == 0 ? read(buffer, BUFFER_SIZE) : read_block(buffer));
+        	int bytes = (encryption == 0 ? read(buffer, BUFFER_SIZE) : read_block(buffer, BUFFER_SIZE));
+			if (binaryFraming) {
+				// collect the bytes until the first frame is complete
+				message.insert(message.end(), buffer, buffer + bytes);
+				int length = OPDIMessage::binaryFrameLength(&message[0], (int)message.size());
+				if ((length > 0) && (message.size() >= (size_t)length)) {
+					try {
+						OPDIMessage* msg = OPDIMessage::decodeBinary(&message[0], length);
+						logDebug("Message received: " + msg->toString());
+						// remaining bytes are discarded (see below)
+						return msg;
+					} catch (MessageException e) {
+						logDebug("Invalid message: " + e.displayText());
+					}
+					message.erase(message.begin(), message.begin() + length);
+				}
+				continue;
+			}
         	// append received bytes to buffer
         	int terminatorPos = -1;
         	for (int i = 0; i < bytes; bytesReceived++, i++) {
@@ -658,7 +1154,7 @@ OPDIMessage* MessageQueueDevice::receiveHandshakeMessage(int timeout /* , IAbort
                 // try to decode the message
                 
 				try {
-					OPDIMessage* msg = OPDIMessage::decode(&part[0]); //, getEncoding());
+					OPDIMessage* msg = OPDIMessage::decode(&part[0], false, crc32c); //, getEncoding());
                 	logDebug("Message received: " + msg->toString());
                 	// this discards remaining bytes in buffer but this shouldn't be a problem 
                 	// because we're expecting handshake messages which are always synchronous
@@ -13,10 +13,20 @@
 
 #include "Poco/Runnable.h"
 #include "Poco/Thread.h"
+#include "Poco/RandomStream.h"
 
 #include "opdi_IDevice.h"
 
 #define AES_BLOCKSIZE 16
+// the size of the nonces that distinguish the key streams of the counter modes
+#define AES_NONCE_SIZE 8
+// the record header of AES-GCM contains the big-endian length of the encrypted message
+#define AES_GCM_HEADER_SIZE 2
+// the authentication tag follows the encrypted message
+#define AES_GCM_TAG_SIZE 16
+
+// the maximum length of the frames that the master accepts (see OPDI_FLAG_FRAME_SIZE)
+#define MASTER_MAX_FRAME_SIZE 65535
 
 /** This class encapsulates a message ready for notification.
 * It takes ownership of the passed-in message. The message is destroyed when the notification is destroyed.
@@ -40,6 +50,21 @@ private:
     bool stop;
     bool done;
 
+	// the payload of the fragmented message that is being received
+	std::string fragments;
+	// the channel of the fragmented message
+	int fragmentChannel;
+	// whether fragments are being received
+	bool fragmented;
+	// whether the fragmented message is too long and is ignored
+	bool fragmentOverflow;
+
+	// decodes and dispatches the complete binary frames; removes them from frames
+	void processBinaryFrames(std::vector<char>& frames);
+
+	// reassembles fragmented messages and dispatches the complete messages
+	void processMessage(OPDIMessage* msg);
+
 public:
 	MessageProcessor(MessageQueueDevice* device, IBasicProtocol* protocol);
 
@@ -64,7 +89,7 @@ class MessageQueueDevice : public IDevice {
 //private:
 //	std::ostream debug;
 
-protected:
+public:
 	/** Defines the possible encryption methods.
 	 * 
 	 * @author Leo
@@ -72,9 +97,14 @@ protected:
 	 */
 	enum Encryption {
 		NO_ENCRYPTION,
-		AES
+		AES,
+		// AES in counter mode ("AES-CTR"); the messages are not padded
+		AES_CTR,
+		// AES in Galois/counter mode ("AES-GCM"); each message is a record with an authentication tag
+		AES_GCM
 	};
 
+protected:
 	// time in ms of the last message send as measured by System.currentTimeMillis()
 	volatile uint64_t lastSendTimeMS;
 
@@ -95,14 +125,89 @@ protected:
 	int bufferSize;
 	int encoding;
 	Encryption encryption;
+	// whether the device sends multi-message frames (negotiated during the handshake)
+	volatile bool multiMessage;
 
-	/*
+	// whether messages are sent and received as binary frames (negotiated during the handshake)
+	volatile bool binaryFraming;
+
+	// whether long messages are sent and received as fragments (negotiated during the handshake)
+	volatile bool fragmentation;
+
+	// whether text messages end with a CRC-32C instead of the additive checksum (negotiated during the handshake)
+	volatile bool crc32c;
+
+	// the maximum length of the frames that the device accepts (announced during the handshake); 0 if unknown
+	volatile int frameSize;
+
+	// returns the maximum payload length of a fragment that fits into the frames of the device
+	size_t getFragmentLength();
+
+	// encodes the message and writes it out
+	void writeMessage(OPDIMessage* message);
+
+	/** The state of a key stream in counter mode. A counter block consists of the prefix and the
+	 * big-endian block number (see opdi_KeyStream of the slave).
+	 */
+	struct KeyStream {
+		uint8_t prefix[AES_BLOCKSIZE - 4];
+		uint32_t counter;
+		// the current block of the key stream and the number of its bytes that have been used
+		uint8_t block[AES_BLOCKSIZE];
+		int used;
+	};
+
+	// the cipher context of the key (see opdi_cipher_create); NULL if encryption is off
+	void *cipher;
+	// the nonces of the counter modes
+	uint8_t deviceNonce[AES_NONCE_SIZE];
+	uint8_t masterNonce[AES_NONCE_SIZE];
+	// the key streams of the bytes from and to the device
+	KeyStream ksIn;
+	KeyStream ksOut;
+	// the numbers of the next records in Galois/counter mode
+	uint32_t recordsIn;
+	uint32_t recordsOut;
+	// the multiples of the hash key for GHASH (4 bit table)
+	uint64_t ghashHigh[16];
+	uint64_t ghashLow[16];
+	// received bytes that have not been decrypted yet
+	std::vector<uint8_t> cipherIn;
+	// decrypted bytes and the position of the first byte that has not been read yet
+	std::vector<char> plainIn;
+	size_t plainPos;
+	// the reusable buffer of the blocks that are encrypted or decrypted with one call
+	std::vector<uint8_t> blocks;
+	// supplies the nonces and the padding
+	Poco::RandomInputStream random;
+
+	// encrypts count blocks with the key of the device
+	void encryptBlocks(uint8_t *dest, const uint8_t *src, int count);
+
+	// writes the nonce of the counter blocks to the prefix: the combination of both nonces
+	void setPrefixNonce(KeyStream& ks);
+
+	// starts the key stream of one direction at the first counter block
+	void resetKeyStream(KeyStream& ks, uint8_t direction);
+
+	// combines the bytes with the key stream; the counter blocks are encrypted with one call
+	void applyKeyStream(KeyStream& ks, uint8_t *bytes, int length);
+
+	// calculates the GHASH tables from the hash key
+	void prepareGHash();
+
+	// multiplies the hash value y with the hash key in GF(2^128)
+	void multiplyGHash(uint8_t *y);
+
+	// starts the key stream of the next record and writes the mask of the authentication tag to tag
+	void startRecord(KeyStream& ks, bool fromDevice, uint8_t *tag);
+
+	// adds the authentication tag of the record with the given header and encrypted message to tag
+	void authenticateRecord(const uint8_t *header, const uint8_t *bytes, int length, uint8_t *tag);
+
+	// reads the available bytes and decrypts the complete blocks or records into plainIn
+	void decryptReceived();
 
-	
-	SecretKeySpec skeySpec; 
-	Cipher cipher;	
-	Random random;
-*/
 	MessageQueueDevice(std::string id);
 
 public:
@@ -159,7 +264,48 @@ void clearEncryption();
 
 virtual Encryption getEncryption();
 
-void setEncryption(Encryption encryption);
+/** Switches encryption on, using the key returned by getEncryptionKey(). The counter modes require
+	* the nonce that the device has sent in its handshake reply (hexadecimal digits); the counter blocks
+	* combine it with the nonce of newEncryptionNonce(). If sessionKey is true,
+	* the device uses a key that is derived from both nonces (see opdi_derive_session_key).
+	* Throws a DeviceException if the key or the nonce is invalid.
+	*/
+void setEncryption(Encryption encryption, std::string deviceNonce = "", bool sessionKey = false);
+
+/** Creates the nonce that the master offers with the counter modes. Returns it as hexadecimal digits.
+	*/
+std::string newEncryptionNonce();
+
+/** Returns true if the device has confirmed that it sends multi-message frames.
+	*/
+bool usesMultiMessage();
+
+void setMultiMessage(bool multiMessage);
+
+/** Returns true if the device has confirmed that messages are exchanged as binary frames.
+	*/
+bool usesBinaryFraming();
+
+void setBinaryFraming(bool binaryFraming);
+
+/** Returns true if the device has confirmed that long messages are exchanged as fragments.
+	*/
+bool usesFragmentation();
+
+void setFragmentation(bool fragmentation);
+
+/** Returns true if the device has confirmed that text messages end with a CRC-32C.
+	*/
+bool usesCRC32C();
+
+void setCRC32C(bool crc32c);
+
+/** Returns the maximum length of the frames that the device has announced during the handshake,
+	* or 0 if the device did not announce it.
+	*/
+int getFrameSize();
+
+void setFrameSize(int frameSize);
 
 virtual std::string getEncryptionKey() = 0;
 
@@ -173,10 +319,11 @@ bool processOutQueue();
 // Returns true if there are enough bytes for a block to be read and decoded
 virtual bool has_block();
 	
-// read and decrypt an encrypted block from the wire
-virtual int read_block(char buffer[]);
+// reads the available encrypted bytes, decrypts them with one call and returns up to maxlength
+// decrypted bytes. The padding of the blocks is removed. Returns the number of bytes
+virtual int read_block(char buffer[], int maxlength);
 
-// writes the bytes as blocks. count specifies the number of bytes total
+// encrypts the bytes in one pass and writes them with one call. count specifies the number of bytes total
 virtual void write_blocks(char bytes[], int count);
 
 /** Reads the next byte.
@@ -18,6 +18,9 @@
 #include <Poco/NumberParser.h>
 #include "Poco/NumberFormatter.h"
 
+#include "opdi_constants.h"
+#include "opdi_strings.h"
+
 #include "opdi_OPDIMessage.h"
 #include "opdi_StringTools.h"
 
@@ -40,51 +43,75 @@ OPDIMessage::OPDIMessage(int channel, std::string payload, int checksum)
 	this->checksum = checksum;
 }
 
-int calcChecksum(char *message) {
-	int myChecksum = 0;
-	bool colonFound = false;
+int calcChecksum(char *message, bool crc32c) {
+	opdi_FrameScan scan;
 	// add everything before the last colon
-	for (int i = strlen(message) - 1; i >= 0; i--)
-		if (colonFound)
-			// add unsigned byte values
-			myChecksum += message[i] & 0xFF;
-		else
-			colonFound = message[i] == OPDIMessage::SEPARATOR;
-	return myChecksum;
+	strings_scan_frame((const uint8_t *)message, strlen(message), '\0', OPDIMessage::SEPARATOR, &scan);
+	if (crc32c)
+		return (int)strings_crc32c(0, (const uint8_t *)message, scan.last_sep < scan.length ? scan.last_sep : 0);
+	return scan.checksum;
 }
 
 /** Tries to decode a message from its serial form.
  *
  * @return
  */
-OPDIMessage* OPDIMessage::decode(char *serialForm/*, Charset encoding*/)
+OPDIMessage* OPDIMessage::decode(char *serialForm, bool verbatim, bool crc32c/*, Charset encoding*/)
 {
 	std::string message(serialForm);
-	// split at ":"
-	std::vector<std::string> parts;
-	StringTools::split(message, SEPARATOR, parts);
-	// valid form?
-	if (parts.size() < 3) 
-		throw MessageException("Message part number too low");
+	opdi_FrameScan scan;
+	if (crc32c) {
+		// the checksum has a fixed length, so the content is read only once to calculate the CRC
+		if (message.size() < (size_t)CRC32C_DIGITS + 4 || message[message.size() - CRC32C_DIGITS - 1] != SEPARATOR)
+			throw MessageException("Message checksum missing");
+		scan.last_sep = message.size() - CRC32C_DIGITS - 1;
+		scan.first_sep = std::min(message.find(SEPARATOR), scan.last_sep);
+		scan.checksum = strings_crc32c(0, (const uint8_t *)message.c_str(), scan.last_sep);
+	} else
+		// find the separators and calculate the content checksum in one pass
+		strings_scan_frame((const uint8_t *)message.c_str(), message.size(), '\0', SEPARATOR, &scan);
+
+	std::string channelPart;
+	std::string checksumPart;
+	std::string content;
+	// escaped separators or parts with leading blanks require splitting and joining
+	if (!verbatim && ((message.size() > 0 && message[0] == ' ') || (message.find("::") != std::string::npos) || (message.find(": ") != std::string::npos))) {
+		// split at ":"
+		std::vector<std::string> parts;
+		StringTools::split(message, SEPARATOR, parts);
+		// valid form?
+		if (parts.size() < 3) 
+			throw MessageException("Message part number too low");
+		channelPart = parts[0];
+		checksumPart = parts[parts.size() - 1];
+		// join payload again (without channel and checksum)
+		content = StringTools::join(1, 1, SEPARATOR, parts);
+	} else {
+		// valid form? there must be at least two separators
+		if (scan.first_sep >= scan.last_sep)
+			throw MessageException("Message part number too low");
+		channelPart = message.substr(0, scan.first_sep);
+		checksumPart = message.substr(scan.last_sep + 1);
+		// the payload is everything between channel and checksum
+		content = message.substr(scan.first_sep + 1, scan.last_sep - scan.first_sep - 1);
+	}
 	// last part must be checksum
-	int checksum = 0;
+	unsigned int checksum = 0;
 	try {
-		checksum = Poco::NumberParser::parseHex(parts[parts.size() - 1]);
+		checksum = Poco::NumberParser::parseHex(checksumPart);
 	} catch (Poco::SyntaxException nfe) {
 		throw MessageException("Message checksum invalid (not a hex number)");
 	}
-	// calculate content checksum
-	int calcCheck = calcChecksum(serialForm);
+	// content checksum; the additive sum of long messages exceeds the four digits
+	unsigned int calcCheck = (crc32c ? scan.checksum : scan.checksum & 0xffff);
 	// checksums not equal?
 	if (calcCheck != checksum) {
 		throw MessageException("Message checksum invalid: " + Poco::NumberFormatter::formatHex(calcCheck) + ", expected: " + Poco::NumberFormatter::formatHex(checksum));
 	}
 	// checksum is ok
-	// join payload again (without channel and checksum)
-	std::string content = StringTools::join(1, 1, SEPARATOR, parts);
 	try {
 		// the first part is the channel
-		int pid = Poco::NumberParser::parse(parts[0]);
+		int pid = Poco::NumberParser::parse(channelPart);
 		// the payload doesn't contain the channel
 		return new OPDIMessage(pid, content, checksum);
 	} catch (Poco::SyntaxException nfe) {
@@ -92,7 +119,7 @@ OPDIMessage* OPDIMessage::decode(char *serialForm/*, Charset encoding*/)
 	}
 }
 
-int OPDIMessage::encode(int encoding, char buffer[], int maxlength)
+int OPDIMessage::encode(int encoding, char buffer[], int maxlength, bool crc32c)
 {
 	// message content is channel plus payload
 	std::stringstream content;
@@ -102,23 +129,90 @@ int OPDIMessage::encode(int encoding, char buffer[], int maxlength)
 	content << payload;
 
 	// calculate message checksum over the bytes to transfer
-	checksum = 0;
 	std::string data = content.str();
 	const char *bytes = data.c_str();
-	for (unsigned int i = 0; i < data.length(); i++) {
-		if (bytes[i] == TERMINATOR)
-			throw MessageException("Message terminator may not appear in payload");
-		// add unsigned bytes for payload
-		checksum += bytes[i] & 0xFF;
-	}
+	opdi_FrameScan scan;
+	// the terminator may not appear in the payload
+	if (strings_scan_frame((const uint8_t *)bytes, data.length(), TERMINATOR, SEPARATOR, &scan) == OPDI_STATUS_OK)
+		throw MessageException("Message terminator may not appear in payload");
 	// A message is terminated by the checksum and a \n
 	content << ":";
-	content << std::setfill('0') << std::setw(4) << std::hex << (checksum & 0xffff);
+	if (crc32c) {
+		checksum = (int)strings_crc32c(0, (const uint8_t *)bytes, data.length());
+		content << std::setfill('0') << std::setw(CRC32C_DIGITS) << std::hex << (unsigned int)checksum;
+	} else {
+		// sum of unsigned bytes for payload
+		checksum = scan.sum;
+		content << std::setfill('0') << std::setw(4) << std::hex << (checksum & 0xffff);
+	}
 	content << TERMINATOR;
 	data = content.str();
-	bytes = data.c_str();
-	strncpy(buffer, bytes, maxlength);
-	return strlen(bytes);
+	if ((int)data.length() > maxlength)
+		throw MessageException("Message too long for the buffer");
+	memcpy(buffer, data.data(), data.length());
+	return (int)data.length();
+}
+
+int OPDIMessage::binaryFrameLength(const char *bytes, int count)
+{
+	uint16_t bodyLength;
+	uint8_t prefixLength = strings_get_varint((const uint8_t *)bytes, count, &bodyLength);
+	if (prefixLength == 0) {
+		// a length prefix has at most three bytes
+		if (count >= 3)
+			throw MessageException("Binary frame length invalid");
+		return 0;
+	}
+	return prefixLength + bodyLength + BINARY_CRC_SIZE;
+}
+
+OPDIMessage* OPDIMessage::decodeBinary(const char *frame, int length)
+{
+	const uint8_t *bytes = (const uint8_t *)frame;
+	if (length < 2 + BINARY_CRC_SIZE)
+		throw MessageException("Binary frame too short");
+	// the CRC covers all preceding bytes of the frame
+	int crc = (bytes[length - 2] << 8) | bytes[length - 1];
+	int calcCrc = strings_crc16(0xffff, bytes, length - BINARY_CRC_SIZE);
+	if (calcCrc != crc) {
+		throw MessageException("Message CRC invalid: " + Poco::NumberFormatter::formatHex(calcCrc) + ", expected: " + Poco::NumberFormatter::formatHex(crc));
+	}
+	uint16_t bodyLength;
+	int pos = strings_get_varint(bytes, length - BINARY_CRC_SIZE, &bodyLength);
+	if ((pos == 0) || (pos + bodyLength + BINARY_CRC_SIZE != length))
+		throw MessageException("Binary frame length invalid");
+	uint16_t channel;
+	uint8_t count = strings_get_varint(bytes + pos, bodyLength, &channel);
+	if (count == 0)
+		throw MessageException("Message channel number invalid");
+	pos += count;
+	return new OPDIMessage(channel, std::string(frame + pos, length - BINARY_CRC_SIZE - pos), crc);
+}
+
+int OPDIMessage::encodeBinary(char buffer[], int maxlength)
+{
+	uint8_t *bytes = (uint8_t *)buffer;
+	// the slave receives the payload as a string
+	if (payload.find('\0') != std::string::npos)
+		throw MessageException("Zero byte may not appear in payload");
+	uint8_t channelBytes[3];
+	uint8_t channelLength = strings_put_varint((uint16_t)channel, channelBytes);
+	size_t bodyLength = channelLength + payload.size();
+	if (bodyLength > 0xffff)
+		throw MessageException("Message payload too long");
+	uint8_t prefix[3];
+	uint8_t prefixLength = strings_put_varint((uint16_t)bodyLength, prefix);
+	int length = prefixLength + (int)bodyLength + BINARY_CRC_SIZE;
+	if (length > maxlength)
+		throw MessageException("Message too long for the buffer");
+
+	memcpy(bytes, prefix, prefixLength);
+	memcpy(bytes + prefixLength, channelBytes, channelLength);
+	memcpy(bytes + prefixLength + channelLength, payload.data(), payload.size());
+	checksum = strings_crc16(0xffff, bytes, length - BINARY_CRC_SIZE);
+	bytes[length - 2] = (uint8_t)(checksum >> 8);
+	bytes[length - 1] = (uint8_t)checksum;
+	return length;
 }
 
 std::string OPDIMessage::getPayload() {
@@ -34,6 +34,10 @@ protected:
 public:
 	static const char SEPARATOR = ':';
 	static const char TERMINATOR = '\n';
+	// size of the CRC at the end of a binary frame
+	static const int BINARY_CRC_SIZE = 2;
+	// number of hexadecimal digits of the CRC-32C at the end of a text message
+	static const int CRC32C_DIGITS = 8;
 
 	/** Creates a message.
 	 * 
@@ -43,16 +47,41 @@ public:
 	
 	OPDIMessage(int channel, std::string payload, int checksum);
 
-	static OPDIMessage* decode(char *serialForm/*, Charset encoding*/);
+	/** Tries to decode a message from its serial form.
+	 * If verbatim is true, the payload is taken as it appears between channel and checksum.
+	 * This is required for fragments because their boundaries may split escaped separators.
+	 * If crc32c is true, the message must end with the eight digits of a CRC-32C instead of the additive checksum.
+	 * Throws a MessageException if the message is malformed.
+	 */
+	static OPDIMessage* decode(char *serialForm, bool verbatim = false, bool crc32c = false/*, Charset encoding*/);
 
 	/** Returns the serial form of a message that contains payload and checksum.
 	 * The parameter maxlength specifies the maximum length of the buffer.
 	 * Throws a MessageException if the buffer is not large enough to contain 
 	 * the message content.
+	 * If crc32c is true, the message ends with a CRC-32C instead of the additive checksum.
 	 * If everything is ok, returns the length of the message in bytes.
 	 * @throws MessageException 
 	 */
-	int encode(int encoding, char buffer[], int maxlength);
+	int encode(int encoding, char buffer[], int maxlength, bool crc32c = false);
+
+	/** Returns the total length of the binary frame that starts with the given bytes,
+	 * or 0 if count is too small to contain the length prefix.
+	 * Throws a MessageException if the length prefix is invalid.
+	 */
+	static int binaryFrameLength(const char *bytes, int count);
+
+	/** Tries to decode a message from a complete binary frame of length bytes.
+	 * Throws a MessageException if the CRC does not match or the frame is malformed.
+	 */
+	static OPDIMessage* decodeBinary(const char *frame, int length);
+
+	/** Returns the binary frame of the message, consisting of length prefix, channel,
+	 * payload and CRC. Throws a MessageException if the buffer is not large enough
+	 * or if the payload contains a zero byte (slaves receive payloads as strings).
+	 * If everything is ok, returns the length of the frame in bytes.
+	 */
+	int encodeBinary(char buffer[], int maxlength);
 
 	std::string getPayload();
 
@@ -8,34 +8,729 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
-    
+
 // Implements encryption functions using AES.
+// The blocks are processed with the AES instructions of the CPU if possible (see opdi_aes.h).
+// The key schedules of a key are kept in a cipher context; the functions without context use
+// the context of the device key (opdi_encryption_key).
+
+#include <mutex>
 
 #include "opdi_constants.h"
 #include "opdi_config.h"
+#include "opdi_aes.h"
 
 #include "opdi_rijndael.h"
 
-static CRijndael *rijndael = nullptr;
+// the hardware backends implement AES-128 (key and block size of 16 bytes)
+#if !defined(OPDI_NO_AES_HARDWARE) && (OPDI_ENCRYPTION_BLOCKSIZE == 16)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <wmmintrin.h>
+	#include <cpuid.h>
+	#define AES_NI
+	// the functions are compiled for AES-NI even if the build does not target it
+	#define AES_NI_TARGET	__attribute__((target("aes,sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <wmmintrin.h>
+	#include <intrin.h>
+	#define AES_NI
+	#define AES_NI_TARGET
+#elif (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)) && (defined(linux) || defined(__linux__))
+	// the build must target the cryptography extension (e. g. -march=armv8-a+crypto);
+	// the CPU is checked at run time because not all ARMv8 processors implement it
+	#include <arm_neon.h>
+	#include <sys/auxv.h>
+	#define AES_ARMV8
+#endif
+#endif
+
+#define AES_ROUNDS		10
+// the number of blocks that the hardware backends process at once
+#define AES_LANES		4
+
+#if defined(AES_NI) || defined(AES_ARMV8)
+#define AES_HARDWARE
+#endif
+
+// the bitsliced backend implements AES-128
+#if (OPDI_ENCRYPTION_BLOCKSIZE == 16)
+#define AES_BITSLICED
+// the number of blocks that the bitsliced backend processes at once (one bit per block in each byte)
+#define BITSLICE_BLOCKS		8
+#endif
+
+/** The key schedules of one key. The schedule of the selected backend is calculated when the
+*   context is created; the schedule of another backend is calculated when it is first used.
+*/
+struct AESContext {
+	uint8_t key[OPDI_ENCRYPTION_BLOCKSIZE];
+	// the portable backend
+	CRijndael *rijndael;
+#ifdef AES_HARDWARE
+	// round keys for encryption and for the equivalent inverse cipher; AES-NI and ARMv8
+	// use the same byte layout. They are stored as bytes because the context may not be
+	// aligned to 16 bytes; the functions load them into registers.
+	bool hardwareReady;
+	uint8_t encKeys[(AES_ROUNDS + 1) * 16];
+	uint8_t decKeys[(AES_ROUNDS + 1) * 16];
+#endif
+#ifdef AES_BITSLICED
+	// the round keys in the layout of the bitsliced state, repeated for all blocks
+	bool bitslicedReady;
+	uint32_t slicedKeys[AES_ROUNDS + 1][4][8];
+#endif
+};
+
+// the context of the device key; is created once when the first block is processed
+static AESContext *device_context = nullptr;
+static std::once_flag device_context_once;
+
+// the selected backend; is determined once when the first block is processed
+static uint8_t backend = OPDI_AES_PORTABLE;
+static std::once_flag backend_once;
+
+#ifdef AES_NI
+
+static bool aesni_supported() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 25)) != 0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & bit_AES) != 0;
+#endif
+}
+
+AES_NI_TARGET static __m128i aesni_expand_step(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+// the round constant of _mm_aeskeygenassist_si128 must be a compile-time constant
+#define AESNI_EXPAND(i, rcon)	k[i] = aesni_expand_step(k[i - 1], _mm_aeskeygenassist_si128(k[i - 1], rcon))
+
+AES_NI_TARGET static void aesni_make_keys(AESContext *context) {
+	__m128i k[AES_ROUNDS + 1];
+
+	k[0] = _mm_loadu_si128((const __m128i *)context->key);
+	AESNI_EXPAND(1, 0x01);
+	AESNI_EXPAND(2, 0x02);
+	AESNI_EXPAND(3, 0x04);
+	AESNI_EXPAND(4, 0x08);
+	AESNI_EXPAND(5, 0x10);
+	AESNI_EXPAND(6, 0x20);
+	AESNI_EXPAND(7, 0x40);
+	AESNI_EXPAND(8, 0x80);
+	AESNI_EXPAND(9, 0x1b);
+	AESNI_EXPAND(10, 0x36);
+
+	for (int i = 0; i <= AES_ROUNDS; i++)
+		_mm_storeu_si128((__m128i *)context->encKeys + i, k[i]);
+	_mm_storeu_si128((__m128i *)context->decKeys, k[AES_ROUNDS]);
+	for (int i = 1; i < AES_ROUNDS; i++)
+		_mm_storeu_si128((__m128i *)context->decKeys + i, _mm_aesimc_si128(k[AES_ROUNDS - i]));
+	_mm_storeu_si128((__m128i *)context->decKeys + AES_ROUNDS, k[0]);
+	context->hardwareReady = true;
+}
+
+// the AES instructions have a latency of several cycles; interleaving independent blocks
+// keeps the pipeline busy
+AES_NI_TARGET static void aesni_encrypt_blocks(const AESContext *context, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	__m128i k[AES_ROUNDS + 1];
+	__m128i m[AES_LANES];
+	int i, j;
+
+	for (i = 0; i <= AES_ROUNDS; i++)
+		k[i] = _mm_loadu_si128((const __m128i *)context->encKeys + i);
+	for (; count >= AES_LANES; count -= AES_LANES, src += AES_LANES * 16, dest += AES_LANES * 16) {
+		for (j = 0; j < AES_LANES; j++)
+			m[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src + j), k[0]);
+		for (i = 1; i < AES_ROUNDS; i++)
+			for (j = 0; j < AES_LANES; j++)
+				m[j] = _mm_aesenc_si128(m[j], k[i]);
+		for (j = 0; j < AES_LANES; j++)
+			_mm_storeu_si128((__m128i *)dest + j, _mm_aesenclast_si128(m[j], k[AES_ROUNDS]));
+	}
+	for (; count > 0; count--, src += 16, dest += 16) {
+		m[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src), k[0]);
+		for (i = 1; i < AES_ROUNDS; i++)
+			m[0] = _mm_aesenc_si128(m[0], k[i]);
+		_mm_storeu_si128((__m128i *)dest, _mm_aesenclast_si128(m[0], k[AES_ROUNDS]));
+	}
+}
+
+AES_NI_TARGET static void aesni_decrypt_blocks(const AESContext *context, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	__m128i k[AES_ROUNDS + 1];
+	__m128i m[AES_LANES];
+	int i, j;
+
+	for (i = 0; i <= AES_ROUNDS; i++)
+		k[i] = _mm_loadu_si128((const __m128i *)context->decKeys + i);
+	for (; count >= AES_LANES; count -= AES_LANES, src += AES_LANES * 16, dest += AES_LANES * 16) {
+		for (j = 0; j < AES_LANES; j++)
+			m[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src + j), k[0]);
+		for (i = 1; i < AES_ROUNDS; i++)
+			for (j = 0; j < AES_LANES; j++)
+				m[j] = _mm_aesdec_si128(m[j], k[i]);
+		for (j = 0; j < AES_LANES; j++)
+			_mm_storeu_si128((__m128i *)dest + j, _mm_aesdeclast_si128(m[j], k[AES_ROUNDS]));
+	}
+	for (; count > 0; count--, src += 16, dest += 16) {
+		m[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src), k[0]);
+		for (i = 1; i < AES_ROUNDS; i++)
+			m[0] = _mm_aesdec_si128(m[0], k[i]);
+		_mm_storeu_si128((__m128i *)dest, _mm_aesdeclast_si128(m[0], k[AES_ROUNDS]));
+	}
+}
+
+#endif	// AES_NI
+
+#ifdef AES_ARMV8
+
+static bool armv8_supported() {
+#if defined(__aarch64__)
+	// HWCAP_AES
+	return (getauxval(AT_HWCAP) & (1 << 3)) != 0;
+#else
+	// HWCAP2_AES
+	return (getauxval(AT_HWCAP2) & (1 << 0)) != 0;
+#endif
+}
+
+// applies the S-box to the bytes of the word; AESE with a zero key performs SubBytes,
+// and ShiftRows has no effect because all columns are equal
+static uint32_t armv8_sub_word(uint32_t word) {
+	uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(word));
+	v = vaeseq_u8(v, vdupq_n_u8(0));
+	return vgetq_lane_u32(vreinterpretq_u32_u8(v), 0);
+}
+
+static void armv8_make_keys(AESContext *context) {
+	static const uint8_t rcon[AES_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	uint32_t w[4 * (AES_ROUNDS + 1)];
+
+	memcpy(w, context->key, 16);
+	for (int i = 4; i < 4 * (AES_ROUNDS + 1); i++) {
+		uint32_t t = w[i - 1];
+		if (i % 4 == 0)
+			// RotWord and SubWord on little-endian words
+			t = armv8_sub_word((t >> 8) | (t << 24)) ^ rcon[i / 4 - 1];
+		w[i] = w[i - 4] ^ t;
+	}
+	memcpy(context->encKeys, w, sizeof(w));
+
+	memcpy(context->decKeys, context->encKeys + AES_ROUNDS * 16, 16);
+	for (int i = 1; i < AES_ROUNDS; i++)
+		vst1q_u8(context->decKeys + i * 16, vaesimcq_u8(vld1q_u8(context->encKeys + (AES_ROUNDS - i) * 16)));
+	memcpy(context->decKeys + AES_ROUNDS * 16, context->encKeys, 16);
+	context->hardwareReady = true;
+}
+
+static void armv8_encrypt_blocks(const AESContext *context, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	uint8x16_t k[AES_ROUNDS + 1];
+	uint8x16_t m[AES_LANES];
+	int i, j;
+
+	for (i = 0; i <= AES_ROUNDS; i++)
+		k[i] = vld1q_u8(context->encKeys + i * 16);
+	for (; count >= AES_LANES; count -= AES_LANES, src += AES_LANES * 16, dest += AES_LANES * 16) {
+		for (j = 0; j < AES_LANES; j++)
+			m[j] = vld1q_u8(src + j * 16);
+		for (i = 0; i < AES_ROUNDS - 1; i++)
+			for (j = 0; j < AES_LANES; j++)
+				m[j] = vaesmcq_u8(vaeseq_u8(m[j], k[i]));
+		for (j = 0; j < AES_LANES; j++)
+			vst1q_u8(dest + j * 16, veorq_u8(vaeseq_u8(m[j], k[AES_ROUNDS - 1]), k[AES_ROUNDS]));
+	}
+	for (; count > 0; count--, src += 16, dest += 16) {
+		m[0] = vld1q_u8(src);
+		for (i = 0; i < AES_ROUNDS - 1; i++)
+			m[0] = vaesmcq_u8(vaeseq_u8(m[0], k[i]));
+		vst1q_u8(dest, veorq_u8(vaeseq_u8(m[0], k[AES_ROUNDS - 1]), k[AES_ROUNDS]));
+	}
+}
+
+static void armv8_decrypt_blocks(const AESContext *context, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	uint8x16_t k[AES_ROUNDS + 1];
+	uint8x16_t m[AES_LANES];
+	int i, j;
+
+	for (i = 0; i <= AES_ROUNDS; i++)
+		k[i] = vld1q_u8(context->decKeys + i * 16);
+	for (; count >= AES_LANES; count -= AES_LANES, src += AES_LANES * 16, dest += AES_LANES * 16) {
+		for (j = 0; j < AES_LANES; j++)
+			m[j] = vld1q_u8(src + j * 16);
+		for (i = 0; i < AES_ROUNDS - 1; i++)
+			for (j = 0; j < AES_LANES; j++)
+				m[j] = vaesimcq_u8(vaesdq_u8(m[j], k[i]));
+		for (j = 0; j < AES_LANES; j++)
+			vst1q_u8(dest + j * 16, veorq_u8(vaesdq_u8(m[j], k[AES_ROUNDS - 1]), k[AES_ROUNDS]));
+	}
+	for (; count > 0; count--, src += 16, dest += 16) {
+		m[0] = vld1q_u8(src);
+		for (i = 0; i < AES_ROUNDS - 1; i++)
+			m[0] = vaesimcq_u8(vaesdq_u8(m[0], k[i]));
+		vst1q_u8(dest, veorq_u8(vaesdq_u8(m[0], k[AES_ROUNDS - 1]), k[AES_ROUNDS]));
+	}
+}
+
+#endif	// AES_ARMV8
+
+#ifdef AES_BITSLICED
+
+// The bitsliced backend avoids the lookup tables of CRijndael whose access pattern depends on the
+// key and the data, and whose size exceeds the data cache of small processors. The state of
+// BITSLICE_BLOCKS blocks is held in 32 words: state[c][i] contains bit i of the bytes of column c.
+// Byte r of the word holds row r of the column, and bit j of this byte belongs to block j.
+// All operations are logical operations on whole words, so the time does not depend on the data.
+
+// moves row r + n of a column word to row r
+#define ROTATE_ROWS(w, n)	(((w) >> (8 * (n))) | ((w) << (32 - 8 * (n))))
+
+/** Applies the S-box to the bits of the eight words (bit i of the bytes in q[i]).
+*   This is the circuit of Boyar and Peralta (113 logical operations).
+*/
+static void bitslice_sbox(uint32_t *q) {
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19, t20;
+	uint32_t t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39, t40;
+	uint32_t t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59, t60;
+	uint32_t t61, t62, t63, t64, t65, t66, t67;
+
+	x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+	x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+	// top linear transformation
+	y14 = x3 ^ x5; y13 = x0 ^ x6; y9 = x0 ^ x3; y8 = x0 ^ x5;
+	t0 = x1 ^ x2; y1 = t0 ^ x7; y4 = y1 ^ x3; y12 = y13 ^ y14;
+	y2 = y1 ^ x0; y5 = y1 ^ x6; y3 = y5 ^ y8; t1 = x4 ^ y12;
+	y15 = t1 ^ x5; y20 = t1 ^ x1; y6 = y15 ^ x7; y10 = y15 ^ t0;
+	y11 = y20 ^ y9; y7 = x7 ^ y11; y17 = y10 ^ y11; y19 = y10 ^ y8;
+	y16 = t0 ^ y11; y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+	// non-linear section (inversion in GF(2^8))
+	t2 = y12 & y15; t3 = y3 & y6; t4 = t3 ^ t2; t5 = y4 & x7;
+	t6 = t5 ^ t2; t7 = y13 & y16; t8 = y5 & y1; t9 = t8 ^ t7;
+	t10 = y2 & y7; t11 = t10 ^ t7; t12 = y9 & y11; t13 = y14 & y17;
+	t14 = t13 ^ t12; t15 = y8 & y10; t16 = t15 ^ t12; t17 = t4 ^ t14;
+	t18 = t6 ^ t16; t19 = t9 ^ t14; t20 = t11 ^ t16; t21 = t17 ^ y20;
+	t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+	t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+	t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+	t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15; z1 = t37 & y6; z2 = t33 & x7; z3 = t43 & y16;
+	z4 = t40 & y1; z5 = t29 & y7; z6 = t42 & y11; z7 = t45 & y17;
+	z8 = t41 & y10; z9 = t44 & y12; z10 = t37 & y3; z11 = t33 & y4;
+	z12 = t43 & y13; z13 = t40 & y5; z14 = t29 & y2; z15 = t42 & y9;
+	z16 = t45 & y14; z17 = t41 & y8;
+
+	// bottom linear transformation
+	t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13; t49 = z9 ^ z10;
+	t50 = z2 ^ z12; t51 = z2 ^ z5; t52 = z7 ^ z8; t53 = z0 ^ z3;
+	t54 = z6 ^ z7; t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+	t58 = z4 ^ t46; t59 = z3 ^ t54; t60 = t46 ^ t57; t61 = z14 ^ t57;
+	t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59; t65 = t61 ^ t62;
+	t66 = z1 ^ t63; t67 = t64 ^ t65;
+
+	q[7] = t59 ^ t63;
+	q[1] = t56 ^ ~t62;
+	q[0] = t48 ^ ~t60;
+	q[4] = t53 ^ t66;
+	q[3] = t51 ^ t66;
+	q[2] = t47 ^ t65;
+	q[6] = t64 ^ ~q[4];
+	q[5] = t55 ^ ~t67;
+}
+
+/** Applies the inverse of the affine transformation of the S-box. Because the inverse S-box equals
+*   this transformation, followed by the S-box and the transformation again, no circuit for the
+*   inverse is needed.
+*/
+static void bitslice_inverse_affine(uint32_t *q) {
+	uint32_t x[8];
+
+	memcpy(x, q, sizeof(x));
+	for (int i = 0; i < 8; i++)
+		q[i] = x[(i + 2) & 7] ^ x[(i + 5) & 7] ^ x[(i + 7) & 7];
+	// the constant 0x05
+	q[0] = ~q[0];
+	q[2] = ~q[2];
+}
+
+// multiplies the bytes by two in GF(2^8)
+#define BITSLICE_XTIME(a, b)	\
+	b[0] = a[7]; b[1] = a[0] ^ a[7]; b[2] = a[1]; b[3] = a[2] ^ a[7];	\
+	b[4] = a[3] ^ a[7]; b[5] = a[4]; b[6] = a[5]; b[7] = a[6]
+
+static void bitslice_shift_rows(uint32_t state[4][8], bool inverse) {
+	uint32_t old[4][8];
+
+	memcpy(old, state, sizeof(old));
+	for (int c = 0; c < 4; c++)
+		for (int i = 0; i < 8; i++) {
+			// row r of column c is taken from column c + r (or c - r for the inverse)
+			int c1 = (inverse ? c + 3 : c + 1) & 3;
+			int c2 = (c + 2) & 3;
+			int c3 = (inverse ? c + 1 : c + 3) & 3;
+			state[c][i] = (old[c][i] & 0x000000ff) | (old[c1][i] & 0x0000ff00)
+				| (old[c2][i] & 0x00ff0000) | (old[c3][i] & 0xff000000);
+		}
+}
+
+static void bitslice_mix_columns(uint32_t state[4][8]) {
+	uint32_t pair[8];
+	uint32_t twice[8];
+
+	for (int c = 0; c < 4; c++) {
+		uint32_t *q = state[c];
+		uint32_t others[8];
+		// row r becomes 2 * (a[r] ^ a[r + 1]) ^ a[r + 1] ^ a[r + 2] ^ a[r + 3]
+		for (int i = 0; i < 8; i++) {
+			uint32_t next = ROTATE_ROWS(q[i], 1);
+			pair[i] = q[i] ^ next;
+			others[i] = next ^ ROTATE_ROWS(q[i], 2) ^ ROTATE_ROWS(q[i], 3);
+		}
+		BITSLICE_XTIME(pair, twice);
+		for (int i = 0; i < 8; i++)
+			q[i] = twice[i] ^ others[i];
+	}
+}
+
+static void bitslice_inv_mix_columns(uint32_t state[4][8]) {
+	uint32_t pair[8];
+	uint32_t twice[8];
+	uint32_t fourfold[8];
+
+	// the inverse is MixColumns after adding 4 * (a[r] ^ a[r + 2]) to each row r
+	for (int c = 0; c < 4; c++) {
+		uint32_t *q = state[c];
+		for (int i = 0; i < 8; i++)
+			pair[i] = q[i] ^ ROTATE_ROWS(q[i], 2);
+		BITSLICE_XTIME(pair, twice);
+		BITSLICE_XTIME(twice, fourfold);
+		for (int i = 0; i < 8; i++)
+			q[i] ^= fourfold[i];
+	}
+	bitslice_mix_columns(state);
+}
+
+static void bitslice_add_round_key(uint32_t state[4][8], const uint32_t key[4][8]) {
+	for (int c = 0; c < 4; c++)
+		for (int i = 0; i < 8; i++)
+			state[c][i] ^= key[c][i];
+}
+
+/** Exchanges rows and columns of the 8x8 bit matrix in x (bit j of byte i with bit i of byte j).
+*/
+static uint64_t bitslice_transpose(uint64_t x) {
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+	return x;
+}
+
+/** Converts BITSLICE_BLOCKS consecutive blocks into the bitsliced state.
+*/
+static void bitslice_load(uint32_t state[4][8], const uint8_t *src) {
+	memset(state, 0, 4 * 8 * sizeof(uint32_t));
+	for (int p = 0; p < 16; p++) {
+		uint64_t x = 0;
+		for (int j = 0; j < BITSLICE_BLOCKS; j++)
+			x |= (uint64_t)src[j * 16 + p] << (8 * j);
+		x = bitslice_transpose(x);
+		for (int i = 0; i < 8; i++)
+			state[p >> 2][i] |= (uint32_t)((x >> (8 * i)) & 0xff) << (8 * (p & 3));
+	}
+}
+
+static void bitslice_store(uint8_t *dest, const uint32_t state[4][8]) {
+	for (int p = 0; p < 16; p++) {
+		uint64_t x = 0;
+		for (int i = 0; i < 8; i++)
+			x |= (uint64_t)((state[p >> 2][i] >> (8 * (p & 3))) & 0xff) << (8 * i);
+		x = bitslice_transpose(x);
+		for (int j = 0; j < BITSLICE_BLOCKS; j++)
+			dest[j * 16 + p] = (uint8_t)(x >> (8 * j));
+	}
+}
+
+/** Applies the S-box to the bytes of the word without table lookups.
+*/
+static uint32_t bitslice_sub_word(uint32_t word) {
+	uint32_t q[8];
 
-static CRijndael *get_rijndael() {
-	if (rijndael != nullptr) {
-		return rijndael;
+	for (int i = 0; i < 8; i++) {
+		q[i] = 0;
+		for (int k = 0; k < 4; k++)
+			q[i] |= ((word >> (8 * k + i)) & 1) << k;
 	}
+	bitslice_sbox(q);
+	word = 0;
+	for (int i = 0; i < 8; i++)
+		for (int k = 0; k < 4; k++)
+			word |= ((q[i] >> k) & 1) << (8 * k + i);
+	return word;
+}
+
+static void bitslice_make_keys(AESContext *context) {
+	static const uint8_t rcon[AES_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	uint32_t w[4 * (AES_ROUNDS + 1)];
+
+	// the words hold the key bytes in little-endian order
+	for (int i = 0; i < 4; i++)
+		w[i] = (uint32_t)context->key[4 * i] | ((uint32_t)context->key[4 * i + 1] << 8)
+			| ((uint32_t)context->key[4 * i + 2] << 16) | ((uint32_t)context->key[4 * i + 3] << 24);
+	for (int i = 4; i < 4 * (AES_ROUNDS + 1); i++) {
+		uint32_t t = w[i - 1];
+		if (i % 4 == 0)
+			// RotWord and SubWord
+			t = bitslice_sub_word((t >> 8) | (t << 24)) ^ rcon[i / 4 - 1];
+		w[i] = w[i - 4] ^ t;
+	}
+
+	// each key bit is spread to the bits of all blocks
+	for (int round = 0; round <= AES_ROUNDS; round++)
+		for (int c = 0; c < 4; c++)
+			for (int i = 0; i < 8; i++) {
+				uint32_t word = 0;
+				for (int r = 0; r < 4; r++)
+					word |= ((0 - ((w[round * 4 + c] >> (8 * r + i)) & 1)) & 0xff) << (8 * r);
+				context->slicedKeys[round][c][i] = word;
+			}
+	memset(w, 0, sizeof(w));
+	context->bitslicedReady = true;
+}
+
+static void bitslice_encrypt(const AESContext *context, uint8_t *dest, const uint8_t *src) {
+	uint32_t state[4][8];
+
+	bitslice_load(state, src);
+	bitslice_add_round_key(state, context->slicedKeys[0]);
+	for (int round = 1; round <= AES_ROUNDS; round++) {
+		for (int c = 0; c < 4; c++)
+			bitslice_sbox(state[c]);
+		bitslice_shift_rows(state, false);
+		if (round < AES_ROUNDS)
+			bitslice_mix_columns(state);
+		bitslice_add_round_key(state, context->slicedKeys[round]);
+	}
+	bitslice_store(dest, state);
+}
+
+static void bitslice_decrypt(const AESContext *context, uint8_t *dest, const uint8_t *src) {
+	uint32_t state[4][8];
+
+	bitslice_load(state, src);
+	bitslice_add_round_key(state, context->slicedKeys[AES_ROUNDS]);
+	for (int round = AES_ROUNDS - 1; round >= 0; round--) {
+		bitslice_shift_rows(state, true);
+		for (int c = 0; c < 4; c++) {
+			bitslice_inverse_affine(state[c]);
+			bitslice_sbox(state[c]);
+			bitslice_inverse_affine(state[c]);
+		}
+		bitslice_add_round_key(state, context->slicedKeys[round]);
+		if (round > 0)
+			bitslice_inv_mix_columns(state);
+	}
+	bitslice_store(dest, state);
+}
+
+/** Processes the blocks in groups of BITSLICE_BLOCKS. An incomplete group takes as long as a complete one.
+*/
+static void bitslice_process_blocks(const AESContext *context, uint8_t *dest, const uint8_t *src, uint16_t count, bool encrypt) {
+	uint8_t buffer[BITSLICE_BLOCKS * 16];
+
+	for (; count >= BITSLICE_BLOCKS; count -= BITSLICE_BLOCKS, src += BITSLICE_BLOCKS * 16, dest += BITSLICE_BLOCKS * 16) {
+		if (encrypt)
+			bitslice_encrypt(context, dest, src);
+		else
+			bitslice_decrypt(context, dest, src);
+	}
+	if (count > 0) {
+		memset(buffer, 0, sizeof(buffer));
+		memcpy(buffer, src, count * 16);
+		if (encrypt)
+			bitslice_encrypt(context, buffer, buffer);
+		else
+			bitslice_decrypt(context, buffer, buffer);
+		memcpy(dest, buffer, count * 16);
+	}
+}
+
+#endif	// AES_BITSLICED
+
+uint8_t opdi_aes_backend_available(uint8_t which) {
+	switch (which) {
+	case OPDI_AES_PORTABLE:
+		return 1;
+#ifdef AES_BITSLICED
+	case OPDI_AES_BITSLICED:
+		return 1;
+#endif
+#ifdef AES_NI
+	case OPDI_AES_AESNI:
+		return aesni_supported() ? 1 : 0;
+#endif
+#ifdef AES_ARMV8
+	case OPDI_AES_ARMV8:
+		return armv8_supported() ? 1 : 0;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/** Chooses the fastest backend that the CPU supports.
+*/
+static void detect_backend() {
+	backend = OPDI_AES_PORTABLE;
+#if defined(OPDI_AES_CONSTANT_TIME) && defined(AES_BITSLICED)
+	backend = OPDI_AES_BITSLICED;
+#endif
+#ifdef AES_NI
+	if (aesni_supported())
+		backend = OPDI_AES_AESNI;
+#endif
+#ifdef AES_ARMV8
+	if (armv8_supported())
+		backend = OPDI_AES_ARMV8;
+#endif
+}
+
+uint8_t opdi_aes_select_backend(uint8_t newBackend) {
+	if (!opdi_aes_backend_available(newBackend))
+		return OPDI_ENCRYPTION_NOT_SUPPORTED;
+	// the detection must not overwrite the selection later
+	std::call_once(backend_once, detect_backend);
+	backend = newBackend;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_aes_backend(void) {
+	// several sessions may process their first blocks at the same time
+	std::call_once(backend_once, detect_backend);
+	return backend;
+}
+
+/** Calculates the key schedule of the backend if necessary. Throws an exception if the key is invalid.
+*/
+static void prepare_context(AESContext *context, uint8_t which) {
+	switch (which) {
+#ifdef AES_NI
+	case OPDI_AES_AESNI:
+		if (!context->hardwareReady)
+			aesni_make_keys(context);
+		break;
+#endif
+#ifdef AES_ARMV8
+	case OPDI_AES_ARMV8:
+		if (!context->hardwareReady)
+			armv8_make_keys(context);
+		break;
+#endif
+#ifdef AES_BITSLICED
+	case OPDI_AES_BITSLICED:
+		if (!context->bitslicedReady)
+			bitslice_make_keys(context);
+		break;
+#endif
+	default:
+		if (context->rijndael == nullptr) {
+			context->rijndael = new CRijndael();
+			context->rijndael->MakeKey((const char *)context->key, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", OPDI_ENCRYPTION_BLOCKSIZE, OPDI_ENCRYPTION_BLOCKSIZE);
+		}
+	}
+}
+
+/** Overwrites the memory with zeros. The volatile access keeps the compiler from removing
+*   the stores to memory that is freed afterwards.
+*/
+static void wipe(void *memory, size_t size) {
+	volatile uint8_t *bytes = (volatile uint8_t *)memory;
+
+	while (size-- > 0)
+		*bytes++ = 0;
+}
+
+/** Frees the context and clears the key and the round keys that it holds. */
+static void free_context(AESContext *context) {
+	delete context->rijndael;
+	wipe(context, sizeof(AESContext));
+	delete context;
+}
+
+static AESContext *new_context(const uint8_t *key) {
+	AESContext *context = new AESContext();
+
+	memcpy(context->key, key, OPDI_ENCRYPTION_BLOCKSIZE);
+	try {
+		prepare_context(context, opdi_aes_backend());
+	} catch (exception&) {
+		free_context(context);
+		throw;
+	}
+	return context;
+}
+
+static void create_device_context() {
 	if (strlen(opdi_encryption_key) != OPDI_ENCRYPTION_BLOCKSIZE)
 		throw runtime_error("AES encryption key length does not match the block size");
 
-	rijndael = new CRijndael();
-	rijndael->MakeKey(opdi_encryption_key, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", OPDI_ENCRYPTION_BLOCKSIZE, OPDI_ENCRYPTION_BLOCKSIZE);
-	return rijndael;
+	device_context = new_context((const uint8_t *)opdi_encryption_key);
 }
 
+/** Returns the context of the device key. It is created by the first caller; the other threads wait
+*   for it. If the creation fails, the exception is thrown and the next call tries again.
+*/
+static AESContext *get_device_context() {
+	std::call_once(device_context_once, create_device_context);
+	return device_context;
+}
 
-uint8_t opdi_encrypt_block(uint8_t* dest, const uint8_t* src) {
+static uint8_t encrypt_blocks(AESContext *context, uint8_t* dest, const uint8_t* src, uint16_t count) {
 	try
 	{
-		CRijndael *oRijndael = get_rijndael();
-		oRijndael->EncryptBlock((const char*)src, (char*)dest);
+		uint8_t which = opdi_aes_backend();
+		prepare_context(context, which);
+		switch (which) {
+#ifdef AES_NI
+		case OPDI_AES_AESNI:
+			aesni_encrypt_blocks(context, dest, src, count);
+			break;
+#endif
+#ifdef AES_ARMV8
+		case OPDI_AES_ARMV8:
+			armv8_encrypt_blocks(context, dest, src, count);
+			break;
+#endif
+#ifdef AES_BITSLICED
+		case OPDI_AES_BITSLICED:
+			bitslice_process_blocks(context, dest, src, count, true);
+			break;
+#endif
+		default:
+			for (; count > 0; count--, src += OPDI_ENCRYPTION_BLOCKSIZE, dest += OPDI_ENCRYPTION_BLOCKSIZE)
+				context->rijndael->EncryptBlock((const char*)src, (char*)dest);
+		}
 	} catch (exception&) {
 		return OPDI_ENCRYPTION_ERROR;
 	}
@@ -43,15 +738,92 @@ uint8_t opdi_encrypt_block(uint8_t* dest, const uint8_t* src) {
 	return OPDI_STATUS_OK;
 }
 
-
-uint8_t opdi_decrypt_block(uint8_t* dest, const uint8_t* src) {
+static uint8_t decrypt_blocks(AESContext *context, uint8_t* dest, const uint8_t* src, uint16_t count) {
 	try
 	{
-		CRijndael *oRijndael = get_rijndael();
-		oRijndael->DecryptBlock((const char*)src, (char*)dest);
+		uint8_t which = opdi_aes_backend();
+		prepare_context(context, which);
+		switch (which) {
+#ifdef AES_NI
+		case OPDI_AES_AESNI:
+			aesni_decrypt_blocks(context, dest, src, count);
+			break;
+#endif
+#ifdef AES_ARMV8
+		case OPDI_AES_ARMV8:
+			armv8_decrypt_blocks(context, dest, src, count);
+			break;
+#endif
+#ifdef AES_BITSLICED
+		case OPDI_AES_BITSLICED:
+			bitslice_process_blocks(context, dest, src, count, false);
+			break;
+#endif
+		default:
+			for (; count > 0; count--, src += OPDI_ENCRYPTION_BLOCKSIZE, dest += OPDI_ENCRYPTION_BLOCKSIZE)
+				context->rijndael->DecryptBlock((const char*)src, (char*)dest);
+		}
 	} catch (exception&) {
 		return OPDI_ENCRYPTION_ERROR;
 	}
 
 	return OPDI_STATUS_OK;
 }
+
+
+uint8_t opdi_encrypt_blocks(uint8_t* dest, const uint8_t* src, uint16_t count) {
+	try
+	{
+		return encrypt_blocks(get_device_context(), dest, src, count);
+	} catch (exception&) {
+		return OPDI_ENCRYPTION_ERROR;
+	}
+}
+
+
+uint8_t opdi_decrypt_blocks(uint8_t* dest, const uint8_t* src, uint16_t count) {
+	try
+	{
+		return decrypt_blocks(get_device_context(), dest, src, count);
+	} catch (exception&) {
+		return OPDI_ENCRYPTION_ERROR;
+	}
+}
+
+
+uint8_t opdi_encrypt_block(uint8_t* dest, const uint8_t* src) {
+	return opdi_encrypt_blocks(dest, src, 1);
+}
+
+
+uint8_t opdi_decrypt_block(uint8_t* dest, const uint8_t* src) {
+	return opdi_decrypt_blocks(dest, src, 1);
+}
+
+void *opdi_cipher_create(const uint8_t *key) {
+	try
+	{
+		return new_context(key);
+	} catch (exception&) {
+		return nullptr;
+	}
+}
+
+
+void opdi_cipher_free(void *cipher) {
+	AESContext *context = (AESContext *)cipher;
+
+	if (context == nullptr)
+		return;
+	free_context(context);
+}
+
+
+uint8_t opdi_cipher_encrypt_blocks(void *cipher, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	return encrypt_blocks((AESContext *)cipher, dest, src, count);
+}
+
+
+uint8_t opdi_cipher_decrypt_blocks(void *cipher, uint8_t *dest, const uint8_t *src, uint16_t count) {
+	return decrypt_blocks((AESContext *)cipher, dest, src, count);
+}
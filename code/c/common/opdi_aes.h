@@ -0,0 +1,63 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Backend selection of the AES implementation in opdi_aes.cpp.
+//
+// opdi_aes.cpp implements opdi_encrypt_block and opdi_decrypt_block (see opdi_config.h).
+// The blocks are processed by the AES instructions of the CPU if they are available
+// (AES-NI on x86, the cryptography extension on ARMv8) and by the portable CRijndael
+// implementation otherwise. The CPU is checked at run time when the first block is processed.
+// The hardware backends can be excluded at build time by defining OPDI_NO_AES_HARDWARE.
+// On CPUs without AES instructions, the bitsliced backend is used instead of CRijndael if
+// OPDI_AES_CONSTANT_TIME is defined (e. g. in the config specs). It uses no lookup tables, so its
+// time does not depend on the key or the data, and it processes eight blocks at once.
+// opdi_aes.cpp also implements the cipher contexts of opdi_config.h that are used for session keys
+// and by the master; each context holds the key schedules of one key.
+
+#ifndef __OPDI_AES_H
+#define __OPDI_AES_H
+
+#include "opdi_platformtypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// AES backends
+
+// table-driven portable code (CRijndael)
+#define OPDI_AES_PORTABLE		0
+// AES-NI instructions of x86 processors
+#define OPDI_AES_AESNI			1
+// cryptography extension of ARMv8 processors
+#define OPDI_AES_ARMV8			2
+// constant-time bitsliced portable code; one to eight blocks take the same time
+#define OPDI_AES_BITSLICED		3
+
+/** Returns the backend that processes the blocks. Detects the CPU features if necessary.
+*/
+uint8_t opdi_aes_backend(void);
+
+/** Returns 1 if the backend can be used on this CPU, 0 otherwise.
+*/
+uint8_t opdi_aes_backend_available(uint8_t backend);
+
+/** Selects the backend that processes the blocks. Can be used to compare the backends or
+*   to force the portable code. Returns OPDI_ENCRYPTION_NOT_SUPPORTED if the backend is not
+*   available on this CPU. Must not be called while other threads process blocks.
+*/
+uint8_t opdi_aes_select_backend(uint8_t backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif		// __OPDI_AES_H
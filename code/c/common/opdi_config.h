@@ -24,6 +24,7 @@
 #include "opdi_platformtypes.h"
 #include "opdi_configspecs.h"
 #include "opdi_port.h"
+#include "opdi_message.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,6 +67,37 @@ extern uint8_t opdi_encrypt_block(uint8_t *dest, const uint8_t *src);
 */
 extern uint8_t opdi_decrypt_block(uint8_t *dest, const uint8_t *src);
 
+/** Is used to encrypt count consecutive blocks of size ENCRYPTION_BLOCKSIZE, usually a complete message.
+*   The blocks are independent of each other; an implementation may process several of them at once.
+*   dest and src may be the same buffer.
+*   Must be provided by the implementation.
+*/
+extern uint8_t opdi_encrypt_blocks(uint8_t *dest, const uint8_t *src, uint16_t count);
+
+/** Is used to decrypt count consecutive blocks of size ENCRYPTION_BLOCKSIZE.
+*   The blocks are independent of each other; an implementation may process several of them at once.
+*   dest and src may be the same buffer.
+*   Must be provided by the implementation.
+*/
+extern uint8_t opdi_decrypt_blocks(uint8_t *dest, const uint8_t *src, uint16_t count);
+
+/** Creates a cipher context for the key of ENCRYPTION_BLOCKSIZE bytes and precomputes its key schedule.
+*   A context is used by one session only. Returns NULL if the context can't be created.
+*   Must be provided by the implementation if OPDI_SESSION_KEYS is defined or if the master
+*   (common/master) is used.
+*/
+extern void *opdi_cipher_create(const uint8_t *key);
+
+/** Releases a cipher context that has been created by opdi_cipher_create and clears the key
+*   material that it holds. cipher may be NULL.
+*/
+extern void opdi_cipher_free(void *cipher);
+
+/** Work like opdi_encrypt_blocks and opdi_decrypt_blocks but use the key of the cipher context.
+*/
+extern uint8_t opdi_cipher_encrypt_blocks(void *cipher, uint8_t *dest, const uint8_t *src, uint16_t count);
+extern uint8_t opdi_cipher_decrypt_blocks(void *cipher, uint8_t *dest, const uint8_t *src, uint16_t count);
+
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -107,9 +139,13 @@ extern uint8_t opdi_slave_callback(OPDIFunctionCode opdiFunctionCode, char *buff
 
 /** Is called by the protocol when a message has been successfully processed. This means the master has been active.
 *   This function can be used to implement an idle timer. This function should return OPDI_STATUS_OK to indicate that everything is ok.
-*   It is usually ok to send messages from this function.
+*   It is usually ok to send messages from this function using the given session.
 */
+#ifdef OPDI_SINGLE_SESSION
 extern uint8_t opdi_message_handled(channel_t channel, const char **parts);
+#else
+extern uint8_t opdi_message_handled(opdi_Session *session, channel_t channel, const char **parts);
+#endif
 
 #endif
 
@@ -54,6 +54,10 @@
 
 #define OPDI_DONT_USE_ENCRYPTION	0
 #define OPDI_USE_ENCRYPTION			1
+// the block cipher is used in counter mode to encrypt a byte stream (see OPDI_ENCRYPTION_CTR)
+#define OPDI_USE_ENCRYPTION_CTR		2
+// each message is encrypted and authenticated with the block cipher in Galois/counter mode (see OPDI_ENCRYPTION_GCM)
+#define OPDI_USE_ENCRYPTION_GCM		3
 
 // The default timeout for messages in milliseconds.
 // May not exceed 65535.
@@ -101,4 +105,52 @@
 */
 #define OPDI_FLAG_AUTHENTICATION_REQUIRED	0x04
 
+/** Is used by the master to indicate that it accepts multi-message frames, i.e. several messages
+*   separated by OPDI_MULTIMESSAGE_SEPARATOR and terminated by a single message terminator.
+*   The device confirms that it sends such frames by setting this flag in its handshake reply.
+*/
+#define OPDI_FLAG_MULTIMESSAGE				0x08
+
+/** Is used by the master to indicate that it accepts binary message frames. The device confirms this
+*   by setting the flag in its handshake reply; all following messages are then sent as binary frames.
+*   A binary frame consists of the frame length as a variable length integer, the channel number as a
+*   variable length integer, the payload, and a CRC-16 over all preceding bytes of the frame.
+*/
+#define OPDI_FLAG_BINARY_FRAMING			0x10
+
+/** Is used by the master to indicate that it accepts fragmented messages. The device confirms this
+*   by setting the flag in its handshake reply. A message that does not fit into one frame may then be
+*   sent as a sequence of frames on the same channel. The payload of each frame except the last
+*   starts with the fragment header OPDI_FRAGMENT_MARKER; the receiver concatenates the payloads.
+*/
+#define OPDI_FLAG_FRAGMENTATION				0x20
+
+/** Is set by the device in its handshake reply if the counter mode encryption uses a session key,
+*   i.e. the encryption of the device nonce followed by the master nonce with the key of the device.
+*/
+#define OPDI_FLAG_SESSION_KEY				0x40
+
+/** Is used by the master to indicate that it accepts text messages that end with a CRC-32C instead of
+*   the additive checksum. The device confirms this by setting the flag in its handshake reply; all following
+*   text messages then end with the checksum separator and eight hexadecimal digits of the CRC-32C over
+*   the channel, the channel separator and the payload. Binary frames and Galois/counter mode records
+*   are not affected.
+*/
+#define OPDI_FLAG_CRC32C					0x80
+
+/** Is used by the master to indicate that it announces the maximum length of the frames it accepts.
+*   The device confirms this by setting the flag in its handshake reply and appending the maximum length
+*   of its own frames as an additional part; the master then appends its maximum length to the protocol
+*   select message. The length of a frame is counted before encryption and includes the checksum or CRC
+*   and the terminator. Each side sends only frames that the other side accepts; devices that don't
+*   confirm the flag accept frames of the traditional size only.
+*/
+#define OPDI_FLAG_FRAME_SIZE				0x100
+
+// the smallest frame length that may be announced during the handshake
+#define OPDI_MIN_FRAME_SIZE					32
+
+// the frame length that is assumed if the peer does not announce it
+#define OPDI_DEFAULT_FRAME_SIZE				255
+
 #endif
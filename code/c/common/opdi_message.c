@@ -15,55 +15,302 @@
 #include <stdio.h>
 #include <string.h>
 
+// this module implements the session functions
+#define OPDI_SESSION_INTERNAL
+
 #include "opdi_platformtypes.h"
 #include "opdi_platformfuncs.h"
 #include "opdi_config.h"
 #include "opdi_message.h"
 #include "opdi_constants.h"
+#include "opdi_strings.h"
+#include "opdi_protocol_constants.h"
+#include "opdi_trace.h"
+
+#if defined(OPDI_TRACE_BUFFER_SIZE) && defined(_MSC_VER)
+#include <windows.h>
+#include <intrin.h>
+#endif
 
 #define MESSAGE_TERMINATOR	'\n'
 #define MESSAGE_SEPARATOR	':'
+#define LIST_SEPARATOR		','
 #define CHANNEL_MAXBUF	3				// maximum size of channel digits
+#define CHANNEL_STRBUF	6				// buffer size for a formatted channel number
 
 #define MESSAGE_MALFORMED	"malformed msg:"
 #define MESSAGE_UNKNOWN		"unknown msg:"
 
-// the message payload buffer
-static char msgPayload[OPDI_MESSAGE_PAYLOAD_LENGTH];
+// the size of the buffer for traced frames; longer frames are truncated in the debug output
+#if (OPDI_MESSAGE_BUFFER_SIZE < 512)
+#define TRACE_TEXT_SIZE		OPDI_MESSAGE_BUFFER_SIZE
+#else
+#define TRACE_TEXT_SIZE		512
+#endif
+
+#ifdef OPDI_SINGLE_SESSION
+
+// the session of configurations that serve only one master
+opdi_Session opdi_single_session;
+
+#endif
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+
+#if (OPDI_MULTIMESSAGE_BUFFER_SIZE < OPDI_MESSAGE_BUFFER_SIZE)
+#error "OPDI_MULTIMESSAGE_BUFFER_SIZE must not be smaller than OPDI_MESSAGE_BUFFER_SIZE"
+#endif
+
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+
+#define BINARY_CRC_SIZE		2			// size of the CRC at the end of a binary frame
+
+#if (OPDI_MESSAGE_BUFFER_SIZE > 0x3fff)
+#error "OPDI_BINARY_FRAMING requires OPDI_MESSAGE_BUFFER_SIZE to be less than 16384 (two byte length prefix)"
+#endif
+
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+
+#if (OPDI_MESSAGE_BUFFER_SIZE < 32)
+#error "OPDI_FRAGMENT_BUFFER_SIZE requires OPDI_MESSAGE_BUFFER_SIZE to be at least 32"
+#endif
+
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+#define IS_BINARY(session)				((session)->binary)
+#else
+#define IS_BINARY(session)				0
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+#define FRAGMENTATION(session)			((session)->fragmentation)
+#else
+#define FRAGMENTATION(session)			0
+#endif
+
+#ifdef OPDI_CRC32C
+#define USES_CRC32C(session)			((session)->crc32c)
+#else
+#define USES_CRC32C(session)			0
+#endif
+
+// framings of received frames (see decode_frame)
+#define FRAMING_TEXT					0
+#define FRAMING_BINARY					1
+#define FRAMING_CRC32C					2
+
+#define TEXT_FRAMING(session)			(USES_CRC32C(session) ? FRAMING_CRC32C : FRAMING_TEXT)
+
+// the checksum separator, the checksum characters and the terminator at the end of a text message
+#define CHECKSUM_TRAILER_SIZE			6
+#define CRC32C_TRAILER_SIZE				10
+#define TRAILER_SIZE(session)			(USES_CRC32C(session) ? CRC32C_TRAILER_SIZE : CHECKSUM_TRAILER_SIZE)
+
+#if !defined(OPDI_NO_ENCRYPTION) && defined(OPDI_ENCRYPTION_CTR)
+
+#if (OPDI_ENCRYPTION_BLOCKSIZE < 16)
+#error "OPDI_ENCRYPTION_CTR requires OPDI_ENCRYPTION_BLOCKSIZE to be at least 16 (nonce, direction and counter)"
+#endif
+
+#define IS_CTR(session)					((session)->encryption == OPDI_USE_ENCRYPTION_CTR)
+#else
+#define IS_CTR(session)					0
+#endif
+
+#if !defined(OPDI_NO_ENCRYPTION) && defined(OPDI_ENCRYPTION_GCM)
+
+#ifndef OPDI_ENCRYPTION_CTR
+#error "OPDI_ENCRYPTION_GCM requires OPDI_ENCRYPTION_CTR"
+#endif
+
+#if (OPDI_ENCRYPTION_BLOCKSIZE != 16)
+#error "OPDI_ENCRYPTION_GCM requires OPDI_ENCRYPTION_BLOCKSIZE to be 16"
+#endif
 
-// the message output buffer
-static uint8_t msgBuf[OPDI_MESSAGE_BUFFER_SIZE];
+#define IS_GCM(session)					((session)->encryption == OPDI_USE_ENCRYPTION_GCM)
 
-// function handler for receiving of bytes
-static func_receive receive;
+// the trailer of the text message that is replaced by the tag; CRC-32C is not used in Galois/counter mode
+#define TEXT_TRAILER_SIZE		CHECKSUM_TRAILER_SIZE
+// the record numbers of the sent records are distinguished from the received ones by the highest bit
+#define GCM_MAX_RECORDS			0x80000000UL
+#endif
+
+#ifdef OPDI_SESSION_KEYS
+
+#ifndef OPDI_ENCRYPTION_CTR
+#error "OPDI_SESSION_KEYS requires OPDI_ENCRYPTION_CTR (the nonces are exchanged in the counter modes)"
+#endif
+
+// the blocks are processed with the session key if there is one
+#define ENCRYPT_BLOCKS(session, dest, src, count)	((session)->cipher != NULL ? opdi_cipher_encrypt_blocks((session)->cipher, dest, src, count) : opdi_encrypt_blocks(dest, src, count))
+#define DECRYPT_BLOCKS(session, dest, src, count)	((session)->cipher != NULL ? opdi_cipher_decrypt_blocks((session)->cipher, dest, src, count) : opdi_decrypt_blocks(dest, src, count))
+#else
+#define ENCRYPT_BLOCKS(session, dest, src, count)	opdi_encrypt_blocks(dest, src, count)
+#define DECRYPT_BLOCKS(session, dest, src, count)	opdi_decrypt_blocks(dest, src, count)
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
 
-// function handler for sending of bytes
-static func_send send;
+/** Overwrites key material with zeros. Unlike memset the volatile stores are not removed
+*   if the memory is not read afterwards.
+*/
+static void wipe(void *memory, uint16_t size) {
+	volatile uint8_t *bytes = (volatile uint8_t *)memory;
 
-// info for receive and send functions
-static void* sendinfo;
+	while (size-- > 0)
+		*bytes++ = 0;
+}
 
-// the timeout used for receiving messages (in milliseconds)
-static uint16_t message_timeout = OPDI_DEFAULT_MESSAGE_TIMEOUT;
+#endif
 
 #ifndef OPDI_NO_ENCRYPTION
+#define OUTGOING_DIRECTION(session)		((session)->encryption ? OPDI_DIR_OUTGOING_ENCR : OPDI_DIR_OUTGOING)
+#else
+#define OUTGOING_DIRECTION(session)		OPDI_DIR_OUTGOING
+#endif
+
+#if (OPDI_TRACE_LEVEL > OPDI_TRACE_OFF)
+
+volatile uint8_t opdi_trace_level = OPDI_TRACE_LEVEL;
 
-// flag whether encryption is on or off
-static uint8_t encryption;
+#ifdef OPDI_TRACE_BUFFER_SIZE
+
+// the ring buffer of trace records
+static opdi_TraceRecord traceRecords[OPDI_TRACE_BUFFER_SIZE];
+// the sequence number of the most recently started record
+static uint32_t traceHead;
+
+#ifdef _MSC_VER
+#define TRACE_NEXT(p)		((uint32_t)_InterlockedIncrement((volatile long *)(p)))
+#define TRACE_STORE(p, v)	_InterlockedExchange((volatile long *)(p), (long)(v))
+#define TRACE_LOAD(p)		((uint32_t)_InterlockedCompareExchange((volatile long *)(p), 0, 0))
+#define TRACE_FENCE_RELEASE()	MemoryBarrier()
+#define TRACE_FENCE_ACQUIRE()	MemoryBarrier()
+#else
+#define TRACE_NEXT(p)		__atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define TRACE_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define TRACE_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define TRACE_FENCE_RELEASE()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define TRACE_FENCE_ACQUIRE()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
+/** Writes a record to the ring buffer. Several threads may write at the same time.
+*/
+static void record_trace(uint8_t direction, const uint8_t *frame, uint16_t length) {
+	uint32_t sequence = TRACE_NEXT(&traceHead);
+	opdi_TraceRecord *record = &traceRecords[(sequence - 1) & (OPDI_TRACE_BUFFER_SIZE - 1)];
+
+	// mark the record as being written; the fence keeps the following writes behind the mark
+	TRACE_STORE(&record->sequence, 0);
+	TRACE_FENCE_RELEASE();
+	record->time = (uint32_t)opdi_get_time_ms();
+	record->direction = direction;
+	record->count = (uint8_t)(length < OPDI_TRACE_DATA_SIZE ? length : OPDI_TRACE_DATA_SIZE);
+	record->length = length;
+	memcpy(record->data, frame, record->count);
+	TRACE_STORE(&record->sequence, sequence);
+}
+
+uint16_t opdi_trace_dump(opdi_TraceDumpFunc dump) {
+	opdi_TraceRecord record;
+	opdi_TraceRecord *slot;
+	uint32_t head = TRACE_LOAD(&traceHead);
+	uint32_t sequence = (head > OPDI_TRACE_BUFFER_SIZE ? head - OPDI_TRACE_BUFFER_SIZE : 0);
+	uint16_t count = 0;
+
+	while (sequence < head) {
+		sequence++;
+		slot = &traceRecords[(sequence - 1) & (OPDI_TRACE_BUFFER_SIZE - 1)];
+		if (TRACE_LOAD(&slot->sequence) != sequence)
+			continue;
+		memcpy(&record, slot, sizeof(record));
+		// the record may have been overwritten during copying; the fence keeps the copy before the check
+		TRACE_FENCE_ACQUIRE();
+		if (TRACE_LOAD(&slot->sequence) != sequence)
+			continue;
+		record.sequence = sequence;
+		dump(&record);
+		count++;
+	}
+	return count;
+}
+
+#endif
+
+/** Traces the frame of length bytes. Text frames may end with the terminator.
+*   Of binary frames, only the payload is passed to opdi_debug_msg.
+*/
+static void trace_frame(uint8_t direction, const uint8_t *frame, uint16_t length, uint8_t binary) {
+#if (OPDI_TRACE_LEVEL >= OPDI_TRACE_DEBUG)
+	char text[TRACE_TEXT_SIZE];
+	uint16_t start = 0;
+	uint16_t end = length;
+#ifdef OPDI_BINARY_FRAMING
+	uint16_t value;
+#endif
+#endif
+
+#ifdef OPDI_TRACE_BUFFER_SIZE
+	record_trace(direction, frame, length);
+#endif
+
+#if (OPDI_TRACE_LEVEL >= OPDI_TRACE_DEBUG)
+	if (opdi_trace_level < OPDI_TRACE_DEBUG)
+		return;
+
+#ifdef OPDI_BINARY_FRAMING
+	if (binary) {
+		// skip length prefix and channel
+		start = strings_get_varint(frame, length, &value);
+		start += strings_get_varint(frame + start, length - start, &value);
+		end = (length >= start + BINARY_CRC_SIZE ? length - BINARY_CRC_SIZE : start);
+	} else
+#endif
+	if ((end > 0) && (frame[end - 1] == MESSAGE_TERMINATOR))
+		end--;
+	if (end - start >= TRACE_TEXT_SIZE)
+		end = start + TRACE_TEXT_SIZE - 1;
+	memcpy(text, frame + start, end - start);
+	text[end - start] = '\0';
+
+	if (direction & OPDI_TRACE_MALFORMED) {
+		direction &= ~OPDI_TRACE_MALFORMED;
+		opdi_debug_msg(MESSAGE_MALFORMED, direction);
+	}
+	opdi_debug_msg(text, direction);
+#endif
+}
+
+// traces the frame if the level is enabled; costs a single comparison otherwise
+#define TRACE_FRAME(level, direction, frame, length, binary) \
+	do { \
+		if (OPDI_TRACE_ENABLED(level)) \
+			trace_frame((direction), (frame), (length), (binary)); \
+	} while (0)
+
+#else
+
+#define TRACE_FRAME(level, direction, frame, length, binary)
 
 #endif
 
-/** Compares cs with the four byte hexadecimal checksum value starting at bytes[pos] and returns 0 if ok.
+/** Compares cs with the hexadecimal checksum value of digits bytes starting at bytes[pos] and returns 0 if ok.
 */
-static uint16_t compare_checksum(uint16_t cs, uint8_t bytes[], uint16_t pos) {
-	uint16_t value = 0;
+static uint16_t compare_checksum(uint32_t cs, uint8_t bytes[], uint16_t pos, uint8_t digits) {
+	uint32_t value = 0;
 	uint8_t byte;
-	uint16_t i;
-	for (i = 0; i < 4; i++) {
-		byte = bytes[pos + 3 - i];
-		if ((byte >= '0') && (byte <= '9')) value |= (byte - '0') << i * 4;
-		else if ((byte >= 'A') && (byte <= 'F')) value |= (byte - 'A' + 10) << i * 4;
-		else if ((byte >= 'a') && (byte <= 'f')) value |= (byte - 'a' + 10) << i * 4;
+	uint8_t i;
+	for (i = 0; i < digits; i++) {
+		byte = bytes[pos + i];
+		value <<= 4;
+		if ((byte >= '0') && (byte <= '9')) value |= byte - '0';
+		else if ((byte >= 'A') && (byte <= 'F')) value |= byte - 'A' + 10;
+		else if ((byte >= 'a') && (byte <= 'f')) value |= byte - 'a' + 10;
 		else
 			return OPDI_ERROR_CONVERSION;
 	}
@@ -72,87 +319,133 @@ static uint16_t compare_checksum(uint16_t cs, uint8_t bytes[], uint16_t pos) {
 	return OPDI_STATUS_OK;
 }
 
-/** Decode the message from bytes using msgPayload as buffer. Returns an error code if it can't be decoded.
+/** Decode the message from the length bytes that are followed by a null terminator. Only these bytes
+*   and the terminator are read. The payload of message points into bytes; its end (the checksum
+*   separator) is returned in end. Returns an error code if it can't be decoded.
 */
-static uint8_t decode(opdi_Message *message, uint8_t bytes[]) {
+static uint8_t decode(opdi_Message *message, uint8_t bytes[], uint16_t length, uint16_t *end) {
 	char channelBuf[CHANNEL_MAXBUF + 1] = {'\0'};
-	uint16_t pos = 0;
-	uint16_t payloadPos = 0;
-	uint16_t lastSepPos = 0;
-	uint16_t checksum = 0;
-	int16_t i;
-	uint8_t err;
+	opdi_FrameScan scan;
+	uint16_t payloadPos;
 
-	// detect separator
-	while (bytes[pos]) {
-		if (bytes[pos] == MESSAGE_SEPARATOR) break;
-		channelBuf[pos] = bytes[pos];
-		checksum += bytes[pos];
-		pos++;
-		if (pos >= CHANNEL_MAXBUF)
-			// separator not detected within the first few characters
-			return OPDI_ERROR_MALFORMED_MESSAGE;
-	}
+	// find the separators and calculate the checksum in one pass
+	// the frame may end at the end of the receive buffer; the scan must not read beyond the terminator
+	if (strings_scan_frame(bytes, (size_t)length + 1, '\0', MESSAGE_SEPARATOR, &scan) != OPDI_STATUS_OK)
+		// not properly null-terminated
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	if (scan.first_sep >= CHANNEL_MAXBUF)
+		// separator not detected within the first few characters
+		return OPDI_ERROR_MALFORMED_MESSAGE;
 
 	// parse the channel number
+	memcpy(channelBuf, bytes, scan.first_sep);
 	if (opdi_str_to_uint16(channelBuf, &(message->channel)) != OPDI_STATUS_OK)
 		return OPDI_ERROR_MALFORMED_MESSAGE;
 
-	checksum += bytes[pos];
-	payloadPos = ++pos;		// start of payload
-
-	// determine end of payload
-	while (bytes[pos]) {
-		if (bytes[pos] == MESSAGE_SEPARATOR) {
-			lastSepPos = pos;
-		}
-		checksum += bytes[pos];
-		pos++;
-		if (pos >= OPDI_MESSAGE_BUFFER_SIZE)
-			// not properly null-terminated
-			return OPDI_ERROR_MALFORMED_MESSAGE;
-	}
+	payloadPos = scan.first_sep + 1;		// start of payload
 
-	if (lastSepPos <= payloadPos)
+	if (scan.last_sep <= payloadPos)
 		// no subsequent separator (checksum missing)
 		return OPDI_ERROR_MALFORMED_MESSAGE;
 
-	// subtract the checksum characters
-	for (i = pos - 1; i > pos - 5; i--) {
-		if (i < 0)
-			// message too short
-			return OPDI_ERROR_MALFORMED_MESSAGE;
-		checksum -= bytes[i];
-	}
-	if (bytes[i] != MESSAGE_SEPARATOR)
+	if (scan.last_sep + 5 != scan.length)
 		// checksum separator expected but not found
 		return OPDI_ERROR_MALFORMED_MESSAGE;
-	checksum -= bytes[i];
 
 	// compare the checksum
-	if (compare_checksum(checksum, bytes, i + 1) != OPDI_STATUS_OK)
+	if (compare_checksum((uint16_t)scan.checksum, bytes, scan.last_sep + 1, 4) != OPDI_STATUS_OK)
 			// checksum wrong
 			return OPDI_ERROR_MALFORMED_MESSAGE;
 
-	// retrieve the payload
-	err = opdi_bytes_to_string(bytes, payloadPos, lastSepPos - payloadPos, msgPayload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (err != OPDI_STATUS_OK)
-		return err;
-	message->payload = msgPayload;
+	// the payload is left in place
+	message->payload = (char *)bytes + payloadPos;
+	*end = (uint16_t)scan.last_sep;
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_CRC32C
+
+/** Decodes the text message of length bytes that ends with a CRC-32C instead of the additive checksum.
+*   The position of the checksum separator follows from the length, so the bytes are read only once
+*   to compute the CRC. The payload of message points into bytes; its end (the checksum separator)
+*   is returned in end. Returns an error code if it can't be decoded.
+*/
+static uint8_t decode_crc32c(opdi_Message *message, uint8_t bytes[], uint16_t length, uint16_t *end) {
+	char channelBuf[CHANNEL_MAXBUF + 1] = {'\0'};
+	uint16_t sep;
+	uint16_t crcPos;
+
+	// channel, separator, payload, checksum separator and eight checksum characters
+	if (length < CRC32C_TRAILER_SIZE + 2)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+	crcPos = length - (CRC32C_TRAILER_SIZE - 1);
+	if (bytes[crcPos] != MESSAGE_SEPARATOR)
+		// checksum separator expected but not found
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// the separator must be detected within the first few characters
+	for (sep = 0; (sep < CHANNEL_MAXBUF) && (bytes[sep] != MESSAGE_SEPARATOR); sep++)
+		;
+	if ((sep == 0) || (sep >= CHANNEL_MAXBUF) || (sep + 1 >= crcPos))
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// compare the checksum
+	if (compare_checksum(strings_crc32c(0, bytes, crcPos), bytes, crcPos + 1, 8) != OPDI_STATUS_OK)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// parse the channel number
+	memcpy(channelBuf, bytes, sep);
+	if (opdi_str_to_uint16(channelBuf, &(message->channel)) != OPDI_STATUS_OK)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// the payload is left in place
+	message->payload = (char *)bytes + sep + 1;
+	*end = crcPos;
 	return OPDI_STATUS_OK;
 }
 
+#endif
+
+/** Appends the checksum separator, the checksum characters and the terminator to the text
+*   message content in msgBuf from start to pos. checksum is the additive checksum of the content;
+*   if CRC-32C is used, the CRC of the content is appended instead. Returns the new end of the content.
+*/
+static uint16_t finish_text(opdi_Session *session, uint16_t start, uint16_t pos, uint16_t checksum) {
+	uint32_t value = checksum;
+	uint8_t digits = 4;
+	uint8_t nibble;
+	uint8_t i;
+
+#ifdef OPDI_CRC32C
+	if (session->crc32c) {
+		value = strings_crc32c(0, session->msgBuf + start, pos - start);
+		digits = 8;
+	}
+#endif
+	session->msgBuf[pos++] = MESSAGE_SEPARATOR;
+	for (i = digits; i > 0; i--) {
+		nibble = (value >> (4 * (i - 1))) & 0x0f;
+		if (nibble >= 10)
+			session->msgBuf[pos++] = 'a' + nibble - 10;
+		else
+			session->msgBuf[pos++] = '0' + nibble;
+	}
+	session->msgBuf[pos++] = MESSAGE_TERMINATOR;
+	return pos;
+}
+
 /** Encodes the message into msgBuf. Returns an error code if it can't be encoded.
 *   Returns the length of the result in length.
 */
-static uint8_t encode(opdi_Message *message, uint16_t *length) {
+static uint8_t encode(opdi_Session *session, opdi_Message *message, uint16_t *length) {
 	char channelBuf[CHANNEL_MAXBUF + 1] = {'\0'};
 	uint16_t pos = 0;
 	uint16_t checksum = 0;
 	size_t i;
 	uint8_t err;
 	uint16_t bytelen = 0;
-	uint8_t nibble;
+	opdi_FrameScan scan;
 
 	// write the channel number
 #if (channel_bits == 8)
@@ -164,280 +457,1654 @@ static uint8_t encode(opdi_Message *message, uint16_t *length) {
 #endif
 
 	// transfer channel number
-	err = opdi_string_to_bytes(channelBuf, msgBuf, 0, OPDI_MESSAGE_BUFFER_SIZE, &bytelen);
+	err = opdi_string_to_bytes(channelBuf, session->msgBuf, 0, OPDI_MESSAGE_BUFFER_SIZE, &bytelen);
 	if (err != OPDI_STATUS_OK)
 		return err;
 
-	msgBuf[pos++] = MESSAGE_SEPARATOR;
+	session->msgBuf[pos++] = MESSAGE_SEPARATOR;
 	if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)
 		return OPDI_ERROR_MSGBUF_OVERFLOW;
 
 	// channel checksum
 	for (i = pos; i > 0; i--)
-		checksum += msgBuf[i - 1];
+		checksum += session->msgBuf[i - 1];
 
 	// transfer payload
-	err = opdi_string_to_bytes(message->payload, msgBuf, pos, OPDI_MESSAGE_BUFFER_SIZE, &bytelen);
+	err = opdi_string_to_bytes(message->payload, session->msgBuf, pos, OPDI_MESSAGE_BUFFER_SIZE, &bytelen);
 	if (err != OPDI_STATUS_OK)
 		return err;
 
-	// payload checksum
-	i = pos;
-	while (pos < bytelen + i) {
-		// check: terminator may not occur
-		if (msgBuf[pos] == MESSAGE_TERMINATOR)
-			return OPDI_TERMINATOR_IN_PAYLOAD;
-		checksum += msgBuf[pos++];
-		if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)
-			return OPDI_ERROR_MSGBUF_OVERFLOW;
-	}
-
-	// checksum separator
-	msgBuf[pos++] = MESSAGE_SEPARATOR;
+	// payload checksum; check: terminator may not occur
+	if (strings_scan_frame(session->msgBuf + pos, bytelen, MESSAGE_TERMINATOR, MESSAGE_SEPARATOR, &scan) == OPDI_STATUS_OK)
+		return OPDI_TERMINATOR_IN_PAYLOAD;
+	checksum += (uint16_t)scan.sum;
+	pos += bytelen;
 	if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)
 		return OPDI_ERROR_MSGBUF_OVERFLOW;
 
-	// add the checksum characters
-	for (i = 4; i > 0; i--) {
-		nibble = (checksum >> (4 * (i - 1))) & 0x0f;
-		if (nibble >= 10)
-			msgBuf[pos++] = 'a' + nibble - 10;
-		else
-			msgBuf[pos++] = '0' + nibble;
-		if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)
-			return OPDI_ERROR_MSGBUF_OVERFLOW;
-	}
-	if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)
+	// checksum separator, checksum characters and terminator
+	if (pos + TRAILER_SIZE(session) > session->maxFrame)
 		return OPDI_ERROR_MSGBUF_OVERFLOW;
-	msgBuf[pos++] = '\n';
-
-	*length = pos;
-	return OPDI_STATUS_OK;
-}
-
-uint8_t opdi_message_setup(func_receive recv, func_send snd, void *info) {
-#ifndef OPDI_NO_ENCRYPTION
-	// if encryption is used, switch it off
-	opdi_set_encryption(OPDI_DONT_USE_ENCRYPTION);
-#endif
-	receive = recv;
-	send = snd;
-	sendinfo = info;
+	*length = finish_text(session, 0, pos, checksum);
 	return OPDI_STATUS_OK;
 }
 
-#ifndef OPDI_NO_ENCRYPTION
+#ifdef OPDI_BINARY_FRAMING
 
-static uint8_t get_encrypted(opdi_Message *message, uint8_t can_send) {
-#ifdef _MSC_VER
-	// compiler can't handle non-constant-length array on the stack
-	// use implementation-provided buffer
-	uint8_t *buf;
-#else
-	// compiler can handle non-constant-length array on the stack
-	uint8_t buf[opdi_encryption_blocksize];
-#endif
+/** Decodes the binary frame of length bytes. The payload of message points into bytes; its end
+*   (the start of the CRC) is returned in end. Returns an error code if the CRC does not match
+*   or if the frame can't be decoded. The payload is passed on as a terminated string, therefore
+*   frames whose payload contains a zero byte are rejected instead of being cut off.
+*/
+static uint8_t decode_binary(opdi_Message *message, uint8_t bytes[], uint16_t length, uint16_t *end) {
+	uint16_t bodyLength;
+	uint16_t channel;
 	uint16_t pos;
-	uint16_t blockpos;
-	uint8_t byte;
-	uint8_t result;
-	uint16_t i;
+	uint8_t count;
 
-#ifdef _MSC_VER
-	buf = opdi_encryption_buffer;
-#endif
+	// length prefix, channel and CRC take at least four bytes
+	if (length < 2 + BINARY_CRC_SIZE)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
 
-	pos = 0;
-	blockpos = 0;
-	while (1) {
-		// read the next byte
-		// A receive implementation may send if waiting for a new message
-		result = receive(sendinfo, &byte, message_timeout, (can_send && ((pos == 0) && (blockpos == 0)) ? 1 : 0));
-		// error or disconnected?
-		if (result != OPDI_STATUS_OK)
-			return result;
+	// compare the CRC
+	if (strings_crc16(0xffff, bytes, length - BINARY_CRC_SIZE) != ((bytes[length - 2] << 8) | bytes[length - 1]))
+		return OPDI_ERROR_MALFORMED_MESSAGE;
 
-		// place in buffer
-		buf[blockpos++] = byte;
-		if (pos + blockpos >= OPDI_MESSAGE_BUFFER_SIZE) {
-			// ignore overflowing messages
-			pos = 0;
-			blockpos = 0;
-		} else
-		// block full?
-		if (blockpos >= opdi_encryption_blocksize) {
-			// decrypt the block
-			result = opdi_decrypt_block(msgBuf + pos,  buf);
-			if (result != OPDI_STATUS_OK)
-				// encryption error; can't notify the master because it expects an encrypted message which can't be sent
-				// this is sort of a dilemma here
-				return result;
+	pos = strings_get_varint(bytes, length - BINARY_CRC_SIZE, &bodyLength);
+	if ((pos == 0) || (pos + bodyLength + BINARY_CRC_SIZE != length))
+		return OPDI_ERROR_MALFORMED_MESSAGE;
 
-			pos += opdi_encryption_blocksize;
-			// go through decrypted block
-			for (i = pos - opdi_encryption_blocksize; i < pos; i++) {
-				// is the byte a message terminator?
-				if (msgBuf[i] == MESSAGE_TERMINATOR) {
-					// the message is finished
-					msgBuf[i] = '\0';
-					if (decode(message, msgBuf) == OPDI_STATUS_OK) {
-			        	opdi_debug_msg((const char *)msgBuf, OPDI_DIR_INCOMING_ENCR);
-						return OPDI_STATUS_OK;
-					}
-					// ignore malformed messages
-                    opdi_debug_msg(MESSAGE_MALFORMED, OPDI_DIR_INCOMING_ENCR);
-                    opdi_debug_msg((const char *)msgBuf, OPDI_DIR_INCOMING_ENCR);
-					pos = 0;
-					blockpos = 0;
-					break;
-				}
-			}
-			// start over with next block
-			blockpos = 0;
-		}
-	}
+	// parse the channel number
+	count = strings_get_varint(bytes + pos, bodyLength, &channel);
+	if (count == 0)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+#if (channel_bits == 8)
+	if (channel > 0xff)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+#endif
+	message->channel = (channel_t)channel;
+	pos += count;
+	if (memchr(bytes + pos, '\0', length - BINARY_CRC_SIZE - pos) != NULL)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// the payload is left in place
+	message->payload = (char *)bytes + pos;
+	*end = length - BINARY_CRC_SIZE;
 	return OPDI_STATUS_OK;
 }
 
-// encrypts the bytes in msgBuf and sends them out
-static uint8_t put_encrypted(uint16_t length) {
-#ifdef _MSC_VER
-	// compiler can't handle non-constant-length array on the stack
-	// use implementation-provided buffers
-	uint8_t *buf;
-	uint8_t *destbuf;
-#else
-	// compiler can handle non-constant-length array on the stack
-	uint8_t buf[opdi_encryption_blocksize];
-	uint8_t destbuf[opdi_encryption_blocksize];
-#endif
-	uint16_t block = 0;
-	uint16_t pos;
-	uint16_t i;
-	uint8_t result;
-
-#ifdef _MSC_VER
-	buf = opdi_encryption_buffer;
-	destbuf = opdi_encryption_buffer_2;
-#endif
-
-	while (length > block * opdi_encryption_blocksize) {
-		for (i = 0; i < opdi_encryption_blocksize; i++) {
-			// source position
-			pos = block * opdi_encryption_blocksize + i;
-			if (pos < length)
-				buf[i] = msgBuf[pos];
-			else
-				// pad with random byte which may not be the message terminator
-				do {
-					buf[i] = (uint8_t)rand();
-				} while (buf[i] == MESSAGE_TERMINATOR);
-		}
-		// encrypt the block
-		result = opdi_encrypt_block(destbuf, buf);
-		if (result != OPDI_STATUS_OK)
-			return result;
+/** Completes the binary frame whose channel and payload have been written to msgBuf starting
+*   at bodyStart. Inserts the length prefix before the body and appends the CRC. Returns the
+*   position of the frame in start and its length in length.
+*/
+static uint8_t finish_binary(opdi_Session *session, uint16_t bodyStart, uint16_t end, uint16_t *start, uint16_t *length) {
+	uint16_t bodyLength = end - bodyStart;
+	uint8_t prefixLength = (bodyLength >= 0x80 ? 2 : 1);
+	uint16_t crc;
 
-//		printf("Sending bytes: %02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X%02X\n", destbuf[0], destbuf[1], destbuf[2], destbuf[3], destbuf[4], destbuf[5], destbuf[6], destbuf[7], destbuf[8], destbuf[9], destbuf[10], destbuf[11], destbuf[12], destbuf[13], destbuf[14], destbuf[15]);
+	if (end + 1 + BINARY_CRC_SIZE > OPDI_MESSAGE_BUFFER_SIZE)
+		return OPDI_ERROR_MSGBUF_OVERFLOW;
 
-		// send the block
-		result = send(sendinfo, destbuf, opdi_encryption_blocksize);
-		if (result != OPDI_STATUS_OK)
-			return result;
-		// next block
-		block++;
+	if (bodyStart < prefixLength) {
+		// the length prefix needs two bytes; this is rare for typical messages
+		memmove(session->msgBuf + prefixLength, session->msgBuf + bodyStart, bodyLength);
+		end += prefixLength - bodyStart;
+		bodyStart = prefixLength;
 	}
+	*start = bodyStart - prefixLength;
+	strings_put_varint(bodyLength, session->msgBuf + *start);
 
+	crc = strings_crc16(0xffff, session->msgBuf + *start, end - *start);
+	session->msgBuf[end++] = (uint8_t)(crc >> 8);
+	session->msgBuf[end++] = (uint8_t)crc;
+
+	*length = end - *start;
 	return OPDI_STATUS_OK;
 }
 
-#endif
-
-uint8_t opdi_get_message(opdi_Message *message, uint8_t can_send) {
-	uint8_t msgBuf[OPDI_MESSAGE_BUFFER_SIZE];
-	uint16_t pos = 0;
-	uint8_t result;
-	uint8_t byte;
+/** Encodes the message as a binary frame into msgBuf. Returns the position of the result
+*   in start and its length in length.
+*/
+static uint8_t encode_binary(opdi_Session *session, opdi_Message *message, uint16_t *start, uint16_t *length) {
+	uint16_t pos = 1;
+	uint16_t bytelen = 0;
+	uint8_t err;
 
-#ifndef OPDI_NO_ENCRYPTION
-	// if encryption is on, use it
-	if (encryption)
-		return get_encrypted(message, can_send);
-#endif
+	// leave space for the length prefix
+	pos += strings_put_varint(message->channel, session->msgBuf + pos);
 
-	while (1) {
-		// A receive implementation may send if waiting for a new message (pos == 0)
-		result = receive(sendinfo, &byte, message_timeout, (can_send && (pos == 0) ? 1 : 0));
-		// error or disconnected?
-		if (result != OPDI_STATUS_OK) return result;
+	// transfer payload; leave space for a longer length prefix and the CRC
+	err = opdi_string_to_bytes(message->payload, session->msgBuf, pos, OPDI_MESSAGE_BUFFER_SIZE - 1 - BINARY_CRC_SIZE, &bytelen);
+	if (err != OPDI_STATUS_OK)
+		return err;
+	// the length prefix may need a second byte
+	if (pos + 1 + bytelen + BINARY_CRC_SIZE > session->maxFrame)
+		return OPDI_ERROR_MSGBUF_OVERFLOW;
 
-		// is the byte a message terminator?
-		if (byte == MESSAGE_TERMINATOR) {
-			// the message is finished
-			msgBuf[pos] = '\0';
-			if (decode(message, msgBuf) == OPDI_STATUS_OK) {
-				opdi_debug_msg((const char *)msgBuf, OPDI_DIR_INCOMING);
-				return OPDI_STATUS_OK;
-			}
-			// ignore malformed messages
-			opdi_debug_msg(MESSAGE_MALFORMED, OPDI_DIR_INCOMING);
-			opdi_debug_msg((const char *)msgBuf, OPDI_DIR_INCOMING);
-			pos = 0;
-		} else {
-			msgBuf[pos] = byte;
-			pos++;
-			if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)		// \0 should fit, too
-				// ignore overflowing messages
-				pos = 0;
-		}
-	}
-	return OPDI_STATUS_OK;
+	return finish_binary(session, 1, pos + bytelen, start, length);
 }
 
-uint8_t opdi_put_message(opdi_Message *message) {
-	uint8_t result;
-	uint16_t length = 0;
+#endif
 
-	result = encode(message, &length);
-	if (result != OPDI_STATUS_OK)
-		return result;
+/** Decodes the received frame of length bytes in place. framing is one of the FRAMING_ constants.
+*   On success the payload of message points into the frame and is terminated there; it remains valid
+*   until the frame is overwritten by the next received message. Malformed frames are traced and
+*   an error code is returned.
+*/
+static uint8_t decode_frame(opdi_Message *message, uint8_t *frame, uint16_t length, uint8_t direction, uint8_t framing) {
+	uint16_t end = 0;
+	uint8_t result;
 
-	// for debug output, do not use terminating \n
-	msgBuf[length - 1] = '\0';
-#ifndef OPDI_NO_ENCRYPTION
-        if (encryption)
-                opdi_debug_msg((const char *)msgBuf, OPDI_DIR_OUTGOING_ENCR);
+#ifdef OPDI_BINARY_FRAMING
+	if (framing == FRAMING_BINARY)
+		result = decode_binary(message, frame, length, &end);
 	else
 #endif
-	opdi_debug_msg((const char *)msgBuf, OPDI_DIR_OUTGOING);
-	msgBuf[length - 1] = '\n';
-
-#ifndef OPDI_NO_ENCRYPTION
-	// if encryption is on, use it
-	if (encryption)
-		return put_encrypted(length);
+#ifdef OPDI_CRC32C
+	if (framing == FRAMING_CRC32C)
+		result = decode_crc32c(message, frame, length, &end);
+	else
 #endif
-
-	result = send(sendinfo, msgBuf, length);
-	if (result != OPDI_STATUS_OK)
+	result = decode(message, frame, length, &end);
+	if (result != OPDI_STATUS_OK) {
+		TRACE_FRAME(OPDI_TRACE_ERRORS, direction | OPDI_TRACE_MALFORMED, frame, length, framing == FRAMING_BINARY);
 		return result;
+	}
+	TRACE_FRAME(OPDI_TRACE_MESSAGES, direction, frame, length, framing == FRAMING_BINARY);
 
+	// terminate the payload; this overwrites the checksum separator or the CRC
+	frame[end] = '\0';
 	return OPDI_STATUS_OK;
 }
 
-#ifndef OPDI_NO_ENCRYPTION
+static uint8_t put_encoded(opdi_Session *session, uint8_t *frame, uint16_t length);
 
-uint8_t opdi_set_encryption(uint8_t enabled) {
-	encryption = enabled;
-	return OPDI_STATUS_OK;
-}
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+
+/** Sends the message content in msgBuf up to pos as a fragment that is continued by the next message.
+*   The content starts with the header (the channel); slot is the position of the fragment header
+*   after it. Afterwards the payload of the next fragment can be written at pos, behind the same header.
+*/
+static uint8_t put_fragment(opdi_Session *session, uint16_t slot, uint16_t *pos, uint16_t *checksum, uint16_t headerSum) {
+	uint16_t start = 0;
+	uint16_t length;
+	uint8_t result;
+
+	session->msgBuf[slot] = OPDI_FRAGMENT_MARKER;
+#ifdef OPDI_BINARY_FRAMING
+	if (session->binary) {
+		// the length prefix goes into the two bytes before the header
+		result = finish_binary(session, 2, *pos, &start, &length);
+		if (result != OPDI_STATUS_OK)
+			return result;
+	} else
+#endif
+	length = finish_text(session, 0, *pos, *checksum + (uint8_t)OPDI_FRAGMENT_MARKER);
+
+	result = put_encoded(session, session->msgBuf + start, length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	*pos = slot + 1;
+	*checksum = headerSum;
+	return OPDI_STATUS_OK;
+}
+
+// appends a byte to the message content in msgBuf; leaves space for checksum and terminator
+// if a fragment header slot has been reserved, the content is sent as a fragment when the buffer is full
+#define PUT_CONTENT_BYTE(b) \
+	if (pos >= limit) { \
+		if (slot == 0) \
+			return OPDI_ERROR_MSGBUF_OVERFLOW; \
+		result = put_fragment(session, slot, &pos, &checksum, headerSum); \
+		if (result != OPDI_STATUS_OK) \
+			return result; \
+	} \
+	session->msgBuf[pos++] = (b); \
+	checksum += (b);
+
+#else
+
+// appends a byte to the message content in msgBuf; leaves space for checksum and terminator
+#define PUT_CONTENT_BYTE(b) \
+	if (pos >= limit) \
+		return OPDI_ERROR_MSGBUF_OVERFLOW; \
+	session->msgBuf[pos++] = (b); \
+	checksum += (b);
+
+#endif
+
+/** Encodes a message with the given parts as payload into msgBuf. Works like strings_join
+*   followed by encode, but writes the channel, the parts, the escaped separators and the
+*   checksum in a single pass. If item is not NULL, up to count items are appended as one more part
+*   in which they are separated by commas (see opdi_put_items).
+*   If fragmentation is enabled, a slot for the fragment header is reserved after the channel;
+*   if the content does not fit into msgBuf, the preceding content is sent as a fragment.
+*   Returns the position of the result in start and its length in length.
+*/
+static uint8_t encode_parts(opdi_Session *session, channel_t channel, const char **parts, opdi_ListItem item, void *context, uint16_t count, uint16_t *start, uint16_t *length) {
+	char channelBuf[CHANNEL_STRBUF];
+	uint16_t pos = 0;
+	// the end of the content; leaves space for the trailer within the frame length
+	uint16_t limit = session->maxFrame - TRAILER_SIZE(session);
+	uint16_t checksum = 0;
+	const char *part;
+	uint8_t i;
+	uint16_t j;
+	uint8_t byte;
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	uint16_t slot = 0;
+	uint16_t headerSum = 0;
+	uint8_t result;
+#endif
+
+	*start = 0;
+
+#ifdef OPDI_BINARY_FRAMING
+	if (session->binary) {
+		// leave space for the length prefix and write the channel number
+		pos = (FRAGMENTATION(session) ? 2 : 1);
+		pos += strings_put_varint(channel, session->msgBuf + pos);
+	} else {
+#endif
+	// write the channel number
+#if (channel_bits == 8)
+	opdi_uint8_to_str(channel, channelBuf);
+#elif (channel_bits == 16)
+	opdi_uint16_to_str(channel, channelBuf);
+#else
+#error "Not implemented; unable to convert channel string to numeric value"
+#endif
+	for (part = channelBuf; *part; part++) {
+		PUT_CONTENT_BYTE((uint8_t)*part);
+	}
+	PUT_CONTENT_BYTE(MESSAGE_SEPARATOR);
+#ifdef OPDI_BINARY_FRAMING
+	}
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	if (session->fragmentation) {
+		// reserve the slot for the fragment header
+		slot = pos++;
+		headerSum = checksum;
+	}
+#endif
+
+	// write the parts; supports only single-byte character sets
+	for (i = 0; parts[i] != NULL; i++) {
+		if (i > 0) {
+			PUT_CONTENT_BYTE(MESSAGE_SEPARATOR);
+		}
+		part = parts[i];
+		// empty parts are encoded as a blank
+		if (*part == '\0') {
+			PUT_CONTENT_BYTE(' ');
+		}
+		for (; *part; part++) {
+			byte = (uint8_t)*part;
+			// check: terminator may not occur in text frames
+			if ((byte == MESSAGE_TERMINATOR) && !IS_BINARY(session))
+				return OPDI_TERMINATOR_IN_PAYLOAD;
+			PUT_CONTENT_BYTE(byte);
+			// escape separators
+			if (byte == MESSAGE_SEPARATOR) {
+				PUT_CONTENT_BYTE(byte);
+			}
+		}
+	}
+
+	// write the list of items as the last part
+	if (item != NULL) {
+		if (i > 0) {
+			PUT_CONTENT_BYTE(MESSAGE_SEPARATOR);
+		}
+		for (j = 0; j < count; j++) {
+			part = item(context, j);
+			if (part == NULL)
+				break;
+			if (j > 0) {
+				PUT_CONTENT_BYTE(LIST_SEPARATOR);
+			}
+			// empty items are encoded as a blank
+			if (*part == '\0') {
+				PUT_CONTENT_BYTE(' ');
+			}
+			for (; *part; part++) {
+				byte = (uint8_t)*part;
+				if ((byte == MESSAGE_TERMINATOR) && !IS_BINARY(session))
+					return OPDI_TERMINATOR_IN_PAYLOAD;
+				PUT_CONTENT_BYTE(byte);
+				// escape item and part separators
+				if ((byte == LIST_SEPARATOR) || (byte == MESSAGE_SEPARATOR)) {
+					PUT_CONTENT_BYTE(byte);
+				}
+			}
+		}
+		// an empty list is encoded as a blank
+		if (j == 0) {
+			PUT_CONTENT_BYTE(' ');
+		}
+	}
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	if (slot > 0) {
+		// the message is complete without fragment header; move the header to close the slot
+#ifdef OPDI_BINARY_FRAMING
+		if (session->binary) {
+			memmove(session->msgBuf + 3, session->msgBuf + 2, slot - 2);
+			return finish_binary(session, 3, pos, start, length);
+		}
+#endif
+		memmove(session->msgBuf + 1, session->msgBuf, slot);
+		*start = 1;
+	}
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+	if (session->binary)
+		return finish_binary(session, 1, pos, start, length);
+#endif
+
+	// checksum separator and characters
+	*length = finish_text(session, *start, pos, checksum) - *start;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_message_setup(opdi_Session *session, func_receive recv, func_send snd, void *info) {
+#ifdef OPDI_SESSION_KEYS
+	// the session key of a previous connection has been released by opdi_message_cleanup
+	session->cipher = NULL;
+#endif
+#ifndef OPDI_NO_ENCRYPTION
+	// if encryption is used, switch it off
+	opdi_set_encryption(session, OPDI_DONT_USE_ENCRYPTION);
+#endif
+	session->receive = recv;
+	session->send = snd;
+	session->info = info;
+	session->message_timeout = OPDI_DEFAULT_MESSAGE_TIMEOUT;
+	// the master has not announced its frame length yet
+	session->maxFrame = (OPDI_MAX_FRAME_SIZE < OPDI_DEFAULT_FRAME_SIZE ? OPDI_MAX_FRAME_SIZE : OPDI_DEFAULT_FRAME_SIZE);
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+	session->receive_bulk = NULL;
+	session->rxPos = 0;
+	session->rxLen = 0;
+#endif
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	session->multimessage = 0;
+	session->collecting = 0;
+	session->frameLen = 0;
+#endif
+#ifdef OPDI_BINARY_FRAMING
+	session->binary = 0;
+#endif
+#ifdef OPDI_CRC32C
+	session->crc32c = 0;
+#endif
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+	session->buffering = 0;
+	session->outLen = 0;
+#endif
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	session->fragmentation = 0;
+#endif
+#if (OPDI_STREAMING_PORTS > 0)
+	session->portBindCount = 0;
+#endif
+	return OPDI_STATUS_OK;
+}
+
+void opdi_message_cleanup(opdi_Session *session) {
+#ifndef OPDI_NO_ENCRYPTION
+	session->encryption = OPDI_DONT_USE_ENCRYPTION;
+#ifdef OPDI_SESSION_KEYS
+	opdi_cipher_free(session->cipher);
+	session->cipher = NULL;
+#endif
+#ifdef OPDI_ENCRYPTION_CTR
+	wipe(session->ctrNonce, sizeof(session->ctrNonce));
+	wipe(session->ctrPeerNonce, sizeof(session->ctrPeerNonce));
+	wipe(&session->ksIn, sizeof(session->ksIn));
+	wipe(&session->ksOut, sizeof(session->ksOut));
+	wipe(session->keyBuf, sizeof(session->keyBuf));
+#endif
+#ifdef OPDI_ENCRYPTION_GCM
+	// the tables are derived from the hash key
+	wipe(session->gcmTableHigh, sizeof(session->gcmTableHigh));
+	wipe(session->gcmTableLow, sizeof(session->gcmTableLow));
+#endif
+#endif
+}
+
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+
+/** Sends the bytes in the output buffer. more specifies whether more bytes of the same reply follow.
+*/
+static uint8_t flush_output(opdi_Session *session, uint8_t more) {
+	uint16_t length = session->outLen;
+
+	if (length == 0)
+		return OPDI_STATUS_OK;
+	session->outLen = 0;
+
+	return session->send(session->info, session->outBuf, length, more);
+}
+
+#endif
+
+/** Sends the bytes, or appends them to the output buffer if outgoing bytes are being collected.
+*/
+static uint8_t send_bytes(opdi_Session *session, uint8_t *bytes, uint16_t length) {
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+	uint8_t result;
+
+	if (session->buffering) {
+		if (session->outLen + length > OPDI_OUTPUT_BUFFER_SIZE) {
+			result = flush_output(session, 1);
+			if (result != OPDI_STATUS_OK)
+				return result;
+		}
+		if (length <= OPDI_OUTPUT_BUFFER_SIZE) {
+			memcpy(session->outBuf + session->outLen, bytes, length);
+			session->outLen += length;
+			return OPDI_STATUS_OK;
+		}
+		// too large for the buffer; send directly
+		return session->send(session->info, bytes, length, 1);
+	}
+#endif
+	return session->send(session->info, bytes, length, 0);
+}
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+
+uint8_t opdi_message_set_bulk_receive(opdi_Session *session, func_receive_bulk recv_bulk) {
+	session->receive_bulk = recv_bulk;
+	return OPDI_STATUS_OK;
+}
+
+/** Makes sure that there are unconsumed bytes in rxBuf. Blocks until bytes are available.
+*/
+static uint8_t fill_receive_buffer(opdi_Session *session, uint8_t can_send) {
+	uint8_t result;
+
+	if (session->rxPos < session->rxLen)
+		return OPDI_STATUS_OK;
+
+	session->rxPos = 0;
+	session->rxLen = 0;
+	result = session->receive_bulk(session->info, session->rxBuf, OPDI_RECEIVE_BUFFER_SIZE, &session->rxLen, session->message_timeout, can_send);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	// an implementation should not return without data
+	if (session->rxLen == 0)
+		return OPDI_TIMEOUT;
+	return OPDI_STATUS_OK;
+}
+
+/** Receives a message using the bulk receive function. The chunks are scanned for the
+*   terminator in rxBuf; remaining bytes are kept for the next message.
+*   A message that has been received completely in one chunk is decoded in rxBuf; otherwise
+*   its parts are collected in inBuf.
+*/
+static uint8_t get_buffered(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint16_t pos = 0;
+	uint8_t overflow = 0;
+	uint8_t result;
+	uint8_t *start;
+	uint8_t *end;
+	uint16_t count;
+
+	while (1) {
+		// A receive implementation may send if waiting for a new message (pos == 0)
+		result = fill_receive_buffer(session, can_send && (pos == 0) && !overflow ? 1 : 0);
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK) return result;
+
+		// look for the message terminator in the available bytes
+		start = session->rxBuf + session->rxPos;
+		end = (uint8_t *)memchr(start, MESSAGE_TERMINATOR, session->rxLen - session->rxPos);
+		count = (end == NULL ? session->rxLen - session->rxPos : (uint16_t)(end - start));
+
+		if ((end != NULL) && (pos == 0) && !overflow && (count < OPDI_MESSAGE_BUFFER_SIZE - 1)) {
+			// the message is complete in rxBuf; consume it including the terminator
+			session->rxPos += count + 1;
+			*end = '\0';
+			if (decode_frame(message, start, count, OPDI_DIR_INCOMING, TEXT_FRAMING(session)) == OPDI_STATUS_OK)
+				return OPDI_STATUS_OK;
+			// ignore malformed messages
+			continue;
+		}
+
+		if (!overflow) {
+			if (pos + count >= OPDI_MESSAGE_BUFFER_SIZE - 1)		// \0 should fit, too
+				// ignore overflowing messages
+				overflow = 1;
+			else {
+				memcpy(session->inBuf + pos, start, count);
+				pos += count;
+			}
+		}
+
+		if (end == NULL) {
+			// all available bytes consumed
+			session->rxPos = session->rxLen;
+			continue;
+		}
+		// consume the terminator, too
+		session->rxPos += count + 1;
+
+		if (overflow) {
+			// start over with the next message
+			overflow = 0;
+			pos = 0;
+			continue;
+		}
+
+		// the message is finished
+		session->inBuf[pos] = '\0';
+		if (decode_frame(message, session->inBuf, pos, OPDI_DIR_INCOMING, TEXT_FRAMING(session)) == OPDI_STATUS_OK)
+			return OPDI_STATUS_OK;
+		// ignore malformed messages
+		pos = 0;
+	}
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_BINARY_FRAMING
+
+/** Returns the binary frame at the start of the unconsumed bytes in rxBuf and consumes it.
+*   Returns NULL if the frame has not been received completely or is too long.
+*/
+static uint8_t *take_binary_frame(opdi_Session *session, uint16_t *length) {
+	uint8_t *start = session->rxBuf + session->rxPos;
+	uint16_t available = session->rxLen - session->rxPos;
+	uint16_t bodyLength;
+	uint8_t count;
+
+	count = strings_get_varint(start, available, &bodyLength);
+	if ((count == 0) || ((uint32_t)count + bodyLength + BINARY_CRC_SIZE > available) || (count + bodyLength + BINARY_CRC_SIZE > OPDI_MESSAGE_BUFFER_SIZE))
+		return NULL;
+	*length = count + bodyLength + BINARY_CRC_SIZE;
+	session->rxPos += *length;
+	return start;
+}
+
+#endif
+
+#endif
+
+#if !defined(OPDI_NO_ENCRYPTION) || defined(OPDI_BINARY_FRAMING)
+
+/** Reads at least one and at most count bytes into dest. Returns the number of bytes in received.
+*/
+static uint8_t receive_bytes(opdi_Session *session, uint8_t *dest, uint16_t count, uint16_t *received, uint8_t can_send) {
+	uint8_t result;
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+	if (session->receive_bulk != NULL) {
+		result = fill_receive_buffer(session, can_send);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		if (count > session->rxLen - session->rxPos)
+			count = session->rxLen - session->rxPos;
+		memcpy(dest, session->rxBuf + session->rxPos, count);
+		session->rxPos += count;
+		*received = count;
+		return OPDI_STATUS_OK;
+	}
+#endif
+
+	result = session->receive(session->info, dest, session->message_timeout, can_send);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	*received = 1;
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+
+/** Receives a binary frame. The length prefix is read first; the rest of the frame is then
+*   read with as few calls of the receive function as possible.
+*   A frame that is available completely in rxBuf is decoded there; otherwise it is collected in inBuf.
+*/
+static uint8_t get_binary(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint8_t *frame;
+	uint16_t pos = 0;
+	uint16_t frameLength = 0;		// is known when the length prefix is complete
+	uint32_t skip = 0;				// remaining bytes of an overflowing frame
+	uint16_t bodyLength;
+	uint16_t received;
+	uint8_t count;
+	uint8_t result;
+
+	while (1) {
+		if (skip > 0) {
+			// ignore overflowing messages
+			result = receive_bytes(session, session->inBuf, (skip < OPDI_MESSAGE_BUFFER_SIZE ? (uint16_t)skip : OPDI_MESSAGE_BUFFER_SIZE), &received, 0);
+			if (result != OPDI_STATUS_OK) return result;
+			skip -= received;
+			continue;
+		}
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+		if ((session->receive_bulk != NULL) && (pos == 0)) {
+			// A receive implementation may send if waiting for a new message
+			result = fill_receive_buffer(session, can_send);
+			if (result != OPDI_STATUS_OK) return result;
+			frame = take_binary_frame(session, &frameLength);
+			if (frame != NULL) {
+				if (decode_frame(message, frame, frameLength, OPDI_DIR_INCOMING, FRAMING_BINARY) == OPDI_STATUS_OK)
+					return OPDI_STATUS_OK;
+				// ignore malformed messages
+				frameLength = 0;
+				continue;
+			}
+		}
+#endif
+		// A receive implementation may send if waiting for a new message (pos == 0)
+		result = receive_bytes(session, session->inBuf + pos, (frameLength == 0 ? 1 : frameLength - pos), &received, (can_send && (pos == 0) ? 1 : 0));
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK) return result;
+		pos += received;
+
+		if (frameLength == 0) {
+			// length prefix complete?
+			count = strings_get_varint(session->inBuf, pos, &bodyLength);
+			if (count == 0) {
+				if (pos >= 3) {
+					// invalid length prefix
+					TRACE_FRAME(OPDI_TRACE_ERRORS, OPDI_DIR_INCOMING | OPDI_TRACE_MALFORMED, session->inBuf, pos, 0);
+					pos = 0;
+				}
+				continue;
+			}
+			if (count + bodyLength + BINARY_CRC_SIZE > OPDI_MESSAGE_BUFFER_SIZE) {
+				skip = (uint32_t)bodyLength + BINARY_CRC_SIZE;
+				pos = 0;
+				continue;
+			}
+			frameLength = count + bodyLength + BINARY_CRC_SIZE;
+		}
+		if (pos < frameLength)
+			continue;
+
+		// the frame is complete
+		if (decode_frame(message, session->inBuf, frameLength, OPDI_DIR_INCOMING, FRAMING_BINARY) == OPDI_STATUS_OK)
+			return OPDI_STATUS_OK;
+		// ignore malformed messages
+		pos = 0;
+		frameLength = 0;
+	}
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
+
+#ifdef OPDI_ENCRYPTION_CTR
+
+/** Combines the bytes with the key stream ks. The key stream consists of the encrypted counter blocks;
+*   as many counter blocks as fit into keyBuf are encrypted with one call. The unused rest of the last
+*   block is kept for the next call.
+*/
+static uint8_t apply_key_stream(opdi_Session *session, opdi_KeyStream *ks, uint8_t *bytes, uint16_t length) {
+	uint16_t blocks;
+	uint16_t count;
+	uint16_t i;
+	uint8_t *counter;
+	uint8_t result;
+
+	// use the rest of the current block
+	while ((length > 0) && (ks->used < OPDI_ENCRYPTION_BLOCKSIZE)) {
+		*bytes++ ^= ks->block[ks->used++];
+		length--;
+	}
+
+	while (length > 0) {
+		blocks = (length + OPDI_ENCRYPTION_BLOCKSIZE - 1) / OPDI_ENCRYPTION_BLOCKSIZE;
+		if (blocks > OPDI_CIPHER_BUFFER_SIZE / OPDI_ENCRYPTION_BLOCKSIZE)
+			blocks = OPDI_CIPHER_BUFFER_SIZE / OPDI_ENCRYPTION_BLOCKSIZE;
+		for (i = 0; i < blocks; i++) {
+			counter = session->keyBuf + i * OPDI_ENCRYPTION_BLOCKSIZE;
+			memcpy(counter, ks->prefix, OPDI_ENCRYPTION_BLOCKSIZE - 4);
+			counter[OPDI_ENCRYPTION_BLOCKSIZE - 4] = (uint8_t)(ks->counter >> 24);
+			counter[OPDI_ENCRYPTION_BLOCKSIZE - 3] = (uint8_t)(ks->counter >> 16);
+			counter[OPDI_ENCRYPTION_BLOCKSIZE - 2] = (uint8_t)(ks->counter >> 8);
+			counter[OPDI_ENCRYPTION_BLOCKSIZE - 1] = (uint8_t)ks->counter;
+			ks->counter++;
+		}
+		result = ENCRYPT_BLOCKS(session, session->keyBuf, session->keyBuf, blocks);
+		if (result != OPDI_STATUS_OK)
+			return result;
+
+		count = blocks * OPDI_ENCRYPTION_BLOCKSIZE;
+		if (count > length) {
+			// keep the rest of the last block
+			count = length;
+			memcpy(ks->block, session->keyBuf + (blocks - 1) * OPDI_ENCRYPTION_BLOCKSIZE, OPDI_ENCRYPTION_BLOCKSIZE);
+			ks->used = count - (blocks - 1) * OPDI_ENCRYPTION_BLOCKSIZE;
+		}
+		for (i = 0; i < count; i++)
+			bytes[i] ^= session->keyBuf[i];
+		bytes += count;
+		length -= count;
+	}
+	return OPDI_STATUS_OK;
+}
+
+/** Writes the nonce of the counter blocks to the prefix: the combination of the nonces of both sides.
+*/
+static void set_prefix_nonce(opdi_Session *session, opdi_KeyStream *ks) {
+	uint8_t i;
+
+	for (i = 0; i < OPDI_CTR_NONCE_SIZE; i++)
+		ks->prefix[i] = session->ctrNonce[i] ^ session->ctrPeerNonce[i];
+}
+
+/** Starts the key stream of one direction at the first counter block. The prefix of the
+*   counter blocks consists of the nonce and the direction.
+*/
+static void reset_key_stream(opdi_Session *session, opdi_KeyStream *ks, uint8_t direction) {
+	memset(ks->prefix, 0, sizeof(ks->prefix));
+	set_prefix_nonce(session, ks);
+	ks->prefix[OPDI_CTR_NONCE_SIZE] = direction;
+	ks->counter = 0;
+	ks->used = OPDI_ENCRYPTION_BLOCKSIZE;
+}
+
+#endif
+
+#ifdef OPDI_ENCRYPTION_GCM
+
+// the reduction constants of the 4 bit GHASH multiplication
+static const uint16_t ghash_last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/** Calculates the GHASH tables of the session from the hash key (the encrypted zero block).
+*/
+static uint8_t prepare_ghash(opdi_Session *session) {
+	uint8_t key[OPDI_ENCRYPTION_BLOCKSIZE];
+	uint64_t high = 0;
+	uint64_t low = 0;
+	uint32_t t;
+	uint8_t i;
+	uint8_t j;
+	uint8_t result;
+
+	memset(key, 0, sizeof(key));
+	result = ENCRYPT_BLOCKS(session, key, key, 1);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	for (i = 0; i < 8; i++) {
+		high = (high << 8) | key[i];
+		low = (low << 8) | key[i + 8];
+	}
+	wipe(key, sizeof(key));
+
+	// the table entry for the bit pattern 1000 is the key itself
+	session->gcmTableHigh[0] = 0;
+	session->gcmTableLow[0] = 0;
+	session->gcmTableHigh[8] = high;
+	session->gcmTableLow[8] = low;
+	for (i = 4; i > 0; i >>= 1) {
+		t = (uint32_t)(low & 1) * 0xe1000000UL;
+		low = (high << 63) | (low >> 1);
+		high = (high >> 1) ^ ((uint64_t)t << 32);
+		session->gcmTableHigh[i] = high;
+		session->gcmTableLow[i] = low;
+	}
+	for (i = 2; i <= 8; i *= 2) {
+		for (j = 1; j < i; j++) {
+			session->gcmTableHigh[i + j] = session->gcmTableHigh[i] ^ session->gcmTableHigh[j];
+			session->gcmTableLow[i + j] = session->gcmTableLow[i] ^ session->gcmTableLow[j];
+		}
+	}
+	return OPDI_STATUS_OK;
+}
+
+/** Multiplies the hash value y with the hash key in GF(2^128).
+*/
+static void ghash_multiply(opdi_Session *session, uint8_t *y) {
+	uint64_t high;
+	uint64_t low;
+	uint8_t nibble;
+	uint8_t rem;
+	int8_t i;
+
+	nibble = y[15] & 0x0f;
+	high = session->gcmTableHigh[nibble];
+	low = session->gcmTableLow[nibble];
+	for (i = 15; i >= 0; i--) {
+		if (i != 15) {
+			nibble = y[i] & 0x0f;
+			rem = (uint8_t)(low & 0x0f);
+			low = (high << 60) | (low >> 4);
+			high = (high >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+			high ^= session->gcmTableHigh[nibble];
+			low ^= session->gcmTableLow[nibble];
+		}
+		nibble = y[i] >> 4;
+		rem = (uint8_t)(low & 0x0f);
+		low = (high << 60) | (low >> 4);
+		high = (high >> 4) ^ ((uint64_t)ghash_last4[rem] << 48);
+		high ^= session->gcmTableHigh[nibble];
+		low ^= session->gcmTableLow[nibble];
+	}
+	for (i = 7; i >= 0; i--) {
+		y[i] = (uint8_t)high;
+		y[i + 8] = (uint8_t)low;
+		high >>= 8;
+		low >>= 8;
+	}
+}
+
+/** Adds the bytes to the hash value y. The last block is padded with zeros.
+*/
+static void ghash_update(opdi_Session *session, uint8_t *y, const uint8_t *bytes, uint16_t length) {
+	uint16_t count;
+	uint16_t i;
+
+	while (length > 0) {
+		count = (length > OPDI_ENCRYPTION_BLOCKSIZE ? OPDI_ENCRYPTION_BLOCKSIZE : length);
+		for (i = 0; i < count; i++)
+			y[i] ^= bytes[i];
+		ghash_multiply(session, y);
+		bytes += count;
+		length -= count;
+	}
+}
+
+/** Starts the key stream of a record. The prefix of the counter blocks consists of the nonce and the
+*   record number; the direction is stored in the highest bit of the record number. Writes the encrypted
+*   first counter block, which masks the authentication tag, to tag.
+*/
+static uint8_t start_record(opdi_Session *session, opdi_KeyStream *ks, uint8_t direction, uint32_t *count, uint8_t *tag) {
+	uint32_t number = *count;
+
+	// a record number must not be used twice
+	if (number >= GCM_MAX_RECORDS)
+		return OPDI_ENCRYPTION_ERROR;
+	(*count)++;
+	if (direction == OPDI_DIR_OUTGOING)
+		number |= GCM_MAX_RECORDS;
+
+	set_prefix_nonce(session, ks);
+	ks->prefix[OPDI_CTR_NONCE_SIZE] = (uint8_t)(number >> 24);
+	ks->prefix[OPDI_CTR_NONCE_SIZE + 1] = (uint8_t)(number >> 16);
+	ks->prefix[OPDI_CTR_NONCE_SIZE + 2] = (uint8_t)(number >> 8);
+	ks->prefix[OPDI_CTR_NONCE_SIZE + 3] = (uint8_t)number;
+	ks->counter = 1;
+	ks->used = OPDI_ENCRYPTION_BLOCKSIZE;
+
+	memset(tag, 0, OPDI_GCM_TAG_SIZE);
+	return apply_key_stream(session, ks, tag, OPDI_GCM_TAG_SIZE);
+}
+
+/** Adds the authentication tag of the record with the given header and encrypted message to tag.
+*/
+static void authenticate_record(opdi_Session *session, const uint8_t *header, const uint8_t *bytes, uint16_t length, uint8_t *tag) {
+	uint8_t y[OPDI_ENCRYPTION_BLOCKSIZE];
+	uint8_t i;
+
+	memset(y, 0, sizeof(y));
+	ghash_update(session, y, header, OPDI_GCM_HEADER_SIZE);
+	ghash_update(session, y, bytes, length);
+
+	// the lengths of the header and of the message in bits
+	y[6] ^= (uint8_t)((OPDI_GCM_HEADER_SIZE * 8) >> 8);
+	y[7] ^= (uint8_t)(OPDI_GCM_HEADER_SIZE * 8);
+	y[13] ^= (uint8_t)(length >> 13);
+	y[14] ^= (uint8_t)(length >> 5);
+	y[15] ^= (uint8_t)(length << 3);
+	ghash_multiply(session, y);
+
+	for (i = 0; i < OPDI_GCM_TAG_SIZE; i++)
+		tag[i] ^= y[i];
+}
+
+/** Decodes the content of a record ("channel:payload" without checksum and terminator) of length bytes
+*   in place. The payload of message points into bytes.
+*/
+static uint8_t decode_record(opdi_Message *message, uint8_t bytes[], uint16_t length) {
+	char channelBuf[CHANNEL_MAXBUF + 1] = {'\0'};
+	uint8_t *separator;
+
+	separator = (uint8_t *)memchr(bytes, MESSAGE_SEPARATOR, (length < CHANNEL_MAXBUF ? length : CHANNEL_MAXBUF));
+	if (separator == NULL)
+		// separator not detected within the first few characters
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// parse the channel number
+	memcpy(channelBuf, bytes, separator - bytes);
+	if (opdi_str_to_uint16(channelBuf, &(message->channel)) != OPDI_STATUS_OK)
+		return OPDI_ERROR_MALFORMED_MESSAGE;
+
+	// the payload is left in place
+	bytes[length] = '\0';
+	message->payload = (char *)separator + 1;
+	return OPDI_STATUS_OK;
+}
+
+/** Reads exactly count bytes into dest.
+*/
+static uint8_t receive_all(opdi_Session *session, uint8_t *dest, uint16_t count, uint8_t can_send) {
+	uint16_t received;
+	uint8_t result;
+
+	while (count > 0) {
+		result = receive_bytes(session, dest, count, &received, can_send);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		dest += received;
+		count -= received;
+		can_send = 0;
+	}
+	return OPDI_STATUS_OK;
+}
+
+/** Receives a record in Galois/counter mode: the header with the length of the encrypted message,
+*   the encrypted message and the authentication tag. The message is decrypted in inBuf after the tag
+*   has been verified. Records that can't be authenticated are ignored.
+*/
+static uint8_t get_record(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint8_t header[OPDI_GCM_HEADER_SIZE];
+	uint8_t tag[OPDI_GCM_TAG_SIZE];
+	uint8_t expected[OPDI_GCM_TAG_SIZE];
+	uint32_t skip;
+	uint16_t length;
+	uint8_t difference;
+	uint8_t i;
+	uint8_t result;
+
+	while (1) {
+		// A receive implementation may send if waiting for a new message
+		result = receive_all(session, header, OPDI_GCM_HEADER_SIZE, can_send);
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK)
+			return result;
+		length = (header[0] << 8) | header[1];
+
+		result = start_record(session, &session->ksIn, OPDI_DIR_INCOMING, &session->gcmInCount, expected);
+		if (result != OPDI_STATUS_OK)
+			return result;
+
+		if (length >= OPDI_MESSAGE_BUFFER_SIZE) {
+			// ignore overflowing messages
+			for (skip = (uint32_t)length + OPDI_GCM_TAG_SIZE; skip > 0; skip -= length) {
+				length = (skip < OPDI_MESSAGE_BUFFER_SIZE ? (uint16_t)skip : OPDI_MESSAGE_BUFFER_SIZE);
+				result = receive_all(session, session->inBuf, length, 0);
+				if (result != OPDI_STATUS_OK)
+					return result;
+			}
+			continue;
+		}
+
+		result = receive_all(session, session->inBuf, length, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		result = receive_all(session, tag, OPDI_GCM_TAG_SIZE, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+
+		// compare the tags in constant time
+		authenticate_record(session, header, session->inBuf, length, expected);
+		difference = 0;
+		for (i = 0; i < OPDI_GCM_TAG_SIZE; i++)
+			difference |= tag[i] ^ expected[i];
+		if (difference != 0) {
+			// ignore forged or damaged messages
+			TRACE_FRAME(OPDI_TRACE_ERRORS, OPDI_DIR_INCOMING_ENCR | OPDI_TRACE_MALFORMED, session->inBuf, length, 0);
+			continue;
+		}
+
+		result = apply_key_stream(session, &session->ksIn, session->inBuf, length);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		if (decode_record(message, session->inBuf, length) == OPDI_STATUS_OK) {
+			TRACE_FRAME(OPDI_TRACE_MESSAGES, OPDI_DIR_INCOMING_ENCR, session->inBuf, length, 0);
+			return OPDI_STATUS_OK;
+		}
+		// ignore malformed messages
+		TRACE_FRAME(OPDI_TRACE_ERRORS, OPDI_DIR_INCOMING_ENCR | OPDI_TRACE_MALFORMED, session->inBuf, length, 0);
+	}
+	return OPDI_STATUS_OK;
+}
+
+/** Sends the text message as a record in Galois/counter mode. The authentication tag replaces
+*   the checksum and the terminator of the message; the record is sent with one write.
+*/
+static uint8_t put_record(opdi_Session *session, const uint8_t *bytes, uint16_t length) {
+	uint8_t *message = session->cipherOut + OPDI_GCM_HEADER_SIZE;
+	uint8_t result;
+
+	if ((length < TEXT_TRAILER_SIZE) || (length - TEXT_TRAILER_SIZE > OPDI_CIPHER_BUFFER_SIZE))
+		return OPDI_ERROR_MSGBUF_OVERFLOW;
+	length -= TEXT_TRAILER_SIZE;
+
+	session->cipherOut[0] = (uint8_t)(length >> 8);
+	session->cipherOut[1] = (uint8_t)length;
+	memcpy(message, bytes, length);
+
+	result = start_record(session, &session->ksOut, OPDI_DIR_OUTGOING, &session->gcmOutCount, message + length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	result = apply_key_stream(session, &session->ksOut, message, length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	authenticate_record(session, session->cipherOut, message, length, message + length);
+
+	return send_bytes(session, session->cipherOut, OPDI_GCM_HEADER_SIZE + length + OPDI_GCM_TAG_SIZE);
+}
+
+#endif
+
+/** Receives an encrypted message. All complete blocks of a received chunk are decrypted with one call.
+*   Blocks that follow the block with the terminator belong to the next message; they are kept in inBuf
+*   (decrypted) and in cipherIn until the next call.
+*   In counter mode the bytes are decrypted where they are received and messages are not padded.
+*/
+static uint8_t get_encrypted(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint16_t pos = 0;		// number of decrypted bytes in inBuf
+	uint16_t scanned = 0;	// number of decrypted bytes that don't contain the terminator
+	uint16_t space;
+	uint16_t blocks;
+	uint16_t next;
+	uint16_t received;
+	uint16_t unit = (IS_CTR(session) ? 1 : OPDI_ENCRYPTION_BLOCKSIZE);
+	uint8_t *end;
+	uint8_t result;
+
+	// blocks of this message may have been decrypted together with the previous message
+	if (session->plainNextLen > 0) {
+		memmove(session->inBuf, session->inBuf + session->plainNext, session->plainNextLen);
+		pos = session->plainNextLen;
+		session->plainNextLen = 0;
+	}
+
+	while (1) {
+		end = (uint8_t *)memchr(session->inBuf + scanned, MESSAGE_TERMINATOR, pos - scanned);
+		if (end != NULL) {
+			// the rest of the block is padding; the next message starts with the following block
+			next = ((uint16_t)(end - session->inBuf) / unit + 1) * unit;
+			session->plainNext = next;
+			session->plainNextLen = pos - next;
+			// the message is finished
+			*end = '\0';
+			if (decode_frame(message, session->inBuf, (uint16_t)(end - session->inBuf), OPDI_DIR_INCOMING_ENCR, TEXT_FRAMING(session)) == OPDI_STATUS_OK)
+				return OPDI_STATUS_OK;
+			// ignore malformed messages
+			memmove(session->inBuf, session->inBuf + next, session->plainNextLen);
+			pos = session->plainNextLen;
+			session->plainNextLen = 0;
+			scanned = 0;
+			continue;
+		}
+		scanned = pos;
+
+		if (pos + unit > OPDI_MESSAGE_BUFFER_SIZE) {
+			// ignore overflowing messages
+			pos = 0;
+			scanned = 0;
+		}
+
+		// read as many bytes as there are complete blocks that fit into inBuf
+		space = (OPDI_MESSAGE_BUFFER_SIZE - pos) / unit * unit;
+
+#ifdef OPDI_ENCRYPTION_CTR
+		if (IS_CTR(session)) {
+			// A receive implementation may send if waiting for a new message
+			result = receive_bytes(session, session->inBuf + pos, space, &received, (can_send && (pos == 0) ? 1 : 0));
+			// error or disconnected?
+			if (result != OPDI_STATUS_OK)
+				return result;
+			// the key stream must advance over all received bytes, including those of ignored messages
+			result = apply_key_stream(session, &session->ksIn, session->inBuf + pos, received);
+			if (result != OPDI_STATUS_OK)
+				return result;
+			pos += received;
+			continue;
+		}
+#endif
+
+		// A receive implementation may send if waiting for a new message
+		result = receive_bytes(session, session->cipherIn + session->cipherInLen, space - session->cipherInLen, &received, (can_send && (pos == 0) && (session->cipherInLen == 0) ? 1 : 0));
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK)
+			return result;
+		session->cipherInLen += received;
+
+		blocks = session->cipherInLen / OPDI_ENCRYPTION_BLOCKSIZE;
+		if (blocks == 0)
+			continue;
+		result = DECRYPT_BLOCKS(session, session->inBuf + pos, session->cipherIn, blocks);
+		if (result != OPDI_STATUS_OK)
+			// encryption error; can't notify the master because it expects an encrypted message which can't be sent
+			// this is sort of a dilemma here
+			return result;
+		pos += blocks * OPDI_ENCRYPTION_BLOCKSIZE;
+
+		// keep the bytes of an incomplete block
+		session->cipherInLen -= blocks * OPDI_ENCRYPTION_BLOCKSIZE;
+		memmove(session->cipherIn, session->cipherIn + blocks * OPDI_ENCRYPTION_BLOCKSIZE, session->cipherInLen);
+	}
+	return OPDI_STATUS_OK;
+}
+
+/** Encrypts the bytes and sends them out. The blocks of a message are encrypted with one call
+*   and sent with one write; longer input is processed in parts of OPDI_CIPHER_BUFFER_SIZE bytes.
+*   In counter mode the bytes are combined with the key stream and sent without padding.
+*/
+static uint8_t put_encrypted(opdi_Session *session, const uint8_t *bytes, uint16_t length) {
+	uint16_t count;
+	uint16_t padded;
+	uint16_t i;
+	uint8_t result;
+
+	while (length > 0) {
+		count = (length > OPDI_CIPHER_BUFFER_SIZE ? OPDI_CIPHER_BUFFER_SIZE : length);
+		memcpy(session->cipherOut, bytes, count);
+#ifdef OPDI_ENCRYPTION_CTR
+		if (IS_CTR(session)) {
+			result = apply_key_stream(session, &session->ksOut, session->cipherOut, count);
+			if (result != OPDI_STATUS_OK)
+				return result;
+			result = send_bytes(session, session->cipherOut, count);
+			if (result != OPDI_STATUS_OK)
+				return result;
+			bytes += count;
+			length -= count;
+			continue;
+		}
+#endif
+		padded = (count + OPDI_ENCRYPTION_BLOCKSIZE - 1) / OPDI_ENCRYPTION_BLOCKSIZE * OPDI_ENCRYPTION_BLOCKSIZE;
+		for (i = count; i < padded; i++)
+			// pad with random byte which may not be the message terminator
+			do {
+				session->cipherOut[i] = (uint8_t)rand();
+			} while (session->cipherOut[i] == MESSAGE_TERMINATOR);
+
+		// encrypt the blocks in place
+		result = ENCRYPT_BLOCKS(session, session->cipherOut, session->cipherOut, padded / OPDI_ENCRYPTION_BLOCKSIZE);
+		if (result != OPDI_STATUS_OK)
+			return result;
+
+		result = send_bytes(session, session->cipherOut, padded);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		bytes += count;
+		length -= count;
+	}
+
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+/** Receives the next message in the current framing.
+*/
+static uint8_t receive_message(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint16_t pos = 0;
+	uint8_t result;
+	uint8_t byte;
+
+#ifdef OPDI_ENCRYPTION_GCM
+	if (IS_GCM(session))
+		return get_record(session, message, can_send);
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
+	// if encryption is on, use it
+	if (session->encryption)
+		return get_encrypted(session, message, can_send);
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+	if (session->binary)
+		return get_binary(session, message, can_send);
+#endif
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+	// if a bulk receive function is available, use it
+	if (session->receive_bulk != NULL)
+		return get_buffered(session, message, can_send);
+#endif
+
+	while (1) {
+		// A receive implementation may send if waiting for a new message (pos == 0)
+		result = session->receive(session->info, &byte, session->message_timeout, (can_send && (pos == 0) ? 1 : 0));
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK) return result;
+
+		// is the byte a message terminator?
+		if (byte == MESSAGE_TERMINATOR) {
+			// the message is finished
+			session->inBuf[pos] = '\0';
+			if (decode_frame(message, session->inBuf, pos, OPDI_DIR_INCOMING, TEXT_FRAMING(session)) == OPDI_STATUS_OK)
+				return OPDI_STATUS_OK;
+			// ignore malformed messages
+			pos = 0;
+		} else {
+			session->inBuf[pos] = byte;
+			pos++;
+			if (pos >= OPDI_MESSAGE_BUFFER_SIZE - 1)		// \0 should fit, too
+				// ignore overflowing messages
+				pos = 0;
+		}
+	}
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+
+/** Receives messages until a message is complete. The payloads of fragments are collected in fragBuf;
+*   fragmented messages that don't fit are ignored. Other messages are returned unchanged.
+*/
+static uint8_t get_fragmented(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+	uint16_t length = 0;
+	uint16_t count;
+	channel_t channel = 0;
+	uint8_t fragmented = 0;
+	uint8_t overflow = 0;
+	uint8_t continued;
+	uint8_t result;
+	const char *payload;
+
+	while (1) {
+		// A receive implementation may send if waiting for a new message
+		result = receive_message(session, message, (can_send && !fragmented ? 1 : 0));
+		// error or disconnected?
+		if (result != OPDI_STATUS_OK) return result;
+
+		if (fragmented && (message->channel != channel)) {
+			// the fragments are not continued; discard them
+			fragmented = 0;
+		}
+		continued = (message->payload[0] == OPDI_FRAGMENT_MARKER);
+		if (!fragmented) {
+			if (!continued)
+				return OPDI_STATUS_OK;
+			// the first fragment
+			fragmented = 1;
+			channel = message->channel;
+			length = 0;
+			overflow = 0;
+		}
+
+		payload = message->payload + (continued ? 1 : 0);
+		count = (uint16_t)strlen(payload);
+		if (length + count >= OPDI_FRAGMENT_BUFFER_SIZE)		// \0 should fit, too
+			overflow = 1;
+		else if (!overflow) {
+			memcpy(session->fragBuf + length, payload, count);
+			length += count;
+		}
+		if (continued)
+			continue;
+
+		// the last fragment
+		fragmented = 0;
+		// ignore overflowing messages
+		if (overflow)
+			continue;
+		session->fragBuf[length] = '\0';
+		message->payload = session->fragBuf;
+		return OPDI_STATUS_OK;
+	}
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+uint8_t opdi_get_message(opdi_Session *session, opdi_Message *message, uint8_t can_send) {
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+	uint8_t result;
+
+	// the master can't reply to bytes that are still in the output buffer
+	result = flush_output(session, 0);
+	if (result != OPDI_STATUS_OK)
+		return result;
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	if (session->fragmentation)
+		return get_fragmented(session, message, can_send);
+#endif
+
+	return receive_message(session, message, can_send);
+}
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+
+/** Sends the collected messages as one frame.
+*/
+static uint8_t send_frame(opdi_Session *session) {
+	uint16_t length = session->frameLen;
+
+	if (length == 0)
+		return OPDI_STATUS_OK;
+	session->frameLen = 0;
+
+#ifdef OPDI_BINARY_FRAMING
+	// binary frames are simply concatenated
+	if (!session->binary)
+#endif
+	// the last message of the frame is terminated regularly
+	session->frameBuf[length - 1] = MESSAGE_TERMINATOR;
+
+#ifndef OPDI_NO_ENCRYPTION
+	// if encryption is on, use it
+	if (session->encryption)
+		return put_encrypted(session, session->frameBuf, length);
+#endif
+
+	return send_bytes(session, session->frameBuf, length);
+}
+
+/** Appends the encoded message to the current frame. Sends the frame first
+*   if the message does not fit.
+*/
+static uint8_t append_to_frame(opdi_Session *session, const uint8_t *message, uint16_t length) {
+	uint8_t result;
+
+	if (session->frameLen + length > OPDI_MULTIMESSAGE_BUFFER_SIZE) {
+		result = send_frame(session);
+		if (result != OPDI_STATUS_OK)
+			return result;
+	}
+	memcpy(session->frameBuf + session->frameLen, message, length);
+	session->frameLen += length;
+#ifdef OPDI_BINARY_FRAMING
+	if (!session->binary)
+#endif
+	// replace the terminator by the separator
+	session->frameBuf[session->frameLen - 1] = OPDI_MULTIMESSAGE_SEPARATOR;
+
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+/** Sends the message that has been encoded into msgBuf starting at frame.
+*/
+static uint8_t put_encoded(opdi_Session *session, uint8_t *frame, uint16_t length) {
+	uint8_t result;
+
+	TRACE_FRAME(OPDI_TRACE_MESSAGES, OUTGOING_DIRECTION(session), frame, length, IS_BINARY(session));
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	// collect the message in the current frame
+	if (session->collecting)
+		return append_to_frame(session, frame, length);
+#endif
+
+#ifdef OPDI_ENCRYPTION_GCM
+	// each message is a record
+	if (IS_GCM(session))
+		return put_record(session, frame, length);
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
+	// if encryption is on, use it
+	if (session->encryption)
+		return put_encrypted(session, frame, length);
+#endif
+
+	result = send_bytes(session, frame, length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_put_message(opdi_Session *session, opdi_Message *message) {
+	uint8_t result;
+	uint16_t start = 0;
+	uint16_t length = 0;
+
+#ifdef OPDI_BINARY_FRAMING
+	if (session->binary)
+		result = encode_binary(session, message, &start, &length);
+	else
+#endif
+	result = encode(session, message, &length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	return put_encoded(session, session->msgBuf + start, length);
+}
+
+uint8_t opdi_put_parts(opdi_Session *session, channel_t channel, const char **parts) {
+	uint8_t result;
+	uint16_t start = 0;
+	uint16_t length = 0;
+
+	result = encode_parts(session, channel, parts, NULL, NULL, 0, &start, &length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	return put_encoded(session, session->msgBuf + start, length);
+}
+
+/** Returns the item of a NULL terminated array (see opdi_put_list).
+*/
+static const char *array_item(void *context, uint16_t index) {
+	return ((const char **)context)[index];
+}
+
+uint8_t opdi_put_list(opdi_Session *session, channel_t channel, const char **parts, const char **items) {
+	return opdi_put_items(session, channel, parts, &array_item, (void *)items, 0xffff);
+}
+
+uint8_t opdi_put_items(opdi_Session *session, channel_t channel, const char **parts, opdi_ListItem item, void *context, uint16_t count) {
+	uint8_t result;
+	uint16_t start = 0;
+	uint16_t length = 0;
+
+	result = encode_parts(session, channel, parts, item, context, count, &start, &length);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	return put_encoded(session, session->msgBuf + start, length);
+}
+
+uint16_t opdi_get_payload_limit(opdi_Session *session) {
+	// the longest channel number with its separator is longer than the length prefix and the
+	// channel number of a binary frame; a fragment header may occupy one more byte
+	return session->maxFrame - TRAILER_SIZE(session) - CHANNEL_STRBUF - (FRAGMENTATION(session) ? 1 : 0);
+}
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+
+uint8_t opdi_set_multimessage(opdi_Session *session, uint8_t enabled) {
+	session->multimessage = enabled;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_begin_multimessage(opdi_Session *session) {
+	session->collecting = session->multimessage;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_end_multimessage(opdi_Session *session) {
+	session->collecting = 0;
+	return send_frame(session);
+}
+
+#endif
+
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+
+uint8_t opdi_begin_output(opdi_Session *session) {
+	session->buffering = 1;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_flush_output(opdi_Session *session) {
+	session->buffering = 0;
+	return flush_output(session, 0);
+}
+
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+
+uint8_t opdi_set_binary_framing(opdi_Session *session, uint8_t enabled) {
+	session->binary = enabled;
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+#ifdef OPDI_CRC32C
+
+uint8_t opdi_set_crc32c(opdi_Session *session, uint8_t enabled) {
+	session->crc32c = enabled;
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+uint8_t opdi_set_frame_size(opdi_Session *session, uint16_t size) {
+	if (size < OPDI_MIN_FRAME_SIZE)
+		return OPDI_PROTOCOL_ERROR;
+	session->maxFrame = (size < OPDI_MAX_FRAME_SIZE ? size : OPDI_MAX_FRAME_SIZE);
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+
+uint8_t opdi_set_fragmentation(opdi_Session *session, uint8_t enabled) {
+	session->fragmentation = enabled;
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
+
+uint8_t opdi_set_encryption(opdi_Session *session, uint8_t enabled) {
+#ifdef OPDI_ENCRYPTION_CTR
+	if (enabled == OPDI_USE_ENCRYPTION_CTR) {
+		reset_key_stream(session, &session->ksIn, OPDI_DIR_INCOMING);
+		reset_key_stream(session, &session->ksOut, OPDI_DIR_OUTGOING);
+	}
+#else
+	if (enabled == OPDI_USE_ENCRYPTION_CTR)
+		return OPDI_ENCRYPTION_NOT_SUPPORTED;
+#endif
+#ifdef OPDI_ENCRYPTION_GCM
+	if (enabled == OPDI_USE_ENCRYPTION_GCM) {
+		uint8_t result = prepare_ghash(session);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		session->gcmInCount = 0;
+		session->gcmOutCount = 0;
+	}
+#else
+	if (enabled == OPDI_USE_ENCRYPTION_GCM)
+		return OPDI_ENCRYPTION_NOT_SUPPORTED;
+#endif
+#ifdef OPDI_SESSION_KEYS
+	if ((enabled < OPDI_USE_ENCRYPTION_CTR) && (session->cipher != NULL)) {
+		// the block mode always uses the device key
+		opdi_cipher_free(session->cipher);
+		session->cipher = NULL;
+	}
+#endif
+	session->encryption = enabled;
+	session->cipherInLen = 0;
+	session->plainNextLen = 0;
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_ENCRYPTION_CTR
+
+/** Returns the value of a hexadecimal digit or 0xff if the character is not a digit.
+*/
+static uint8_t hex_digit(char c) {
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return 0xff;
+}
+
+uint8_t opdi_new_ctr_nonce(opdi_Session *session, const char *peerHex, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+	uint8_t high;
+	uint8_t low;
+	uint8_t i;
+	uint8_t result;
+
+	hex[0] = '\0';
+	// the nonce of the master makes the counter blocks differ even if the device repeats its nonce
+	if (peerHex == NULL)
+		return OPDI_ERROR_CONVERSION;
+	for (i = 0; i < OPDI_CTR_NONCE_SIZE; i++) {
+		high = hex_digit(peerHex[i * 2]);
+		low = (high == 0xff ? 0xff : hex_digit(peerHex[i * 2 + 1]));
+		if (low == 0xff)
+			return OPDI_ERROR_CONVERSION;
+		session->ctrPeerNonce[i] = (uint8_t)((high << 4) | low);
+	}
+	if (peerHex[OPDI_CTR_NONCE_SIZE * 2] != '\0')
+		return OPDI_ERROR_CONVERSION;
+
+	// a repeated nonce repeats the key stream; there is no fallback to a weaker generator
+	result = opdi_random_bytes(session->ctrNonce, OPDI_CTR_NONCE_SIZE);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	for (i = 0; i < OPDI_CTR_NONCE_SIZE; i++) {
+		hex[i * 2] = digits[session->ctrNonce[i] >> 4];
+		hex[i * 2 + 1] = digits[session->ctrNonce[i] & 0x0f];
+	}
+	hex[OPDI_CTR_NONCE_SIZE * 2] = '\0';
+	return OPDI_STATUS_OK;
+}
+
+#ifdef OPDI_SESSION_KEYS
+
+uint8_t opdi_derive_session_key(opdi_Session *session) {
+	uint8_t key[OPDI_ENCRYPTION_BLOCKSIZE];
+	uint8_t result;
+
+	// the nonces of both sides form the block that is encrypted with the device key
+	memset(key, 0, sizeof(key));
+	memcpy(key, session->ctrNonce, OPDI_CTR_NONCE_SIZE);
+	memcpy(key + OPDI_CTR_NONCE_SIZE, session->ctrPeerNonce, OPDI_CTR_NONCE_SIZE);
+	result = opdi_encrypt_blocks(key, key, 1);
+	if (result != OPDI_STATUS_OK) {
+		wipe(key, sizeof(key));
+		return result;
+	}
+
+	opdi_cipher_free(session->cipher);
+	session->cipher = opdi_cipher_create(key);
+	wipe(key, sizeof(key));
+	if (session->cipher == NULL)
+		return OPDI_ENCRYPTION_ERROR;
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+#endif
 
 #endif
 
-void opdi_set_timeout(uint16_t timeout) {
-	message_timeout = timeout;
+void opdi_set_timeout(opdi_Session *session, uint16_t timeout) {
+	session->message_timeout = timeout;
 }
 
-uint16_t opdi_get_timeout(void) {
-	return message_timeout;
+uint16_t opdi_get_timeout(opdi_Session *session) {
+	return session->message_timeout;
 }
@@ -29,38 +29,389 @@ extern "C" {
 typedef uint8_t (*func_receive)(void *info, uint8_t *byte, uint16_t timeout, uint8_t can_send);
 
 /** Defines the function that is used to write bytes.
+*   more is 1 if the bytes are followed by more bytes of the same reply (see opdi_begin_output).
+*   An implementation may use this as a hint for the transport, e.g. MSG_MORE.
 *   Implementations must provide a pointer to this function when calling opdi_message_setup.
 */
-typedef uint8_t (*func_send)(void *info, uint8_t *bytes, uint16_t count);
+typedef uint8_t (*func_send)(void *info, uint8_t *bytes, uint16_t count, uint8_t more);
 
+/** Defines the function that is used to read all currently available bytes at once.
+*   It blocks until at least one byte is available or the timeout (in milliseconds) expires.
+*   At most maxcount bytes are placed in bytes; the number of bytes read is returned in count.
+*   can_send has the same meaning as for func_receive.
+*   This function is optional. It requires OPDI_RECEIVE_BUFFER_SIZE to be defined in the config specs.
+*/
+typedef uint8_t (*func_receive_bulk)(void *info, uint8_t *bytes, uint16_t maxcount, uint16_t *count, uint16_t timeout, uint8_t can_send);
+
+/** A received message. The payload points into the receive buffers of the session
+*   and is valid until the next message is received.
+*/
 typedef struct opdi_Message {
 	channel_t channel;
 	char *payload;
 } opdi_Message;
 
-/** Setup the messaging subsystem. Supply handlers for sending and receiving of bytes.
+#ifdef OPDI_NO_ENCRYPTION
+// the modes of the encryption are not available without encryption
+#undef OPDI_ENCRYPTION_CTR
+#undef OPDI_ENCRYPTION_GCM
+#undef OPDI_SESSION_KEYS
+#endif
+
+/** The length of the longest frame that fits into the message buffer, including the terminator.
+*   It is announced to masters that support OPDI_FLAG_FRAME_SIZE.
+*/
+#define OPDI_MAX_FRAME_SIZE			(OPDI_MESSAGE_BUFFER_SIZE - 1)
+
+#ifndef OPDI_NO_ENCRYPTION
+
+/** The size of the buffers for encrypted blocks: the message buffer size rounded up to whole blocks.
+*/
+#define OPDI_CIPHER_BUFFER_SIZE		(((OPDI_MESSAGE_BUFFER_SIZE + OPDI_ENCRYPTION_BLOCKSIZE - 1) / OPDI_ENCRYPTION_BLOCKSIZE) * OPDI_ENCRYPTION_BLOCKSIZE)
+
+#ifdef OPDI_ENCRYPTION_CTR
+
+// the size of the nonce that distinguishes the key streams of different connections
+#define OPDI_CTR_NONCE_SIZE		8
+
+/** The state of a key stream in counter mode. A counter block consists of the prefix and the
+*   big-endian block number in the last four bytes. In counter mode the prefix contains the nonce
+*   and the direction; in Galois/counter mode it contains the nonce and the record number.
+*/
+typedef struct opdi_KeyStream {
+	// the first bytes of the counter blocks
+	uint8_t prefix[OPDI_ENCRYPTION_BLOCKSIZE - 4];
+	// the number of the next counter block
+	uint32_t counter;
+	// the current block of the key stream and the number of its bytes that have been used
+	uint8_t block[OPDI_ENCRYPTION_BLOCKSIZE];
+	uint16_t used;
+} opdi_KeyStream;
+
+#endif
+
+#ifdef OPDI_ENCRYPTION_GCM
+
+// the record header contains the big-endian length of the encrypted message
+#define OPDI_GCM_HEADER_SIZE	2
+// the authentication tag follows the encrypted message
+#define OPDI_GCM_TAG_SIZE		16
+
+// the size of the buffer for an outgoing record
+#define OPDI_CIPHER_OUT_SIZE	(OPDI_CIPHER_BUFFER_SIZE + OPDI_GCM_HEADER_SIZE + OPDI_GCM_TAG_SIZE)
+#else
+#define OPDI_CIPHER_OUT_SIZE	OPDI_CIPHER_BUFFER_SIZE
+#endif
+
+#endif
+
+#if (OPDI_STREAMING_PORTS > 0)
+
+/** Holds streaming port bindings.
+*/
+typedef struct opdi_StreamingPortBinding {
+	channel_t channel;
+	struct opdi_Port *port;
+} opdi_StreamingPortBinding;
+
+#endif
+
+/** Holds the state of the connection to one master. All message and protocol functions
+*   operate on a session, so one process can serve several masters at the same time.
+*   A session must be initialized using opdi_message_setup before it is used and released using
+*   opdi_message_cleanup when the connection has ended.
+*/
+typedef struct opdi_Session {
+	// function handler for receiving of bytes
+	func_receive receive;
+	// function handler for sending of bytes
+	func_send send;
+	// info for receive and send functions
+	void *info;
+	// the timeout used for receiving messages (in milliseconds)
+	uint16_t message_timeout;
+
+	// the buffer for received frames; payloads of received messages may point into it
+	uint8_t inBuf[OPDI_MESSAGE_BUFFER_SIZE];
+	// the message output buffer
+	uint8_t msgBuf[OPDI_MESSAGE_BUFFER_SIZE];
+	// the maximum length of sent frames; depends on the frame length that the master has announced
+	uint16_t maxFrame;
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+	// optional function handler for receiving chunks of bytes
+	func_receive_bulk receive_bulk;
+	// bytes that have been received but not yet consumed
+	uint8_t rxBuf[OPDI_RECEIVE_BUFFER_SIZE];
+	uint16_t rxPos;
+	uint16_t rxLen;
+#endif
+
+#ifndef OPDI_NO_ENCRYPTION
+	// flag whether encryption is on or off
+	uint8_t encryption;
+	// received encrypted bytes that don't form a complete block yet
+	uint8_t cipherIn[OPDI_CIPHER_BUFFER_SIZE];
+	uint16_t cipherInLen;
+	// decrypted bytes in inBuf that follow the last received message
+	uint16_t plainNext;
+	uint16_t plainNextLen;
+	// the encrypted blocks of an outgoing message
+	uint8_t cipherOut[OPDI_CIPHER_OUT_SIZE];
+#ifdef OPDI_ENCRYPTION_CTR
+	// the nonce of the counter mode; is sent to the master during the handshake
+	uint8_t ctrNonce[OPDI_CTR_NONCE_SIZE];
+	// the nonce that the master has offered with the counter mode
+	uint8_t ctrPeerNonce[OPDI_CTR_NONCE_SIZE];
+	// the key streams of the received and of the sent bytes
+	opdi_KeyStream ksIn;
+	opdi_KeyStream ksOut;
+	// the blocks of a key stream that are generated at once
+	uint8_t keyBuf[OPDI_CIPHER_BUFFER_SIZE];
+#endif
+#ifdef OPDI_SESSION_KEYS
+	// the cipher context of the session key (see opdi_cipher_create); NULL if the device key is used
+	void *cipher;
+#endif
+#ifdef OPDI_ENCRYPTION_GCM
+	// the multiples of the hash key for GHASH (4 bit table)
+	uint64_t gcmTableHigh[16];
+	uint64_t gcmTableLow[16];
+	// the numbers of the next received and of the next sent record
+	uint32_t gcmInCount;
+	uint32_t gcmOutCount;
+#endif
+#endif
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	// flag whether multi-message frames may be sent
+	uint8_t multimessage;
+	// flag whether outgoing messages are being collected
+	uint8_t collecting;
+	// the frame of collected outgoing messages
+	uint8_t frameBuf[OPDI_MULTIMESSAGE_BUFFER_SIZE];
+	uint16_t frameLen;
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+	// flag whether messages are sent and received as binary frames
+	uint8_t binary;
+#endif
+
+#ifdef OPDI_CRC32C
+	// flag whether text messages end with a CRC-32C instead of the additive checksum
+	uint8_t crc32c;
+#endif
+
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+	// flag whether outgoing bytes are collected until the next flush point
+	uint8_t buffering;
+	// the collected outgoing bytes
+	uint8_t outBuf[OPDI_OUTPUT_BUFFER_SIZE];
+	uint16_t outLen;
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	// flag whether messages may be sent and received as fragments
+	uint8_t fragmentation;
+	// the reassembled payload of a fragmented message
+	char fragBuf[OPDI_FRAGMENT_BUFFER_SIZE];
+#endif
+
+	// for splitting messages into parts
+	const char *msg_parts[OPDI_MAX_MESSAGE_PARTS];
+	// for assembling a payload
+	char msg_payload[OPDI_MESSAGE_PAYLOAD_LENGTH];
+	// flag whether a protocol handler is running
+	uint8_t connected;
+	// the port info message of the current request (see opdi_set_port_message)
+	char portMessage[OPDI_MAX_PORT_INFO_MESSAGE + 1];
+#if (OPDI_STREAMING_PORTS > 0)
+	// the streaming ports that the master of this session has bound
+	opdi_StreamingPortBinding portBinds[OPDI_STREAMING_PORTS];
+	uint16_t portBindCount;
+#endif
+} opdi_Session;
+
+#ifdef OPDI_SINGLE_SESSION
+
+/** The session that is used by configurations that serve only one master at a time.
+*   If OPDI_SINGLE_SESSION is defined the message and protocol functions can be called
+*   without a session argument; they operate on this session instead.
+*/
+extern opdi_Session opdi_single_session;
+
+#endif
+
+/** Setup the messaging subsystem for a new connection. Supply handlers for sending and receiving of bytes.
 *   recv is a pointer to a function that receives bytes.
 *   snd is a pointer to a function that sends bytes.
 *   info is a pointer to information required by the recv and snd functions.
 */
-uint8_t opdi_message_setup(func_receive recv, func_send snd, void *info);
+uint8_t opdi_message_setup(opdi_Session *session, func_receive recv, func_send snd, void *info);
+
+/** Ends the connection of the session. Releases the session key and clears the key material
+*   of the session. Must be called before the session is set up again or its memory is released.
+*/
+void opdi_message_cleanup(opdi_Session *session);
+
+#ifdef OPDI_RECEIVE_BUFFER_SIZE
+
+/** Sets a function that receives chunks of bytes. Must be called after opdi_message_setup.
+*   If it is set, incoming bytes are read through this function into a buffer of OPDI_RECEIVE_BUFFER_SIZE
+*   bytes, and the per-byte receive function is no longer used.
+*/
+uint8_t opdi_message_set_bulk_receive(opdi_Session *session, func_receive_bulk recv_bulk);
+
+#endif
 
 /** Puts the next received message in message.
 *   If canSend is true a receive function may send its own messages during waiting for
 *   a message. This will usually be the case if no protocol is currently being executed.
 *   Returns a status code != OPDI_STATUS_OK in case of an error or disconnecting.
+*   The payload of the message is valid until the next call.
 */
-uint8_t opdi_get_message(opdi_Message *message, uint8_t canSend);
+uint8_t opdi_get_message(opdi_Session *session, opdi_Message *message, uint8_t canSend);
 
 /** Sends the message to the master.
 *   Returns a status code != OPDI_STATUS_OK in case of an error or disconnecting.
 */
-uint8_t opdi_put_message(opdi_Message *message);
+uint8_t opdi_put_message(opdi_Session *session, opdi_Message *message);
+
+/** Sends a message with the given parts as payload to the master. The parts array must be
+*   terminated by NULL. The parts are joined like strings_join does, i. e. separators are escaped
+*   and empty parts are sent as a blank, but are written into the output buffer directly.
+*   Returns a status code != OPDI_STATUS_OK in case of an error or disconnecting.
+*/
+uint8_t opdi_put_parts(opdi_Session *session, channel_t channel, const char **parts);
+
+/** Sends a message like opdi_put_parts whose payload ends with one more part that contains the
+*   items joined by commas. The items array must be terminated by NULL. Item separators are escaped
+*   like strings_join does. Is used for lists whose joined form may be longer than a message buffer.
+*   Returns a status code != OPDI_STATUS_OK in case of an error or disconnecting.
+*/
+uint8_t opdi_put_list(opdi_Session *session, channel_t channel, const char **parts, const char **items);
+
+/** Returns the item with the given index of a list that is sent with opdi_put_items, or NULL if the
+*   list ends before it. The items are requested in ascending order, each once.
+*/
+typedef const char *(*opdi_ListItem)(void *context, uint16_t index);
+
+/** Sends a message like opdi_put_list whose list consists of up to count items that are returned by
+*   the item function. Is used for lists that are not stored as arrays.
+*   Returns a status code != OPDI_STATUS_OK in case of an error or disconnecting.
+*/
+uint8_t opdi_put_items(opdi_Session *session, channel_t channel, const char **parts, opdi_ListItem item, void *context, uint16_t count);
+
+/** Returns the length of the longest payload that is sent as one frame on any channel with the
+*   current framing and frame length.
+*/
+uint16_t opdi_get_payload_limit(opdi_Session *session);
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+
+/** Enables or disables multi-message frames. Is called during the handshake if the master
+*   has indicated that it accepts multi-message frames.
+*/
+uint8_t opdi_set_multimessage(opdi_Session *session, uint8_t enabled);
+
+/** Starts collecting outgoing messages. The collected messages are sent as multi-message frames
+*   of up to OPDI_MULTIMESSAGE_BUFFER_SIZE bytes when opdi_end_multimessage is called.
+*   Messages are sent immediately if multi-message frames are not enabled.
+*/
+uint8_t opdi_begin_multimessage(opdi_Session *session);
+
+/** Sends the messages that have been collected since opdi_begin_multimessage.
+*/
+uint8_t opdi_end_multimessage(opdi_Session *session);
+
+#endif
+
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+
+/** Starts collecting outgoing bytes in the output buffer of OPDI_OUTPUT_BUFFER_SIZE bytes.
+*   The buffer is sent when it is full or when opdi_flush_output is called.
+*/
+uint8_t opdi_begin_output(opdi_Session *session);
+
+/** Sends the bytes collected since opdi_begin_output with one call of the send function
+*   and stops collecting. Is called when the handling of a request is finished.
+*/
+uint8_t opdi_flush_output(opdi_Session *session);
+
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+
+/** Enables or disables binary frames (see OPDI_FLAG_BINARY_FRAMING). Is called during the handshake
+*   if the master has indicated that it accepts binary frames. Binary frames are not used together with encryption.
+*   Binary frames only change the framing; the payloads remain strings (see opdi_Message), so they
+*   can't contain zero bytes. Received frames with a zero byte in the payload are malformed.
+*/
+uint8_t opdi_set_binary_framing(opdi_Session *session, uint8_t enabled);
+
+#endif
+
+#ifdef OPDI_CRC32C
+
+/** Enables or disables the CRC-32C of text messages (see OPDI_FLAG_CRC32C). Is called during the handshake
+*   if the master has indicated that it accepts it. Binary frames keep their CRC-16; in Galois/counter mode
+*   the messages are protected by the authentication tag instead.
+*/
+uint8_t opdi_set_crc32c(opdi_Session *session, uint8_t enabled);
+
+#endif
+
+/** Sets the maximum length of the frames that the master accepts (see OPDI_FLAG_FRAME_SIZE). Is called during
+*   the handshake if the master has announced it. Sent frames are limited to the smaller of this length and
+*   OPDI_MAX_FRAME_SIZE; until then they are limited to OPDI_DEFAULT_FRAME_SIZE.
+*   Returns OPDI_PROTOCOL_ERROR if the length is less than OPDI_MIN_FRAME_SIZE.
+*/
+uint8_t opdi_set_frame_size(opdi_Session *session, uint16_t size);
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+
+/** Enables or disables fragmentation (see OPDI_FLAG_FRAGMENTATION). Is called during the handshake
+*   if the master has indicated that it accepts fragmented messages. Messages that are sent with
+*   opdi_put_parts or opdi_put_list are then split into fragments if they don't fit into the message buffer.
+*   Received fragments are reassembled into a payload of up to OPDI_FRAGMENT_BUFFER_SIZE - 1 characters.
+*/
+uint8_t opdi_set_fragmentation(opdi_Session *session, uint8_t enabled);
+
+#endif
 
 #ifndef OPDI_NO_ENCRYPTION
 
-/** Enable encryption. See device.h for encryption functions. */
-uint8_t opdi_set_encryption(uint8_t enabled);
+/** Enable encryption. See device.h for encryption functions.
+*   enabled is one of the OPDI_*USE_ENCRYPTION* constants. Switching encryption off or to the
+*   block mode releases the session key.
+*/
+uint8_t opdi_set_encryption(opdi_Session *session, uint8_t enabled);
+
+#ifdef OPDI_ENCRYPTION_CTR
+
+/** Chooses a new nonce for the counter mode and writes it to hex as 2 * OPDI_CTR_NONCE_SIZE
+*   hexadecimal digits plus terminator. peerHex is the nonce that the master has offered in the same
+*   format; the counter blocks contain the combination of both nonces. The nonce must be sent to the
+*   master before the counter mode is switched on with opdi_set_encryption(session, OPDI_USE_ENCRYPTION_CTR).
+*   The Galois/counter mode uses the nonces in the same way. The nonce is taken from opdi_random_bytes;
+*   if the platform can't provide secure random bytes or if peerHex is invalid, an error is returned
+*   and the counter modes must not be used.
+*/
+uint8_t opdi_new_ctr_nonce(opdi_Session *session, const char *peerHex, char *hex);
+
+#ifdef OPDI_SESSION_KEYS
+
+/** Derives the key of the session from the device key (opdi_encryption_key), the nonce of the
+*   session and the nonce of the master, and precomputes the key schedule of the session key.
+*   The session key is the device key's encryption of both nonces.
+*   Must be called after opdi_new_ctr_nonce and before the encryption is switched on.
+*/
+uint8_t opdi_derive_session_key(opdi_Session *session);
+
+#endif
+
+#endif
 
 /** Specifies the block size of the encryption. Must be specified if encryption is used.
 */
@@ -70,22 +421,44 @@ extern const uint16_t opdi_encryption_blocksize;
 */
 extern char opdi_encryption_key[];
 
-#ifdef _MSC_VER
-	// MS Visual C compiler can't handle non-constant-length arrays on the stack
-	// implementation must provide enough space
-	extern uint8_t opdi_encryption_buffer[];
-	extern uint8_t opdi_encryption_buffer_2[];
-#endif
-
 #endif
 
 /** Set the current message timeout.
 */
-void opdi_set_timeout(uint16_t timeout);
+void opdi_set_timeout(opdi_Session *session, uint16_t timeout);
 
 /** Get the current message timeout.
 */
-uint16_t opdi_get_timeout(void);
+uint16_t opdi_get_timeout(opdi_Session *session);
+
+#if defined(OPDI_SINGLE_SESSION) && !defined(OPDI_SESSION_INTERNAL)
+
+// compatibility layer: map the calls without session argument to the single session
+#define opdi_message_setup(recv, snd, info)		opdi_message_setup(&opdi_single_session, recv, snd, info)
+#define opdi_message_cleanup()					opdi_message_cleanup(&opdi_single_session)
+#define opdi_message_set_bulk_receive(recv_bulk)	opdi_message_set_bulk_receive(&opdi_single_session, recv_bulk)
+#define opdi_get_message(message, canSend)		opdi_get_message(&opdi_single_session, message, canSend)
+#define opdi_put_message(message)				opdi_put_message(&opdi_single_session, message)
+#define opdi_put_parts(channel, parts)			opdi_put_parts(&opdi_single_session, channel, parts)
+#define opdi_put_list(channel, parts, items)	opdi_put_list(&opdi_single_session, channel, parts, items)
+#define opdi_put_items(channel, parts, item, context, count)	opdi_put_items(&opdi_single_session, channel, parts, item, context, count)
+#define opdi_get_payload_limit()				opdi_get_payload_limit(&opdi_single_session)
+#define opdi_set_multimessage(enabled)			opdi_set_multimessage(&opdi_single_session, enabled)
+#define opdi_begin_multimessage()				opdi_begin_multimessage(&opdi_single_session)
+#define opdi_end_multimessage()					opdi_end_multimessage(&opdi_single_session)
+#define opdi_begin_output()						opdi_begin_output(&opdi_single_session)
+#define opdi_flush_output()						opdi_flush_output(&opdi_single_session)
+#define opdi_set_binary_framing(enabled)		opdi_set_binary_framing(&opdi_single_session, enabled)
+#define opdi_set_fragmentation(enabled)			opdi_set_fragmentation(&opdi_single_session, enabled)
+#define opdi_set_crc32c(enabled)				opdi_set_crc32c(&opdi_single_session, enabled)
+#define opdi_set_frame_size(size)				opdi_set_frame_size(&opdi_single_session, size)
+#define opdi_set_encryption(enabled)			opdi_set_encryption(&opdi_single_session, enabled)
+#define opdi_new_ctr_nonce(peerHex, hex)		opdi_new_ctr_nonce(&opdi_single_session, peerHex, hex)
+#define opdi_derive_session_key()				opdi_derive_session_key(&opdi_single_session)
+#define opdi_set_timeout(timeout)				opdi_set_timeout(&opdi_single_session, timeout)
+#define opdi_get_timeout()						opdi_get_timeout(&opdi_single_session)
+
+#endif
 
 #ifdef __cplusplus
 }
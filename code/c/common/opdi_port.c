@@ -17,6 +17,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+// this module implements the session functions
+#define OPDI_SESSION_INTERNAL
+
 #include "opdi_constants.h"
 #include "opdi_config.h"
 
@@ -29,13 +32,73 @@ static opdi_PortGroup *portGroupHead = NULL;
 static opdi_PortGroup *portGroupTail = NULL;
 #endif
 
-static char port_info_message[OPDI_MAX_PORT_INFO_MESSAGE];
+// the session whose request is being handled by the calling thread; receives the port info message
+static OPDI_THREAD_LOCAL opdi_Session *port_session = NULL;
 
-#if (OPDI_STREAMING_PORTS > 0)
+#ifdef OPDI_DYNAMIC_PORTS
+
+// the initial size of the port index of the registry
+#define PORT_INDEX_MIN_SIZE		64
+
+// the ports in the order of the list; has room for portTableSize ports
+static opdi_Port **portTable = NULL;
+static uint16_t portTableSize = 0;
+
+/** A block of port records that are handed out by opdi_new_port.
+*/
+typedef struct PortSlab {
+	struct PortSlab *next;
+	uint16_t used;
+	opdi_Port ports[OPDI_DYNAMIC_PORTS];
+} PortSlab;
+
+// the slabs of port records; the slab that is being used comes first
+static PortSlab *portSlabs = NULL;
+
+// the index of the ports by ID (open addressing with linear probing); empty slots are NULL
+// it grows with the registry and is at most half full
+static opdi_Port **portIndex = NULL;
+static uint32_t portIndexSize = 0;
+#define PORT_INDEX
+
+#elif defined(OPDI_PORT_INDEX_SIZE)
+
+// the index of the ports by ID (open addressing with linear probing); empty slots are NULL
+static opdi_Port *portIndex[OPDI_PORT_INDEX_SIZE];
+#define portIndexSize			OPDI_PORT_INDEX_SIZE
+#define PORT_INDEX
+
+#endif
 
-// streaming port bindings
-static opdi_StreamingPortBinding sPortBinds[OPDI_STREAMING_PORTS];
-static uint16_t sPortBindCount = 0;
+#ifdef OPDI_PORT_INDEX_SIZE
+#if ((OPDI_PORT_INDEX_SIZE & (OPDI_PORT_INDEX_SIZE - 1)) != 0)
+#error "OPDI_PORT_INDEX_SIZE must be a power of two"
+#endif
+#endif
+
+#if defined(OPDI_PORT_INDEX_SIZE) && defined(OPDI_EXTENDED_PROTOCOL)
+// the index of the port groups by ID
+static opdi_PortGroup *groupIndex[OPDI_PORT_INDEX_SIZE];
+static uint8_t groupIndexFull = 0;
+#endif
+
+#ifdef PORT_INDEX
+
+// flag whether a port did not fit into the index; lookups of IDs that are not indexed then walk the list
+static uint8_t portIndexFull = 0;
+
+/** Returns the hash of the ID (FNV-1a). The first slot that is probed for the ID is the hash
+*   modulo the size of the index.
+*/
+static uint32_t index_hash(const char *id) {
+	uint32_t hash = 2166136261UL;
+
+	while (*id != '\0') {
+		hash ^= (uint8_t)*id++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
 
 #endif
 
@@ -44,10 +107,18 @@ uint8_t opdi_clear_ports(void) {
 	portCount = 0;
 	portHead = NULL;
 	portTail = NULL;
-#if (OPDI_STREAMING_PORTS > 0)
-
-// reset streaming port bindings
-	opdi_reset_bindings();
+#ifdef PORT_INDEX
+	if (portIndexSize > 0)
+		memset(portIndex, 0, portIndexSize * sizeof(opdi_Port *));
+	portIndexFull = 0;
+#endif
+#ifdef OPDI_DYNAMIC_PORTS
+	// free the port records of opdi_new_port
+	while (portSlabs != NULL) {
+		PortSlab *slab = portSlabs;
+		portSlabs = slab->next;
+		free(slab);
+	}
 #endif
 
 	return OPDI_STATUS_OK;
@@ -61,21 +132,152 @@ opdi_Port *opdi_get_last_port(void) {
 	return portTail;
 }
 
+uint16_t opdi_get_port_count(void) {
+	return portCount;
+}
+
+opdi_Port *opdi_get_port_at(uint16_t index) {
+#ifdef OPDI_DYNAMIC_PORTS
+	if (index >= portCount)
+		return NULL;
+	return portTable[index];
+#else
+	opdi_Port *port = portHead;
+	while ((port != NULL) && (index > 0)) {
+		port = port->next;
+		index--;
+	}
+	return port;
+#endif
+}
+
+#ifdef PORT_INDEX
+
+/** Enters the port into the index. If a port with the same ID has been added before, the index keeps
+*   that port, like the lookup in the list.
+*/
+static void index_port(opdi_Port *port) {
+	uint32_t slot = index_hash(port->id) & (portIndexSize - 1);
+	uint32_t i;
+
+	for (i = 0; i < portIndexSize; i++) {
+		if (portIndex[slot] == NULL) {
+			portIndex[slot] = port;
+			return;
+		}
+		if (!strcmp(portIndex[slot]->id, port->id))
+			return;
+		slot = (slot + 1) & (portIndexSize - 1);
+	}
+	portIndexFull = 1;
+}
+
+#endif
+
+#ifdef OPDI_DYNAMIC_PORTS
+
+opdi_Port *opdi_new_port(void) {
+	PortSlab *slab = portSlabs;
+
+	if ((slab == NULL) || (slab->used >= OPDI_DYNAMIC_PORTS)) {
+		slab = (PortSlab *)calloc(1, sizeof(PortSlab));
+		if (slab == NULL)
+			return NULL;
+		slab->next = portSlabs;
+		portSlabs = slab;
+	}
+	return &slab->ports[slab->used++];
+}
+
+/** Makes room for one more port in the table and in the index of the registry.
+*   Returns OPDI_TOO_MANY_PORTS if there is not enough memory.
+*/
+static uint8_t grow_registry(void) {
+	opdi_Port **table;
+	uint32_t size;
+	uint16_t i;
+
+	if (portCount >= portTableSize) {
+		// the table starts with room for OPDI_MAX_DEVICE_PORTS ports and doubles its size
+		size = (portTableSize == 0 ? OPDI_MAX_DEVICE_PORTS : 2 * (uint32_t)portTableSize);
+		if (size > 0xffff)
+			size = 0xffff;
+		table = (opdi_Port **)realloc(portTable, size * sizeof(opdi_Port *));
+		if (table == NULL)
+			return OPDI_TOO_MANY_PORTS;
+		portTable = table;
+		portTableSize = (uint16_t)size;
+	}
+
+	if (2 * ((uint32_t)portCount + 1) > portIndexSize) {
+		size = (portIndexSize == 0 ? PORT_INDEX_MIN_SIZE : 2 * portIndexSize);
+		table = (opdi_Port **)calloc(size, sizeof(opdi_Port *));
+		if (table == NULL)
+			return OPDI_TOO_MANY_PORTS;
+		free(portIndex);
+		portIndex = table;
+		portIndexSize = size;
+		// enter the ports again in the order of the list
+		for (i = 0; i < portCount; i++)
+			index_port(portTable[i]);
+	}
+	return OPDI_STATUS_OK;
+}
+
+#endif
+
+/** Returns the kind of the port type (see OPDI_PORTKIND_*).
+*/
+static uint8_t port_kind(const char *type) {
+	if ((type == NULL) || (type[0] < '0') || (type[1] != '\0'))
+		return OPDI_PORTKIND_UNKNOWN;
+	if (type[0] - '0' >= OPDI_PORTKIND_UNKNOWN)
+		return OPDI_PORTKIND_UNKNOWN;
+	return (uint8_t)(type[0] - '0');
+}
+
 uint8_t opdi_add_port(opdi_Port *port) {
-	portCount++;
-	if (portCount > OPDI_MAX_DEVICE_PORTS)
+#ifdef OPDI_DYNAMIC_PORTS
+	if ((portCount >= 0xffff) || (grow_registry() != OPDI_STATUS_OK))
 		return OPDI_TOO_MANY_PORTS;
+	portTable[portCount] = port;
+#else
+	if (portCount >= OPDI_MAX_DEVICE_PORTS)
+		return OPDI_TOO_MANY_PORTS;
+#endif
+	portCount++;
 	if (portHead == NULL)
 		portHead = port;
 	if (portTail != NULL)
 		portTail->next = port;
 	portTail = port;
 	port->next = NULL;
+	port->kind = port_kind(port->type);
+#ifdef PORT_INDEX
+	index_port(port);
+#endif
 	return OPDI_STATUS_OK;
 }
 
 opdi_Port *opdi_find_port_by_id(const char *id) {
-	opdi_Port *port = portHead;
+	opdi_Port *port;
+#ifdef PORT_INDEX
+	uint32_t slot = index_hash(id) & (portIndexSize - 1);
+	uint32_t i;
+
+	for (i = 0; i < portIndexSize; i++) {
+		port = portIndex[slot];
+		if (port == NULL)
+			break;
+		if (!strcmp(port->id, id))
+			return port;
+		slot = (slot + 1) & (portIndexSize - 1);
+	}
+	// all ports are indexed unless the index has overflowed
+	if (!portIndexFull)
+		return NULL;
+#endif
+	port = portHead;
 	while (port != NULL) {
 		if (!strcmp(port->id, id))
 			return port;
@@ -86,6 +288,28 @@ opdi_Port *opdi_find_port_by_id(const char *id) {
 
 #ifdef OPDI_EXTENDED_PROTOCOL
 
+#ifdef OPDI_PORT_INDEX_SIZE
+
+/** Enters the group into the index. Works like index_port.
+*/
+static void index_portgroup(opdi_PortGroup *group) {
+	uint32_t slot = index_hash(group->id) & (OPDI_PORT_INDEX_SIZE - 1);
+	uint32_t i;
+
+	for (i = 0; i < OPDI_PORT_INDEX_SIZE; i++) {
+		if (groupIndex[slot] == NULL) {
+			groupIndex[slot] = group;
+			return;
+		}
+		if (!strcmp(groupIndex[slot]->id, group->id))
+			return;
+		slot = (slot + 1) & (OPDI_PORT_INDEX_SIZE - 1);
+	}
+	groupIndexFull = 1;
+}
+
+#endif
+
 uint8_t opdi_add_portgroup(opdi_PortGroup *group) {
 	if (portGroupHead == NULL)
 		portGroupHead = group;
@@ -93,11 +317,31 @@ uint8_t opdi_add_portgroup(opdi_PortGroup *group) {
 		portGroupTail->next = group;
 	portGroupTail = group;
 	group->next = NULL;
+#ifdef OPDI_PORT_INDEX_SIZE
+	index_portgroup(group);
+#endif
 	return OPDI_STATUS_OK;
 }
 
 opdi_PortGroup *opdi_find_portgroup_by_id(const char *id) {
-	opdi_PortGroup *group = portGroupHead;
+	opdi_PortGroup *group;
+#ifdef OPDI_PORT_INDEX_SIZE
+	uint32_t slot = index_hash(id) & (OPDI_PORT_INDEX_SIZE - 1);
+	uint32_t i;
+
+	for (i = 0; i < OPDI_PORT_INDEX_SIZE; i++) {
+		group = groupIndex[slot];
+		if (group == NULL)
+			break;
+		if (!strcmp(group->id, id))
+			return group;
+		slot = (slot + 1) & (OPDI_PORT_INDEX_SIZE - 1);
+	}
+	// all groups are indexed unless the index has overflowed
+	if (!groupIndexFull)
+		return NULL;
+#endif
+	group = portGroupHead;
 	while (group != NULL) {
 		if (!strcmp(group->id, id))
 			return group;
@@ -110,19 +354,19 @@ opdi_PortGroup *opdi_find_portgroup_by_id(const char *id) {
 
 #if (OPDI_STREAMING_PORTS > 0)
 
-uint8_t opdi_bind_port(opdi_Port *port, channel_t channel) {
+uint8_t opdi_bind_port(opdi_Session *session, opdi_Port *port, channel_t channel) {
 	uint8_t i;
 	opdi_StreamingPortInfo *spi;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_STREAMING))
+	if (port->kind != OPDI_PORTKIND_STREAMING)
 		return OPDI_WRONG_PORT_TYPE;
 
 	// channel already bound?
 	// determine existing binding
-	for (i = 0; i < sPortBindCount; i++) {
-		if (sPortBinds[i].channel == channel) {
+	for (i = 0; i < session->portBindCount; i++) {
+		if (session->portBinds[i].channel == channel) {
 			// different port bound?
-			if (sPortBinds[i].port != port)
+			if (session->portBinds[i].port != port)
 				return OPDI_CHANNEL_INVALID;
 			else
 				// port already bound to this channel
@@ -130,33 +374,37 @@ uint8_t opdi_bind_port(opdi_Port *port, channel_t channel) {
 		}
 	}
 
+	// the port remembers one channel; it can't be bound by two sessions
+	spi = (opdi_StreamingPortInfo *)port->info.ptr;
+	if (spi->channel != 0)
+		return OPDI_PORT_ACCESS_DENIED;
+
 	// new binding possible?
-	if (sPortBindCount >= OPDI_STREAMING_PORTS)
+	if (session->portBindCount >= OPDI_STREAMING_PORTS)
 		return OPDI_TOO_MANY_BINDINGS;
 
-	sPortBinds[sPortBindCount].channel = channel;
-	sPortBinds[sPortBindCount].port = port;
+	session->portBinds[session->portBindCount].channel = channel;
+	session->portBinds[session->portBindCount].port = port;
 
 	// remember channel
-	spi = (opdi_StreamingPortInfo *)port->info.ptr;
 	spi->channel = channel;
 
-	sPortBindCount++;
+	session->portBindCount++;
 
 	return OPDI_STATUS_OK;
 }
 
-uint8_t opdi_unbind_port(opdi_Port *port) {
+uint8_t opdi_unbind_port(opdi_Session *session, opdi_Port *port) {
 	uint8_t i;
 	opdi_StreamingPortInfo *spi;
 	int8_t portPos = -1;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_STREAMING))
+	if (port->kind != OPDI_PORTKIND_STREAMING)
 		return OPDI_WRONG_PORT_TYPE;
 
 	// determine port binding location
-	for (i = 0; i < sPortBindCount; i++) {
-		if (sPortBinds[i].port == port) {
+	for (i = 0; i < session->portBindCount; i++) {
+		if (session->portBinds[i].port == port) {
 			portPos = i;
 			break;
 		}
@@ -172,24 +420,24 @@ uint8_t opdi_unbind_port(opdi_Port *port) {
 	spi->channel = 0;
 
 	// shift port bindings left
-	for (i = portPos + 1; i < sPortBindCount; i++)
-		sPortBinds[i - 1] = sPortBinds[i];
+	for (i = portPos + 1; i < session->portBindCount; i++)
+		session->portBinds[i - 1] = session->portBinds[i];
 
-	sPortBindCount--;
+	session->portBindCount--;
 	
 	return OPDI_STATUS_OK;
 }
 
-uint8_t opdi_try_dispatch_stream(opdi_Message *m) {
+uint8_t opdi_try_dispatch_stream(opdi_Session *session, opdi_Message *m) {
 	uint8_t i;
 	// try to find a binding
-	for (i = 0; i < sPortBindCount; i++) {
-		if (sPortBinds[i].channel == m->channel) {
+	for (i = 0; i < session->portBindCount; i++) {
+		if (session->portBinds[i].channel == m->channel) {
 			// binding found
-			opdi_StreamingPortInfo *spi = (opdi_StreamingPortInfo *)sPortBinds[i].port->info.ptr;
+			opdi_StreamingPortInfo *spi = (opdi_StreamingPortInfo *)session->portBinds[i].port->info.ptr;
 			// dataReceivce function specified?
 			if (spi->dataReceived)
-				return spi->dataReceived(sPortBinds[i].port, m->payload);
+				return spi->dataReceived(session->portBinds[i].port, m->payload);
 			else
 				// handler not provided; this port doesn't accept data
 				return OPDI_STATUS_OK;
@@ -199,30 +447,44 @@ uint8_t opdi_try_dispatch_stream(opdi_Message *m) {
 	return OPDI_NO_BINDING;
 }
 
-uint8_t opdi_reset_bindings() {
+uint8_t opdi_reset_bindings(opdi_Session *session) {
 	uint8_t i;
 
-	// clear all bound channels
-	for (i = 0; i < sPortBindCount; i++) {
-		opdi_StreamingPortInfo *spi = (opdi_StreamingPortInfo *)sPortBinds[i].port->info.ptr;
+	// clear the channels that are bound in this session
+	for (i = 0; i < session->portBindCount; i++) {
+		opdi_StreamingPortInfo *spi = (opdi_StreamingPortInfo *)session->portBinds[i].port->info.ptr;
 		spi->channel = 0;
 	}
 
-	sPortBindCount = 0;
+	session->portBindCount = 0;
 
 	return OPDI_STATUS_OK;
 }
 
-uint16_t opdi_get_port_bind_count() {
-	return sPortBindCount;
+uint16_t opdi_get_port_bind_count(opdi_Session *session) {
+	return session->portBindCount;
 }
 
 #endif
 
 void opdi_set_port_message(const char *message) {
-	strncpy(port_info_message, message, OPDI_MAX_PORT_INFO_MESSAGE);
+	size_t length;
+
+	if (port_session == NULL)
+		return;
+	length = strlen(message);
+	if (length > OPDI_MAX_PORT_INFO_MESSAGE)
+		length = OPDI_MAX_PORT_INFO_MESSAGE;
+	memcpy(port_session->portMessage, message, length);
+	port_session->portMessage[length] = '\0';
+}
+
+void opdi_set_port_session(opdi_Session *session) {
+	if (session != NULL)
+		session->portMessage[0] = '\0';
+	port_session = session;
 }
 
-const char *opdi_get_port_message() {
-	return port_info_message;
+const char *opdi_get_port_message(opdi_Session *session) {
+	return session->portMessage;
 }
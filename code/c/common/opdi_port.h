@@ -26,7 +26,7 @@ extern "C" {
 #define OPDI_QUOTE(x) OPDI_Q(x)
 
 /** Port type constants.
-*   Compared using string comparison.
+*   These strings are sent to the master.
 */
 #define OPDI_PORTTYPE_DIGITAL	"0"
 #define OPDI_PORTTYPE_ANALOG	"1"
@@ -35,6 +35,18 @@ extern "C" {
 #define OPDI_PORTTYPE_STREAMING	"4"
 #define OPDI_PORTTYPE_CUSTOM	"5"
 
+/** Port kind constants. The kind is the numeric value of the port type;
+*   it is set by opdi_add_port and selects the functions that handle the port.
+*/
+#define OPDI_PORTKIND_DIGITAL	0
+#define OPDI_PORTKIND_ANALOG	1
+#define OPDI_PORTKIND_SELECT	2
+#define OPDI_PORTKIND_DIAL		3
+#define OPDI_PORTKIND_STREAMING	4
+#define OPDI_PORTKIND_CUSTOM	5
+// the kind of ports with an unknown type; also the number of known kinds
+#define OPDI_PORTKIND_UNKNOWN	6
+
 /** Port direction constants. 
 */
 #define OPDI_PORTDIRCAP_UNKNOWN	""
@@ -116,6 +128,7 @@ typedef struct opdi_Port {
 	int32_t flags;				// port flags
 	opdi_PtrInt info;			// pointer to additional info (port type dependent)
 	struct opdi_Port *next;		// pointer to next port
+	uint8_t kind;				// the kind of the port (determined from the type by opdi_add_port)
 } opdi_Port;
 
 #ifdef OPDI_EXTENDED_PROTOCOL
@@ -160,15 +173,9 @@ typedef struct opdi_StreamingPortInfo {
 	channel_t channel;
 } opdi_StreamingPortInfo;
 
-/** Holds streaming port bindings.
-*/
-typedef struct opdi_StreamingPortBinding {
-	channel_t channel;
-	struct opdi_Port *port;
-} opdi_StreamingPortBinding;
-
-/** Clears the list of ports. This does not free the memory associated with the ports.
-*   Resets all port bindings of streaming ports.
+/** Clears the list of ports. This does not free the memory associated with the ports,
+*   except for the port records that have been returned by opdi_new_port.
+*   Must not be called while a session has bound streaming ports.
 */
 uint8_t opdi_clear_ports(void);
 
@@ -182,7 +189,31 @@ opdi_Port *opdi_get_ports(void);
 */
 opdi_Port *opdi_get_last_port(void);
 
+/** Returns the number of ports in the list.
+*/
+uint16_t opdi_get_port_count(void);
+
+/** Returns the port at the given position of the list (starting with 0).
+*   NULL if there is no such port. Takes constant time if OPDI_DYNAMIC_PORTS is defined;
+*   otherwise the list is walked.
+*/
+opdi_Port *opdi_get_port_at(uint16_t index);
+
+#ifdef OPDI_DYNAMIC_PORTS
+
+/** Returns a new port record whose members are zero, or NULL if there is not enough memory.
+*   The records are allocated in slabs of OPDI_DYNAMIC_PORTS records and freed by opdi_clear_ports.
+*/
+opdi_Port *opdi_new_port(void);
+
+#endif
+
 /** Adds a port to the list. Returns OPDI_STATUS_OK if everything is ok.
+*   Returns OPDI_TOO_MANY_PORTS if the list already contains OPDI_MAX_DEVICE_PORTS ports or,
+*   if OPDI_DYNAMIC_PORTS is defined, if the registry cannot grow.
+*   Sets the kind of the port from its type; the type must not change after the port has been added.
+*   If OPDI_PORT_INDEX_SIZE or OPDI_DYNAMIC_PORTS is defined the port is also entered into a hashed index by ID;
+*   the ID of the port must not change after it has been added.
 */
 uint8_t opdi_add_port(opdi_Port *port);
 
@@ -193,27 +224,30 @@ opdi_Port *opdi_find_port_by_id(const char *id);
 
 #if (OPDI_STREAMING_PORTS > 0)
 
-/** Binds the port to the specified channel. The port must be a streaming port.
+/** Binds the port to the specified channel of the session. The port must be a streaming port.
+*   The bindings of each session are separate. A port can be bound by one session at a time;
+*   returns OPDI_PORT_ACCESS_DENIED if another session has bound it.
 */
-uint8_t opdi_bind_port(opdi_Port *port, channel_t channel);
+uint8_t opdi_bind_port(opdi_Session *session, opdi_Port *port, channel_t channel);
 
-/** Unbinds the port. The port must be a streaming port.
+/** Unbinds the port from its channel in the session. The port must be a streaming port.
 */
-uint8_t opdi_unbind_port(opdi_Port *port);
+uint8_t opdi_unbind_port(opdi_Session *session, opdi_Port *port);
 
-/** Tries to dispatch the message payload to a bound streaming port. If a streaming port is found,
-*   its dataReceived function from its port information is called and its result returned.
-*   If there is no port bound to this channel, returns OPDI_NO_BINDING.
+/** Tries to dispatch the message payload to a streaming port that is bound in the session.
+*   If a streaming port is found, its dataReceived function from its port information is called
+*   and its result returned. If there is no port bound to this channel, returns OPDI_NO_BINDING.
 */
-uint8_t opdi_try_dispatch_stream(opdi_Message *m);
+uint8_t opdi_try_dispatch_stream(opdi_Session *session, opdi_Message *m);
 
-/** Resets all bindings. This will usually be called when a new connection is being initiated.
+/** Resets the bindings of the session. Is called when a connection is being initiated and when it has ended.
+*   The bindings of other sessions are not changed.
 */
-uint8_t opdi_reset_bindings(void);
+uint8_t opdi_reset_bindings(opdi_Session *session);
 
-/** Returns the number of currently bound streaming ports.
+/** Returns the number of streaming ports that are currently bound in the session.
 */
-uint16_t opdi_get_port_bind_count(void);
+uint16_t opdi_get_port_bind_count(opdi_Session *session);
 
 #endif
 
@@ -229,13 +263,35 @@ opdi_PortGroup *opdi_find_portgroup_by_id(const char *id);
 #endif
 
 /** Used to set the port info message for OPDI_PORT_ACCESS_DENIED and OPDI_PORT_ERROR.
-*   The message is copied into an internal buffer.
+*   The message is copied into the buffer of the session whose request is being handled
+*   by the calling thread (see opdi_set_port_session). It is truncated to OPDI_MAX_PORT_INFO_MESSAGE
+*   characters. Outside of a request the message is ignored.
 */
 void opdi_set_port_message(const char *message);
 
-/** Used to get the port info message for OPDI_PORT_ACCESS_DENIED and OPDI_PORT_ERROR.
+/** Clears the port info message of the session and directs opdi_set_port_message on the calling
+*   thread to the session. Is called by the protocol before it handles a request and with NULL
+*   after the request has been answered.
 */
-const char *opdi_get_port_message(void);
+void opdi_set_port_session(opdi_Session *session);
+
+/** Used to get the port info message of the session for OPDI_PORT_ACCESS_DENIED and OPDI_PORT_ERROR.
+*/
+const char *opdi_get_port_message(opdi_Session *session);
+
+#if defined(OPDI_SINGLE_SESSION) && !defined(OPDI_SESSION_INTERNAL)
+
+// compatibility layer: the port info message and the bindings of the single session
+#define opdi_get_port_message()		opdi_get_port_message(&opdi_single_session)
+#if (OPDI_STREAMING_PORTS > 0)
+#define opdi_bind_port(port, channel)		opdi_bind_port(&opdi_single_session, port, channel)
+#define opdi_unbind_port(port)				opdi_unbind_port(&opdi_single_session, port)
+#define opdi_try_dispatch_stream(m)			opdi_try_dispatch_stream(&opdi_single_session, m)
+#define opdi_reset_bindings()				opdi_reset_bindings(&opdi_single_session)
+#define opdi_get_port_bind_count()			opdi_get_port_bind_count(&opdi_single_session)
+#endif
+
+#endif
 
 #ifdef __cplusplus
 }
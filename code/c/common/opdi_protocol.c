@@ -14,6 +14,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+// this module implements the session functions
+#define OPDI_SESSION_INTERNAL
+
 #include "opdi_constants.h"
 #include "opdi_strings.h"
 #include "opdi_message.h"
@@ -25,17 +28,12 @@
 #include "opdi_platformtypes.h"
 #include "opdi_configspecs.h"
 
-// for splitting messages into parts
-const char *opdi_msg_parts[OPDI_MAX_MESSAGE_PARTS];
-// for assembling a payload
-char opdi_msg_payload[OPDI_MESSAGE_PAYLOAD_LENGTH];
-
 // expects a control message on channel 0
-uint8_t expect_control_message(const char **parts, uint8_t *partCount) {
+uint8_t expect_control_message(opdi_Session *session, const char **parts, uint8_t *partCount) {
 	opdi_Message m;
 	uint8_t result;
 
-	result = opdi_get_message(&m, OPDI_CANNOT_SEND);
+	result = opdi_get_message(session, &m, OPDI_CANNOT_SEND);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -58,85 +56,61 @@ uint8_t expect_control_message(const char **parts, uint8_t *partCount) {
 	return OPDI_STATUS_OK;
 }
 
-uint8_t send_error(uint8_t code, const char *part1, const char *part2) {
+uint8_t send_error(opdi_Session *session, uint8_t code, const char *part1, const char *part2) {
 	// send an error message on the control channel
 	char buf[BUFSIZE_8BIT];
-	opdi_Message message;
 	uint8_t result;
 
 	opdi_uint8_to_str(code, buf);
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_Error;
-	opdi_msg_parts[1] = buf;
-	opdi_msg_parts[2] = part1;
-	opdi_msg_parts[3] = part2;
-	opdi_msg_parts[4] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
+	session->msg_parts[0] = OPDI_Error;
+	session->msg_parts[1] = buf;
+	session->msg_parts[2] = part1;
+	session->msg_parts[3] = part2;
+	session->msg_parts[4] = NULL;
 
 	// send on the control channel
-	message.channel = 0;
-	message.payload = opdi_msg_payload;
-
-	result = opdi_put_message(&message);
+	result = opdi_put_parts(session, 0, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 	return code;
 }
 
-uint8_t send_disagreement(channel_t channel, uint8_t code, const char *part1, const char *part2) {
+uint8_t send_disagreement(opdi_Session *session, channel_t channel, uint8_t code, const char *part1, const char *part2) {
 	// send a disagreement message on the specified channel
 	char buf[BUFSIZE_8BIT];
-	opdi_Message message;
 	uint8_t result;
 
 	opdi_uint8_to_str(code, buf);
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_Disagreement;
-	opdi_msg_parts[1] = buf;
-	opdi_msg_parts[2] = part1;
-	opdi_msg_parts[3] = part2;
-	opdi_msg_parts[4] = NULL;
+	session->msg_parts[0] = OPDI_Disagreement;
+	session->msg_parts[1] = buf;
+	session->msg_parts[2] = part1;
+	session->msg_parts[3] = part2;
+	session->msg_parts[4] = NULL;
 
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	message.channel = channel;
-	message.payload = opdi_msg_payload;
-
-	result = opdi_put_message(&message);
+	result = opdi_put_parts(session, channel, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 	return OPDI_STATUS_OK;
 }
 
-uint8_t send_port_error(channel_t channel, const char *portID, const char *part1, const char *part2) {
+uint8_t send_port_error(opdi_Session *session, channel_t channel, const char *portID, const char *part1, const char *part2) {
 	// send a port error message on the specified channel
-	opdi_Message message;
 	uint8_t result;
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_Error;
-	opdi_msg_parts[1] = portID;
-	opdi_msg_parts[2] = part1;
-	opdi_msg_parts[3] = part2;
-	opdi_msg_parts[4] = NULL;
+	session->msg_parts[0] = OPDI_Error;
+	session->msg_parts[1] = portID;
+	session->msg_parts[2] = part1;
+	session->msg_parts[3] = part2;
+	session->msg_parts[4] = NULL;
 
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	message.channel = channel;
-	message.payload = opdi_msg_payload;
-
-	result = opdi_put_message(&message);
+	result = opdi_put_parts(session, channel, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -144,23 +118,15 @@ uint8_t send_port_error(channel_t channel, const char *portID, const char *part1
 }
 
 #if (OPDI_STREAMING_PORTS > 0) || !defined(OPDI_NO_AUTHENTICATION)
-uint8_t send_agreement(channel_t channel) {
+uint8_t send_agreement(opdi_Session *session, channel_t channel) {
 	// send an agreement message on the specified channel
-	opdi_Message message;
 	uint8_t result;
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_Agreement;
-	opdi_msg_parts[1] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	message.channel = channel;
-	message.payload = opdi_msg_payload;
+	session->msg_parts[0] = OPDI_Agreement;
+	session->msg_parts[1] = NULL;
 
-	result = opdi_put_message(&message);
+	result = opdi_put_parts(session, channel, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -168,32 +134,29 @@ uint8_t send_agreement(channel_t channel) {
 }
 #endif
 
-/** Common function: send the contents of the opdi_msg_parts array on the specified channel.
+/** Common function: send the already joined contents of the session's msg_payload on the specified channel.
 */
-uint8_t send_payload(channel_t channel) {
+uint8_t send_payload(opdi_Session *session, channel_t channel) {
 	opdi_Message message;
 	uint8_t result;
 
 	message.channel = channel;
-	message.payload = opdi_msg_payload;
+	message.payload = session->msg_payload;
 
-	result = opdi_put_message(&message);
+	result = opdi_put_message(session, &message);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 	return OPDI_STATUS_OK;
 }
 
-/** Common function: send the contents of the opdi_msg_parts array on the specified channel.
+/** Common function: send the contents of the session's msg_parts array on the specified channel.
+*   The parts are serialized directly into the message buffer without joining them first.
 */
-uint8_t send_parts(channel_t channel) {
+uint8_t send_parts(opdi_Session *session, channel_t channel) {
 	uint8_t result;
 
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	result = send_payload(channel);
+	result = opdi_put_parts(session, channel, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -14,6 +14,7 @@
 
 #include "opdi_platformtypes.h"
 #include "opdi_configspecs.h"
+#include "opdi_message.h"
 
 // buffer sizes for numeric to string conversions
 #define BUFSIZE_8BIT	5
@@ -23,29 +24,25 @@
 
 // Common functions of the OPDI protocol.
 
-extern const char *opdi_msg_parts[OPDI_MAX_MESSAGE_PARTS];
-// for assembling a payload
-extern char opdi_msg_payload[OPDI_MESSAGE_PAYLOAD_LENGTH];
-
 // expects a control message on channel 0
-uint8_t expect_control_message(const char **parts, uint8_t *partCount);
+uint8_t expect_control_message(opdi_Session *session, const char **parts, uint8_t *partCount);
 
 // sends an error with optional additional information
-uint8_t send_error(uint8_t code, const char *part1, const char *part2);
+uint8_t send_error(opdi_Session *session, uint8_t code, const char *part1, const char *part2);
 
 // sends a disagreement message with optional additional information
-uint8_t send_disagreement(channel_t channel, uint8_t code, const char *part1, const char *part2);
+uint8_t send_disagreement(opdi_Session *session, channel_t channel, uint8_t code, const char *part1, const char *part2);
 
 // sends a port error message with optional additional information
-uint8_t send_port_error(channel_t channel, const char *portID, const char *part1, const char *part2);
+uint8_t send_port_error(opdi_Session *session, channel_t channel, const char *portID, const char *part1, const char *part2);
 
 // sends an agreement message
-uint8_t send_agreement(channel_t channel);
+uint8_t send_agreement(opdi_Session *session, channel_t channel);
 
-// sends the contents of the opdi_msg_parts array on the specified channel
-uint8_t send_payload(channel_t channel);
+// sends the already joined contents of the session's msg_payload buffer on the specified channel
+uint8_t send_payload(opdi_Session *session, channel_t channel);
 
-// sends the contents of the opdi_msg_parts array on the specified channel
-uint8_t send_parts(channel_t channel);
+// sends the contents of the session's msg_parts array on the specified channel
+uint8_t send_parts(opdi_Session *session, channel_t channel);
 
 #endif		// __OPDI_PROTOCOL_H
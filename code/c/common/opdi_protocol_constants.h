@@ -15,6 +15,14 @@
 
 #define OPDI_PARTS_SEPARATOR			':'
 #define OPDI_MULTIMESSAGE_SEPARATOR		'\r'
+// starts the payload of a message fragment that is continued by the next message on the same channel
+#define OPDI_FRAGMENT_MARKER			'\x17'
+// is appended to the name of an encryption method to denote its counter mode, e. g. "AES-CTR"
+#define OPDI_ENCRYPTION_CTR_SUFFIX		"-CTR"
+// is appended to the name of an encryption method to denote its Galois/counter mode, e. g. "AES-GCM"
+#define OPDI_ENCRYPTION_GCM_SUFFIX		"-GCM"
+// separates the counter mode method from the nonce in the handshake reply, e. g. "AES-CTR/0123456789abcdef"
+#define OPDI_ENCRYPTION_NONCE_SEPARATOR	'/'
 
 #define OPDI_Handshake 					"OPDI"
 #define OPDI_Handshake_version 			"0.1"
@@ -94,3 +102,36 @@
 
 #define OPDI_getAllSelectPortLabels		"gASL"
 
+// The request identifiers packed into integers, the first character in the highest byte.
+// The slave dispatches requests with a switch over these keys instead of comparing strings.
+// They must match the identifiers above.
+#define OPDI_COMMAND_KEY(a, b, c, d)	(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+#define OPDI_KEY_getDeviceCaps			OPDI_COMMAND_KEY('g', 'D', 'C', 0)
+#define OPDI_KEY_getPortInfo			OPDI_COMMAND_KEY('g', 'P', 'I', 0)
+#define OPDI_KEY_getAnalogPortState		OPDI_COMMAND_KEY('g', 'A', 'S', 0)
+#define OPDI_KEY_setAnalogPortValue		OPDI_COMMAND_KEY('s', 'A', 'V', 0)
+#define OPDI_KEY_setAnalogPortMode		OPDI_COMMAND_KEY('s', 'A', 'M', 0)
+#define OPDI_KEY_setAnalogPortResolution	OPDI_COMMAND_KEY('s', 'A', 'R', 0)
+#define OPDI_KEY_setAnalogPortReference	OPDI_COMMAND_KEY('s', 'A', 'R', 'F')
+#define OPDI_KEY_getDigitalPortState	OPDI_COMMAND_KEY('g', 'D', 'S', 0)
+#define OPDI_KEY_setDigitalPortLine		OPDI_COMMAND_KEY('s', 'D', 'L', 0)
+#define OPDI_KEY_setDigitalPortMode		OPDI_COMMAND_KEY('s', 'D', 'M', 0)
+#define OPDI_KEY_getSelectPortLabel		OPDI_COMMAND_KEY('g', 'S', 'L', 0)
+#define OPDI_KEY_getSelectPortState		OPDI_COMMAND_KEY('g', 'S', 'S', 0)
+#define OPDI_KEY_setSelectPortPosition	OPDI_COMMAND_KEY('s', 'S', 'P', 0)
+#define OPDI_KEY_getDialPortState		OPDI_COMMAND_KEY('g', 'D', 'L', 'S')
+#define OPDI_KEY_setDialPortPosition	OPDI_COMMAND_KEY('s', 'D', 'L', 'P')
+#define OPDI_KEY_getCustomPortState		OPDI_COMMAND_KEY('g', 'C', 'P', 'S')
+#define OPDI_KEY_setCustomPortState		OPDI_COMMAND_KEY('s', 'C', 'P', 'S')
+#define OPDI_KEY_bindStreamingPort		OPDI_COMMAND_KEY('b', 'S', 'P', 0)
+#define OPDI_KEY_unbindStreamingPort	OPDI_COMMAND_KEY('u', 'S', 'P', 0)
+
+#define OPDI_KEY_getAllPortInfos		OPDI_COMMAND_KEY('g', 'A', 'P', 'I')
+#define OPDI_KEY_getExtendedPortInfo	OPDI_COMMAND_KEY('g', 'E', 'P', 'I')
+#define OPDI_KEY_getExtendedPortState	OPDI_COMMAND_KEY('g', 'E', 'P', 'S')
+#define OPDI_KEY_getAllPortStates		OPDI_COMMAND_KEY('g', 'A', 'P', 'S')
+#define OPDI_KEY_getExtendedDeviceInfo	OPDI_COMMAND_KEY('g', 'E', 'D', 'I')
+#define OPDI_KEY_getGroupInfo			OPDI_COMMAND_KEY('g', 'G', 'I', 0)
+#define OPDI_KEY_getExtendedGroupInfo	OPDI_COMMAND_KEY('g', 'E', 'G', 'I')
+#define OPDI_KEY_getAllSelectPortLabels	OPDI_COMMAND_KEY('g', 'A', 'S', 'L')
@@ -934,6 +934,22 @@ CRijndael::CRijndael() : m_bKeyInit(false)
 //DESTRUCTOR
 CRijndael::~CRijndael()
 {
+	//Clear the round keys and the chain; the optimizer may not remove volatile stores
+	volatile char* p = (volatile char*)m_Ke;
+	for(size_t i=0; i<sizeof(m_Ke); i++)
+		p[i] = 0;
+	p = (volatile char*)m_Kd;
+	for(size_t i=0; i<sizeof(m_Kd); i++)
+		p[i] = 0;
+	p = (volatile char*)tk;
+	for(size_t i=0; i<sizeof(tk); i++)
+		p[i] = 0;
+	p = m_chain0;
+	for(size_t i=0; i<sizeof(m_chain0); i++)
+		p[i] = 0;
+	p = m_chain;
+	for(size_t i=0; i<sizeof(m_chain); i++)
+		p[i] = 0;
 }
 
 //Expand a user-supplied key material into a session key.
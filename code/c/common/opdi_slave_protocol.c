@@ -25,9 +25,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+// this module implements the session functions
+#define OPDI_SESSION_INTERNAL
+
 #include "opdi_constants.h"
 #include "opdi_strings.h"
 #include "opdi_message.h"
+#include "opdi_trace.h"
 #include "opdi_protocol.h"
 #include "opdi_slave_protocol.h"
 #include "opdi_protocol_constants.h"
@@ -36,94 +40,136 @@
 #include "opdi_platformtypes.h"
 #include "opdi_configspecs.h"
 
-static uint8_t connected;
+#if defined(OPDI_EXTENDED_PROTOCOL) && defined(OPDI_MULTIMESSAGE_BUFFER_SIZE)
+/** Sends the messages collected since opdi_begin_multimessage.
+*   Returns the given result unless it is OK and sending fails.
+*/
+static uint8_t end_multimessage(opdi_Session *session, uint8_t result) {
+	uint8_t sendResult = opdi_end_multimessage(session);
+	if (result != OPDI_STATUS_OK)
+		return result;
+	return sendResult;
+}
+#endif
+
+/** Returns the ID of the port that context points to and advances context to the next port
+*   (see opdi_put_items).
+*/
+static const char *next_port_id(void *context, uint16_t index) {
+	opdi_Port **port = (opdi_Port **)context;
+	const char *id;
+
+	if (*port == NULL)
+		return NULL;
+	id = (*port)->id;
+	*port = (*port)->next;
+	return id;
+}
+
+/** Returns the length of an item of a comma-separated list including the escape characters.
+*/
+static uint16_t list_item_length(const char *item) {
+	uint16_t length = 0;
+
+	// empty items are encoded as a blank
+	if (*item == '\0')
+		return 1;
+	for (; *item; item++)
+		length += ((*item == ',') || (*item == OPDI_PARTS_SEPARATOR) ? 2 : 1);
+	return length;
+}
 
 // send a comma-separated list of port IDs
-static uint8_t send_device_caps(channel_t channel) {
-	opdi_Message message;
-	uint16_t portCount = 0;
-	const char *opdi_msg_parts[OPDI_MAX_DEVICE_PORTS];
-	char portCSV[OPDI_MESSAGE_PAYLOAD_LENGTH];
+// if the request contains the position of a port in the list, the reply contains the IDs from
+// this port on that fit into one frame, preceded by the position of the next page, or 0 if it
+// is the last page (BDC:next:IDs)
+static uint8_t send_device_caps(opdi_Session *session, channel_t channel) {
 	opdi_Port *port;
+	opdi_Port *first;
+	uint16_t cursor;
+	uint16_t count = 0;
+	uint32_t length = 0;
+	uint16_t limit;
+	char next[BUFSIZE_16BIT];
 	uint8_t result;
 
-	// prepare list of device ports
-	opdi_msg_parts[0] = NULL;
-	port = opdi_get_ports();
-	while (port != NULL) {
-		if (portCount >= OPDI_MAX_DEVICE_PORTS)
-			return OPDI_TOO_MANY_PORTS;
-		opdi_msg_parts[portCount++] = port->id;
-		port = port->next;
+	if (session->msg_parts[1] == NULL) {
+		session->msg_parts[0] = "BDC";
+
+		// send on the same channel; the port IDs are joined as comma separated list
+		// the message is sent as fragments if it is too long and the master accepts them
+		port = opdi_get_ports();
+		return opdi_put_items(session, channel, session->msg_parts, &next_port_id, &port, 0xffff);
 	}
-	opdi_msg_parts[portCount] = NULL;
 
-	// join port IDs as comma separated list
-	result = strings_join(opdi_msg_parts, ',', portCSV, OPDI_MESSAGE_PAYLOAD_LENGTH);
+	result = opdi_str_to_uint16(session->msg_parts[1], &cursor);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	// join payload
-	opdi_msg_parts[0] = "BDC";
-	opdi_msg_parts[1] = portCSV;
-	opdi_msg_parts[2] = NULL;
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
+	// the payload consists of the magic, the position of the next page and the list
+	limit = opdi_get_payload_limit(session) - (3 + BUFSIZE_16BIT + 1);
 
-	// send on the same channel
-	message.channel = channel;
-	message.payload = opdi_msg_payload;
+	// the page contains at least one port
+	first = opdi_get_port_at(cursor);
+	port = first;
+	while (port != NULL) {
+		length += list_item_length(port->id) + (count > 0 ? 1 : 0);
+		if ((count > 0) && (length > limit))
+			break;
+		count++;
+		port = port->next;
+	}
+	opdi_uint16_to_str(port == NULL ? 0 : cursor + count, next);
 
-	result = opdi_put_message(&message);
-	if (result != OPDI_STATUS_OK)
-		return result;
-	
-	return OPDI_STATUS_OK;
+	session->msg_parts[0] = "BDC";
+	session->msg_parts[1] = next;
+	session->msg_parts[2] = NULL;
+
+	port = first;
+	return opdi_put_items(session, channel, session->msg_parts, &next_port_id, &port, count);
 }
 
-#ifndef OPDI_NO_DIGITAL_PORTS
-static uint8_t send_digital_port_info(channel_t channel, opdi_Port *port) {
-	char flagStr[BUFSIZE_32BIT];
+// the maximum number of parts of a port info message (dial port)
+#define PORT_INFO_PARTS		7
 
-	opdi_int32_to_str(port->flags, flagStr);
+/** The parts of a port info message and the buffers of the numbers in them.
+*/
+typedef struct opdi_InfoRecord {
+	const char *parts[PORT_INFO_PARTS + 1];
+	char numbers[3][BUFSIZE_64BIT];
+	char flags[BUFSIZE_32BIT];
+} opdi_InfoRecord;
 
-	// join payload
-	opdi_msg_parts[0] = OPDI_digitalPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-	opdi_msg_parts[3] = port->caps;
-	opdi_msg_parts[4] = flagStr;
-	opdi_msg_parts[5] = NULL;
-
-	return send_parts(channel);
+#ifndef OPDI_NO_DIGITAL_PORTS
+static void digital_port_info(opdi_Port *port, opdi_InfoRecord *record) {
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_digitalPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+	record->parts[3] = port->caps;
+	record->parts[4] = record->flags;
+	record->parts[5] = NULL;
 }
 #endif
 
 #ifndef OPDI_NO_ANALOG_PORTS
-static uint8_t send_analog_port_info(channel_t channel, opdi_Port *port) {
-	char flagStr[BUFSIZE_32BIT];
-
-	opdi_int32_to_str(port->flags, flagStr);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_analogPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-	opdi_msg_parts[3] = port->caps;
-	opdi_msg_parts[4] = flagStr;
-	opdi_msg_parts[5] = NULL;
-
-	return send_parts(channel);
+static void analog_port_info(opdi_Port *port, opdi_InfoRecord *record) {
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_analogPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+	record->parts[3] = port->caps;
+	record->parts[4] = record->flags;
+	record->parts[5] = NULL;
 }
 #endif
 
 #ifndef OPDI_NO_SELECT_PORTS
-static uint8_t send_select_port_info(channel_t channel, opdi_Port *port) {
+static void select_port_info(opdi_Port *port, opdi_InfoRecord *record) {
 	char **labels;
 	uint16_t positions = 0;
-	char buf[BUFSIZE_16BIT];
-	char flagStr[BUFSIZE_32BIT];
 
 	// port info is an array of char*
 	labels = (char**)port->info.ptr;
@@ -133,122 +179,72 @@ static uint8_t send_select_port_info(channel_t channel, opdi_Port *port) {
 		positions++;
 
 	// convert positions to str
-	opdi_uint16_to_str(positions, (char *)&buf);
-	opdi_int32_to_str(port->flags, flagStr);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_selectPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-	opdi_msg_parts[3] = buf;
-	opdi_msg_parts[4] = flagStr;
-	opdi_msg_parts[5] = NULL;
-
-	return send_parts(channel);
+	opdi_uint16_to_str(positions, record->numbers[0]);
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_selectPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+	record->parts[3] = record->numbers[0];
+	record->parts[4] = record->flags;
+	record->parts[5] = NULL;
 }
 #endif
 
 #ifndef OPDI_NO_DIAL_PORTS
-static uint8_t send_dial_port_info(channel_t channel, opdi_Port *port) {
-	char minbuf[BUFSIZE_64BIT];
-	char maxbuf[BUFSIZE_64BIT];
-	char stepbuf[BUFSIZE_64BIT];
-	char flagStr[BUFSIZE_32BIT];
-
+static void dial_port_info(opdi_Port *port, opdi_InfoRecord *record) {
 	opdi_DialPortInfo *dpi = (opdi_DialPortInfo *)port->info.ptr;
 	// convert values to strings
-	opdi_int64_to_str(dpi->min, (char *)&minbuf);
-	opdi_int64_to_str(dpi->max, (char *)&maxbuf);
-	opdi_int64_to_str(dpi->step, (char *)&stepbuf);
-	opdi_int32_to_str(port->flags, flagStr);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_dialPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-	opdi_msg_parts[3] = minbuf;
-	opdi_msg_parts[4] = maxbuf;
-	opdi_msg_parts[5] = stepbuf;
-	opdi_msg_parts[6] = flagStr;
-	opdi_msg_parts[7] = NULL;
-
-	return send_parts(channel);
+	opdi_int64_to_str(dpi->min, record->numbers[0]);
+	opdi_int64_to_str(dpi->max, record->numbers[1]);
+	opdi_int64_to_str(dpi->step, record->numbers[2]);
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_dialPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+	record->parts[3] = record->numbers[0];
+	record->parts[4] = record->numbers[1];
+	record->parts[5] = record->numbers[2];
+	record->parts[6] = record->flags;
+	record->parts[7] = NULL;
 }
 #endif
 
 #ifdef OPDI_USE_CUSTOM_PORTS
-static uint8_t send_custom_port_info(channel_t channel, opdi_Port *port) {
-	char flagStr[BUFSIZE_32BIT];
-
+static void custom_port_info(opdi_Port *port, opdi_InfoRecord *record) {
 //	opdi_CustomPortInfo *cpi = (opdi_CustomPortInfo *)port->info.ptr;
 	// convert values to strings
-	opdi_int32_to_str(port->flags, flagStr);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_customPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-//	opdi_msg_parts[3] = cpi->custom;
-	opdi_msg_parts[3] = flagStr;
-	opdi_msg_parts[4] = NULL;
-
-	return send_parts(channel);
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_customPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+//	record->parts[3] = cpi->custom;
+	record->parts[3] = record->flags;
+	record->parts[4] = NULL;
 }
 #endif
 
 #if (OPDI_STREAMING_PORTS > 0)
-static uint8_t send_streaming_port_info(channel_t channel, opdi_Port *port) {
-	char buf[BUFSIZE_16BIT];
-
+static void streaming_port_info(opdi_Port *port, opdi_InfoRecord *record) {
 	opdi_StreamingPortInfo *spi = (opdi_StreamingPortInfo *)port->info.ptr;
 	// convert flags to str
-	opdi_int32_to_str(port->flags, (char *)&buf);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_streamingPort;	// port magic
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = port->name;
-	opdi_msg_parts[3] = spi->driverID;
-	opdi_msg_parts[4] = buf;
-	opdi_msg_parts[5] = NULL;
-
-	return send_parts(channel);
+	opdi_int32_to_str(port->flags, record->flags);
+
+	record->parts[0] = OPDI_streamingPort;	// port magic
+	record->parts[1] = port->id;
+	record->parts[2] = port->name;
+	record->parts[3] = spi->driverID;
+	record->parts[4] = record->flags;
+	record->parts[5] = NULL;
 }
 #endif
 
-static uint8_t send_port_info(channel_t channel, opdi_Port *port) {
-
-#ifndef OPDI_NO_DIGITAL_PORTS
-	if (0 == strcmp(port->type, OPDI_PORTTYPE_DIGITAL)) {
-		return send_digital_port_info(channel, port);
-#else
-	// "better keep it gramat."
-	if (0) {
-#endif
-#ifndef OPDI_NO_ANALOG_PORTS
-	} else if (0 == strcmp(port->type, OPDI_PORTTYPE_ANALOG)) {
-		return send_analog_port_info(channel, port);
-#endif
-#ifndef OPDI_NO_SELECT_PORTS
-	} else if (0 == strcmp(port->type, OPDI_PORTTYPE_SELECT)) {
-		return send_select_port_info(channel, port);
-#endif
-#ifndef OPDI_NO_DIAL_PORTS
-	} else if (0 == strcmp(port->type, OPDI_PORTTYPE_DIAL)) {
-		return send_dial_port_info(channel, port);
-#endif
-#if (OPDI_STREAMING_PORTS > 0)
-	} else if (0 == strcmp(port->type, OPDI_PORTTYPE_STREAMING)) {
-		return send_streaming_port_info(channel, port);
-#endif
-	} else
-		return OPDI_PORTTYPE_UNKNOWN;
-}
-
 /// analog port functions
 
 #ifndef OPDI_NO_ANALOG_PORTS
-static uint8_t get_analog_port_state(opdi_Port *port) {
+static uint8_t send_analog_port_state(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	char mode[] = " ";
 	char res[] = " ";
@@ -256,53 +252,45 @@ static uint8_t get_analog_port_state(opdi_Port *port) {
 	int32_t value = 0;
 	char valStr[BUFSIZE_32BIT];
 
-	if (0 != strcmp(port->type, OPDI_PORTTYPE_ANALOG)) {
+	if (port->kind != OPDI_PORTKIND_ANALOG) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
 	result = opdi_get_analog_port_state(port, mode, res, ref, &value);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	opdi_int32_to_str(value, valStr);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_analogPortState;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = mode;
-	opdi_msg_parts[3] = ref;
-	opdi_msg_parts[4] = res;
-	opdi_msg_parts[5] = valStr;
-	opdi_msg_parts[6] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	return OPDI_STATUS_OK;
-}
-
-static uint8_t send_analog_port_state(channel_t channel, opdi_Port *port) {
-	uint8_t result = get_analog_port_state(port);
 	if (result == OPDI_PORT_ERROR) {
-		send_port_error(channel, port->id, opdi_get_port_message(), NULL);
+		send_port_error(session, channel, port->id, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	else
 	if (result == OPDI_PORT_ACCESS_DENIED) {
-		send_disagreement(channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(), NULL);
+		send_disagreement(session, channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_payload(channel);
+	opdi_int32_to_str(value, valStr);
+
+	// join payload
+	session->msg_parts[0] = OPDI_analogPortState;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = mode;
+	session->msg_parts[3] = ref;
+	session->msg_parts[4] = res;
+	session->msg_parts[5] = valStr;
+	session->msg_parts[6] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t set_analog_port_value(channel_t channel, opdi_Port *port, const char *value) {
+static uint8_t set_analog_port_value(opdi_Session *session, channel_t channel, opdi_Port *port, const char *value) {
 	int32_t val;
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_ANALOG) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_str_to_int32(value, &val);
 	if (result != OPDI_STATUS_OK)
 		return result;
@@ -311,106 +299,113 @@ static uint8_t set_analog_port_value(channel_t channel, opdi_Port *port, const c
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_analog_port_state(channel, port);
+	return send_analog_port_state(session, channel, port);
 }
 
-static uint8_t set_analog_port_mode(channel_t channel, opdi_Port *port, const char *mode) {
+static uint8_t set_analog_port_mode(opdi_Session *session, channel_t channel, opdi_Port *port, const char *mode) {
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_ANALOG) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_set_analog_port_mode(port, mode);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_analog_port_state(channel, port);
+	return send_analog_port_state(session, channel, port);
 }
 
-static uint8_t set_analog_port_resolution(channel_t channel, opdi_Port *port, const char *res) {
+static uint8_t set_analog_port_resolution(opdi_Session *session, channel_t channel, opdi_Port *port, const char *res) {
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_ANALOG) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_set_analog_port_resolution(port, res);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_analog_port_state(channel, port);
+	return send_analog_port_state(session, channel, port);
 }
 
-static uint8_t set_analog_port_reference(channel_t channel, opdi_Port *port, const char *ref) {
+static uint8_t set_analog_port_reference(opdi_Session *session, channel_t channel, opdi_Port *port, const char *ref) {
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_ANALOG) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_set_analog_port_reference(port, ref);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_analog_port_state(channel, port);
+	return send_analog_port_state(session, channel, port);
 }
 #endif
 
 /// digital port functions
 
 #ifndef OPDI_NO_DIGITAL_PORTS
-// writes the digital port state to the opdi_msg_parts array
-static uint8_t get_digital_port_state(opdi_Port *port) {
+static uint8_t send_digital_port_state(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	char mode[] = " ";
 	char line[] = " ";
 
-	if (strcmp(port->type, OPDI_PORTTYPE_DIGITAL)) {
+	if (port->kind != OPDI_PORTKIND_DIGITAL) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
 	result = opdi_get_digital_port_state(port, mode, line);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_digitalPortState;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = mode;
-	opdi_msg_parts[3] = line;
-	opdi_msg_parts[4] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	return OPDI_STATUS_OK;
-}
-
-static uint8_t send_digital_port_state(channel_t channel, opdi_Port *port) {
-	uint8_t result = get_digital_port_state(port);
 	if (result == OPDI_PORT_ERROR) {
-		send_port_error(channel, port->id, opdi_get_port_message(), NULL);
+		send_port_error(session, channel, port->id, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	else
 	if (result == OPDI_PORT_ACCESS_DENIED) {
-		send_disagreement(channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(), NULL);
+		send_disagreement(session, channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_payload(channel);
+	// join payload
+	session->msg_parts[0] = OPDI_digitalPortState;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = mode;
+	session->msg_parts[3] = line;
+	session->msg_parts[4] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t set_digital_port_line(channel_t channel, opdi_Port *port, const char *line) {
+static uint8_t set_digital_port_line(opdi_Session *session, channel_t channel, opdi_Port *port, const char *line) {
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_DIGITAL) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_set_digital_port_line(port, line);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_digital_port_state(channel, port);
+	return send_digital_port_state(session, channel, port);
 }
 
-static uint8_t set_digital_port_mode(channel_t channel, opdi_Port *port, const char *mode) {
+static uint8_t set_digital_port_mode(opdi_Session *session, channel_t channel, opdi_Port *port, const char *mode) {
 	uint8_t result;
 
+	if (port->kind != OPDI_PORTKIND_DIGITAL) {
+		return OPDI_WRONG_PORT_TYPE;
+	}
+
 	result = opdi_set_digital_port_mode(port, mode);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_digital_port_state(channel, port);
+	return send_digital_port_state(session, channel, port);
 }
 #endif
 
@@ -418,13 +413,13 @@ static uint8_t set_digital_port_mode(channel_t channel, opdi_Port *port, const c
 
 #ifndef OPDI_NO_SELECT_PORTS
 
-static uint8_t send_select_port_label(channel_t channel, opdi_Port *port, const char *position) {
+static uint8_t send_select_port_label(opdi_Session *session, channel_t channel, opdi_Port *port, const char *position) {
 	uint8_t result;
 	uint16_t pos;
 	uint16_t i;
 	char **labels;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_SELECT)) {
+	if (port->kind != OPDI_PORTKIND_SELECT) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
@@ -445,67 +440,55 @@ static uint8_t send_select_port_label(channel_t channel, opdi_Port *port, const
 		return OPDI_POSITION_INVALID;
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_selectPortLabel;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = position;
-	opdi_msg_parts[3] = labels[i];
-	opdi_msg_parts[4] = NULL;
+	session->msg_parts[0] = OPDI_selectPortLabel;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = position;
+	session->msg_parts[3] = labels[i];
+	session->msg_parts[4] = NULL;
 
-	return send_parts(channel);
+	return send_parts(session, channel);
 }
 
-static uint8_t get_select_port_state(opdi_Port *port) {
+static uint8_t send_select_port_state(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	uint16_t pos;
 	char position[BUFSIZE_32BIT];
 
-	if (strcmp(port->type, OPDI_PORTTYPE_SELECT)) {
+	if (port->kind != OPDI_PORTKIND_SELECT) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
 	result = opdi_get_select_port_state(port, &pos);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	opdi_uint16_to_str(pos, position);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_selectPortState;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = position;
-	opdi_msg_parts[3] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	return OPDI_STATUS_OK;
-}
-
-static uint8_t send_select_port_state(channel_t channel, opdi_Port *port) {
-	uint8_t result = get_select_port_state(port);
 	if (result == OPDI_PORT_ERROR) {
-		send_port_error(channel, port->id, opdi_get_port_message(), NULL);
+		send_port_error(session, channel, port->id, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	else
 	if (result == OPDI_PORT_ACCESS_DENIED) {
-		send_disagreement(channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(), NULL);
+		send_disagreement(session, channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_payload(channel);
+	opdi_uint16_to_str(pos, position);
+
+	// join payload
+	session->msg_parts[0] = OPDI_selectPortState;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = position;
+	session->msg_parts[3] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t set_select_port_position(channel_t channel, opdi_Port *port, const char *position) {
+static uint8_t set_select_port_position(opdi_Session *session, channel_t channel, opdi_Port *port, const char *position) {
 	uint8_t result;
 	uint16_t pos;
 	uint16_t i;
 	char **labels;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_SELECT)) {
+	if (port->kind != OPDI_PORTKIND_SELECT) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
@@ -529,65 +512,53 @@ static uint8_t set_select_port_position(channel_t channel, opdi_Port *port, cons
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_select_port_state(channel, port);
+	return send_select_port_state(session, channel, port);
 }
 #endif
 
 /// dial port functions
 
 #ifndef OPDI_NO_DIAL_PORTS
-static uint8_t get_dial_port_state(opdi_Port *port) {
+static uint8_t send_dial_port_state(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	int64_t pos;
 	char position[BUFSIZE_64BIT];
 
-	if (strcmp(port->type, OPDI_PORTTYPE_DIAL)) {
+	if (port->kind != OPDI_PORTKIND_DIAL) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
 	result = opdi_get_dial_port_state(port, &pos);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	opdi_int64_to_str(pos, position);
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_dialPortState;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = position;
-	opdi_msg_parts[3] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	return OPDI_STATUS_OK;
-}
-
-static uint8_t send_dial_port_state(channel_t channel, opdi_Port *port) {
-	uint8_t result = get_dial_port_state(port);
 	if (result == OPDI_PORT_ERROR) {
-		send_port_error(channel, port->id, opdi_get_port_message(), NULL);
+		send_port_error(session, channel, port->id, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	else
 	if (result == OPDI_PORT_ACCESS_DENIED) {
-		send_disagreement(channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(), NULL);
+		send_disagreement(session, channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_payload(channel);
+	opdi_int64_to_str(pos, position);
+
+	// join payload
+	session->msg_parts[0] = OPDI_dialPortState;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = position;
+	session->msg_parts[3] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t set_dial_port_position(channel_t channel, opdi_Port *port, const char *position) {
+static uint8_t set_dial_port_position(opdi_Session *session, channel_t channel, opdi_Port *port, const char *position) {
 	uint8_t result;
 	int64_t pos;
 	opdi_DialPortInfo *dpi;
 	int64_t i;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_DIAL)) {
+	if (port->kind != OPDI_PORTKIND_DIAL) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
@@ -607,58 +578,46 @@ static uint8_t set_dial_port_position(channel_t channel, opdi_Port *port, const
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_dial_port_state(channel, port);
+	return send_dial_port_state(session, channel, port);
 }
 #endif
 
 #ifdef OPDI_USE_CUSTOM_PORTS
-static uint8_t get_custom_port_value(opdi_Port *port) {
+static uint8_t send_custom_port_state(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	#define OPDI_CUSTOM_PORT_VALUE_MAXLEN 256
 	char value[OPDI_CUSTOM_PORT_VALUE_MAXLEN];
 
-	if (strcmp(port->type, OPDI_PORTTYPE_CUSTOM)) {
+	if (port->kind != OPDI_PORTKIND_CUSTOM) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
 	result = opdi_get_custom_port_value(port, value, OPDI_CUSTOM_PORT_VALUE_MAXLEN);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	// join payload
-	opdi_msg_parts[0] = OPDI_customPortState;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = value;
-	opdi_msg_parts[3] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	return OPDI_STATUS_OK;
-}
-
-static uint8_t send_custom_port_state(channel_t channel, opdi_Port *port) {
-	uint8_t result = get_custom_port_value(port);
 	if (result == OPDI_PORT_ERROR) {
-		send_port_error(channel, port->id, opdi_get_port_message(), NULL);
+		send_port_error(session, channel, port->id, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	else
 	if (result == OPDI_PORT_ACCESS_DENIED) {
-		send_disagreement(channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(), NULL);
+		send_disagreement(session, channel, OPDI_PORT_ACCESS_DENIED, opdi_get_port_message(session), NULL);
 		return OPDI_STATUS_OK;
 	}
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_payload(channel);
+	// join payload
+	session->msg_parts[0] = OPDI_customPortState;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = value;
+	session->msg_parts[3] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t set_custom_port_value(channel_t channel, opdi_Port *port, const char *value) {
+static uint8_t set_custom_port_value(opdi_Session *session, channel_t channel, opdi_Port *port, const char *value) {
 	uint8_t result;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_CUSTOM)) {
+	if (port->kind != OPDI_PORTKIND_CUSTOM) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
@@ -666,13 +625,201 @@ static uint8_t set_custom_port_value(channel_t channel, opdi_Port *port, const c
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	return send_custom_port_state(channel, port);
+	return send_custom_port_state(session, channel, port);
+}
+#endif
+
+/// port kinds
+
+typedef void (*opdi_InfoFunction)(opdi_Port *port, opdi_InfoRecord *record);
+typedef uint8_t (*opdi_PortFunction)(opdi_Session *session, channel_t channel, opdi_Port *port);
+
+/** The functions that provide the info and send the state of a kind of port. A function is NULL
+*   if the kind does not support it or if it is disabled by the configuration.
+*/
+typedef struct opdi_PortKind {
+	opdi_InfoFunction getInfo;
+	opdi_PortFunction sendState;
+} opdi_PortKind;
+
+// indexed by the kind of the port (see OPDI_PORTKIND_*)
+static const opdi_PortKind portKinds[OPDI_PORTKIND_UNKNOWN] = {
+#ifndef OPDI_NO_DIGITAL_PORTS
+	{ digital_port_info, send_digital_port_state },
+#else
+	{ NULL, NULL },
+#endif
+#ifndef OPDI_NO_ANALOG_PORTS
+	{ analog_port_info, send_analog_port_state },
+#else
+	{ NULL, NULL },
+#endif
+#ifndef OPDI_NO_SELECT_PORTS
+	{ select_port_info, send_select_port_state },
+#else
+	{ NULL, NULL },
+#endif
+#ifndef OPDI_NO_DIAL_PORTS
+	{ dial_port_info, send_dial_port_state },
+#else
+	{ NULL, NULL },
+#endif
+#if (OPDI_STREAMING_PORTS > 0)
+	{ streaming_port_info, NULL },
+#else
+	{ NULL, NULL },
+#endif
+#ifdef OPDI_USE_CUSTOM_PORTS
+	{ custom_port_info, send_custom_port_state }
+#else
+	{ NULL, NULL }
+#endif
+};
+
+/** Returns the function that provides the info of the port, or NULL if the port's type is unknown.
+*/
+static opdi_InfoFunction port_info_function(opdi_Port *port) {
+	if (port->kind >= OPDI_PORTKIND_UNKNOWN)
+		return NULL;
+	return portKinds[port->kind].getInfo;
+}
+
+#ifdef OPDI_EXTENDED_PROTOCOL
+/** Returns the function that sends the state of the port, or NULL if the port has no state.
+*/
+static opdi_PortFunction port_state_function(opdi_Port *port) {
+	if (port->kind >= OPDI_PORTKIND_UNKNOWN)
+		return NULL;
+	return portKinds[port->kind].sendState;
 }
 #endif
 
+static uint8_t send_port_info(opdi_Session *session, channel_t channel, opdi_Port *port) {
+	opdi_InfoFunction getInfo = port_info_function(port);
+	opdi_InfoRecord record;
+
+	if (getInfo == NULL)
+		return OPDI_PORTTYPE_UNKNOWN;
+	getInfo(port, &record);
+	return opdi_put_parts(session, channel, record.parts);
+}
+
+/** The state of the iterator over the info records of a page of ports (see next_info_item).
+*/
+typedef struct opdi_InfoPage {
+	// the port of the current record and the first port that is not on the page
+	opdi_Port *port;
+	opdi_Port *end;
+	opdi_InfoRecord record;
+	// the number of parts of the current record
+	char count[BUFSIZE_8BIT];
+	// the next part of the current record; 0 if the next item is the number of parts
+	uint8_t part;
+} opdi_InfoPage;
+
+/** Fills the record with the info of the port. Returns the number of parts, or 0 if the
+*   port's type is unknown.
+*/
+static uint8_t get_info_record(opdi_Port *port, opdi_InfoRecord *record) {
+	opdi_InfoFunction getInfo = port_info_function(port);
+	uint8_t count = 0;
+
+	if (getInfo == NULL)
+		return 0;
+	getInfo(port, record);
+	while (record->parts[count] != NULL)
+		count++;
+	return count;
+}
+
+/** Returns the next item of the info records of the page that context points to (see opdi_put_items).
+*   Each record consists of the number of its parts followed by the parts of the port info message.
+*   Ports whose type is unknown are skipped.
+*/
+static const char *next_info_item(void *context, uint16_t index) {
+	opdi_InfoPage *page = (opdi_InfoPage *)context;
+	const char *item;
+	uint8_t count = 0;
+
+	if (page->part == 0) {
+		// start the record of the next port
+		while ((page->port != page->end) && (count == 0)) {
+			count = get_info_record(page->port, &page->record);
+			if (count == 0)
+				page->port = page->port->next;
+		}
+		if (count == 0)
+			return NULL;
+		opdi_uint8_to_str(count, page->count);
+		page->part = 1;
+		return page->count;
+	}
+	item = page->record.parts[page->part - 1];
+	if (page->record.parts[page->part] == NULL) {
+		// the record is complete
+		page->port = page->port->next;
+		page->part = 0;
+	} else
+		page->part++;
+	return item;
+}
+
+// send the info records of the ports from the given position of the list on that fit into one frame,
+// preceded by the position of the next page, or 0 if it is the last page (BDC:next:records)
+// the master can thus discover the ports without requesting the info of each port
+static uint8_t send_port_info_page(opdi_Session *session, channel_t channel) {
+	opdi_InfoPage page;
+	opdi_Port *port;
+	uint16_t cursor;
+	uint16_t count = 0;
+	uint32_t length = 0;
+	uint32_t recordLength;
+	uint16_t limit;
+	uint8_t parts;
+	uint8_t i;
+	char next[BUFSIZE_16BIT];
+	uint8_t result;
+
+	if (strcmp(session->msg_parts[2], OPDI_getPortInfo))
+		return OPDI_PROTOCOL_ERROR;
+	result = opdi_str_to_uint16(session->msg_parts[1], &cursor);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	// the payload consists of the magic, the position of the next page and the list
+	limit = opdi_get_payload_limit(session) - (3 + BUFSIZE_16BIT + 1);
+
+	// the page contains at least one port
+	page.port = opdi_get_port_at(cursor);
+	port = page.port;
+	while (port != NULL) {
+		parts = get_info_record(port, &page.record);
+		if (parts > 0) {
+			// the number of parts and the parts, each preceded by a separator
+			recordLength = (parts < 10 ? 1 : 2) + parts;
+			for (i = 0; i < parts; i++)
+				recordLength += list_item_length(page.record.parts[i]);
+			length += recordLength + (length > 0 ? 1 : 0);
+			if ((count > 0) && (length > limit))
+				break;
+		}
+		count++;
+		port = port->next;
+	}
+	opdi_uint16_to_str(port == NULL ? 0 : cursor + count, next);
+
+	session->msg_parts[0] = "BDC";
+	session->msg_parts[1] = next;
+	session->msg_parts[2] = NULL;
+
+	page.end = port;
+	page.part = 0;
+	return opdi_put_items(session, channel, session->msg_parts, &next_info_item, &page, 0xffff);
+}
+
 /// streaming port functions
 #if (OPDI_STREAMING_PORTS > 0)
-static uint8_t bind_streaming_port(channel_t channel, opdi_Port *port, const char *bChan) {
+static uint8_t bind_streaming_port(opdi_Session *session, channel_t channel, opdi_Port *port, const char *bChan) {
 	uint8_t result;
 	channel_t bChannel;
 
@@ -693,11 +840,14 @@ static uint8_t bind_streaming_port(channel_t channel, opdi_Port *port, const cha
 		return OPDI_CHANNEL_INVALID;
 
 	// bind port
-	result = opdi_bind_port(port, bChannel);
+	result = opdi_bind_port(session, port, bChannel);
 
 	// problem
 	if (result == OPDI_TOO_MANY_BINDINGS) {
-		return send_disagreement(channel, result, NULL, NULL);
+		return send_disagreement(session, channel, result, NULL, NULL);
+	}
+	if (result == OPDI_PORT_ACCESS_DENIED) {
+		return send_disagreement(session, channel, result, "Port is bound by another connection", NULL);
 	}
 
 	// error
@@ -705,47 +855,47 @@ static uint8_t bind_streaming_port(channel_t channel, opdi_Port *port, const cha
 		return result;
 
 	// ok
-	return send_agreement(channel);
+	return send_agreement(session, channel);
 }
 
-static uint8_t unbind_streaming_port(channel_t channel, opdi_Port *port) {
+static uint8_t unbind_streaming_port(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 
 	// unbind port
-	result = opdi_unbind_port(port);
+	result = opdi_unbind_port(session, port);
 
 	// error
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 	// ok
-	return send_agreement(channel);
+	return send_agreement(session, channel);
 }
 #endif
 
 #ifdef OPDI_EXTENDED_PROTOCOL
 
-static uint8_t send_extended_port_info(channel_t channel, const char *portID, char *portInfo) {
+static uint8_t send_extended_port_info(opdi_Session *session, channel_t channel, const char *portID, char *portInfo) {
 	// join payload
-	opdi_msg_parts[0] = OPDI_extendedPortInfo;
-	opdi_msg_parts[1] = portID;
-	opdi_msg_parts[2] = portInfo;
-	opdi_msg_parts[3] = NULL;
+	session->msg_parts[0] = OPDI_extendedPortInfo;
+	session->msg_parts[1] = portID;
+	session->msg_parts[2] = portInfo;
+	session->msg_parts[3] = NULL;
 
-	return send_parts(channel);
+	return send_parts(session, channel);
 }
 
-static uint8_t send_extended_port_state(channel_t channel, const char *portID, char *portState) {
+static uint8_t send_extended_port_state(opdi_Session *session, channel_t channel, const char *portID, char *portState) {
 	// join payload
-	opdi_msg_parts[0] = OPDI_extendedPortState;
-	opdi_msg_parts[1] = portID;
-	opdi_msg_parts[2] = portState;
-	opdi_msg_parts[3] = NULL;
+	session->msg_parts[0] = OPDI_extendedPortState;
+	session->msg_parts[1] = portID;
+	session->msg_parts[2] = portState;
+	session->msg_parts[3] = NULL;
 
-	return send_parts(channel);
+	return send_parts(session, channel);
 }
 
-static uint8_t send_all_port_infos(channel_t channel) {
+static uint8_t send_all_port_infos(opdi_Session *session, channel_t channel) {
 	opdi_Port *port;
 	uint8_t result;
 	char buffer[OPDI_EXTENDED_INFO_LENGTH];
@@ -753,107 +903,47 @@ static uint8_t send_all_port_infos(channel_t channel) {
 	port = opdi_get_ports();
 	// go through list of device ports
 	while (port != NULL) {
-
-#ifndef OPDI_NO_DIGITAL_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_DIGITAL) == 0) {
-			result = send_digital_port_info(channel, port);
-			if (result != OPDI_STATUS_OK)
-				return result;
-		}
-		else
-#endif
-#ifndef OPDI_NO_ANALOG_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_ANALOG) == 0) {
-			result = send_analog_port_info(channel, port);
-			if (result != OPDI_STATUS_OK)
-				return result;
-		}
-		else
-#endif
-#ifndef OPDI_NO_SELECT_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_SELECT) == 0) {
-			result = send_select_port_info(channel, port);
+		if (port_info_function(port) != NULL) {
+			result = send_port_info(session, channel, port);
 			if (result != OPDI_STATUS_OK)
 				return result;
-		}
-		else
-#endif
-#ifndef OPDI_NO_DIAL_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_DIAL) == 0) {
-			result = send_dial_port_info(channel, port);
+
+			// send extended port info
+			// copy port ID to the buffer
+			strncpy(buffer, port->id, OPDI_EXTENDED_INFO_LENGTH);
+			result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_PORTINFO, buffer, OPDI_EXTENDED_INFO_LENGTH);
 			if (result != OPDI_STATUS_OK)
 				return result;
-		}
-#endif
-#ifdef OPDI_USE_CUSTOM_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_CUSTOM) == 0) {
-			result = send_custom_port_info(channel, port);
+			result = send_extended_port_info(session, channel, port->id, buffer);
 			if (result != OPDI_STATUS_OK)
 				return result;
 		}
-#endif
-		// send extended port info
-		// copy port ID to the buffer
-		strncpy(buffer, opdi_msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
-		result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_PORTINFO, buffer, OPDI_EXTENDED_INFO_LENGTH);
-		if (result != OPDI_STATUS_OK)
-			return result;
-		result = send_extended_port_info(channel, opdi_msg_parts[1], buffer);
-		if (result != OPDI_STATUS_OK)
-			return result;
 
 		port = port->next;
 	}
 	return OPDI_STATUS_OK;
 }
 
-static uint8_t send_all_port_states(channel_t channel) {
+static uint8_t send_all_port_states(opdi_Session *session, channel_t channel) {
 	uint8_t result;
 	opdi_Port *port;
+	opdi_PortFunction sendState;
 	char buffer[OPDI_EXTENDED_INFO_LENGTH];
 
 	// go through list of device ports
 	port = opdi_get_ports();
 	while (port != NULL) {
-		result = OPDI_PORTTYPE_UNKNOWN;
+		sendState = port_state_function(port);
+		result = (sendState == NULL ? OPDI_PORTTYPE_UNKNOWN : sendState(session, channel, port));
 
-#ifndef OPDI_NO_DIGITAL_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_DIGITAL) == 0) {
-			result = send_digital_port_state(channel, port);
-		}
-		else
-#endif
-#ifndef OPDI_NO_ANALOG_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_ANALOG) == 0) {
-			result = send_analog_port_state(channel, port);
-		}
-		else
-#endif
-#ifndef OPDI_NO_SELECT_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_SELECT) == 0) {
-			result = send_select_port_state(channel, port);
-		}
-		else
-#endif
-#ifndef OPDI_NO_DIAL_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_DIAL) == 0) {
-			result = send_dial_port_state(channel, port);
-		}
-                else
-#endif
-#ifdef OPDI_USE_CUSTOM_PORTS
-		if (strcmp(port->type, OPDI_PORTTYPE_CUSTOM) == 0) {
-			result = send_custom_port_state(channel, port);
-		}
-#endif
 		if (result == OPDI_STATUS_OK) {
 			// state sent ok; send extended info
 			// copy port ID to the buffer
-			strncpy(buffer, opdi_msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
+			strncpy(buffer, session->msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
 			result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_PORTSTATE, buffer, OPDI_EXTENDED_INFO_LENGTH);
 			if (result != OPDI_STATUS_OK)
 				return result;
-			result = send_extended_port_state(channel, opdi_msg_parts[1], buffer);
+			result = send_extended_port_state(session, channel, session->msg_parts[1], buffer);
 			if (result != OPDI_STATUS_OK)
 				return result;
 		}
@@ -864,49 +954,49 @@ static uint8_t send_all_port_states(channel_t channel) {
 	return OPDI_STATUS_OK;
 }
 
-static uint8_t send_group_info(channel_t channel, opdi_PortGroup *group) {
+static uint8_t send_group_info(opdi_Session *session, channel_t channel, opdi_PortGroup *group) {
 	char buf[BUFSIZE_32BIT];
 
 	// convert flags
 	opdi_int32_to_str(group->flags, buf);
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_groupInfo;
-	opdi_msg_parts[1] = group->id;
-	opdi_msg_parts[2] = group->label;
-	opdi_msg_parts[3] = group->parent;
-	opdi_msg_parts[4] = buf;	// flags
-	opdi_msg_parts[5] = NULL;
-
-	return send_parts(channel);
+	session->msg_parts[0] = OPDI_groupInfo;
+	session->msg_parts[1] = group->id;
+	session->msg_parts[2] = group->label;
+	session->msg_parts[3] = group->parent;
+	session->msg_parts[4] = buf;	// flags
+	session->msg_parts[5] = NULL;
+
+	return send_parts(session, channel);
 }
 
-static uint8_t send_extended_group_info(channel_t channel, opdi_PortGroup *group) {
+static uint8_t send_extended_group_info(opdi_Session *session, channel_t channel, opdi_PortGroup *group) {
 	// join payload
-	opdi_msg_parts[0] = OPDI_extendedGroupInfo;
-	opdi_msg_parts[1] = group->id;
-	opdi_msg_parts[2] = group->extendedInfo;
-	opdi_msg_parts[3] = NULL;
+	session->msg_parts[0] = OPDI_extendedGroupInfo;
+	session->msg_parts[1] = group->id;
+	session->msg_parts[2] = group->extendedInfo;
+	session->msg_parts[3] = NULL;
 
-	return send_parts(channel);
+	return send_parts(session, channel);
 }
 
-static uint8_t send_extended_device_info(channel_t channel, char *deviceInfo) {
+static uint8_t send_extended_device_info(opdi_Session *session, channel_t channel, char *deviceInfo) {
 	// join payload
-	opdi_msg_parts[0] = OPDI_extendedDeviceInfo;
-	opdi_msg_parts[1] = deviceInfo;
-	opdi_msg_parts[2] = NULL;
+	session->msg_parts[0] = OPDI_extendedDeviceInfo;
+	session->msg_parts[1] = deviceInfo;
+	session->msg_parts[2] = NULL;
 
-	return send_parts(channel);
+	return send_parts(session, channel);
 }
 
-static uint8_t send_all_select_port_labels(channel_t channel, opdi_Port *port) {
+static uint8_t send_all_select_port_labels(opdi_Session *session, channel_t channel, opdi_Port *port) {
 	uint8_t result;
 	uint16_t pos = 0;
 	char position[BUFSIZE_16BIT];
 	char **labels;
 
-	if (strcmp(port->type, OPDI_PORTTYPE_SELECT)) {
+	if (port->kind != OPDI_PORTKIND_SELECT) {
 		return OPDI_WRONG_PORT_TYPE;
 	}
 
@@ -914,15 +1004,15 @@ static uint8_t send_all_select_port_labels(channel_t channel, opdi_Port *port) {
 	labels = (char**)port->info.ptr;
 
 	// join payload
-	opdi_msg_parts[0] = OPDI_selectPortLabel;
-	opdi_msg_parts[1] = port->id;
-	opdi_msg_parts[2] = position;
-	opdi_msg_parts[4] = NULL;
+	session->msg_parts[0] = OPDI_selectPortLabel;
+	session->msg_parts[1] = port->id;
+	session->msg_parts[2] = position;
+	session->msg_parts[4] = NULL;
 	while (labels[pos]) {
 		opdi_uint16_to_str(pos, position);
-		opdi_msg_parts[3] = labels[pos];
+		session->msg_parts[3] = labels[pos];
 
-		result = send_parts(channel);
+		result = send_parts(session, channel);
 		if (result != OPDI_STATUS_OK)
 			return result;
 		pos++;
@@ -932,323 +1022,269 @@ static uint8_t send_all_select_port_labels(channel_t channel, opdi_Port *port) {
 
 #endif		// OPDI_EXTENDED_PROTOCOL
 
-/** Implements the basic protocol message handler.
+/** Packs the request identifier into its key (see OPDI_COMMAND_KEY). Identifiers that are empty
+*   or longer than four characters are mapped to 0, which matches no request.
+*/
+static uint32_t command_key(const char *command) {
+	uint32_t key = 0;
+	uint8_t i;
+
+	for (i = 0; i < 4; i++) {
+		// shorter identifiers are padded with zeros
+		if (command[i] == '\0')
+			return (i == 0 ? 0 : key << (8 * (4 - i)));
+		key = (key << 8) | (uint8_t)command[i];
+	}
+	return (command[4] == '\0' ? key : 0);
+}
+
+/** Finds the port that is specified by the first parameter of the request. If needsValue is true,
+*   the request must have a second parameter.
 */
-static uint8_t basic_protocol_message(channel_t channel) {
+static uint8_t get_port_param(opdi_Session *session, opdi_Port **port, uint8_t needsValue) {
+	if (session->msg_parts[1] == NULL)
+		return OPDI_PROTOCOL_ERROR;
+	// find port
+	*port = opdi_find_port_by_id(session->msg_parts[1]);
+	if (*port == NULL)
+		return OPDI_PORT_UNKNOWN;
+	if (needsValue && (session->msg_parts[2] == NULL))
+		return OPDI_PROTOCOL_ERROR;
+	return OPDI_STATUS_OK;
+}
+
+/** Implements the basic protocol message handler. The request is dispatched with a switch over
+*   the key of its identifier, so the time does not depend on the number of requests.
+*/
+static uint8_t basic_protocol_message(opdi_Session *session, channel_t channel) {
 	uint8_t result;
 	opdi_Port *port;
 
 	// we can be sure to have no control channel messages here
 	// so we don't have to handle Disconnect etc.
 
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_getDeviceCaps)) {
-		// get device capabilities
-		return send_device_caps(channel);
-	}
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getPortInfo)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	switch (command_key(session->msg_parts[0])) {
+	case OPDI_KEY_getDeviceCaps:
+		// get device capabilities; with the port infos if requested
+		if ((session->msg_parts[1] != NULL) && (session->msg_parts[2] != NULL))
+			return send_port_info_page(session, channel);
+		return send_device_caps(session, channel);
 
-		result = send_port_info(channel, port);
-		return result;
-	} 
-#ifndef OPDI_NO_ANALOG_PORTS
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getAnalogPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	case OPDI_KEY_getPortInfo:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_port_info(session, channel, port);
 
-		result = send_analog_port_state(channel, port);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setAnalogPortValue)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+#ifndef OPDI_NO_ANALOG_PORTS
+	case OPDI_KEY_getAnalogPortState:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_analog_port_state(session, channel, port);
 
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// set the value
-		result = set_analog_port_value(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setAnalogPortMode)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	case OPDI_KEY_setAnalogPortValue:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_analog_port_value(session, channel, port, session->msg_parts[2]);
 
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// set the value
-		result = set_analog_port_mode(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setAnalogPortResolution)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	case OPDI_KEY_setAnalogPortMode:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_analog_port_mode(session, channel, port, session->msg_parts[2]);
 
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// set the value
-		result = set_analog_port_resolution(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setAnalogPortReference)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	case OPDI_KEY_setAnalogPortResolution:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_analog_port_resolution(session, channel, port, session->msg_parts[2]);
 
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// set the value
-		result = set_analog_port_reference(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
+	case OPDI_KEY_setAnalogPortReference:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_analog_port_reference(session, channel, port, session->msg_parts[2]);
 #endif
-#ifndef OPDI_NO_DIGITAL_PORTS
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getDigitalPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
 
-		result = send_digital_port_state(channel, port);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setDigitalPortLine)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+#ifndef OPDI_NO_DIGITAL_PORTS
+	case OPDI_KEY_getDigitalPortState:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_digital_port_state(session, channel, port);
 
-		result = set_digital_port_line(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setDigitalPortMode)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
+	case OPDI_KEY_setDigitalPortLine:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_digital_port_line(session, channel, port, session->msg_parts[2]);
 
-		result = set_digital_port_mode(channel, port, opdi_msg_parts[2]);
-		return result;
-	}
+	case OPDI_KEY_setDigitalPortMode:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_digital_port_mode(session, channel, port, session->msg_parts[2]);
 #endif
+
 #ifndef OPDI_NO_SELECT_PORTS
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getSelectPortLabel)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		result = send_select_port_label(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getSelectPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		result = send_select_port_state(channel, port);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setSelectPortPosition)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		result = set_select_port_position(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
+	case OPDI_KEY_getSelectPortLabel:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_select_port_label(session, channel, port, session->msg_parts[2]);
+
+	case OPDI_KEY_getSelectPortState:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_select_port_state(session, channel, port);
+
+	case OPDI_KEY_setSelectPortPosition:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_select_port_position(session, channel, port, session->msg_parts[2]);
 #endif
+
 #ifndef OPDI_NO_DIAL_PORTS
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getDialPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		result = send_dial_port_state(channel, port);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setDialPortPosition)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		result = set_dial_port_position(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
+	case OPDI_KEY_getDialPortState:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_dial_port_state(session, channel, port);
+
+	case OPDI_KEY_setDialPortPosition:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_dial_port_position(session, channel, port, session->msg_parts[2]);
 #endif
+
 #ifdef OPDI_USE_CUSTOM_PORTS
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getCustomPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		result = send_custom_port_state(channel, port);
-		return result;
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_setCustomPortState)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		result = set_custom_port_value(channel, port, opdi_msg_parts[2]);
-		return result;
-	} 
+	case OPDI_KEY_getCustomPortState:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return send_custom_port_state(session, channel, port);
+
+	case OPDI_KEY_setCustomPortState:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return set_custom_port_value(session, channel, port, session->msg_parts[2]);
 #endif
+
 #if (OPDI_STREAMING_PORTS > 0)
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_bindStreamingPort)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		if (opdi_msg_parts[2] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		result = bind_streaming_port(channel, port, opdi_msg_parts[2]);
-		return result;
-	}
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_unbindStreamingPort)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		result = unbind_streaming_port(channel, port);
-		return result;
-	}
+	case OPDI_KEY_bindStreamingPort:
+		result = get_port_param(session, &port, 1);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return bind_streaming_port(session, channel, port, session->msg_parts[2]);
+
+	case OPDI_KEY_unbindStreamingPort:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		return unbind_streaming_port(session, channel, port);
 #endif
-	else {
+
+	default:
 		// unknown message received
 		return OPDI_MESSAGE_UNKNOWN;
 	}
 }
 
 #ifdef OPDI_EXTENDED_PROTOCOL
-/** Implements the extended protocol message handler.
+/** Implements the extended protocol message handler. Requests of the basic protocol are passed
+*   to its handler from the default case of the switch.
 */
-static uint8_t extended_protocol_message(channel_t channel) {
+static uint8_t extended_protocol_message(opdi_Session *session, channel_t channel) {
 	uint8_t result;
 	opdi_Port *port;
 	opdi_PortGroup *group;
 	char buffer[OPDI_EXTENDED_INFO_LENGTH];
-	// only handle messages of the extended protocol here
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_getAllPortInfos)) {
-		return send_all_port_infos(channel);
-	} 
-	else 
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_getAllPortStates)) {
-		return send_all_port_states(channel);
-	} 
-	else 
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_getExtendedPortInfo)) {
-		if (opdi_msg_parts[1] == NULL)
+
+	switch (command_key(session->msg_parts[0])) {
+	case OPDI_KEY_getAllPortInfos:
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+		// send all replies in as few frames as possible
+		opdi_begin_multimessage(session);
+		return end_multimessage(session, send_all_port_infos(session, channel));
+#else
+		return send_all_port_infos(session, channel);
+#endif
+
+	case OPDI_KEY_getAllPortStates:
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+		// send all replies in as few frames as possible
+		opdi_begin_multimessage(session);
+		return end_multimessage(session, send_all_port_states(session, channel));
+#else
+		return send_all_port_states(session, channel);
+#endif
+
+	case OPDI_KEY_getExtendedPortInfo:
+		if (session->msg_parts[1] == NULL)
 			return OPDI_PROTOCOL_ERROR;
 		// copy port ID to the buffer
-		strncpy(buffer, opdi_msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
+		strncpy(buffer, session->msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
 		result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_PORTINFO, buffer, OPDI_EXTENDED_INFO_LENGTH);
 		if (result != OPDI_STATUS_OK)
 			return result;
-		return send_extended_port_info(channel, opdi_msg_parts[1], buffer);
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getExtendedPortState)) {
-		if (opdi_msg_parts[1] == NULL)
+		return send_extended_port_info(session, channel, session->msg_parts[1], buffer);
+
+	case OPDI_KEY_getExtendedPortState:
+		if (session->msg_parts[1] == NULL)
 			return OPDI_PROTOCOL_ERROR;
 		// copy port ID to the buffer
-		strncpy(buffer, opdi_msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
+		strncpy(buffer, session->msg_parts[1], OPDI_EXTENDED_INFO_LENGTH);
 		result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_PORTSTATE, buffer, OPDI_EXTENDED_INFO_LENGTH);
 		if (result != OPDI_STATUS_OK)
 			return result;
-		return send_extended_port_state(channel, opdi_msg_parts[1], buffer);
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getGroupInfo)) {
-		if (opdi_msg_parts[1] == NULL)
+		return send_extended_port_state(session, channel, session->msg_parts[1], buffer);
+
+	case OPDI_KEY_getGroupInfo:
+		if (session->msg_parts[1] == NULL)
 			return OPDI_PROTOCOL_ERROR;
 		// find group
-		group = opdi_find_portgroup_by_id(opdi_msg_parts[1]);
+		group = opdi_find_portgroup_by_id(session->msg_parts[1]);
 		if (group == NULL)
 			return OPDI_GROUP_UNKNOWN;
-		return send_group_info(channel, group);
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getExtendedGroupInfo)) {
-		if (opdi_msg_parts[1] == NULL)
+		return send_group_info(session, channel, group);
+
+	case OPDI_KEY_getExtendedGroupInfo:
+		if (session->msg_parts[1] == NULL)
 			return OPDI_PROTOCOL_ERROR;
 		// find group
-		group = opdi_find_portgroup_by_id(opdi_msg_parts[1]);
+		group = opdi_find_portgroup_by_id(session->msg_parts[1]);
 		if (group == NULL)
 			return OPDI_GROUP_UNKNOWN;
-		return send_extended_group_info(channel, group);
-	} 
-	else if (0 == strcmp(opdi_msg_parts[0], OPDI_getExtendedDeviceInfo)) {
+		return send_extended_group_info(session, channel, group);
+
+	case OPDI_KEY_getExtendedDeviceInfo:
 		result = opdi_slave_callback(OPDI_FUNCTION_GET_EXTENDED_DEVICEINFO, buffer, OPDI_EXTENDED_INFO_LENGTH);
 		if (result != OPDI_STATUS_OK)
 			return result;
-		return send_extended_device_info(channel, buffer);
-	} 
-	else
-	// only handle messages of the extended protocol here
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_getAllSelectPortLabels)) {
-		if (opdi_msg_parts[1] == NULL)
-			return OPDI_PROTOCOL_ERROR;
-		// find port
-		port = opdi_find_port_by_id(opdi_msg_parts[1]);
-		if (port == NULL)
-			return OPDI_PORT_UNKNOWN;
-		return send_all_select_port_labels(channel, port);
-	} 
-	else 
+		return send_extended_device_info(session, channel, buffer);
+
+	case OPDI_KEY_getAllSelectPortLabels:
+		result = get_port_param(session, &port, 0);
+		if (result != OPDI_STATUS_OK)
+			return result;
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+		// send all replies in as few frames as possible
+		opdi_begin_multimessage(session);
+		return end_multimessage(session, send_all_select_port_labels(session, channel, port));
+#else
+		return send_all_select_port_labels(session, channel, port);
+#endif
+
+	default:
 		// for all other messages, fall back to the basic protocol
-		return basic_protocol_message(channel);
+		return basic_protocol_message(session, channel);
+	}
 }
 #endif
 
@@ -1285,79 +1321,109 @@ uint8_t opdi_handle_basic_message(opdi_Message *m) {
 } 
 */
 
-static uint8_t handle_message_result(opdi_Message *m, uint8_t result) {
+static uint8_t handle_message_result(opdi_Session *session, opdi_Message *m, uint8_t result) {
 	if (result != OPDI_STATUS_OK) {
 		// special case: message unknown
 		if (result == OPDI_MESSAGE_UNKNOWN) {
-			opdi_debug_msg("Unknown message", OPDI_DIR_DEBUG);
+			if (OPDI_TRACE_ENABLED(OPDI_TRACE_DEBUG))
+				opdi_debug_msg("Unknown message", OPDI_DIR_DEBUG);
 			result = OPDI_STATUS_OK;
 		} else
 		// intentional disconnects are not an error
 		if (result != OPDI_DISCONNECTED)
 			// an error occurred during message handling; send error to device and exit message processing
-			return send_error(result, NULL, NULL);
+			return send_error(session, result, NULL, NULL);
 	}
 	return result;
 }
 
+/** Handles a message that has been received by the message loop.
+*/
+static uint8_t process_message(opdi_Session *session, opdi_Message *m, opdi_ProtocolHandler protocolHandler) {
+	uint8_t result;
+
+	result = strings_split(m->payload, OPDI_PARTS_SEPARATOR, session->msg_parts, OPDI_MAX_MESSAGE_PARTS, 1, NULL);
+	if (result != OPDI_STATUS_OK)
+		return result;
+
+	// message on control channel?
+	if (m->channel == 0) {
+		// disconnect message?
+		if (0 == strcmp(session->msg_parts[0], OPDI_Disconnect))
+			return OPDI_DISCONNECTED;
+
+		// error message?
+		if (0 == strcmp(session->msg_parts[0], OPDI_Error))
+			return OPDI_DEVICE_ERROR;
+
+		// debug message?
+		if (0 == strcmp(session->msg_parts[0], OPDI_Debug)) {
+			result = opdi_debug_msg(session->msg_parts[1], OPDI_DIR_DEBUG);
+			if (result != OPDI_STATUS_OK)
+				return result;
+		}
+	} else {
+		// clear the port info message; the port callbacks of this request set it for this session
+		opdi_set_port_session(session);
+
+		// message other than control message received
+		// let the protocol handle the message
+		result = protocolHandler(session, m->channel);
+		result = handle_message_result(session, m, result);
+		opdi_set_port_session(NULL);
+		if (result != OPDI_STATUS_OK)
+			return result;
+	}
+
+#ifdef OPDI_HAS_MESSAGE_HANDLED
+	// notify the device that a message has been handled
+#ifdef OPDI_SINGLE_SESSION
+	result = opdi_message_handled(m->channel, session->msg_parts);
+#else
+	result = opdi_message_handled(session, m->channel, session->msg_parts);
+#endif
+	if (result != OPDI_STATUS_OK) {
+		// intentional disconnects are not an error
+		if (result != OPDI_DISCONNECTED)
+			// an error occurred during message handling; send error to device and exit
+			return send_error(session, result, NULL, NULL);
+		return result;
+	}
+#endif
+	return OPDI_STATUS_OK;
+}
+
 /** The protocol message loop.
 */
-static uint8_t message_loop(opdi_ProtocolHandler protocolHandler) {
+static uint8_t message_loop(opdi_Session *session, opdi_ProtocolHandler protocolHandler) {
 	opdi_Message m;
 	uint8_t result;
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+	uint8_t flushResult;
+#endif
 
 	// enter processing loop
 	while (1) {
 		// because this call is blocking, it will result
 		// in a timeout error if no ping message is coming in any more
 		// causing the termination of the connection
-		result = opdi_get_message(&m, OPDI_CAN_SEND);
+		result = opdi_get_message(session, &m, OPDI_CAN_SEND);
 		if (result != OPDI_STATUS_OK)
 			return result;
 
-		result = strings_split(m.payload, OPDI_PARTS_SEPARATOR, opdi_msg_parts, OPDI_MAX_MESSAGE_PARTS, 1, NULL);
+#ifdef OPDI_OUTPUT_BUFFER_SIZE
+		// collect the replies to this message and send them at once
+		opdi_begin_output(session);
+		result = process_message(session, &m, protocolHandler);
+		// flush point: the request has been handled
+		flushResult = opdi_flush_output(session);
+		if ((result == OPDI_STATUS_OK) && (flushResult != OPDI_STATUS_OK))
+			result = flushResult;
+#else
+		result = process_message(session, &m, protocolHandler);
+#endif
 		if (result != OPDI_STATUS_OK)
 			return result;
-
-		// message on control channel?
-		if (m.channel == 0) {
-			// disconnect message?
-			if (0 == strcmp(opdi_msg_parts[0], OPDI_Disconnect))
-				return OPDI_DISCONNECTED;
-
-			// error message?
-			if (0 == strcmp(opdi_msg_parts[0], OPDI_Error))
-				return OPDI_DEVICE_ERROR;
-
-			// debug message?
-			if (0 == strcmp(opdi_msg_parts[0], OPDI_Debug)) {
-				result = opdi_debug_msg(opdi_msg_parts[1], OPDI_DIR_DEBUG);
-				if (result != OPDI_STATUS_OK)
-					return result;
-			}
-		} else {
-			// clear port info message
-			opdi_set_port_message("");
-
-			// message other than control message received
-			// let the protocol handle the message
-			result = protocolHandler(m.channel);
-			result = handle_message_result(&m, result);
-			if (result != OPDI_STATUS_OK)
-				return result;
-		}
-
-#ifdef OPDI_HAS_MESSAGE_HANDLED
-		// notify the device that a message has been handled
-		result = opdi_message_handled(m.channel, opdi_msg_parts);
-		if (result != OPDI_STATUS_OK) {
-			// intentional disconnects are not an error
-			if (result != OPDI_DISCONNECTED)
-				// an error occurred during message handling; send error to device and exit
-				return send_error(result, NULL, NULL);
-			return result;
-		}
-#endif
 	}	// while
 }
 
@@ -1365,25 +1431,95 @@ static uint8_t message_loop(opdi_ProtocolHandler protocolHandler) {
 *   Most importantly, this will disable encryption as it is not used at the beginning
 *   of the handshake.
 */
-uint8_t opdi_slave_init() {
+uint8_t opdi_slave_init(opdi_Session *session) {
 #ifndef OPDI_NO_ENCRYPTION
 	// handshake starts unencrypted
-	opdi_set_encryption(OPDI_DONT_USE_ENCRYPTION);
+	opdi_set_encryption(session, OPDI_DONT_USE_ENCRYPTION);
 #endif
 
 	return OPDI_STATUS_OK;
 }
 
+#ifndef OPDI_NO_ENCRYPTION
+
+#ifdef OPDI_ENCRYPTION_CTR
+// the size of the buffer for the encryption of the handshake reply (method, suffix, separator, nonce)
+#define ENCRYPTION_REPLY_SIZE	40
+#endif
+
+#ifdef OPDI_ENCRYPTION_CTR
+
+/** Returns 1 if the encryption offered by the master is the device's encryption method with the
+*   suffix of a mode, followed by the nonce of the master (e. g. "AES-GCM/0123456789abcdef"), and if
+*   the reply fits into the buffer, 0 otherwise. The nonce is returned in nonce. An offer without
+*   the nonce is not accepted because the counter blocks must depend on both sides.
+*/
+static uint8_t is_method_mode(const char *offered, const char *suffix, const char **nonce) {
+	size_t length = strlen(opdi_encryption_method);
+	size_t suffixLength = strlen(suffix);
+
+	if ((0 != strncmp(offered, opdi_encryption_method, length))
+			|| (0 != strncmp(offered + length, suffix, suffixLength))
+			|| (length + suffixLength + 2 * OPDI_CTR_NONCE_SIZE + 2 > ENCRYPTION_REPLY_SIZE))
+		return 0;
+	offered += length + suffixLength;
+	if ((*offered != OPDI_ENCRYPTION_NONCE_SEPARATOR) || (strlen(offered + 1) != 2 * OPDI_CTR_NONCE_SIZE))
+		return 0;
+	*nonce = offered + 1;
+	return 1;
+}
+
+#endif
+
+/** Returns the OPDI_*USE_ENCRYPTION* mode in which the device's encryption method is supported
+*   by the master, or OPDI_DONT_USE_ENCRYPTION. If the master offers several modes, the
+*   Galois/counter mode is preferred to the counter mode and the counter mode to the block mode.
+*   The nonce that the master has appended to the chosen mode is returned in peerNonce.
+*/
+static uint8_t choose_encryption(const char **encryptions, uint8_t count, const char **peerNonce) {
+	uint8_t i;
+	uint8_t mode = OPDI_DONT_USE_ENCRYPTION;
+	uint8_t offered;
+	const char *nonce = NULL;
+
+	*peerNonce = NULL;
+	for (i = 0; i < count; i++) {
+		if (0 == strcmp(encryptions[i], opdi_encryption_method))
+			offered = OPDI_USE_ENCRYPTION;
+#ifdef OPDI_ENCRYPTION_CTR
+		else if (is_method_mode(encryptions[i], OPDI_ENCRYPTION_CTR_SUFFIX, &nonce))
+			offered = OPDI_USE_ENCRYPTION_CTR;
+#endif
+#ifdef OPDI_ENCRYPTION_GCM
+		else if (is_method_mode(encryptions[i], OPDI_ENCRYPTION_GCM_SUFFIX, &nonce))
+			offered = OPDI_USE_ENCRYPTION_GCM;
+#endif
+		else
+			continue;
+		// the modes are numbered in the order of preference
+		if (offered > mode) {
+			mode = offered;
+			*peerNonce = (offered == OPDI_USE_ENCRYPTION ? NULL : nonce);
+		}
+	}
+	return mode;
+}
+
+#endif
+
 /* Performs the handshake and runs the message processing loop if successful.
 *  Errors during the handshake are not sent to the connected device.
 */
-uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, opdi_ProtocolCallback protocol_callback) {
+uint8_t opdi_slave_start(opdi_Session *session, opdi_Message *message, opdi_GetProtocol get_protocol, opdi_ProtocolCallback protocol_callback) {
 #define MAX_ENCRYPTIONS		3
-	opdi_Message m;
 	uint8_t result;
 	uint8_t partCount;
 	int32_t flags;
+	int32_t replyFlags;
 	char buf[BUFSIZE_32BIT];
+	uint8_t use_frame_size;
+	uint16_t frameSize;
+	char frameSizeBuf[BUFSIZE_16BIT];
 #ifndef OPDI_FUNCTION_BUFFERSIZE
 #define OPDI_FUNCTION_BUFFERSIZE	32
 #endif
@@ -1393,20 +1529,37 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 
 #ifndef OPDI_NO_ENCRYPTION
 	const char *encryptions[MAX_ENCRYPTIONS];
-	uint8_t i;
 	const char *encryption = "";
-	uint8_t use_encryption = 0;
+	uint8_t use_encryption = OPDI_DONT_USE_ENCRYPTION;
+	const char *peerNonce;
+#ifdef OPDI_ENCRYPTION_CTR
+	char encryptionBuf[ENCRYPTION_REPLY_SIZE];
+	uint8_t i;
+#endif
 #endif
 #ifndef OPDI_NO_AUTHENTICATION
+	opdi_Message m;
 	uint32_t savedTimeout;
 #endif
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	uint8_t use_multimessage;
+#endif
+#ifdef OPDI_BINARY_FRAMING
+	uint8_t use_binary;
+#endif
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	uint8_t use_fragmentation;
+#endif
+#ifdef OPDI_CRC32C
+	uint8_t use_crc32c;
+#endif
 
 #if (OPDI_STREAMING_PORTS > 0)
-	// initiate a new connection: clear port bindings
-	opdi_reset_bindings();
+	// initiate a new connection: clear the port bindings of this session
+	opdi_reset_bindings(session);
 #endif
 
-	connected = 0;
+	session->connected = 0;
 
 	if (protocol_callback != NULL)
 		protocol_callback(OPDI_PROTOCOL_START_HANDSHAKE);
@@ -1419,7 +1572,7 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 	if (message->channel != 0)
 		return OPDI_PROTOCOL_ERROR;
 
-	result = strings_split(message->payload, OPDI_PARTS_SEPARATOR, opdi_msg_parts, OPDI_MAX_MESSAGE_PARTS, 1, &partCount);
+	result = strings_split(message->payload, OPDI_PARTS_SEPARATOR, session->msg_parts, OPDI_MAX_MESSAGE_PARTS, 1, &partCount);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -1427,29 +1580,42 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 		return OPDI_PROTOCOL_ERROR;
 
 	// handshake tag must match
-	if (strcmp(opdi_msg_parts[0], OPDI_Handshake))
+	if (strcmp(session->msg_parts[0], OPDI_Handshake))
 		return OPDI_PROTOCOL_ERROR;
 
 	// protocol version must match
-	if (strcmp(opdi_msg_parts[1], OPDI_Handshake_version))
+	if (strcmp(session->msg_parts[1], OPDI_Handshake_version))
 		return OPDI_PROTOCOL_ERROR;
 
 	// convert flags
-	result = opdi_str_to_int32(opdi_msg_parts[2], &flags);
+	result = opdi_str_to_int32(session->msg_parts[2], &flags);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
+	// does the master announce its frame length?
+	use_frame_size = ((flags & OPDI_FLAG_FRAME_SIZE) == OPDI_FLAG_FRAME_SIZE);
+
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	// does the master accept multi-message frames?
+	use_multimessage = ((flags & OPDI_FLAG_MULTIMESSAGE) == OPDI_FLAG_MULTIMESSAGE);
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	// does the master accept fragmented messages?
+	use_fragmentation = ((flags & OPDI_FLAG_FRAGMENTATION) == OPDI_FLAG_FRAGMENTATION);
+#endif
+
 #ifdef OPDI_NO_ENCRYPTION
 	// is encryption required by the master?
 	if (flags & OPDI_FLAG_ENCRYPTION_REQUIRED) {
 		// this device does not support encryption
-		send_disagreement(OPDI_ENCRYPTION_NOT_SUPPORTED, 0, NULL, NULL);
+		send_disagreement(session, OPDI_ENCRYPTION_NOT_SUPPORTED, 0, NULL, NULL);
 		return OPDI_ENCRYPTION_NOT_SUPPORTED;
 	}
 #else
 	// encryption is supported
 	// split supported encryptions
-	result = strings_split(opdi_msg_parts[3], ',', encryptions, MAX_ENCRYPTIONS, 1, &partCount);
+	result = strings_split(session->msg_parts[3], ',', encryptions, MAX_ENCRYPTIONS, 1, &partCount);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -1457,49 +1623,31 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 	if ((flags & OPDI_FLAG_ENCRYPTION_REQUIRED) == OPDI_FLAG_ENCRYPTION_REQUIRED) {
 		// does the device not allow or support encryption?
 		if (((opdi_device_flags & OPDI_FLAG_ENCRYPTION_NOT_ALLOWED) == OPDI_FLAG_ENCRYPTION_NOT_ALLOWED) || (opdi_encryption_method[0] == '\0')) {
-			send_disagreement(0, OPDI_ENCRYPTION_NOT_SUPPORTED, "Encryption not supported: ", "by device");
+			send_disagreement(session, 0, OPDI_ENCRYPTION_NOT_SUPPORTED, "Encryption not supported: ", "by device");
 			return OPDI_ENCRYPTION_NOT_SUPPORTED;
 		}
 
 		// device's encryption must be supported
-		result = OPDI_ENCRYPTION_NOT_SUPPORTED;
-		for (i = 0; i < partCount; i++) {
-			if (0 == strcmp(encryptions[i], opdi_encryption_method)) {
-				result = OPDI_STATUS_OK;
-				break;
-			}
-		}
-		if (result != OPDI_STATUS_OK) {
-			send_disagreement(0, result, "Encryption not supported: ", opdi_encryption_method);
-			return result;
+		use_encryption = choose_encryption(encryptions, partCount, &peerNonce);
+		if (use_encryption == OPDI_DONT_USE_ENCRYPTION) {
+			send_disagreement(session, 0, OPDI_ENCRYPTION_NOT_SUPPORTED, "Encryption not supported: ", opdi_encryption_method);
+			return OPDI_ENCRYPTION_NOT_SUPPORTED;
 		}
-		// choose encryption
-		encryption = opdi_encryption_method;
-		use_encryption = 1;
 	} 
 	// does the device require encryption?
 	else if ((opdi_device_flags & OPDI_FLAG_ENCRYPTION_REQUIRED) == OPDI_FLAG_ENCRYPTION_REQUIRED) {
 		// does the master not allow encryption?
 		if (flags & OPDI_FLAG_ENCRYPTION_NOT_ALLOWED) {
-			send_disagreement(0, OPDI_ENCRYPTION_REQUIRED, "Encryption required: ", "by device");
+			send_disagreement(session, 0, OPDI_ENCRYPTION_REQUIRED, "Encryption required: ", "by device");
 			return OPDI_ENCRYPTION_REQUIRED;
 		}
 
 		// device's encryption must be supported
-		result = OPDI_ENCRYPTION_REQUIRED;
-		for (i = 0; i < partCount; i++) {
-			if (0 == strcmp(encryptions[i], opdi_encryption_method)) {
-				result = OPDI_STATUS_OK;
-				break;
-			}
-		}
-		if (result != OPDI_STATUS_OK) {
-			send_disagreement(0, result, "Encryption required: ", opdi_encryption_method);
-			return result;
+		use_encryption = choose_encryption(encryptions, partCount, &peerNonce);
+		if (use_encryption == OPDI_DONT_USE_ENCRYPTION) {
+			send_disagreement(session, 0, OPDI_ENCRYPTION_REQUIRED, "Encryption required: ", opdi_encryption_method);
+			return OPDI_ENCRYPTION_REQUIRED;
 		}
-		// choose encryption
-		encryption = opdi_encryption_method;
-		use_encryption = 1;
 	}
 	else {
 		// encryption is optional
@@ -1507,18 +1655,71 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 		// not forbidden by device flags?
 		if ((opdi_device_flags & OPDI_FLAG_ENCRYPTION_NOT_ALLOWED) != OPDI_FLAG_ENCRYPTION_NOT_ALLOWED) {
 			// device's encryption may be supported
-			for (i = 0; i < partCount; i++) {
-				if (0 == strcmp(encryptions[i], opdi_encryption_method)) {
-					// choose encryption
-					encryption = opdi_encryption_method;
-					use_encryption = 1;
-					break;
-				}
-			}
+			use_encryption = choose_encryption(encryptions, partCount, &peerNonce);
 		}
 	}
+
+	// choose encryption
+	if (use_encryption != OPDI_DONT_USE_ENCRYPTION)
+		encryption = opdi_encryption_method;
+#ifdef OPDI_ENCRYPTION_CTR
+	if (use_encryption >= OPDI_USE_ENCRYPTION_CTR) {
+		// the reply contains the nonce of the key streams: <method>-CTR/<nonce> or <method>-GCM/<nonce>
+		strcpy(encryptionBuf, opdi_encryption_method);
+#ifdef OPDI_ENCRYPTION_GCM
+		if (use_encryption == OPDI_USE_ENCRYPTION_GCM)
+			strcat(encryptionBuf, OPDI_ENCRYPTION_GCM_SUFFIX);
+		else
+#endif
+		strcat(encryptionBuf, OPDI_ENCRYPTION_CTR_SUFFIX);
+		i = (uint8_t)strlen(encryptionBuf);
+		encryptionBuf[i] = OPDI_ENCRYPTION_NONCE_SEPARATOR;
+		result = opdi_new_ctr_nonce(session, peerNonce, encryptionBuf + i + 1);
+		if (result != OPDI_STATUS_OK) {
+			send_disagreement(session, 0, result, "Encryption error: ", "nonce");
+			return result;
+		}
+		encryption = encryptionBuf;
+#ifdef OPDI_SESSION_KEYS
+		// the key of the session is derived from the nonces of both sides
+		result = opdi_derive_session_key(session);
+		if (result != OPDI_STATUS_OK) {
+			send_disagreement(session, 0, result, "Encryption error: ", "session key");
+			return result;
+		}
+#endif
+	}
+#endif
 #endif	// OPDI_NO_ENCRYPTION
 
+#ifdef OPDI_BINARY_FRAMING
+	// does the master accept binary frames? they are not combined with encryption
+	use_binary = ((flags & OPDI_FLAG_BINARY_FRAMING) == OPDI_FLAG_BINARY_FRAMING);
+#ifndef OPDI_NO_ENCRYPTION
+	if (use_encryption)
+		use_binary = 0;
+#endif
+#endif
+
+#ifdef OPDI_CRC32C
+	// does the master accept the CRC-32C? it protects text messages only
+	use_crc32c = ((flags & OPDI_FLAG_CRC32C) == OPDI_FLAG_CRC32C);
+#ifdef OPDI_BINARY_FRAMING
+	if (use_binary)
+		use_crc32c = 0;
+#endif
+#if !defined(OPDI_NO_ENCRYPTION) && defined(OPDI_ENCRYPTION_GCM)
+	if (use_encryption == OPDI_USE_ENCRYPTION_GCM)
+		use_crc32c = 0;
+#endif
+#endif
+
+#if defined(OPDI_MULTIMESSAGE_BUFFER_SIZE) && defined(OPDI_ENCRYPTION_GCM)
+	// each message is sent as a record of its own in Galois/counter mode
+	if (use_encryption == OPDI_USE_ENCRYPTION_GCM)
+		use_multimessage = 0;
+#endif
+
 	////////////////////////////////////////////////////////////
 	///// Send: Handshake reply
 	////////////////////////////////////////////////////////////
@@ -1533,61 +1734,119 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 		return result;
 
 	// prepare handshake reply message
-	m.channel = 0;
-	m.payload = opdi_msg_payload;
-	opdi_msg_parts[0] = OPDI_Handshake;
-	opdi_msg_parts[1] = OPDI_Handshake_version;
-	opdi_msg_parts[2] = funcBuf1;
+	session->msg_parts[0] = OPDI_Handshake;
+	session->msg_parts[1] = OPDI_Handshake_version;
+	session->msg_parts[2] = funcBuf1;
 #ifndef OPDI_NO_ENCRYPTION
-	opdi_msg_parts[3] = encryption;
+	session->msg_parts[3] = encryption;
 #else
-	opdi_msg_parts[3] = "";
+	session->msg_parts[3] = "";
+#endif
+	replyFlags = opdi_device_flags;
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	// confirm multi-message frames
+	if (use_multimessage)
+		replyFlags |= OPDI_FLAG_MULTIMESSAGE;
 #endif
+#ifdef OPDI_BINARY_FRAMING
+	// confirm binary frames
+	if (use_binary)
+		replyFlags |= OPDI_FLAG_BINARY_FRAMING;
+#endif
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	// confirm fragmented messages
+	if (use_fragmentation)
+		replyFlags |= OPDI_FLAG_FRAGMENTATION;
+#endif
+#ifdef OPDI_CRC32C
+	// confirm the CRC-32C
+	if (use_crc32c)
+		replyFlags |= OPDI_FLAG_CRC32C;
+#endif
+#ifdef OPDI_SESSION_KEYS
+	// tell the master to derive the session key
+	if (use_encryption >= OPDI_USE_ENCRYPTION_CTR)
+		replyFlags |= OPDI_FLAG_SESSION_KEY;
+#endif
+	// confirm the frame length exchange
+	if (use_frame_size)
+		replyFlags |= OPDI_FLAG_FRAME_SIZE;
 	// convert flags to string
-	opdi_int32_to_str(opdi_device_flags, buf);
-	opdi_msg_parts[4] = buf;
-	opdi_msg_parts[5] = funcBuf2;
-	opdi_msg_parts[6] = NULL;
-
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
+	opdi_int32_to_str(replyFlags, buf);
+	session->msg_parts[4] = buf;
+	session->msg_parts[5] = funcBuf2;
+	session->msg_parts[6] = NULL;
+	if (use_frame_size) {
+		// append the length of the longest frame that this device can receive
+		opdi_uint16_to_str(OPDI_MAX_FRAME_SIZE, frameSizeBuf);
+		session->msg_parts[6] = frameSizeBuf;
+		session->msg_parts[7] = NULL;
+	}
 
-	result = opdi_put_message(&m);
+	result = opdi_put_parts(session, 0, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 #ifndef OPDI_NO_ENCRYPTION
 	// if encryption is used, switch it on
 	if (use_encryption) {
-		opdi_set_encryption(OPDI_USE_ENCRYPTION);
+		opdi_set_encryption(session, use_encryption);
 	}
 #endif
 
+#ifdef OPDI_MULTIMESSAGE_BUFFER_SIZE
+	opdi_set_multimessage(session, use_multimessage);
+#endif
+
+#ifdef OPDI_BINARY_FRAMING
+	// the following messages are sent and received as binary frames
+	opdi_set_binary_framing(session, use_binary);
+#endif
+
+#ifdef OPDI_FRAGMENT_BUFFER_SIZE
+	opdi_set_fragmentation(session, use_fragmentation);
+#endif
+
+#ifdef OPDI_CRC32C
+	// the following text messages end with the CRC-32C
+	opdi_set_crc32c(session, use_crc32c);
+#endif
+
 	////////////////////////////////////////////////////////////
 	///// Receive: Protocol Select
 	////////////////////////////////////////////////////////////
 
-	result = expect_control_message(opdi_msg_parts, &partCount);
+	result = expect_control_message(session, session->msg_parts, &partCount);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	if (partCount != 3)
+	// the master appends its frame length if the device has confirmed the exchange
+	if ((partCount != 3) && !(use_frame_size && (partCount == 4)))
 		return OPDI_PROTOCOL_ERROR;
+
+	if (partCount == 4) {
+		result = opdi_str_to_uint16(session->msg_parts[3], &frameSize);
+		if (result != OPDI_STATUS_OK)
+			return result;
+		// limit the following frames to the length that the master accepts
+		result = opdi_set_frame_size(session, frameSize);
+		if (result != OPDI_STATUS_OK)
+			return result;
+	}
 		
 #ifdef OPDI_EXTENDED_PROTOCOL
 	// check extended protocol implementation
-	if (0 == strcmp(opdi_msg_parts[0], OPDI_Extended_protocol_magic)) {
+	if (0 == strcmp(session->msg_parts[0], OPDI_Extended_protocol_magic)) {
 		protocol_handler = &extended_protocol_message;
 	}
 	else
 #endif
 	// check chosen protocol implementation
-	if (0 != strcmp(opdi_msg_parts[0], OPDI_Basic_protocol_magic)) {
+	if (0 != strcmp(session->msg_parts[0], OPDI_Basic_protocol_magic)) {
 		// not the basic protocol, use device supplied function to determine protocol handler
 		if (get_protocol == NULL)
 			return OPDI_PROTOCOL_NOT_SUPPORTED;
-		protocol_handler = get_protocol(opdi_msg_parts[0]);
+		protocol_handler = get_protocol(session->msg_parts[0]);
 		// protocol not registered
 		if (protocol_handler == NULL)
 			// fallback to basic
@@ -1595,12 +1854,12 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 	}
 
 	// set master's name
-	result = opdi_slave_callback(OPDI_FUNCTION_SET_MASTER_NAME, (char*)opdi_msg_parts[2], 0);
+	result = opdi_slave_callback(OPDI_FUNCTION_SET_MASTER_NAME, (char*)session->msg_parts[2], 0);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
 	// pass preferred languages, see opdi_device.h
-	result = opdi_slave_callback(OPDI_FUNCTION_SET_LANGUAGES, (char*)opdi_msg_parts[1], 0);
+	result = opdi_slave_callback(OPDI_FUNCTION_SET_LANGUAGES, (char*)session->msg_parts[1], 0);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -1613,17 +1872,11 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 	if (result != OPDI_STATUS_OK)
 		return result;
 
-	m.channel = 0;
-	m.payload = opdi_msg_payload;
-	opdi_msg_parts[0] = OPDI_Agreement;
-	opdi_msg_parts[1] = funcBuf1;
-	opdi_msg_parts[2] = NULL;
+	session->msg_parts[0] = OPDI_Agreement;
+	session->msg_parts[1] = funcBuf1;
+	session->msg_parts[2] = NULL;
 
-	result = strings_join(opdi_msg_parts, OPDI_PARTS_SEPARATOR, opdi_msg_payload, OPDI_MESSAGE_PAYLOAD_LENGTH);
-	if (result != OPDI_STATUS_OK)
-		return result;
-
-	result = opdi_put_message(&m);
+	result = opdi_put_parts(session, 0, session->msg_parts);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -1631,7 +1884,7 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 	// is authentication required by the master?
 	if (flags & OPDI_FLAG_AUTHENTICATION_REQUIRED) {
 		// this device does not support authentication
-		send_disagreement(OPDI_AUTH_NOT_SUPPORTED, 0, NULL, NULL);
+		send_disagreement(session, OPDI_AUTH_NOT_SUPPORTED, 0, NULL, NULL);
 		return OPDI_AUTH_NOT_SUPPORTED;
 	}
 #else
@@ -1643,73 +1896,78 @@ uint8_t opdi_slave_start(opdi_Message *message, opdi_GetProtocol get_protocol, o
 		////////////////////////////////////////////////////////////
 
 		// increase the timeout for this procedure (the user may have to enter credentials first)
-		savedTimeout = opdi_get_timeout();
-		opdi_set_timeout(OPDI_AUTHENTICATION_TIMEOUT);
-		result = opdi_get_message(&m, OPDI_CANNOT_SEND);
+		savedTimeout = opdi_get_timeout(session);
+		opdi_set_timeout(session, OPDI_AUTHENTICATION_TIMEOUT);
+		result = opdi_get_message(session, &m, OPDI_CANNOT_SEND);
 		// set the saved timeout back
-		opdi_set_timeout(savedTimeout);
+		opdi_set_timeout(session, savedTimeout);
 		if (result != OPDI_STATUS_OK)
 			return result;
 
-		result = strings_split(m.payload, OPDI_PARTS_SEPARATOR, opdi_msg_parts, OPDI_MAX_MESSAGE_PARTS, 0, NULL);	// no trim!
+		result = strings_split(m.payload, OPDI_PARTS_SEPARATOR, session->msg_parts, OPDI_MAX_MESSAGE_PARTS, 0, NULL);	// no trim!
 		if (result != OPDI_STATUS_OK)
 			return result;
 
-		if (0 != strcmp(opdi_msg_parts[0], OPDI_Auth)) {
-			send_disagreement(0, OPDI_AUTHENTICATION_EXPECTED, NULL, NULL);
+		if (0 != strcmp(session->msg_parts[0], OPDI_Auth)) {
+			send_disagreement(session, 0, OPDI_AUTHENTICATION_EXPECTED, NULL, NULL);
 			return OPDI_AUTHENTICATION_EXPECTED;
 		}
 
 		// set user name
-		result = opdi_slave_callback(OPDI_FUNCTION_SET_USERNAME, (char *)opdi_msg_parts[1], 0);
+		result = opdi_slave_callback(OPDI_FUNCTION_SET_USERNAME, (char *)session->msg_parts[1], 0);
 		if (result == OPDI_STATUS_OK)
 			// set password
-			result = opdi_slave_callback(OPDI_FUNCTION_SET_PASSWORD, (char *)opdi_msg_parts[2], 0);
+			result = opdi_slave_callback(OPDI_FUNCTION_SET_PASSWORD, (char *)session->msg_parts[2], 0);
 		if (result != OPDI_STATUS_OK) {
-			send_disagreement(0, OPDI_AUTHENTICATION_FAILED, "Authentication failed", NULL);
+			send_disagreement(session, 0, OPDI_AUTHENTICATION_FAILED, "Authentication failed", NULL);
 			return OPDI_AUTHENTICATION_FAILED;
 		}
 
-		result = send_agreement(0);
+		result = send_agreement(session, 0);
 		if (result != OPDI_STATUS_OK)
 			return result;
 	}
 #endif	// OPDI_NO_AUTHENTICATION
 
-	connected = 1;
+	session->connected = 1;
 
 	if (protocol_callback != NULL)
 		protocol_callback(OPDI_PROTOCOL_CONNECTED);
 
 	// start the protocol
-	result = message_loop(protocol_handler);
+	result = message_loop(session, protocol_handler);
 
 	if (protocol_callback != NULL)
 		protocol_callback(OPDI_PROTOCOL_DISCONNECTED);
 
-	connected = 0;
+#if (OPDI_STREAMING_PORTS > 0)
+	// release the ports for other connections
+	opdi_reset_bindings(session);
+#endif
+
+	session->connected = 0;
 
 	return result;
 }
 
-uint8_t opdi_slave_connected(void) {
-	return connected;
+uint8_t opdi_slave_connected(opdi_Session *session) {
+	return session->connected;
 }
 
 /** Sends a debug message to the master.
 */
-uint8_t opdi_send_debug(const char *debugmsg) {
-	opdi_msg_parts[0] = OPDI_Debug;
-	opdi_msg_parts[1] = debugmsg;
-	opdi_msg_parts[2] = NULL;
+uint8_t opdi_send_debug(opdi_Session *session, const char *debugmsg) {
+	session->msg_parts[0] = OPDI_Debug;
+	session->msg_parts[1] = debugmsg;
+	session->msg_parts[2] = NULL;
 
-	// send the opdi_msg_parts on the control channel
-	return send_parts(0);
+	// send the session->msg_parts on the control channel
+	return send_parts(session, 0);
 }
 
 /** Causes the Reconfigure message to be sent which prompts the master to re-read the device capabilities.
 */
-uint8_t opdi_reconfigure(void) {
+uint8_t opdi_reconfigure(opdi_Session *session) {
 	// send a reconfigure message on the control channel
 	opdi_Message message;
 	uint8_t result;
@@ -1718,7 +1976,7 @@ uint8_t opdi_reconfigure(void) {
 	message.channel = 0;
 	message.payload = (char *)OPDI_Reconfigure;
 
-	result = opdi_put_message(&message);
+	result = opdi_put_message(session, &message);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -1729,29 +1987,29 @@ uint8_t opdi_reconfigure(void) {
 *   If the first element is NULL, sends the empty refresh message causing all ports to be
 *   refreshed.
 */
-uint8_t opdi_refresh(opdi_Port **ports) {
+uint8_t opdi_refresh(opdi_Session *session, opdi_Port **ports) {
 	opdi_Port *port = ports[0];
 	uint8_t i = 1;
 
-	// prepare the opdi_msg_parts
-	opdi_msg_parts[0] = OPDI_Refresh;
+	// prepare the session->msg_parts
+	session->msg_parts[0] = OPDI_Refresh;
 	// iterate over all specified ports
 	while (port != NULL) {
-		opdi_msg_parts[i] = port->id;
+		session->msg_parts[i] = port->id;
 		port = ports[i++];
 		if (i >= OPDI_MAX_MESSAGE_PARTS)
 			return OPDI_ERROR_PARTS_OVERFLOW;
 	}
-	opdi_msg_parts[i] = NULL;
+	session->msg_parts[i] = NULL;
 
-	// send the opdi_msg_parts
-	return send_parts(0);
+	// send the session->msg_parts
+	return send_parts(session, 0);
 }
 
 /** Causes the Disconnect message to be sent to the master.
 *   Returns OPDI_DISCONNECTED. After this, no more messages may be sent to the master.
 */
-uint8_t opdi_disconnect(void) {
+uint8_t opdi_disconnect(opdi_Session *session) {
 	// send a disconnect message on the control channel
 	opdi_Message message;
 	uint8_t result;
@@ -1760,7 +2018,7 @@ uint8_t opdi_disconnect(void) {
 	message.channel = 0;
 	message.payload = (char *)OPDI_Disconnect;
 
-	result = opdi_put_message(&message);
+	result = opdi_put_message(session, &message);
 	if (result != OPDI_STATUS_OK)
 		return result;
 
@@ -16,6 +16,7 @@
 
 #include "opdi_platformtypes.h"
 #include "opdi_port.h"
+#include "opdi_message.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,7 +30,7 @@ typedef void (*opdi_ProtocolCallback)(uint8_t protocol_state);
 /** Defines a protocol handler that has been identified by a protocol identifier.
 *   This function processes messages
 */
-typedef uint8_t (*opdi_ProtocolHandler)(channel_t channel);
+typedef uint8_t (*opdi_ProtocolHandler)(opdi_Session *session, channel_t channel);
 
 /** Callback function to determine a protocol handler.
 *   If this is NULL, supports only the basic protocol.
@@ -48,37 +49,52 @@ typedef opdi_ProtocolHandler (*opdi_GetProtocol)(const char *protocolID);
 *   Most importantly, this will disable encryption as it is not used at the beginning
 *   of the handshake.
 */
-uint8_t opdi_slave_init(void);
+uint8_t opdi_slave_init(opdi_Session *session);
 
-/** Starts the OPDI protocol by performing the handshake using the given message.
+/** Starts the OPDI protocol on the session by performing the handshake using the given message.
+*   Returns when the session has ended. Several sessions may be run at the same time, each on its
+*   own thread. The ports are shared by the sessions; their callbacks are called on these threads.
 *   get_protocol is used to determine extended protocols. It is passed the master's chosen
 *   protocol identifier and may return a protocol handler. It may also be NULL.
 *   If it is NULL, only the basic protocol can be used.
 */
-uint8_t opdi_slave_start(opdi_Message *m, opdi_GetProtocol get_protocol, opdi_ProtocolCallback protocol_callback);
+uint8_t opdi_slave_start(opdi_Session *session, opdi_Message *m, opdi_GetProtocol get_protocol, opdi_ProtocolCallback protocol_callback);
 
 /** Returns 1 if the slave is currently connected, i. e. a protocol handler is running; 0 otherwise.
 */
-uint8_t opdi_slave_connected(void);
+uint8_t opdi_slave_connected(opdi_Session *session);
 
 /** Sends a debug message to the master.
 */
-uint8_t opdi_send_debug(const char *debugmsg);
+uint8_t opdi_send_debug(opdi_Session *session, const char *debugmsg);
 	
 /** Causes the Reconfigure message to be sent which prompts the master to re-read the device capabilities.
 */
-uint8_t opdi_reconfigure(void);
+uint8_t opdi_reconfigure(opdi_Session *session);
 
 /** Causes the Refresh message to be sent for the specified ports. The last element must be NULL.
 *   If the first element is NULL, sends the empty refresh message causing all ports to be
 *   refreshed.
 */
-uint8_t opdi_refresh(opdi_Port **ports);
+uint8_t opdi_refresh(opdi_Session *session, opdi_Port **ports);
 
 /** Causes the Disconnect message to be sent to the master.
 *   Returns OPDI_DISCONNECTED. After this, no more messages may be sent to the master.
 */
-uint8_t opdi_disconnect(void);
+uint8_t opdi_disconnect(opdi_Session *session);
+
+#if defined(OPDI_SINGLE_SESSION) && !defined(OPDI_SESSION_INTERNAL)
+
+// compatibility layer: map the calls without session argument to the single session
+#define opdi_slave_init()						opdi_slave_init(&opdi_single_session)
+#define opdi_slave_start(m, get_protocol, protocol_callback)	opdi_slave_start(&opdi_single_session, m, get_protocol, protocol_callback)
+#define opdi_slave_connected()					opdi_slave_connected(&opdi_single_session)
+#define opdi_send_debug(debugmsg)				opdi_send_debug(&opdi_single_session, debugmsg)
+#define opdi_reconfigure()						opdi_reconfigure(&opdi_single_session)
+#define opdi_refresh(ports)						opdi_refresh(&opdi_single_session, ports)
+#define opdi_disconnect()						opdi_disconnect(&opdi_single_session)
+
+#endif
 
 #ifdef __cplusplus
 }
@@ -14,6 +14,8 @@
 #ifndef __OPDI_STRINGS_H
 #define __OPDI_STRINGS_H
 
+#include <stddef.h>
+
 #include "opdi_platformtypes.h"
 
 #ifdef __cplusplus
@@ -35,6 +37,48 @@ uint8_t strings_split(const char *str, char separator, const char **parts, uint8
 */
 uint8_t strings_join(const char **parts, char separator, char *dest, uint16_t max_length);
 
+/** Contains the result of strings_scan_frame. Positions are relative to the start of the scanned bytes.
+*/
+typedef struct opdi_FrameScan {
+	size_t length;			// number of bytes before the terminator
+	size_t first_sep;		// position of the first separator; equals length if there is none
+	size_t last_sep;		// position of the last separator; equals length if there is none
+	uint32_t sum;			// additive sum of all bytes before the terminator
+	uint32_t checksum;		// additive sum of all bytes before the last separator; 0 if there is none
+} opdi_FrameScan;
+
+/** Scans at most max_length bytes in a single pass for the terminator and the separators and
+*   computes the additive message checksum on the way. Uses SSE2, AVX2 or NEON if the compiler
+*   targets these instruction sets unless OPDI_NO_SIMD is defined.
+*   Returns OPDI_STATUS_OK if the terminator has been found. Otherwise scan->length equals
+*   max_length and OPDI_ERROR_MALFORMED_MESSAGE is returned.
+*/
+uint8_t strings_scan_frame(const uint8_t *bytes, size_t max_length, uint8_t terminator, uint8_t separator, opdi_FrameScan *scan);
+
+/** Updates crc with the CRC-16/CCITT (polynomial 0x1021) of length bytes. Start with 0xFFFF.
+*   Is used to protect binary message frames.
+*/
+uint16_t strings_crc16(uint16_t crc, const uint8_t *bytes, size_t length);
+
+/** Updates crc with the CRC-32C (Castagnoli, reflected polynomial 0x82f63b78) of length bytes.
+*   Start with 0; the result of one call can be passed to the next to continue the computation.
+*   Uses the CRC32 instructions of SSE4.2 or ARMv8 if the compiler targets these instruction sets
+*   unless OPDI_NO_SIMD is defined, and a slicing-by-8 table otherwise. Not available on AVR.
+*   Is used to protect text message frames if OPDI_CRC32C is defined.
+*/
+uint32_t strings_crc32c(uint32_t crc, const uint8_t *bytes, size_t length);
+
+/** Writes value as a variable length integer of seven bits per byte, least significant group first.
+*   Returns the number of bytes written to dest (1 to 3).
+*/
+uint8_t strings_put_varint(uint16_t value, uint8_t *dest);
+
+/** Reads a variable length integer written by strings_put_varint from at most length bytes.
+*   Returns the number of bytes consumed, or 0 if the bytes end before the integer does or
+*   if the integer does not fit into 16 bits.
+*/
+uint8_t strings_get_varint(const uint8_t *bytes, size_t length, uint16_t *value);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,108 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Level-gated tracing of the messaging subsystem
+
+#ifndef __OPDI_TRACE_H
+#define __OPDI_TRACE_H
+
+#include "opdi_platformtypes.h"
+#include "opdi_configspecs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// trace levels
+
+// nothing is traced
+#define OPDI_TRACE_OFF			0
+// malformed messages are traced
+#define OPDI_TRACE_ERRORS		1
+// all sent and received messages are traced
+#define OPDI_TRACE_MESSAGES		2
+// additionally, messages are passed to opdi_debug_msg (the behavior of earlier versions)
+#define OPDI_TRACE_DEBUG		3
+
+/** The highest trace level that is compiled in. Trace calls above this level cost nothing.
+*   May be defined in the config specs; OPDI_TRACE_OFF removes tracing completely.
+*/
+#ifndef OPDI_TRACE_LEVEL
+#define OPDI_TRACE_LEVEL		OPDI_TRACE_DEBUG
+#endif
+
+/** Is combined with the OPDI_DIR_* direction of a trace record if the message was malformed.
+*/
+#define OPDI_TRACE_MALFORMED	0x40
+
+/** Defines the number of frame bytes that are stored per trace record.
+*/
+#ifndef OPDI_TRACE_DATA_SIZE
+#define OPDI_TRACE_DATA_SIZE	24
+#endif
+
+#if (OPDI_TRACE_LEVEL > OPDI_TRACE_OFF)
+
+/** The current trace level. Is initialized to OPDI_TRACE_LEVEL and may be lowered or raised
+*   (up to OPDI_TRACE_LEVEL) at run time. If it is OPDI_TRACE_OFF, tracing costs a single
+*   comparison per message.
+*/
+extern volatile uint8_t opdi_trace_level;
+
+#define OPDI_TRACE_ENABLED(level)	(((level) <= OPDI_TRACE_LEVEL) && ((level) <= opdi_trace_level))
+
+#else
+
+#define OPDI_TRACE_ENABLED(level)	0
+
+#endif
+
+#ifdef OPDI_TRACE_BUFFER_SIZE
+
+#if ((OPDI_TRACE_BUFFER_SIZE & (OPDI_TRACE_BUFFER_SIZE - 1)) != 0)
+#error "OPDI_TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+/** A trace record in the ring buffer. The records are written without locks; a record
+*   that is currently being written has the sequence number 0.
+*/
+typedef struct opdi_TraceRecord {
+	// consecutive number of the record, starting at 1
+	uint32_t sequence;
+	// time of the event in milliseconds (see opdi_get_time_ms)
+	uint32_t time;
+	// OPDI_DIR_* direction, possibly combined with OPDI_TRACE_MALFORMED
+	uint8_t direction;
+	// number of frame bytes in data
+	uint8_t count;
+	// length of the complete frame
+	uint16_t length;
+	// the first bytes of the frame
+	uint8_t data[OPDI_TRACE_DATA_SIZE];
+} opdi_TraceRecord;
+
+/** Is called by opdi_trace_dump for each record.
+*/
+typedef void (*opdi_TraceDumpFunc)(const opdi_TraceRecord *record);
+
+/** Passes the records in the ring buffer of OPDI_TRACE_BUFFER_SIZE records to dump, oldest first.
+*   Records that are overwritten during the dump are skipped. Returns the number of records passed.
+*   May be called from any thread at any time.
+*/
+uint16_t opdi_trace_dump(opdi_TraceDumpFunc dump);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif		// __OPDI_TRACE_H
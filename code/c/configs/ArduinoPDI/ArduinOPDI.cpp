@@ -72,7 +72,7 @@ static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t c
 }
 
 /** Sends count bytes to the serial port. */
-static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count) {
+static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count, uint8_t more) {
 	Opdi->ioStream->write(bytes, count);
 
 	return OPDI_STATUS_OK;
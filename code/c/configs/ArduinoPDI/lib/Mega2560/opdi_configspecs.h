@@ -29,6 +29,10 @@
 
 #define OPDI_IS_SLAVE	1
 
+// This device serves one master at a time. The message and protocol functions
+// are called without a session argument and use the single session.
+#define OPDI_SINGLE_SESSION
+
 #define OPDI_ENCODING_DEFAULT	OPDI_ENCODING_UTF8
 
 // Defines the maximum message length this slave can receive.
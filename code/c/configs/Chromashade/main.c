@@ -170,7 +170,7 @@ static uint8_t io_receive(void *info, uint8_t *byte, uint16_t timeout, uint8_t c
 
 /** Sends count bytes to the BT module.
 *   If an error occurs returns an error code != 0. */
-static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count) {
+static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count, uint8_t more) {
 	uint16_t counter = 0;
 	
 	while (counter < count)
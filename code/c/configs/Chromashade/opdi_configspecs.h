@@ -32,6 +32,10 @@ extern "C" {
 
 #define OPDI_IS_SLAVE	1
 
+// This device serves one master at a time. The message and protocol functions
+// are called without a session argument and use the single session.
+#define OPDI_SINGLE_SESSION
+
 // Sets the default encoding that is used by this slave.
 #define OPDI_ENCODING_DEFAULT		OPDI_ENCODING_ISO8859_1
 
@@ -64,6 +68,9 @@ extern "C" {
 // Define to conserve memory
 #define OPDI_NO_ENCRYPTION
 
+// Messages are not traced; define to conserve memory
+#define OPDI_TRACE_LEVEL	OPDI_TRACE_OFF
+
 // Define to conserve memory
 #define	OPDI_NO_AUTHENTICATION
 
@@ -34,15 +34,18 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/param.h>
+#include <signal.h>
 
 #include "opdi_platformfuncs.h"
 #include "opdi_configspecs.h"
 #include "opdi_constants.h"
 #include "opdi_port.h"
 #include "opdi_message.h"
+#include "opdi_trace.h"
 #include "opdi_protocol.h"
 #include "opdi_slave_protocol.h"
 #include "opdi_config.h"
@@ -60,19 +63,48 @@ static char first_com_byte = 0;
 static unsigned long idle_timeout_ms = 180000;
 static unsigned long last_activity = 0;
 
-/** For TCP connections, receives a byte from the socket specified in info and places the result in byte.
-*   For serial connections, reads a byte from the file handle specified in info and places the result in byte.
+// is set by SIGUSR1 to request a dump of the trace buffer
+static volatile sig_atomic_t dump_trace = 0;
+
+static void request_trace_dump(int signal) {
+	dump_trace = 1;
+}
+
+/** Prints a trace record to the console. Non-printable bytes are shown in hexadecimal.
+*/
+static void print_trace_record(const opdi_TraceRecord* record) {
+	char dir = ((record->direction & ~OPDI_TRACE_MALFORMED) == OPDI_DIR_INCOMING ? '>' : '<');
+
+	printf("#%u %u ms %c%s %u bytes: ", record->sequence, record->time, dir, 
+		(record->direction & OPDI_TRACE_MALFORMED ? " malformed" : ""), record->length);
+	for (int i = 0; i < record->count; i++) {
+		if ((record->data[i] >= ' ') && (record->data[i] < 127))
+			putchar(record->data[i]);
+		else
+			printf("\\x%02x", record->data[i]);
+	}
+	printf("%s\n", (record->count < record->length ? "..." : ""));
+}
+
+/** For TCP connections, receives the available bytes from the socket specified in info.
+*   For serial connections, reads the available bytes from the file handle specified in info.
+*   At most maxcount bytes are placed in bytes; the number of bytes read is returned in count.
 *   Blocks until data is available or the timeout expires.
 *   If an error occurs returns an error code != 0.
 *   If the connection has been gracefully closed, returns STATUS_DISCONNECTED.
 */
-static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t canSend) {
-	char c;
+static uint8_t io_receive_bulk(void* info, uint8_t* bytes, uint16_t maxcount, uint16_t* count, uint16_t timeout, uint8_t canSend) {
 	int result;
 	uint64_t ticks = opdi_get_time_ms();
 	long sendTicks = ticks;
 
 	while (1) {
+		// dump of the trace buffer requested?
+		if (dump_trace) {
+			dump_trace = 0;
+			opdi_trace_dump(&print_trace_record);
+		}
+
 		// send a message every few ms if canSend
 		// independent of connection mode
 		if (opdi_get_time_ms() - sendTicks >= 830) {
@@ -88,7 +120,7 @@ static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t c
 			int newsockfd = (long)info;
 
 			// try to read data
-			result = read(newsockfd, &c, 1);
+			result = read(newsockfd, bytes, maxcount);
 			if (result < 0) {
 				// timed out?
 				if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -108,28 +140,29 @@ static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t c
 			if (result == 0)
 				// dirty disconnect
 				return OPDI_NETWORK_ERROR;
-			else
-				// a byte has been received
-//				printf("%i", c);
+			else {
+				// bytes have been received
+				*count = result;
 				break;
+			}
 		}
 		else
 		if (connection_mode == MODE_SERIAL) {
 			int fd = (long)info;
-			char inputData;
 			int bytesRead;
 
 			// first byte of connection remembered?
 			if (first_com_byte != 0) {
-				c = first_com_byte;
+				bytes[0] = first_com_byte;
 				first_com_byte = 0;
+				*count = 1;
 				break;
 			}
 
-			if ((bytesRead = read(fd, &inputData, 1)) >= 0) {
-				if (bytesRead == 1) {
-					// a byte has been received
-					c = inputData;
+			if ((bytesRead = read(fd, bytes, maxcount)) >= 0) {
+				if (bytesRead > 0) {
+					// bytes have been received
+					*count = bytesRead;
 					break;
 				}
 				else {
@@ -146,22 +179,29 @@ static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t c
 		}
 	}
 
-	*byte = (uint8_t)c;
-
 	return OPDI_STATUS_OK;
 }
 
+/** Receives a single byte. See io_receive_bulk.
+*/
+static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t canSend) {
+	uint16_t count;
+
+	return io_receive_bulk(info, byte, 1, &count, timeout, canSend);
+}
+
 /** For TCP connections, sends count bytes to the socket specified in info.
+*   If more bytes of the same reply follow, the kernel is told to wait for them (MSG_MORE).
 *   For serial connections, writes count bytes to the file handle specified in info.
 *   If an error occurs returns an error code != 0. */
-static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count) {
+static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count, uint8_t more) {
 	char* c = (char*)bytes;
 
 	if (connection_mode == MODE_TCP) {
 
 		int newsockfd = (long)info;
 
-		if (write(newsockfd, c, count) < 0) {
+		if (send(newsockfd, c, count, (more ? MSG_MORE : 0)) < 0) {
 			printf("ERROR writing to socket");
 			return OPDI_DEVICE_ERROR;
 		}
@@ -209,19 +249,32 @@ int HandleTCPConnection(int csock) {
 		return OPDI_DEVICE_ERROR;
 	}
 
+	// replies are collected in the output buffer and sent at once; don't delay them any further
+	int noDelay = 1;
+	if (setsockopt (csock, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof(noDelay)) < 0) {
+		printf("setsockopt failed\n");
+		return OPDI_DEVICE_ERROR;
+	}
+
 	// info value is the socket handle
-	result = opdi_message_setup(&io_receive, &io_send, (void*)(long)csock);
+	result = opdi_message_setup(&test_session, &io_receive, &io_send, (void*)(long)csock);
 	if (result != 0) 
 		return result;
 
-	result = opdi_get_message(&message, OPDI_CANNOT_SEND);
+	// read incoming data in chunks
+	result = opdi_message_set_bulk_receive(&test_session, &io_receive_bulk);
+	if (result != 0)
+		return result;
+
+	result = opdi_get_message(&test_session, &message, OPDI_CANNOT_SEND);
 	if (result != 0) 
 		return result;
 
 	last_activity = opdi_get_time_ms();
 
 	// initiate handshake
-	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	result = opdi_slave_start(&test_session, &message, NULL, &my_protocol_callback);
+	opdi_message_cleanup(&test_session);
 
 	// release the socket
 	return result;
@@ -238,18 +291,24 @@ int HandleSerialConnection(char firstByte, int fd) {
 	init_device();
 
 	// info value is the serial port handle
-	result = opdi_message_setup(&io_receive, &io_send, (void*)(long)fd);
+	result = opdi_message_setup(&test_session, &io_receive, &io_send, (void*)(long)fd);
+	if (result != 0)
+		return result;
+
+	// read incoming data in chunks
+	result = opdi_message_set_bulk_receive(&test_session, &io_receive_bulk);
 	if (result != 0)
 		return result;
 
-	result = opdi_get_message(&message, OPDI_CANNOT_SEND);
+	result = opdi_get_message(&test_session, &message, OPDI_CANNOT_SEND);
 	if (result != 0)
 		return result;
 
 	last_activity = opdi_get_time_ms();
 
 	// initiate handshake
-	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	result = opdi_slave_start(&test_session, &message, NULL, &my_protocol_callback);
+	opdi_message_cleanup(&test_session);
 
 	return result;
 }
@@ -259,23 +318,23 @@ int HandleSerialConnection(char firstByte, int fd) {
 #endif 
 
 
-uint8_t opdi_message_handled(channel_t channel, const char** parts) {
+uint8_t opdi_message_handled(opdi_Session *session, channel_t channel, const char** parts) {
 	uint8_t result;
 	if (idle_timeout_ms > 0) {
 		// do not time out if there are bound streaming ports
-		if (channel != 0 || opdi_get_port_bind_count() > 0) {
+		if (channel != 0 || opdi_get_port_bind_count(session) > 0) {
 			// reset activity time
 			last_activity = opdi_get_time_ms();
 		} else {
 			// control channel message
 			if (opdi_get_time_ms() - last_activity > idle_timeout_ms) {
-				result = opdi_send_debug("Session timeout!");
+				result = opdi_send_debug(session, "Session timeout!");
 				if (result != OPDI_STATUS_OK)
 					return result;
-				return opdi_disconnect();
+				return opdi_disconnect(session);
 			} else {
 				// send a test debug message
-				// opdi_send_debug("Session timeout not yet reached");
+				// opdi_send_debug(session, "Session timeout not yet reached");
 			}
 		}
 	}
@@ -474,13 +533,18 @@ int main(int argc, char* argv[])
 	int tcp_port = 13110;
 	char* comPort = NULL;
 
-	printf("LinOPDI server. Arguments: [-i] [-tcp <port>] [-com <port>]\n");
+	printf("LinOPDI server. Arguments: [-i] [-q] [-tcp <port>] [-com <port>]\n");
 	printf("-i starts the interactive master.\n");
+	printf("-q does not print messages; send SIGUSR1 to print the most recent messages.\n");
 
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-i") == 0) {
 			interactive = 1;
 		} else
+		if (strcmp(argv[i], "-q") == 0) {
+			// record messages in the trace buffer only
+			opdi_trace_level = OPDI_TRACE_MESSAGES;
+		} else
         	if (i < argc - 1) {
 	                if (strcmp(argv[i], "-tcp") == 0) {
 				// parse tcp port number
@@ -502,6 +566,8 @@ int main(int argc, char* argv[])
 		}
         }
 
+	signal(SIGUSR1, &request_trace_dump);
+
 	// master?
 	if (interactive) {
 		code = start_master();
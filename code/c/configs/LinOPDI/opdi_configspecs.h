@@ -43,7 +43,10 @@ extern "C" {
 
 // Defines the maximum message length this slave can receive.
 // Consumes this amount of bytes in RAM.
-#define OPDI_MESSAGE_BUFFER_SIZE		256
+// Masters that announce their frame length receive frames of up to this size minus one; others receive
+// frames of the traditional length of 255 bytes. Must be a multiple of the encryption block size and
+// less than 16384 for binary framing.
+#define OPDI_MESSAGE_BUFFER_SIZE		16368
 
 // Defines the maximum message string length this slave can receive.
 // Consumes this amount of bytes times sizeof(char) in RAM.
@@ -52,6 +55,37 @@ extern "C" {
 // on systems with only single-byte character sets.
 #define OPDI_MESSAGE_PAYLOAD_LENGTH	(OPDI_MESSAGE_BUFFER_SIZE - 9)
 
+// Defines the size of the buffer for incoming data that is read in chunks.
+// If defined, a bulk receive function may be set using opdi_message_set_bulk_receive.
+#define OPDI_RECEIVE_BUFFER_SIZE		1024
+
+// Define to support binary message frames (length prefix, channel number and CRC-16 instead of
+// the text form with additive checksum) if the master requests them during the handshake.
+#define OPDI_BINARY_FRAMING
+
+// Defines the size of the buffer for outgoing multi-message frames.
+// If defined, replies that consist of several messages are sent with as few writes as possible
+// if the master accepts multi-message frames.
+#define OPDI_MULTIMESSAGE_BUFFER_SIZE	16384
+
+// Defines the size of the buffer for outgoing bytes.
+// If defined, the replies to a request are collected and sent with as few writes as possible.
+#define OPDI_OUTPUT_BUFFER_SIZE		16384
+
+// Defines the size of the buffer for reassembling fragmented messages.
+// If defined, messages that are larger than the message buffer are sent and received as fragments
+// if the master accepts fragmented messages.
+#define OPDI_FRAGMENT_BUFFER_SIZE		65535
+
+// Define to end text messages with a CRC-32C instead of the additive checksum if the master requests it
+// during the handshake. The CRC detects reordered bytes; it is computed with the CRC32 instructions
+// of SSE4.2 or ARMv8 if the compiler targets them.
+#define OPDI_CRC32C
+
+// Defines the number of records in the ring buffer of the trace facility (a power of two).
+// If defined, sent and received messages are recorded and can be dumped using opdi_trace_dump.
+#define OPDI_TRACE_BUFFER_SIZE		256
+
 // maximum length of master's name this device will accept
 #define OPDI_MASTER_NAME_LENGTH	32
 
@@ -61,6 +95,14 @@ extern "C" {
 // maximum possible ports on this device
 #define OPDI_MAX_DEVICE_PORTS	32
 
+// number of slots of the hashed index that finds ports and port groups by ID (a power of two);
+// should be at least twice the number of ports. Undefine to search the port list
+#define OPDI_PORT_INDEX_SIZE	64
+
+// Define to let the port registry grow beyond OPDI_MAX_DEVICE_PORTS (uses malloc). OPDI_MAX_DEVICE_PORTS
+// is then the initial capacity; the value is the number of port records that opdi_new_port allocates at once
+#define OPDI_DYNAMIC_PORTS		64
+
 // define to conserve RAM and ROM
 //#define OPDI_NO_DIGITAL_PORTS
 
@@ -91,6 +133,23 @@ extern "C" {
 */
 #define OPDI_ENCRYPTION_BLOCKSIZE	16
 
+/** Define to offer the counter mode of the encryption method (e. g. "AES-CTR") in addition to the
+*   block mode. In counter mode the messages are encrypted as a byte stream without padding.
+*/
+#define OPDI_ENCRYPTION_CTR
+
+/** Define to offer the Galois/counter mode of the encryption method (e. g. "AES-GCM"). Each message
+*   is sent as a record with a length header and an authentication tag instead of the checksum.
+*   Requires OPDI_ENCRYPTION_CTR and a block size of 16.
+*/
+#define OPDI_ENCRYPTION_GCM
+
+/** Define to encrypt the counter and Galois/counter modes with a key per session. It is derived
+*   from the nonces of the slave and the master during the handshake; the device key is only used
+*   to derive it. Requires OPDI_ENCRYPTION_CTR.
+*/
+#define OPDI_SESSION_KEYS
+
 #define OPDI_HAS_MESSAGE_HANDLED
 
 #define OPDI_MAX_PORT_INFO_MESSAGE	240
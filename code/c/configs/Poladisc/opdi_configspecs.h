@@ -32,6 +32,10 @@ extern "C" {
 
 #define OPDI_IS_SLAVE	1
 
+// This device serves one master at a time. The message and protocol functions
+// are called without a session argument and use the single session.
+#define OPDI_SINGLE_SESSION
+
 // Defines the maximum message length this slave can receive.
 // Consumes this amount of bytes in data and the same amount on the stack.
 #define OPDI_MESSAGE_BUFFER_SIZE		48
@@ -63,6 +67,9 @@ extern "C" {
 // Define to conserve memory
 #define OPDI_NO_ENCRYPTION
 
+// Messages are not traced; define to conserve memory
+#define OPDI_TRACE_LEVEL	OPDI_TRACE_OFF
+
 // Define to conserve memory
 #define	OPDI_NO_AUTHENTICATION
 
@@ -68,8 +68,6 @@ const char *opdi_password = "admin";
 uint16_t opdi_device_flags = OPDI_FLAG_AUTHENTICATION_REQUIRED;
 
 const uint16_t opdi_encryption_blocksize = OPDI_ENCRYPTION_BLOCKSIZE;
-uint8_t opdi_encryption_buffer[OPDI_ENCRYPTION_BLOCKSIZE];
-uint8_t opdi_encryption_buffer_2[OPDI_ENCRYPTION_BLOCKSIZE];
 char opdi_encryption_key[] = "0123456789012345";
 
 /// Ports
@@ -219,7 +217,7 @@ static uint8_t io_receive(void *info, uint8_t *byte, uint16_t timeout, uint8_t c
 /** For TCP connections, sends count bytes to the socket specified in info.
 *   For serial connections, writes count bytes to the file handle specified in info.
 *   If an error occurs returns an error code != 0. */
-static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count) {
+static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count, uint8_t more) {
 	char *c = (char *)bytes;
 
 	if (connection_mode == MODE_TCP) {
@@ -537,6 +535,7 @@ int HandleTCPConnection(int csock) {
 
 	// initiate handshake
 	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	opdi_message_cleanup();
 
 	// release the socket
 	return result;
@@ -561,6 +560,7 @@ int HandleSerialConnection(char firstByte, int fd) {
 
 	// initiate handshake
 	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	opdi_message_cleanup();
 
 	return result;
 }
@@ -36,6 +36,10 @@ extern "C" {
 // This config is a slave
 #define OPDI_IS_SLAVE	1
 
+// This device serves one master at a time. The message and protocol functions
+// are called without a session argument and use the single session.
+#define OPDI_SINGLE_SESSION
+
 // Sets the default encoding used by this config.
 #define OPDI_ENCODING_DEFAULT	OPDI_ENCODING_UTF8
 
@@ -89,6 +93,28 @@ extern "C" {
 */
 #define OPDI_ENCRYPTION_BLOCKSIZE	16
 
+/** Define to offer the counter mode of the encryption method (e. g. "AES-CTR") in addition to the
+*   block mode. In counter mode the messages are encrypted as a byte stream without padding.
+*/
+#define OPDI_ENCRYPTION_CTR
+
+/** Define to offer the Galois/counter mode of the encryption method (e. g. "AES-GCM"). Each message
+*   is sent as a record with a length header and an authentication tag instead of the checksum.
+*   Requires OPDI_ENCRYPTION_CTR and a block size of 16.
+*/
+#define OPDI_ENCRYPTION_GCM
+
+/** Define to encrypt the counter and Galois/counter modes with a key per session. It is derived
+*   from the nonces of the slave and the master during the handshake; the device key is only used
+*   to derive it. Requires OPDI_ENCRYPTION_CTR.
+*/
+#define OPDI_SESSION_KEYS
+
+/** Define to use the constant-time bitsliced AES code instead of the lookup tables of CRijndael
+*   if the processor has no AES instructions (e. g. ARMv6 boards like the Raspberry Pi Zero).
+*/
+#define OPDI_AES_CONSTANT_TIME
+
 #define OPDI_MAX_PORT_INFO_MESSAGE	240
 
 #ifdef __cplusplus
@@ -161,7 +161,7 @@ static uint8_t io_receive(void* info, uint8_t* byte, uint16_t timeout, uint8_t c
 /** For TCP connections, sends count bytes to the socket specified in info.
 *   For COM connections, writes count bytes to the file handle specified in info.
 *   If an error occurs returns an error code != 0. */
-static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count) {
+static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count, uint8_t more) {
 	char* c = (char*)bytes;
 
 	if (connection_mode == MODE_TCP) {
@@ -187,27 +187,27 @@ static uint8_t io_send(void* info, uint8_t* bytes, uint16_t count) {
 void init_device() {
 	configure_ports();
 
-	opdi_slave_init();
+	opdi_slave_init(&test_session);
 }
 
 
-uint8_t opdi_message_handled(channel_t channel, const char** parts) {
+uint8_t opdi_message_handled(opdi_Session *session, channel_t channel, const char** parts) {
 	uint8_t result;
 	if (idle_timeout_ms > 0) {
 		// do not time out if there are bound streaming ports
-		if (channel != 0 || opdi_get_port_bind_count() > 0) {
+		if (channel != 0 || opdi_get_port_bind_count(session) > 0) {
 			// reset activity time
 			last_activity = GetTickCount();
 		} else {
 			// control channel message
 			if (GetTickCount() - last_activity > idle_timeout_ms) {
-				result = opdi_send_debug("Session timeout!");
+				result = opdi_send_debug(session, "Session timeout!");
 				if (result != OPDI_STATUS_OK)
 					return result;
-				return opdi_disconnect();
+				return opdi_disconnect(session);
 			} else {
 				// send a test debug message
-				// opdi_send_debug("Session timeout not yet reached");
+				// opdi_send_debug(session, "Session timeout not yet reached");
 			}
 		}
 	}
@@ -225,16 +225,18 @@ int HandleTCPConnection(int* csock) {
 	init_device();
 
 	// info value is the socket handle
-	opdi_message_setup(&io_receive, &io_send, (void*)csock);
+	opdi_message_setup(&test_session, &io_receive, &io_send, (void*)csock);
+	opdi_set_timeout(&test_session, 65535);
 
-	result = opdi_get_message(&message, OPDI_CANNOT_SEND);
+	result = opdi_get_message(&test_session, &message, OPDI_CANNOT_SEND);
 	if (result != 0) 
 		return result;
 
 	last_activity = GetTickCount();
 
 	// initiate handshake
-	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	result = opdi_slave_start(&test_session, &message, NULL, &my_protocol_callback);
+	opdi_message_cleanup(&test_session);
 
 	// release the socket
     free(csock);
@@ -252,16 +254,18 @@ int HandleCOMConnection(char firstByte, HANDLE hndPort) {
 	init_device();
 
 	// info value is the serial port handle
-	opdi_message_setup(&io_receive, &io_send, (void*)hndPort);
+	opdi_message_setup(&test_session, &io_receive, &io_send, (void*)hndPort);
+	opdi_set_timeout(&test_session, 65535);
 
-	result = opdi_get_message(&message, OPDI_CANNOT_SEND);
+	result = opdi_get_message(&test_session, &message, OPDI_CANNOT_SEND);
 	if (result != 0) 
 		return result;
 
 	last_activity = GetTickCount();
 
 	// initiate handshake
-	result = opdi_slave_start(&message, NULL, &my_protocol_callback);
+	result = opdi_slave_start(&test_session, &message, NULL, &my_protocol_callback);
+	opdi_message_cleanup(&test_session);
 
     return result;
 }
@@ -502,8 +506,6 @@ int _tmain(int argc, _TCHAR* argv[])
 	if (interactive) {
 		code = start_master();
 	} else {
-		opdi_set_timeout(65535);
-
 		// slave
 		if (com_port > 0) {
 			LPCTSTR comPort = (LPCTSTR)malloc(6);
@@ -92,6 +92,23 @@ extern "C" {
 */
 #define OPDI_ENCRYPTION_BLOCKSIZE	16
 
+/** Define to offer the counter mode of the encryption method (e. g. "AES-CTR") in addition to the
+*   block mode. In counter mode the messages are encrypted as a byte stream without padding.
+*/
+#define OPDI_ENCRYPTION_CTR
+
+/** Define to offer the Galois/counter mode of the encryption method (e. g. "AES-GCM"). Each message
+*   is sent as a record with a length header and an authentication tag instead of the checksum.
+*   Requires OPDI_ENCRYPTION_CTR and a block size of 16.
+*/
+#define OPDI_ENCRYPTION_GCM
+
+/** Define to encrypt the counter and Galois/counter modes with a key per session. It is derived
+*   from the nonces of the slave and the master during the handshake; the device key is only used
+*   to derive it. Requires OPDI_ENCRYPTION_CTR.
+*/
+#define OPDI_SESSION_KEYS
+
 #define OPDI_HAS_MESSAGE_HANDLED
 
 #define OPDI_MAX_PORT_INFO_MESSAGE	256
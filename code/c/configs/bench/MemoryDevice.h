@@ -0,0 +1,79 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// An in-memory transport for the master's MessageQueueDevice (benchmarks and fuzz target).
+
+#ifndef __MEMORYDEVICE_H
+#define __MEMORYDEVICE_H
+
+#include <string.h>
+#include <string>
+
+#include "opdi_MessageQueueDevice.h"
+
+extern "C" char opdi_encryption_key[];
+
+/** A device that reads the bytes of the input string and appends written bytes to the output string.
+*   It is never connected; only the encoding and encryption functions of MessageQueueDevice are used.
+*/
+class MemoryDevice : public MessageQueueDevice
+{
+public:
+	// the bytes that are delivered by the read functions
+	std::string input;
+	size_t inputPos;
+	// the bytes that have been written
+	std::string output;
+
+	MemoryDevice() : MessageQueueDevice("memory"), inputPos(0) {}
+
+	virtual ~MemoryDevice() { clearEncryption(); }
+
+	// replaces the input
+	void setInput(const std::string& bytes) { input = bytes; inputPos = 0; }
+
+	virtual std::string getEncryptionKey() { return std::string(opdi_encryption_key); }
+	virtual char read() { return input[inputPos++]; }
+	virtual int read_bytes(char buffer[], int maxlength) {
+		int count = hasBytes();
+		if (count > maxlength)
+			count = maxlength;
+		memcpy(buffer, input.data() + inputPos, count);
+		inputPos += count;
+		return count;
+	}
+	virtual int hasBytes() { return (int)(input.size() - inputPos); }
+	virtual int read(char buffer[], int length) { return read_bytes(buffer, length); }
+	virtual void write(char buffer[], int length) { output.append(buffer, length); }
+	virtual void close() {}
+
+	virtual bool isSupported() { return true; }
+	virtual bool prepare() { return true; }
+	virtual std::string getMasterName() { return "Bench"; }
+	virtual void logDebug(std::string) {}
+	virtual std::string getName() { return "memory"; }
+	virtual std::string getLabel() { return "memory"; }
+	virtual std::string getAddress() { return "memory"; }
+	virtual bool tryToUseEncryption() { return true; }
+	virtual void connect(IDeviceListener*) {}
+	virtual void abortConnect() {}
+	virtual IBasicProtocol* getProtocol() { return NULL; }
+	virtual std::string getDeviceName() { return "memory"; }
+	virtual std::string getDisplayAddress() { return "memory"; }
+	virtual std::string getUser() { return ""; }
+	virtual void setUser(std::string) {}
+	virtual std::string getPassword() { return ""; }
+	virtual void setPassword(std::string) {}
+	virtual std::string getConnectionMessage(uint8_t) { return ""; }
+	virtual BasicDeviceCapabilities* getCapabilities() { return NULL; }
+};
+
+#endif		// __MEMORYDEVICE_H
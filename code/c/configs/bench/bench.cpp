@@ -0,0 +1,586 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Microbenchmarks for the OPDI messaging layer.
+// Usage: bench [iterations]
+// Reports messages per second, nanoseconds per message and the bytes on the wire per second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "opdi_constants.h"
+#include "opdi_config.h"
+#include "opdi_message.h"
+#include "opdi_strings.h"
+#include "opdi_trace.h"
+#include "opdi_aes.h"
+
+#include "opdi_OPDIMessage.h"
+#include "opdi_StringTools.h"
+
+#include "MemoryDevice.h"
+
+// sample messages of different lengths (without checksum and terminator)
+static const char *samples[] = {
+	"0:gDS:DO1",
+	"1:DL:DO1:1",
+	"0:BDC:DO1:DO2:DI1:AO1:AI1:SL1:DL1:SL2",
+	"0:BSP:SL2:Select Port 2:3:0",
+	"0:BDP:DO1:Digital Out 1:out:0:Label text with some more characters in it to fill the payload",
+	"0:This is a long payload that resembles an extended device info or a port message "
+		"with many characters that have to be scanned for the separators and summed up for "
+		"the checksum before the payload can be copied to the message buffer",
+};
+
+#define SAMPLE_COUNT	(sizeof(samples) / sizeof(samples[0]))
+
+// the serial form of all samples including checksum and terminator
+static std::string textStream;
+// all samples as binary frames
+static std::string binaryStream;
+// the serial form of all samples with CRC-32C instead of the additive checksum
+static std::string crcStream;
+// the serial form of all samples, encrypted
+static std::string encryptedStream;
+// the stream that is currently delivered by the receive functions
+static std::string stream;
+static size_t streamPos;
+
+// the serial forms of the samples without terminator (for the master)
+static std::string serialForms[SAMPLE_COUNT];
+// the binary frames of the samples
+static std::string binaryForms[SAMPLE_COUNT];
+// the serial forms of the samples with CRC-32C, without terminator
+static std::string crcForms[SAMPLE_COUNT];
+
+// the framings of the slave
+#define TEXT		0
+#define BINARY		1
+#define CRC32C		2
+
+// the samples split into channel and payload
+static int channels[SAMPLE_COUNT];
+static std::string payloads[SAMPLE_COUNT];
+
+static void prepare_samples(void) {
+	char checksum[12];
+	uint8_t buffer[OPDI_MESSAGE_BUFFER_SIZE];
+	for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+		unsigned int sum = 0;
+		for (const char *c = samples[i]; *c; c++)
+			sum += *c & 0xff;
+		snprintf(checksum, sizeof(checksum), ":%04x", sum & 0xffff);
+		serialForms[i] = std::string(samples[i]) + checksum;
+		textStream += serialForms[i] + "\n";
+		snprintf(checksum, sizeof(checksum), ":%08x", strings_crc32c(0, (const uint8_t *)samples[i], strlen(samples[i])));
+		crcForms[i] = std::string(samples[i]) + checksum;
+		crcStream += crcForms[i] + "\n";
+
+		const char *sep = strchr(samples[i], ':');
+		channels[i] = atoi(samples[i]);
+		payloads[i] = std::string(sep + 1);
+		OPDIMessage message(channels[i], payloads[i]);
+		int length = message.encodeBinary((char *)buffer, sizeof(buffer));
+		binaryForms[i] = std::string((const char *)buffer, length);
+		binaryStream += binaryForms[i];
+
+		// pad the serial form to whole blocks like the message layer
+		std::string padded = serialForms[i] + "\n";
+		padded.resize((padded.size() + OPDI_ENCRYPTION_BLOCKSIZE - 1) / OPDI_ENCRYPTION_BLOCKSIZE * OPDI_ENCRYPTION_BLOCKSIZE, ' ');
+		opdi_encrypt_blocks(buffer, (const uint8_t *)padded.data(), (uint16_t)(padded.size() / OPDI_ENCRYPTION_BLOCKSIZE));
+		encryptedStream += std::string((const char *)buffer, padded.size());
+	}
+}
+
+/** Returns the text stream repeated for at least the given number of messages and combined with
+*   the key stream of the counter mode (nonce 0) like the master sends it to the slave.
+*/
+static std::string counter_mode_stream(long messages) {
+	uint8_t block[OPDI_ENCRYPTION_BLOCKSIZE];
+	std::string result;
+
+	for (long i = 0; i <= messages / (long)SAMPLE_COUNT; i++)
+		result += textStream;
+	for (size_t pos = 0; pos < result.size(); pos += OPDI_ENCRYPTION_BLOCKSIZE) {
+		uint32_t counter = (uint32_t)(pos / OPDI_ENCRYPTION_BLOCKSIZE);
+		memset(block, 0, sizeof(block));
+		block[OPDI_CTR_NONCE_SIZE] = OPDI_DIR_INCOMING;
+		block[OPDI_ENCRYPTION_BLOCKSIZE - 4] = (uint8_t)(counter >> 24);
+		block[OPDI_ENCRYPTION_BLOCKSIZE - 3] = (uint8_t)(counter >> 16);
+		block[OPDI_ENCRYPTION_BLOCKSIZE - 2] = (uint8_t)(counter >> 8);
+		block[OPDI_ENCRYPTION_BLOCKSIZE - 1] = (uint8_t)counter;
+		opdi_encrypt_blocks(block, block, 1);
+		for (size_t i = 0; (i < sizeof(block)) && (pos + i < result.size()); i++)
+			result[pos + i] ^= block[i];
+	}
+	return result;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** Prints the results of a message benchmark. bytes is the number of bytes on the wire.
+*/
+static void report(const char *name, long messages, double bytes, double seconds) {
+	printf("%-36s %10ld msgs %8.3f s %12.0f msgs/s %8.1f ns/msg %8.1f MB/s\n", name, messages, seconds,
+		messages / seconds, seconds * 1e9 / messages, bytes / seconds / 1e6);
+}
+
+/** Returns the number of bytes of the given number of messages of a stream that contains each sample once.
+*/
+static double stream_bytes(const std::string &samples, long messages) {
+	return (double)samples.size() * messages / SAMPLE_COUNT;
+}
+
+/** Delivers the sample stream in an endless loop, one byte per call.
+*/
+static uint8_t io_receive(void *info, uint8_t *byte, uint16_t timeout, uint8_t canSend) {
+	*byte = (uint8_t)stream[streamPos++];
+	if (streamPos >= stream.size())
+		streamPos = 0;
+	return OPDI_STATUS_OK;
+}
+
+/** Delivers the sample stream in an endless loop, as many bytes as requested.
+*/
+static uint8_t io_receive_bulk(void *info, uint8_t *bytes, uint16_t maxcount, uint16_t *count, uint16_t timeout, uint8_t canSend) {
+	uint16_t n = 0;
+	while (n < maxcount) {
+		size_t chunk = stream.size() - streamPos;
+		if (chunk > (size_t)(maxcount - n))
+			chunk = maxcount - n;
+		memcpy(bytes + n, stream.data() + streamPos, chunk);
+		n += (uint16_t)chunk;
+		streamPos += chunk;
+		if (streamPos >= stream.size())
+			streamPos = 0;
+	}
+	*count = n;
+	return OPDI_STATUS_OK;
+}
+
+// the number of bytes that have been sent
+static double sentBytes;
+// collects the sent bytes if it is not NULL
+static std::string *sentStream;
+
+static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count, uint8_t more) {
+	sentBytes += count;
+	if (sentStream != NULL)
+		sentStream->append((const char *)bytes, count);
+	return OPDI_STATUS_OK;
+}
+
+static void bench_slave_decode(const char *name, long iterations, func_receive_bulk recv_bulk, uint8_t framing, uint8_t encrypted = 0) {
+	static opdi_Session session;
+	opdi_Message message;
+	uint8_t result;
+
+	opdi_message_setup(&session, &io_receive, &io_send, NULL);
+	opdi_message_set_bulk_receive(&session, recv_bulk);
+	opdi_set_binary_framing(&session, framing == BINARY);
+	opdi_set_crc32c(&session, framing == CRC32C);
+	opdi_set_encryption(&session, encrypted);
+	if (encrypted == OPDI_USE_ENCRYPTION_CTR)
+		// the key stream does not repeat; the stream must not wrap around
+		stream = counter_mode_stream(iterations);
+	else
+		stream = (encrypted ? encryptedStream : (framing == BINARY ? binaryStream : (framing == CRC32C ? crcStream : textStream)));
+	streamPos = 0;
+	// the counter mode stream contains more than one pass of the samples
+	double bytes = stream_bytes(encrypted == OPDI_USE_ENCRYPTION_CTR ? textStream : stream, iterations);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		result = opdi_get_message(&session, &message, OPDI_CANNOT_SEND);
+		if (result != OPDI_STATUS_OK) {
+			printf("%s: error %d\n", name, result);
+			exit(1);
+		}
+	}
+	report(name, iterations, bytes, seconds_since(start));
+}
+
+static void bench_slave_encode(const char *name, long iterations, uint8_t framing, uint8_t encrypted = 0) {
+	static opdi_Session session;
+	opdi_Message message;
+	char payload[OPDI_MESSAGE_PAYLOAD_LENGTH];
+	uint8_t result;
+
+	opdi_message_setup(&session, &io_receive, &io_send, NULL);
+	opdi_set_binary_framing(&session, framing == BINARY);
+	opdi_set_crc32c(&session, framing == CRC32C);
+	opdi_set_encryption(&session, encrypted);
+	sentBytes = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		size_t sample = i % SAMPLE_COUNT;
+		// the payload is not modified but opdi_Message requires a mutable string
+		strcpy(payload, payloads[sample].c_str());
+		message.channel = (channel_t)channels[sample];
+		message.payload = payload;
+		result = opdi_put_message(&session, &message);
+		if (result != OPDI_STATUS_OK) {
+			printf("%s: error %d\n", name, result);
+			exit(1);
+		}
+	}
+	report(name, iterations, sentBytes, seconds_since(start));
+}
+
+static void bench_master_decode_binary(const char *name, long iterations) {
+	long channelSum = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		const std::string &frame = binaryForms[i % SAMPLE_COUNT];
+		OPDIMessage *message = OPDIMessage::decodeBinary(frame.data(), (int)frame.size());
+		channelSum += message->getChannel();
+		delete message;
+	}
+	report(name, iterations, stream_bytes(binaryStream, iterations), seconds_since(start));
+	if (channelSum < 0)
+		printf("unexpected channel sum\n");
+}
+
+static void bench_master_encode(const char *name, long iterations, uint8_t framing) {
+	char buffer[OPDI_MESSAGE_BUFFER_SIZE];
+	long length = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		size_t sample = i % SAMPLE_COUNT;
+		OPDIMessage message(channels[sample], payloads[sample]);
+		length += (framing == BINARY ? message.encodeBinary(buffer, sizeof(buffer)) : message.encode(0, buffer, sizeof(buffer), framing == CRC32C));
+	}
+	report(name, iterations, (double)length, seconds_since(start));
+	if (length < 0)
+		printf("unexpected length sum\n");
+}
+
+static void report_sizes(void) {
+	printf("%-36s %10s %10s\n", "message size (bytes)", "text", "binary");
+	for (size_t i = 0; i < SAMPLE_COUNT; i++)
+		printf("  sample %-27d %10d %10d\n", (int)i + 1, (int)serialForms[i].size() + 1, (int)binaryForms[i].size());
+	printf("  %-34s %10.1f %10.1f\n", "average", (double)textStream.size() / SAMPLE_COUNT, (double)binaryStream.size() / SAMPLE_COUNT);
+}
+
+static void bench_master_decode(const char *name, long iterations, bool crc32c) {
+	char buffer[OPDI_MESSAGE_BUFFER_SIZE];
+	long channels = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		const std::string &serialForm = (crc32c ? crcForms : serialForms)[i % SAMPLE_COUNT];
+		// decode expects a mutable buffer
+		memcpy(buffer, serialForm.c_str(), serialForm.size() + 1);
+		OPDIMessage *message = OPDIMessage::decode(buffer, false, crc32c);
+		channels += message->getChannel();
+		delete message;
+	}
+	report(name, iterations, stream_bytes(crc32c ? crcStream : textStream, iterations), seconds_since(start));
+	if (channels < 0)
+		printf("unexpected channel sum\n");
+}
+
+/** Measures the checksums of the text and binary frames over the sample stream.
+*/
+static void bench_checksum(const char *name, long iterations, uint8_t framing) {
+	const uint8_t *bytes = (const uint8_t *)textStream.data();
+	uint32_t checksum = 0;
+	opdi_FrameScan scan;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i += SAMPLE_COUNT) {
+		if (framing == CRC32C)
+			checksum += strings_crc32c(0, bytes, textStream.size());
+		else if (framing == BINARY)
+			checksum += strings_crc16(0xffff, bytes, textStream.size());
+		else {
+			strings_scan_frame(bytes, textStream.size(), '\0', ':', &scan);
+			checksum += scan.sum;
+		}
+	}
+	report(name, iterations, stream_bytes(textStream, iterations), seconds_since(start));
+	if (checksum == 1)
+		printf("unexpected checksum\n");
+}
+
+static void bench_strings_split(const char *name, long iterations) {
+	char buffer[OPDI_MESSAGE_BUFFER_SIZE];
+	const char *parts[OPDI_MAX_MESSAGE_PARTS];
+	uint8_t partCount;
+	long partSum = 0;
+	double bytes = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		const std::string &payload = payloads[i % SAMPLE_COUNT];
+		// the parts are split in place
+		memcpy(buffer, payload.c_str(), payload.size() + 1);
+		if (strings_split(buffer, ':', parts, OPDI_MAX_MESSAGE_PARTS, 1, &partCount) != OPDI_STATUS_OK) {
+			printf("%s: error\n", name);
+			exit(1);
+		}
+		partSum += partCount;
+		bytes += payload.size();
+	}
+	report(name, iterations, bytes, seconds_since(start));
+	if (partSum < 0)
+		printf("unexpected part sum\n");
+}
+
+static void bench_strings_join(const char *name, long iterations) {
+	char buffers[SAMPLE_COUNT][OPDI_MESSAGE_BUFFER_SIZE];
+	const char *parts[SAMPLE_COUNT][OPDI_MAX_MESSAGE_PARTS + 1];
+	char dest[OPDI_MESSAGE_BUFFER_SIZE];
+	double bytes = 0;
+
+	// join the parts of the split payloads
+	for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+		uint8_t partCount;
+		memcpy(buffers[i], payloads[i].c_str(), payloads[i].size() + 1);
+		strings_split(buffers[i], ':', parts[i], OPDI_MAX_MESSAGE_PARTS, 0, &partCount);
+		parts[i][partCount] = NULL;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		if (strings_join(parts[i % SAMPLE_COUNT], ':', dest, sizeof(dest)) != OPDI_STATUS_OK) {
+			printf("%s: error\n", name);
+			exit(1);
+		}
+		bytes += strlen(dest);
+	}
+	report(name, iterations, bytes, seconds_since(start));
+}
+
+static void bench_master_split(const char *name, long iterations) {
+	std::vector<std::string> parts;
+	long partSum = 0;
+	double bytes = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		const std::string &payload = payloads[i % SAMPLE_COUNT];
+		parts.clear();
+		StringTools::split(payload, ':', parts);
+		partSum += parts.size();
+		bytes += payload.size();
+	}
+	report(name, iterations, bytes, seconds_since(start));
+	if (partSum < 0)
+		printf("unexpected part sum\n");
+}
+
+static void bench_master_join(const char *name, long iterations) {
+	std::vector<std::string> parts[SAMPLE_COUNT];
+	double bytes = 0;
+
+	for (size_t i = 0; i < SAMPLE_COUNT; i++)
+		StringTools::split(payloads[i], ':', parts[i]);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++)
+		bytes += StringTools::join(':', parts[i % SAMPLE_COUNT]).size();
+	report(name, iterations, bytes, seconds_since(start));
+}
+
+/** Measures the master receiving the messages that the slave sends with the given encryption.
+*   The messages pass the buffered block pipeline of MessageQueueDevice (read_block).
+*/
+static void bench_master_receive(const char *name, long iterations, uint8_t encrypted, MessageQueueDevice::Encryption encryption) {
+	static opdi_Session session;
+	opdi_Message message;
+	char payload[OPDI_MESSAGE_PAYLOAD_LENGTH];
+	char nonce[2 * OPDI_CTR_NONCE_SIZE + 1] = "";
+	char buffer[1024];
+	std::string encryptedStream;
+	MemoryDevice device;
+	long messages = 0;
+	// the number of messages in the stream
+	const long streamMessages = 100 * SAMPLE_COUNT;
+
+	// let the slave encrypt the stream
+	opdi_message_setup(&session, &io_receive, &io_send, NULL);
+	if (encrypted >= OPDI_USE_ENCRYPTION_CTR)
+		opdi_new_ctr_nonce(&session, device.newEncryptionNonce().c_str(), nonce);
+	opdi_set_encryption(&session, encrypted);
+	sentStream = &encryptedStream;
+	for (long i = 0; i < streamMessages; i++) {
+		size_t sample = i % SAMPLE_COUNT;
+		strcpy(payload, payloads[sample].c_str());
+		message.channel = (channel_t)channels[sample];
+		message.payload = payload;
+		opdi_put_message(&session, &message);
+	}
+	sentStream = NULL;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	device.setInput(encryptedStream);
+	device.setEncryption(encryption, nonce);
+	while (messages < iterations) {
+		if (!device.has_block()) {
+			// start again; the key streams of the counter modes must start again, too
+			device.setInput(encryptedStream);
+			device.setEncryption(encryption, nonce);
+		}
+		int count = device.read_block(buffer, sizeof(buffer));
+		for (int i = 0; i < count; i++)
+			if (buffer[i] == OPDIMessage::TERMINATOR)
+				messages++;
+	}
+	report(name, messages, (double)encryptedStream.size() * messages / streamMessages, seconds_since(start));
+}
+
+/** Measures the master encoding and encrypting messages (write_blocks).
+*/
+static void bench_master_send(const char *name, long iterations, MessageQueueDevice::Encryption encryption) {
+	char buffer[OPDI_MESSAGE_BUFFER_SIZE];
+	MemoryDevice device;
+	double bytes = 0;
+
+	device.setEncryption(encryption, "0001020304050607");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		size_t sample = i % SAMPLE_COUNT;
+		OPDIMessage message(channels[sample], payloads[sample]);
+		device.write_blocks(buffer, message.encode(0, buffer, sizeof(buffer)));
+		if (device.output.size() > 65536) {
+			bytes += device.output.size();
+			device.output.clear();
+		}
+	}
+	bytes += device.output.size();
+	report(name, iterations, bytes, seconds_since(start));
+}
+
+static void bench_aes(const char *name, long iterations, uint8_t backend, bool encrypt, uint16_t perCall) {
+	uint8_t blocks[64 * OPDI_ENCRYPTION_BLOCKSIZE];
+	uint8_t result = OPDI_STATUS_OK;
+	long count = 0;
+
+	if (opdi_aes_select_backend(backend) != OPDI_STATUS_OK) {
+		printf("%-36s not available on this CPU\n", name);
+		return;
+	}
+	for (size_t i = 0; i < sizeof(blocks); i++)
+		blocks[i] = (uint8_t)i;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (count < iterations) {
+		// process the buffer in place again and again, perCall blocks per call
+		for (size_t i = 0; i < sizeof(blocks); i += perCall * OPDI_ENCRYPTION_BLOCKSIZE)
+			result |= (encrypt ? opdi_encrypt_blocks(blocks + i, blocks + i, perCall) : opdi_decrypt_blocks(blocks + i, blocks + i, perCall));
+		count += sizeof(blocks) / OPDI_ENCRYPTION_BLOCKSIZE;
+	}
+	double seconds = seconds_since(start);
+	if (result != OPDI_STATUS_OK) {
+		printf("%s: error %d\n", name, result);
+		exit(1);
+	}
+	printf("%-36s %10ld blks %8.3f s %12.0f blks/s\n", name, count, seconds, count / seconds);
+}
+
+// the key of the AES benchmarks
+char opdi_encryption_key[] = "0123456789012345";
+const uint16_t opdi_encryption_blocksize = OPDI_ENCRYPTION_BLOCKSIZE;
+
+// the message layer requires the debug callback
+uint8_t opdi_debug_msg(const char *str, uint8_t direction) {
+	return OPDI_STATUS_OK;
+}
+
+int main(int argc, char *argv[]) {
+	long iterations = 1000000;
+	if (argc > 1)
+		iterations = atol(argv[1]);
+	if (iterations <= 0) {
+		printf("Usage: bench [iterations]\n");
+		return 1;
+	}
+
+	prepare_samples();
+
+	// measure with tracing switched off at run time
+	opdi_trace_level = OPDI_TRACE_OFF;
+
+	report_sizes();
+
+	bench_slave_decode("slave decode (byte receive)", iterations, NULL, TEXT);
+	bench_slave_decode("slave decode (bulk receive)", iterations, &io_receive_bulk, TEXT);
+	bench_slave_decode("slave decode binary (byte receive)", iterations, NULL, BINARY);
+	bench_slave_decode("slave decode binary (bulk receive)", iterations, &io_receive_bulk, BINARY);
+	bench_slave_decode("slave decode CRC-32C (byte receive)", iterations, NULL, CRC32C);
+	bench_slave_decode("slave decode CRC-32C (bulk receive)", iterations, &io_receive_bulk, CRC32C);
+	bench_slave_encode("slave encode", iterations, TEXT);
+	bench_slave_encode("slave encode binary", iterations, BINARY);
+	bench_slave_encode("slave encode CRC-32C", iterations, CRC32C);
+	bench_master_decode("master decode", iterations, false);
+	bench_master_decode("master decode CRC-32C", iterations, true);
+	bench_master_decode_binary("master decode binary", iterations);
+	bench_master_encode("master encode", iterations, TEXT);
+	bench_master_encode("master encode binary", iterations, BINARY);
+	bench_master_encode("master encode CRC-32C", iterations, CRC32C);
+	bench_checksum("checksum (additive)", iterations, TEXT);
+	bench_checksum("checksum (CRC-16)", iterations, BINARY);
+	bench_checksum("checksum (CRC-32C)", iterations, CRC32C);
+	bench_strings_split("strings_split", iterations);
+	bench_strings_join("strings_join", iterations);
+	bench_master_split("master split", iterations);
+	bench_master_join("master join", iterations);
+	bench_aes("aes encrypt (portable)", iterations, OPDI_AES_PORTABLE, true, 1);
+	bench_aes("aes decrypt (portable)", iterations, OPDI_AES_PORTABLE, false, 1);
+	bench_aes("aes encrypt 16 blocks (portable)", iterations, OPDI_AES_PORTABLE, true, 16);
+	bench_aes("aes decrypt 16 blocks (portable)", iterations, OPDI_AES_PORTABLE, false, 16);
+	bench_aes("aes encrypt (bitsliced)", iterations, OPDI_AES_BITSLICED, true, 1);
+	bench_aes("aes decrypt (bitsliced)", iterations, OPDI_AES_BITSLICED, false, 1);
+	bench_aes("aes encrypt 16 blocks (bitsliced)", iterations, OPDI_AES_BITSLICED, true, 16);
+	bench_aes("aes decrypt 16 blocks (bitsliced)", iterations, OPDI_AES_BITSLICED, false, 16);
+	bench_aes("aes encrypt (AES-NI)", iterations, OPDI_AES_AESNI, true, 1);
+	bench_aes("aes decrypt (AES-NI)", iterations, OPDI_AES_AESNI, false, 1);
+	bench_aes("aes encrypt 16 blocks (AES-NI)", iterations, OPDI_AES_AESNI, true, 16);
+	bench_aes("aes decrypt 16 blocks (AES-NI)", iterations, OPDI_AES_AESNI, false, 16);
+	bench_aes("aes encrypt (ARMv8)", iterations, OPDI_AES_ARMV8, true, 1);
+	bench_aes("aes decrypt (ARMv8)", iterations, OPDI_AES_ARMV8, false, 1);
+	bench_aes("aes encrypt 16 blocks (ARMv8)", iterations, OPDI_AES_ARMV8, true, 16);
+	bench_aes("aes decrypt 16 blocks (ARMv8)", iterations, OPDI_AES_ARMV8, false, 16);
+
+	// the encrypted messages use the fastest backend, or the bitsliced backend if it is the default
+	opdi_aes_select_backend(opdi_aes_backend_available(OPDI_AES_AESNI) ? OPDI_AES_AESNI : (opdi_aes_backend_available(OPDI_AES_ARMV8) ? OPDI_AES_ARMV8 :
+#ifdef OPDI_AES_CONSTANT_TIME
+		OPDI_AES_BITSLICED));
+#else
+		OPDI_AES_PORTABLE));
+#endif
+	bench_slave_decode("slave decode AES (byte receive)", iterations, NULL, TEXT, OPDI_USE_ENCRYPTION);
+	bench_slave_decode("slave decode AES (bulk receive)", iterations, &io_receive_bulk, TEXT, OPDI_USE_ENCRYPTION);
+	bench_slave_encode("slave encode AES", iterations, TEXT, OPDI_USE_ENCRYPTION);
+	bench_slave_decode("slave decode AES-CTR (byte receive)", iterations, NULL, TEXT, OPDI_USE_ENCRYPTION_CTR);
+	bench_slave_decode("slave decode AES-CTR (bulk receive)", iterations, &io_receive_bulk, TEXT, OPDI_USE_ENCRYPTION_CTR);
+	bench_slave_encode("slave encode AES-CTR", iterations, TEXT, OPDI_USE_ENCRYPTION_CTR);
+	bench_slave_encode("slave encode AES-GCM", iterations, TEXT, OPDI_USE_ENCRYPTION_GCM);
+	bench_master_receive("master receive AES", iterations, OPDI_USE_ENCRYPTION, MessageQueueDevice::AES);
+	bench_master_receive("master receive AES-CTR", iterations, OPDI_USE_ENCRYPTION_CTR, MessageQueueDevice::AES_CTR);
+	bench_master_receive("master receive AES-GCM", iterations, OPDI_USE_ENCRYPTION_GCM, MessageQueueDevice::AES_GCM);
+	bench_master_send("master send AES", iterations, MessageQueueDevice::AES);
+	bench_master_send("master send AES-CTR", iterations, MessageQueueDevice::AES_CTR);
+	bench_master_send("master send AES-GCM", iterations, MessageQueueDevice::AES_GCM);
+
+	return 0;
+}
@@ -0,0 +1,516 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Fuzz target for the OPDI messaging layer.
+// Each input is passed as received bytes to the decoders of the slave and the master in all framings
+// and encryption modes. The optimized functions are compared with simple reference implementations
+// and the messages that are derived from the input must pass the encoders and decoders unchanged.
+// A difference is reported and the program is aborted.
+// Usage: fuzz [iterations [seed]] mutates the sample messages with its own generator.
+// If OPDI_LIBFUZZER is defined, only LLVMFuzzerTestOneInput is compiled (clang -fsanitize=fuzzer).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "opdi_constants.h"
+#include "opdi_protocol_constants.h"
+#include "opdi_config.h"
+#include "opdi_message.h"
+#include "opdi_strings.h"
+#include "opdi_trace.h"
+
+#include "opdi_OPDIMessage.h"
+
+#include "MemoryDevice.h"
+
+// the bytes that are delivered by the receive functions
+static const uint8_t *input;
+static size_t inputLength;
+static size_t inputPos;
+// flag whether the bulk receive function fills the receive buffer completely
+static bool fullChunks;
+// the bytes that have been sent by the slave
+static std::string sent;
+// the nonce that the master offers with the counter modes (hexadecimal digits)
+static std::string masterNonce(2 * OPDI_CTR_NONCE_SIZE, '0');
+
+static uint8_t io_receive(void *info, uint8_t *byte, uint16_t timeout, uint8_t canSend) {
+	if (inputPos >= inputLength)
+		return OPDI_TIMEOUT;
+	*byte = input[inputPos++];
+	return OPDI_STATUS_OK;
+}
+
+static uint8_t io_receive_bulk(void *info, uint8_t *bytes, uint16_t maxcount, uint16_t *count, uint16_t timeout, uint8_t canSend) {
+	size_t n = inputLength - inputPos;
+	if (n == 0)
+		return OPDI_TIMEOUT;
+	// deliver the bytes in chunks of different sizes
+	if (n > maxcount)
+		n = maxcount;
+	if (!fullChunks && n > (size_t)(inputPos % 61) + 1)
+		n = (inputPos % 61) + 1;
+	memcpy(bytes, input + inputPos, n);
+	inputPos += n;
+	*count = (uint16_t)n;
+	return OPDI_STATUS_OK;
+}
+
+static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count, uint8_t more) {
+	sent.append((const char *)bytes, count);
+	return OPDI_STATUS_OK;
+}
+
+static void fail(const char *check, const uint8_t *data, size_t size) {
+	fprintf(stderr, "fuzz: %s failed for input of %d bytes:\n", check, (int)size);
+	for (size_t i = 0; i < size; i++)
+		fprintf(stderr, "%02x%s", data[i], (i % 32 == 31 ? "\n" : " "));
+	fprintf(stderr, "\n");
+	abort();
+}
+
+/** Scans the frame byte by byte like strings_scan_frame without SIMD.
+*/
+static uint8_t reference_scan(const uint8_t *bytes, size_t maxLength, uint8_t terminator, uint8_t separator, opdi_FrameScan *scan) {
+	size_t length = 0;
+	uint32_t sum = 0;
+	uint32_t beforeLast = 0;
+
+	scan->first_sep = maxLength;
+	scan->last_sep = maxLength;
+	while (length < maxLength && bytes[length] != terminator) {
+		if (bytes[length] == separator) {
+			if (scan->first_sep == maxLength)
+				scan->first_sep = length;
+			scan->last_sep = length;
+			beforeLast = sum;
+		}
+		sum += bytes[length];
+		length++;
+	}
+	if (length < maxLength) {
+		// positions without a separator equal the length of the frame
+		if (scan->first_sep == maxLength)
+			scan->first_sep = length;
+		if (scan->last_sep == maxLength)
+			scan->last_sep = length;
+	}
+	scan->length = length;
+	scan->sum = sum;
+	scan->checksum = (scan->last_sep < length ? beforeLast : 0);
+	return (length < maxLength ? OPDI_STATUS_OK : OPDI_ERROR_MALFORMED_MESSAGE);
+}
+
+static uint16_t reference_crc16(const uint8_t *bytes, size_t length) {
+	uint16_t crc = 0xffff;
+	for (size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t)bytes[i] << 8;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+	}
+	return crc;
+}
+
+static uint32_t reference_crc32c(const uint8_t *bytes, size_t length) {
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < length; i++) {
+		crc ^= bytes[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1);
+	}
+	return ~crc;
+}
+
+/** Compares strings_scan_frame with the reference at all offsets of the first bytes (alignments).
+*/
+static void check_scan(const uint8_t *data, size_t size) {
+	for (size_t offset = 0; offset < size && offset < 32; offset++) {
+		for (int t = 0; t < 2; t++) {
+			uint8_t terminator = (t == 0 ? '\n' : '\0');
+			opdi_FrameScan scan, expected;
+			uint8_t result = strings_scan_frame(data + offset, size - offset, terminator, ':', &scan);
+			uint8_t expectedResult = reference_scan(data + offset, size - offset, terminator, ':', &expected);
+			if (result != expectedResult || scan.length != expected.length || scan.sum != expected.sum)
+				fail("strings_scan_frame", data, size);
+			// the separator positions are only defined if the terminator has been found
+			if (result == OPDI_STATUS_OK && (scan.first_sep != expected.first_sep || scan.last_sep != expected.last_sep || scan.checksum != expected.checksum))
+				fail("strings_scan_frame (separators)", data, size);
+		}
+	}
+	if (strings_crc16(0xffff, data, size) != reference_crc16(data, size))
+		fail("strings_crc16", data, size);
+	// the CRC-32C may be computed in parts
+	if (strings_crc32c(strings_crc32c(0, data, size / 3), data + size / 3, size - size / 3) != reference_crc32c(data, size))
+		fail("strings_crc32c", data, size);
+}
+
+// the framings of the slave
+#define TEXT		0
+#define BINARY		1
+#define CRC32C		2
+
+static const char *framingNames[] = { "", " (binary)", " (CRC-32C)" };
+
+/** Receives all messages from the input with the slave. Returns them as "channel:payload" lines.
+*/
+static std::string slave_receive(const uint8_t *data, size_t size, uint8_t framing, uint8_t encrypted, const char *nonce, bool bulk) {
+	static opdi_Session session;
+	opdi_Message message;
+	std::string result;
+
+	opdi_message_setup(&session, &io_receive, &io_send, NULL);
+	if (bulk)
+		opdi_message_set_bulk_receive(&session, &io_receive_bulk);
+	opdi_set_binary_framing(&session, framing == BINARY);
+	opdi_set_crc32c(&session, framing == CRC32C);
+	if (encrypted >= OPDI_USE_ENCRYPTION_CTR) {
+		char hex[2 * OPDI_CTR_NONCE_SIZE + 1];
+		opdi_new_ctr_nonce(&session, masterNonce.c_str(), hex);
+		// use the nonce of the input
+		memcpy(session.ctrNonce, nonce, OPDI_CTR_NONCE_SIZE);
+	}
+	opdi_set_encryption(&session, encrypted);
+	input = data;
+	inputLength = size;
+	inputPos = 0;
+	// the message layer ignores malformed messages; it stops at the end of the input
+	while (opdi_get_message(&session, &message, OPDI_CANNOT_SEND) == OPDI_STATUS_OK) {
+		if (strlen(message.payload) >= OPDI_MESSAGE_BUFFER_SIZE)
+			fail("slave payload length", data, size);
+		result += std::to_string(message.channel) + ":" + message.payload + "\n";
+	}
+	return result;
+}
+
+/** Receives the first text frame of the input so that it ends with the last byte of the receive buffer
+*   of the slave. The frame is decoded in place; the decoder must not read beyond its terminator.
+*   The empty frames before it are ignored.
+*/
+static void check_buffer_end(const uint8_t *data, size_t size, const char *nonce) {
+	const uint8_t *end = (const uint8_t *)memchr(data, '\n', size);
+	// the frame must fit into the message buffer, too
+	if (end == NULL || end - data >= OPDI_MESSAGE_BUFFER_SIZE - 2)
+		return;
+	size_t length = end - data + 1;
+	std::string framed(OPDI_RECEIVE_BUFFER_SIZE - length, '\n');
+	framed.append((const char *)data, length);
+	// binary frames are not terminated
+	static const uint8_t framings[] = { TEXT, CRC32C };
+	for (int f = 0; f < 2; f++) {
+		uint8_t framing = framings[f];
+		std::string expected = slave_receive((const uint8_t *)framed.data(), framed.size(), framing, 0, nonce, false);
+		fullChunks = true;
+		std::string received = slave_receive((const uint8_t *)framed.data(), framed.size(), framing, 0, nonce, true);
+		fullChunks = false;
+		if (received != expected)
+			fail((std::string("slave receive buffer end") + framingNames[framing]).c_str(), data, size);
+	}
+}
+
+/** Passes the input as text lines and binary frames to the master decoders. Malformed messages throw.
+*/
+static void master_decode(const uint8_t *data, size_t size) {
+	std::vector<char> line;
+	for (size_t i = 0; i <= size; i++) {
+		if (i == size || data[i] == OPDIMessage::TERMINATOR) {
+			line.push_back('\0');
+			for (int verbatim = 0; verbatim < 2; verbatim++)
+				for (int crc32c = 0; crc32c < 2; crc32c++) {
+					std::vector<char> buffer(line);
+					try {
+						delete OPDIMessage::decode(&buffer[0], verbatim != 0, crc32c != 0);
+					} catch (Poco::Exception&) {}
+				}
+			line.clear();
+		} else
+			line.push_back(data[i]);
+	}
+	// find the binary frames by their length prefixes
+	for (size_t pos = 0; pos < size; ) {
+		uint16_t bodyLength = 0;
+		uint8_t count = strings_get_varint(data + pos, size - pos, &bodyLength);
+		size_t length = count + bodyLength + 2;
+		if (count == 0 || length > size - pos)
+			length = size - pos;
+		try {
+			delete OPDIMessage::decodeBinary((const char *)data + pos, (int)length);
+		} catch (Poco::Exception&) {}
+		pos += (count == 0 ? 1 : length);
+	}
+}
+
+/** Passes the input as encrypted bytes to the master (read_block).
+*/
+static void master_receive(const uint8_t *data, size_t size, MessageQueueDevice::Encryption encryption, const char *nonce) {
+	MemoryDevice device;
+	char buffer[256];
+
+	device.setEncryption(encryption, nonce);
+	for (size_t pos = 0; pos < size; ) {
+		// deliver the bytes in chunks of different sizes
+		size_t chunk = (pos % 37) + 1;
+		device.input.append((const char *)data + pos, (chunk < size - pos ? chunk : size - pos));
+		pos += chunk;
+		while (device.has_block())
+			if (device.read_block(buffer, sizeof(buffer)) == 0)
+				break;
+	}
+}
+
+/** Derives a message from the input: the first byte is the channel, the rest is the payload.
+*   The terminator, the null character and the fragment marker are replaced.
+*/
+static void derive_message(const uint8_t *data, size_t size, int *channel, std::string *payload) {
+	// the slave accepts channel numbers of up to two digits
+	*channel = (size > 0 ? data[0] % 100 : 0);
+	payload->clear();
+	for (size_t i = 1; i < size && payload->size() < 180; i++) {
+		char c = (char)data[i];
+		if (c == '\n' || c == '\0' || c == '\r' || c == OPDI_FRAGMENT_MARKER)
+			c = ' ';
+		*payload += c;
+	}
+}
+
+/** Sends the derived message from the slave to the master and back in all framings and encryption modes.
+*/
+static void check_round_trip(const uint8_t *data, size_t size, const char *nonce) {
+	static opdi_Session session;
+	static const MessageQueueDevice::Encryption encryptions[] = { MessageQueueDevice::NO_ENCRYPTION,
+		MessageQueueDevice::AES, MessageQueueDevice::AES_CTR, MessageQueueDevice::AES_GCM };
+	int channel;
+	std::string payload;
+	char slavePayload[OPDI_MESSAGE_BUFFER_SIZE];
+	char buffer[OPDI_MESSAGE_BUFFER_SIZE + 16];
+	char nonceHex[2 * OPDI_CTR_NONCE_SIZE + 1];
+
+	// the text frame of the message
+	std::string frame;
+
+	derive_message(data, size, &channel, &payload);
+	for (int i = 0; i < OPDI_CTR_NONCE_SIZE; i++)
+		snprintf(nonceHex + 2 * i, 3, "%02x", (uint8_t)nonce[i]);
+
+	// slave to master
+	for (uint8_t framing = TEXT; framing <= CRC32C; framing++) {
+		std::string check = std::string("slave to master") + framingNames[framing];
+		opdi_Message message;
+		opdi_message_setup(&session, &io_receive, &io_send, NULL);
+		opdi_set_binary_framing(&session, framing == BINARY);
+		opdi_set_crc32c(&session, framing == CRC32C);
+		strcpy(slavePayload, payload.c_str());
+		message.channel = (channel_t)channel;
+		message.payload = slavePayload;
+		sent.clear();
+		if (opdi_put_message(&session, &message) != OPDI_STATUS_OK)
+			// too long or not encodable
+			return;
+		OPDIMessage *decoded = NULL;
+		try {
+			if (framing == BINARY)
+				decoded = OPDIMessage::decodeBinary(sent.data(), (int)sent.size());
+			else {
+				std::vector<char> line(sent.begin(), sent.end() - 1);
+				line.push_back('\0');
+				decoded = OPDIMessage::decode(&line[0], true, framing == CRC32C);
+			}
+		} catch (Poco::Exception&) {
+			fail(check.c_str(), data, size);
+		}
+		if (decoded->getChannel() != channel || decoded->getPayload() != payload)
+			fail(check.c_str(), data, size);
+		delete decoded;
+		if (framing == TEXT)
+			frame = sent;
+	}
+
+	// master to slave
+	OPDIMessage message(channel, payload);
+	int length;
+	try {
+		length = message.encode(0, buffer, sizeof(buffer));
+	} catch (Poco::Exception&) {
+		fail("master encode", data, size);
+	}
+	std::string expected = std::to_string(channel) + ":" + payload + "\n";
+	for (int e = 0; e < 4; e++) {
+		MemoryDevice device;
+		uint8_t encrypted = (uint8_t)encryptions[e];
+		if (encryptions[e] == MessageQueueDevice::NO_ENCRYPTION)
+			device.output.assign(buffer, length);
+		else {
+			masterNonce = device.newEncryptionNonce();
+			device.setEncryption(encryptions[e], nonceHex);
+			std::vector<char> copy(buffer, buffer + length);
+			device.write_blocks(&copy[0], length);
+		}
+		std::string received = slave_receive((const uint8_t *)device.output.data(), device.output.size(), TEXT, encrypted, nonce, false);
+		if (received != expected)
+			fail("master to slave", data, size);
+
+		// the slave encrypts the message for the master
+		if (encryptions[e] != MessageQueueDevice::NO_ENCRYPTION) {
+			opdi_Message slaveMessage;
+			char hex[2 * OPDI_CTR_NONCE_SIZE + 1];
+			MemoryDevice master;
+			opdi_message_setup(&session, &io_receive, &io_send, NULL);
+			if (opdi_new_ctr_nonce(&session, master.newEncryptionNonce().c_str(), hex) != OPDI_STATUS_OK)
+				fail("slave nonce", data, size);
+			opdi_set_encryption(&session, encrypted);
+			strcpy(slavePayload, payload.c_str());
+			slaveMessage.channel = (channel_t)channel;
+			slaveMessage.payload = slavePayload;
+			sent.clear();
+			opdi_put_message(&session, &slaveMessage);
+			master.setEncryption(encryptions[e], hex);
+			master.setInput(sent);
+			std::string decrypted;
+			while (master.has_block()) {
+				int count = master.read_block(buffer, sizeof(buffer));
+				if (count == 0)
+					break;
+				decrypted.append(buffer, count);
+			}
+			// the master restores the text frame
+			if (decrypted != frame)
+				fail("slave to master (encrypted)", data, size);
+		}
+	}
+
+	// master to slave with CRC-32C
+	try {
+		length = message.encode(0, buffer, sizeof(buffer), true);
+	} catch (Poco::Exception&) {
+		fail("master encode (CRC-32C)", data, size);
+	}
+	if (slave_receive((const uint8_t *)buffer, length, CRC32C, 0, nonce, false) != expected)
+		fail("master to slave (CRC-32C)", data, size);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	// the nonce of the counter modes is taken from the input
+	char nonce[OPDI_CTR_NONCE_SIZE];
+	for (int i = 0; i < OPDI_CTR_NONCE_SIZE; i++)
+		nonce[i] = (char)(i < (int)size ? data[i] : i);
+	char nonceHex[2 * OPDI_CTR_NONCE_SIZE + 1];
+	for (int i = 0; i < OPDI_CTR_NONCE_SIZE; i++)
+		snprintf(nonceHex + 2 * i, 3, "%02x", (uint8_t)nonce[i]);
+
+	check_scan(data, size);
+
+	// the byte and the bulk receive functions must return the same messages
+	for (uint8_t framing = TEXT; framing <= CRC32C; framing++)
+		if (slave_receive(data, size, framing, 0, nonce, false) != slave_receive(data, size, framing, 0, nonce, true))
+			fail((std::string("slave bulk receive") + framingNames[framing]).c_str(), data, size);
+	check_buffer_end(data, size, nonce);
+	slave_receive(data, size, TEXT, OPDI_USE_ENCRYPTION, nonce, false);
+	if (slave_receive(data, size, TEXT, OPDI_USE_ENCRYPTION_CTR, nonce, false) != slave_receive(data, size, TEXT, OPDI_USE_ENCRYPTION_CTR, nonce, true))
+		fail("slave bulk receive (AES-CTR)", data, size);
+	slave_receive(data, size, CRC32C, OPDI_USE_ENCRYPTION_CTR, nonce, true);
+	slave_receive(data, size, TEXT, OPDI_USE_ENCRYPTION_GCM, nonce, false);
+
+	master_decode(data, size);
+	master_receive(data, size, MessageQueueDevice::AES, nonceHex);
+	master_receive(data, size, MessageQueueDevice::AES_CTR, nonceHex);
+	master_receive(data, size, MessageQueueDevice::AES_GCM, nonceHex);
+
+	check_round_trip(data, size, nonce);
+	return 0;
+}
+
+// the key of the encryption modes
+char opdi_encryption_key[] = "0123456789012345";
+const uint16_t opdi_encryption_blocksize = OPDI_ENCRYPTION_BLOCKSIZE;
+
+// the message layer requires the debug callback
+uint8_t opdi_debug_msg(const char *str, uint8_t direction) {
+	return OPDI_STATUS_OK;
+}
+
+#ifndef OPDI_LIBFUZZER
+
+// the inputs that are mutated
+static const char *seeds[] = {
+	"0:OPDI:0.1:0:AES:0649\n",
+	"1:gDC:0151\n",
+	"1:BDC:DO1:DO2:DI1:AO1:AI1:SL1:DL1:SL2:0cd6\n1:gPI:DO1:0297\n",
+	"1:a::b: c:0267\n\x17:0000\n",
+	"1:gDC:2fec7ef8\n2:gDS:DP1:aa664b64\n",
+	"\x07\x01gDC\x5c\x2f\x06\x01gPI:DP1\x00\x00",
+};
+
+#define SEED_COUNT	(sizeof(seeds) / sizeof(seeds[0]))
+
+/** Changes the input at random: flips bits, inserts, removes and duplicates bytes.
+*/
+static void mutate(std::string &data) {
+	int changes = 1 + rand() % 8;
+	for (int i = 0; i < changes; i++) {
+		size_t pos = (data.empty() ? 0 : rand() % (data.size() + 1));
+		switch (rand() % 6) {
+		case 0:
+			if (pos < data.size())
+				data[pos] ^= (char)(1 << (rand() % 8));
+			break;
+		case 1:
+			data.insert(pos, 1, (char)(rand() % 256));
+			break;
+		case 2:
+			// insert a character that is significant for the message layer
+			data.insert(pos, 1, ":\n\r\x17 0f"[rand() % 7]);
+			break;
+		case 3:
+			if (pos < data.size())
+				data.erase(pos, 1 + rand() % 4);
+			break;
+		case 4:
+			if (pos < data.size())
+				data.insert(pos, data.substr(pos, 1 + rand() % 32));
+			break;
+		default:
+			data += seeds[rand() % SEED_COUNT];
+			break;
+		}
+	}
+	if (data.size() > 2048)
+		data.resize(2048);
+}
+
+int main(int argc, char *argv[]) {
+	long iterations = 10000;
+	unsigned int seed = 1;
+	if (argc > 1)
+		iterations = atol(argv[1]);
+	if (argc > 2)
+		seed = (unsigned int)atol(argv[2]);
+	if (iterations <= 0) {
+		printf("Usage: fuzz [iterations [seed]]\n");
+		return 1;
+	}
+	srand(seed);
+	opdi_trace_level = OPDI_TRACE_OFF;
+
+	std::string data;
+	for (long i = 0; i < iterations; i++) {
+		// start again from a seed from time to time
+		if (i % 64 == 0)
+			data = seeds[rand() % SEED_COUNT];
+		mutate(data);
+		LLVMFuzzerTestOneInput((const uint8_t *)data.data(), data.size());
+	}
+	printf("fuzz: %ld inputs passed\n", iterations);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,77 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Configuration specification for the OPDI benchmarks.
+// The message layer settings correspond to the LinOPDI configuration.
+
+#ifndef __OPDI_CONFIGSPECS_H
+#define __OPDI_CONFIGSPECS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Defines the maximum message length this slave can receive.
+#define OPDI_MESSAGE_BUFFER_SIZE		256
+
+// Defines the maximum message string length this slave can receive.
+#define OPDI_MESSAGE_PAYLOAD_LENGTH	(OPDI_MESSAGE_BUFFER_SIZE - 9)
+
+// Defines the size of the buffer for incoming data that is read in chunks.
+#define OPDI_RECEIVE_BUFFER_SIZE		1024
+
+// Define to support binary message frames (length prefix, channel number and CRC-16 instead of
+// the text form with additive checksum) if the master requests them during the handshake.
+#define OPDI_BINARY_FRAMING
+
+// Define to end text messages with a CRC-32C instead of the additive checksum if the master requests it
+// during the handshake. The CRC detects reordered bytes; it is computed with the CRC32 instructions
+// of SSE4.2 or ARMv8 if the compiler targets them.
+#define OPDI_CRC32C
+
+#define OPDI_MAX_MESSAGE_PARTS	16
+
+// The scale benchmark runs the slave protocol with a growing port registry.
+#define OPDI_IS_SLAVE		1
+
+#define OPDI_MASTER_NAME_LENGTH	32
+
+// the initial capacity of the port registry
+#define OPDI_MAX_DEVICE_PORTS	32
+
+#define OPDI_PORT_INDEX_SIZE	64
+
+#define OPDI_DYNAMIC_PORTS		256
+
+// each of the concurrent sessions of the scale benchmark binds one streaming port
+#define OPDI_STREAMING_PORTS		2
+
+#define OPDI_MAX_PORT_INFO_MESSAGE	240
+
+// The AES backends are measured with this block size; the sessions of the benchmarks are not encrypted.
+#define OPDI_ENCRYPTION_BLOCKSIZE	16
+
+// The encrypted messages are also measured in counter mode and in Galois/counter mode.
+#define OPDI_ENCRYPTION_CTR
+#define OPDI_ENCRYPTION_GCM
+
+/** Define to encrypt the counter and Galois/counter modes with a key per session. It is derived
+*   from the nonces of the slave and the master during the handshake; the device key is only used
+*   to derive it. Requires OPDI_ENCRYPTION_CTR.
+*/
+#define OPDI_SESSION_KEYS
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		// __OPDI_CONFIGSPECS_H
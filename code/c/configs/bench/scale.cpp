@@ -0,0 +1,529 @@
+//    This file is part of an OPDI reference implementation.
+//    see: Open Protocol for Device Interaction
+//
+//    Copyright (C) 2011-2016 Leo Meyer (leo@leomeyer.de)
+//    All rights reserved.
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+
+// Scale benchmark for the slave protocol with a large number of ports.
+// Usage: scale [ports [rounds]]
+// A master in memory connects to the slave, queries the device capabilities page by page and
+// then the info and the state of each port. This is compared with pages that contain the port
+// info records (gDC:<cursor>:gPI), after which only the states are queried. Reports the time of
+// the handshake and of the full refresh, the round trips and the bytes that the slave has sent.
+// Finally two masters refresh the ports at the same time on two threads. Each of them binds its own
+// streaming port to the same channel number in its session.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include "opdi_constants.h"
+#include "opdi_config.h"
+#include "opdi_port.h"
+#include "opdi_message.h"
+#include "opdi_protocol_constants.h"
+#include "opdi_slave_protocol.h"
+
+#ifndef OPDI_DYNAMIC_PORTS
+#error "The scale benchmark requires OPDI_DYNAMIC_PORTS"
+#endif
+
+#if (OPDI_STREAMING_PORTS == 0)
+#error "The scale benchmark requires OPDI_STREAMING_PORTS"
+#endif
+
+// the states of the master
+#define HANDSHAKE		0
+#define PROTOCOL		1
+#define BIND			2
+#define CAPABILITIES	3
+#define PORT_INFO		4
+#define PORT_STATE		5
+#define DONE			6
+
+// the channel that the concurrent masters bind their streaming ports to
+#define STREAM_CHANNEL	"2"
+
+// The state of the master belongs to the thread, so that two masters can run at the same time.
+
+// the requests of the master that have not been read by the slave
+static thread_local std::string input;
+static thread_local size_t inputPos;
+// the replies of the slave that have not been processed by the master
+static thread_local std::string output;
+
+static thread_local int state;
+// whether the pages of the device capabilities contain the port info records
+static bool infoPages;
+// the streaming port that the master binds after the handshake; empty if none
+static thread_local std::string streamPort;
+// the port IDs and magics that the master has received, and the position of the port that is queried
+static thread_local std::vector<std::string> portIDs;
+static thread_local std::vector<std::string> portMagics;
+static thread_local size_t portPos;
+
+// the number of requests and the number of bytes that the slave has sent
+static thread_local long requests;
+static thread_local double sentBytes;
+
+static thread_local std::chrono::steady_clock::time_point startTime;
+static thread_local double handshakeTime;
+static thread_local double refreshTime;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void fail(const char *reason, const std::string &reply) {
+	printf("Error: %s: %s\n", reason, reply.c_str());
+	exit(1);
+}
+
+/** Appends a request with the additive checksum to the input of the slave.
+*/
+static void request(int channel, const std::string &payload) {
+	char checksum[8];
+	std::string message = std::to_string(channel) + ":" + payload;
+	unsigned int sum = 0;
+	for (size_t i = 0; i < message.size(); i++)
+		sum += (uint8_t)message[i];
+	snprintf(checksum, sizeof(checksum), ":%04x\n", sum & 0xffff);
+	input += message + checksum;
+	requests++;
+}
+
+/** Sends the query of the state of the port with the given magic.
+*/
+static void request_state(const std::string &magic) {
+	const std::string &id = portIDs[portPos];
+	if (magic == OPDI_digitalPort)
+		request(1, "gDS:" + id);
+	else if (magic == OPDI_analogPort)
+		request(1, "gAS:" + id);
+	else
+		fail("unexpected port magic", magic);
+}
+
+/** Requests the page of the device capabilities at the given position.
+*/
+static void request_page(const std::string &cursor) {
+	request(1, "gDC:" + cursor + (infoPages ? ":gPI" : ""));
+}
+
+/** Adds the items of the list to the port IDs, or, if the list consists of info records,
+*   the IDs and the magics of the records. The items of the benchmark contain no separators.
+*/
+static void add_page(const std::string &list) {
+	std::vector<std::string> items;
+	for (size_t start = 0; start < list.size(); ) {
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		items.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+	if (!infoPages) {
+		portIDs.insert(portIDs.end(), items.begin(), items.end());
+		return;
+	}
+	// each record consists of the number of parts, the magic, the ID and further parts
+	for (size_t i = 0; i < items.size(); ) {
+		size_t count = atoi(items[i].c_str());
+		if ((count < 2) || (i + count >= items.size()))
+			fail("invalid info record", list);
+		// the streaming ports have no state
+		if (items[i + 1] != OPDI_streamingPort) {
+			portMagics.push_back(items[i + 1]);
+			portIDs.push_back(items[i + 2]);
+		}
+		i += count + 1;
+	}
+}
+
+/** Processes the reply of the slave and sends the next request. The reply consists of
+*   the channel and the payload; the checksum has been removed.
+*/
+static void next_request(const std::string &reply) {
+	size_t sep = reply.find(':');
+	if (sep == std::string::npos)
+		fail("invalid reply", reply);
+	std::string payload = reply.substr(sep + 1);
+
+	switch (state) {
+	case HANDSHAKE:
+		if (payload.compare(0, 5, "OPDI:") != 0)
+			fail("handshake refused", reply);
+		request(0, "BP:en:Scale");
+		state = PROTOCOL;
+		break;
+	case PROTOCOL:
+		if (payload.compare(0, 3, "OK:") != 0)
+			fail("protocol refused", reply);
+		handshakeTime += seconds_since(startTime);
+		startTime = std::chrono::steady_clock::now();
+		portIDs.clear();
+		portMagics.clear();
+		if (!streamPort.empty()) {
+			request(1, std::string(OPDI_bindStreamingPort) + ":" + streamPort + ":" + STREAM_CHANNEL);
+			state = BIND;
+			break;
+		}
+		request_page("0");
+		state = CAPABILITIES;
+		break;
+	case BIND:
+		if (payload != OPDI_Agreement)
+			fail("binding refused", reply);
+		request_page("0");
+		state = CAPABILITIES;
+		break;
+	case CAPABILITIES: {
+		// BDC:<next>:<port IDs>
+		if (payload.compare(0, 4, "BDC:") != 0)
+			fail("unexpected capabilities", reply);
+		size_t pos = payload.find(':', 4);
+		if (pos == std::string::npos)
+			fail("capabilities are not paginated", reply);
+		std::string next = payload.substr(4, pos - 4);
+		add_page(payload.substr(pos + 1));
+		if (next != "0") {
+			request_page(next);
+			break;
+		}
+		portPos = 0;
+		if (infoPages) {
+			request_state(portMagics[0]);
+			state = PORT_STATE;
+		} else {
+			request(1, "gPI:" + portIDs[0]);
+			state = PORT_INFO;
+		}
+		break;
+	}
+	case PORT_INFO:
+		request_state(payload.substr(0, payload.find(':')));
+		state = PORT_STATE;
+		break;
+	case PORT_STATE:
+		if (payload.compare(0, 3, "DS:") != 0 && payload.compare(0, 3, "AS:") != 0)
+			fail("unexpected port state", reply);
+		portPos++;
+		if (portPos < portIDs.size()) {
+			if (infoPages) {
+				request_state(portMagics[portPos]);
+				break;
+			}
+			request(1, "gPI:" + portIDs[portPos]);
+			state = PORT_INFO;
+			break;
+		}
+		refreshTime += seconds_since(startTime);
+		request(0, OPDI_Disconnect);
+		state = DONE;
+		break;
+	default:
+		fail("unexpected reply", reply);
+	}
+}
+
+/** Delivers the requests of the master. If all of them have been read, the master
+*   processes the replies of the slave to create the next ones.
+*/
+static uint8_t io_receive(void *info, uint8_t *byte, uint16_t timeout, uint8_t canSend) {
+	while (inputPos >= input.size()) {
+		size_t end = output.find('\n');
+		if (end == std::string::npos)
+			return OPDI_TIMEOUT;
+		input.clear();
+		inputPos = 0;
+		// remove the checksum
+		next_request(output.substr(0, end - 5));
+		output.erase(0, end + 1);
+	}
+	*byte = (uint8_t)input[inputPos++];
+	return OPDI_STATUS_OK;
+}
+
+static uint8_t io_send(void *info, uint8_t *bytes, uint16_t count, uint8_t more) {
+	sentBytes += count;
+	output.append((const char *)bytes, count);
+	return OPDI_STATUS_OK;
+}
+
+/** Connects the master, refreshes all ports and disconnects. Returns the result of the slave.
+*/
+static uint8_t run_session(void) {
+	static thread_local opdi_Session session;
+	opdi_Message message;
+	uint8_t result;
+
+	input.clear();
+	inputPos = 0;
+	output.clear();
+	state = HANDSHAKE;
+	startTime = std::chrono::steady_clock::now();
+
+	opdi_message_setup(&session, &io_receive, &io_send, NULL);
+	request(0, "OPDI:0.1:0:");
+	result = opdi_get_message(&session, &message, OPDI_CANNOT_SEND);
+	if (result == OPDI_STATUS_OK)
+		result = opdi_slave_start(&session, &message, NULL, NULL);
+	opdi_message_cleanup(&session);
+	return result;
+}
+
+// the identifiers and the names of the ports
+static std::vector<std::string> ids;
+static std::vector<std::string> names;
+
+static void add_ports(long count) {
+	ids.resize(count);
+	names.resize(count);
+	for (long i = 0; i < count; i++) {
+		ids[i] = "P" + std::to_string(i);
+		names[i] = "Port " + std::to_string(i);
+		opdi_Port *port = opdi_new_port();
+		if (port == NULL) {
+			printf("Error: Not enough memory for %ld ports\n", count);
+			exit(1);
+		}
+		port->id = ids[i].c_str();
+		port->name = names[i].c_str();
+		// alternate digital and analog ports
+		port->type = (i % 2 == 0 ? OPDI_PORTTYPE_DIGITAL : OPDI_PORTTYPE_ANALOG);
+		port->caps = OPDI_PORTDIRCAP_BIDI;
+		if (opdi_add_port(port) != OPDI_STATUS_OK) {
+			printf("Error: Unable to add %ld ports\n", count);
+			exit(1);
+		}
+	}
+}
+
+// the streaming ports of the concurrent masters
+static const char *streamIDs[] = { "S0", "S1" };
+static opdi_StreamingPortInfo streamInfos[2];
+static opdi_Port streamPorts[2];
+
+static void add_streaming_ports(void) {
+	for (int i = 0; i < 2; i++) {
+		streamInfos[i].driverID = "Scale";
+		streamPorts[i].id = streamIDs[i];
+		streamPorts[i].name = streamIDs[i];
+		streamPorts[i].type = OPDI_PORTTYPE_STREAMING;
+		streamPorts[i].caps = OPDI_PORTDIRCAP_BIDI;
+		streamPorts[i].info.ptr = &streamInfos[i];
+		if (opdi_add_port(&streamPorts[i]) != OPDI_STATUS_OK) {
+			printf("Error: Unable to add the streaming ports\n");
+			exit(1);
+		}
+	}
+}
+
+// the concurrent masters announce their names at the same time
+thread_local char opdi_master_name[OPDI_MASTER_NAME_LENGTH];
+uint16_t opdi_device_flags = 0;
+char opdi_encryption_method[] = "AES";
+char opdi_encryption_key[] = "0123456789012345";
+const uint16_t opdi_encryption_blocksize = OPDI_ENCRYPTION_BLOCKSIZE;
+
+uint8_t opdi_debug_msg(const char *str, uint8_t direction) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_slave_callback(OPDIFunctionCode opdiFunctionCode, char *buffer, size_t data) {
+	switch (opdiFunctionCode) {
+	case OPDI_FUNCTION_GET_CONFIG_NAME: strncpy(buffer, "OPDI Scale Benchmark", data); return OPDI_STATUS_OK;
+	case OPDI_FUNCTION_SET_MASTER_NAME: strncpy(opdi_master_name, buffer, sizeof(opdi_master_name) - 1); return OPDI_STATUS_OK;
+	case OPDI_FUNCTION_GET_SUPPORTED_PROTOCOLS: strncpy(buffer, "BP", data); return OPDI_STATUS_OK;
+	case OPDI_FUNCTION_GET_ENCODING: strncpy(buffer, "ISO8859-1", data); return OPDI_STATUS_OK;
+	case OPDI_FUNCTION_SET_LANGUAGES: return OPDI_STATUS_OK;
+	case OPDI_FUNCTION_GET_EXTENDED_DEVICEINFO:
+	case OPDI_FUNCTION_GET_EXTENDED_PORTINFO:
+	case OPDI_FUNCTION_GET_EXTENDED_PORTSTATE:
+		buffer[0] = '\0';
+		return OPDI_STATUS_OK;
+	default: return OPDI_FUNCTION_UNKNOWN;
+	}
+}
+
+// the ports have constant states
+
+uint8_t opdi_get_analog_port_state(opdi_Port *port, char mode[], char res[], char ref[], int32_t *value) {
+	mode[0] = '0';
+	res[0] = '1';
+	ref[0] = '0';
+	*value = 512;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_analog_port_value(opdi_Port *port, int32_t value) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_analog_port_mode(opdi_Port *port, const char mode[]) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_analog_port_resolution(opdi_Port *port, const char res[]) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_analog_port_reference(opdi_Port *port, const char ref[]) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_get_digital_port_state(opdi_Port *port, char mode[], char line[]) {
+	mode[0] = '0';
+	line[0] = '1';
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_digital_port_line(opdi_Port *port, const char line[]) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_digital_port_mode(opdi_Port *port, const char mode[]) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_get_select_port_state(opdi_Port *port, uint16_t *position) {
+	*position = 0;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_select_port_position(opdi_Port *port, uint16_t position) {
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_get_dial_port_state(opdi_Port *port, int64_t *position) {
+	*position = 0;
+	return OPDI_STATUS_OK;
+}
+
+uint8_t opdi_set_dial_port_position(opdi_Port *port, int64_t position) {
+	return OPDI_STATUS_OK;
+}
+
+/** Measures the given number of sessions and prints the results. Returns 0 if all sessions succeed.
+*/
+static int bench_refresh(const char *name, long ports, long rounds, bool withInfos) {
+	infoPages = withInfos;
+	requests = 0;
+	sentBytes = 0;
+	handshakeTime = 0;
+	refreshTime = 0;
+
+	for (long i = 0; i < rounds; i++) {
+		uint8_t result = run_session();
+		if ((result != OPDI_DISCONNECTED) || (state != DONE)) {
+			printf("Error: The session ended with result %d\n", result);
+			return 1;
+		}
+		if (portIDs.size() != (size_t)ports) {
+			printf("Error: The master has received %zu of %ld port IDs\n", portIDs.size(), ports);
+			return 1;
+		}
+	}
+
+	printf("%s:\n", name);
+	printf("  %-22s %10ld rounds %9.3f ms\n", "handshake", rounds, handshakeTime * 1e3 / rounds);
+	printf("  %-22s %10ld rounds %9.3f ms %8.1f us/port\n", "full refresh", rounds, refreshTime * 1e3 / rounds,
+		refreshTime * 1e6 / rounds / ports);
+	printf("  %-22s %10ld per round %6.1f KB sent per round\n", "round trips", requests / rounds, sentBytes / rounds / 1e3);
+	return 0;
+}
+
+/** The results of the sessions of one of the concurrent masters.
+*/
+struct MasterResult {
+	uint8_t result;
+	size_t portCount;
+	double refreshTime;
+};
+
+/** Runs the given number of sessions on the calling thread. The master binds the streaming port
+*   with the given index after each handshake.
+*/
+static void run_master(int index, long rounds, MasterResult *masterResult) {
+	streamPort = streamIDs[index];
+	refreshTime = 0;
+	masterResult->result = OPDI_DISCONNECTED;
+	for (long i = 0; i < rounds; i++) {
+		uint8_t result = run_session();
+		if ((result != OPDI_DISCONNECTED) || (state != DONE)) {
+			masterResult->result = result;
+			break;
+		}
+	}
+	masterResult->portCount = portIDs.size();
+	masterResult->refreshTime = refreshTime;
+}
+
+/** Measures two masters whose sessions run at the same time. Returns 0 if all sessions succeed.
+*/
+static int bench_concurrent(long ports, long rounds) {
+	MasterResult results[2];
+
+	infoPages = true;
+	add_streaming_ports();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread first(run_master, 0, rounds, &results[0]);
+	std::thread second(run_master, 1, rounds, &results[1]);
+	first.join();
+	second.join();
+	double seconds = seconds_since(start);
+
+	for (int i = 0; i < 2; i++) {
+		if (results[i].result != OPDI_DISCONNECTED) {
+			printf("Error: A session of master %d ended with result %d\n", i + 1, results[i].result);
+			return 1;
+		}
+		if (results[i].portCount != (size_t)ports) {
+			printf("Error: Master %d has received %zu of %ld port IDs\n", i + 1, results[i].portCount, ports);
+			return 1;
+		}
+	}
+
+	printf("two concurrent sessions:\n");
+	printf("  %-22s %10ld rounds %9.3f ms %8.1f us/port\n", "full refresh", rounds,
+		(results[0].refreshTime + results[1].refreshTime) * 1e3 / 2 / rounds,
+		(results[0].refreshTime + results[1].refreshTime) * 1e6 / 2 / rounds / ports);
+	printf("  %-22s %10ld rounds %9.3f ms\n", "both masters", rounds, seconds * 1e3 / rounds);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	long ports = 10000;
+	long rounds = 10;
+	if (argc > 1)
+		ports = atol(argv[1]);
+	if (argc > 2)
+		rounds = atol(argv[2]);
+	if ((ports <= 0) || (ports > 0xffff) || (rounds <= 0)) {
+		printf("Usage: scale [ports [rounds]]\n");
+		return 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	add_ports(ports);
+	printf("%-24s %10ld ports %10.3f ms\n", "add ports", ports, seconds_since(start) * 1e3);
+
+	if (bench_refresh("ID pages", ports, rounds, false) != 0)
+		return 1;
+	if (bench_refresh("info pages", ports, rounds, true) != 0)
+		return 1;
+	if (bench_concurrent(ports, rounds) != 0)
+		return 1;
+
+	opdi_clear_ports();
+	return 0;
+}
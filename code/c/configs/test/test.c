@@ -37,6 +37,9 @@
 #include "test.h"
 
 char opdi_master_name[OPDI_MASTER_NAME_LENGTH];
+
+// the session of the connected master; is notified about simulated events
+opdi_Session test_session;
 uint16_t opdi_device_flags = 0; // OPDI_FLAG_AUTHENTICATION_REQUIRED;
 
 char opdi_encryption_method[] = "AES";
@@ -46,13 +49,6 @@ char opdi_encryption_key[] = "0123456789012345";
 char loginUser[] = "admin";
 char loginPassword[] = "admin";
 
-// provide MS-specific encryption buffers
-// (The MS compiler can't do dynamic array allocation on the stack apparently)
-#ifdef _MSC_VER
-uint8_t opdi_encryption_buffer[OPDI_ENCRYPTION_BLOCKSIZE];
-uint8_t opdi_encryption_buffer_2[OPDI_ENCRYPTION_BLOCKSIZE];
-#endif
-
 /// Ports
 
 static struct opdi_Port digPort = { "DP1", "Digital Port", OPDI_PORTTYPE_DIGITAL };
@@ -160,7 +156,7 @@ uint8_t opdi_set_analog_port_value(opdi_Port *port, int32_t value) {
 			// cause port refresh
 			refreshPort[0] = &digPort;
 			refreshPort[1] = NULL;
-			opdi_refresh(refreshPort);
+			opdi_refresh(&test_session, refreshPort);
 		}
 	} else
 		// unknown port
@@ -251,7 +247,7 @@ uint8_t opdi_set_digital_port_line(opdi_Port *port, const char line[]) {
 			// cause port refresh
 			refreshPort[0] = &anaPort;
 			refreshPort[1] = NULL;
-			opdi_refresh(refreshPort);
+			opdi_refresh(&test_session, refreshPort);
 		}
 	} else
 	if (!strcmp(port->id, digPort2.id)) {
@@ -333,15 +329,15 @@ uint8_t opdi_set_select_port_position(opdi_Port *port, uint16_t position) {
 			}
 
 			// ask the master to reconfigure
-			opdi_reconfigure();
+			opdi_reconfigure(&test_session);
 		}
 	} else
 	if (!strcmp(port->id, testPort.id)) {
 		switch(position) {
 			// simulate test cases
-		case 1: return opdi_disconnect();
+		case 1: return opdi_disconnect(&test_session);
 		case 2: exit(1);	// crash
-		case 3: return opdi_send_debug("Test debug message");
+		case 3: return opdi_send_debug(&test_session, "Test debug message");
 		case 4: return OPDI_DEVICE_ERROR;
 		}
 	} else
@@ -484,7 +480,7 @@ void handle_streaming_ports() {
 		m.channel = sp1Info.channel;
 		sprintf(bmp085, "BMP085:%.2f:%.2f", temperature, pressure);
 		m.payload = bmp085;
-		opdi_put_message(&m);
+		opdi_put_message(&test_session, &m);
 	}
 	// channel assigned for streaming port?
 	if (sp2Info.channel > 0) {
@@ -495,7 +491,7 @@ void handle_streaming_ports() {
 		// remove trailing 0x0A (it's the message separator and will prevent the message from being sent)
 		clocktext[strlen(clocktext) - 1] = '\0';
 		m.payload = clocktext;
-		opdi_put_message(&m);
+		opdi_put_message(&test_session, &m);
 	}
 }
 
@@ -26,11 +26,15 @@
 
 #define OPDI_CONFIG_NAME_LENGTH 32
 
+#include "opdi_message.h"
+
 // externs defined in test.c
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+extern opdi_Session test_session;
+
 extern void configure_ports();
 extern void handle_streaming_ports();
 extern void my_protocol_callback(uint8_t state);
@@ -29,5 +29,8 @@
 #error "Not implemented; please define channel number data type"
 #endif
 
+// storage class of variables that have one instance per thread; there is only one thread
+#define OPDI_THREAD_LOCAL
+
 
 #endif		// __PLATFORMTYPES_H
\ No newline at end of file
@@ -17,7 +17,9 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
+#include <sys/syscall.h>
 
 #include "opdi_constants.h"
 #include "opdi_platformfuncs.h"
@@ -158,4 +160,43 @@ uint64_t opdi_get_time_ms(void) {
     return theTick;
 }
 
+uint8_t opdi_random_bytes(uint8_t *bytes, uint16_t count) {
+	ssize_t n;
+	int fd;
+
+#ifdef SYS_getrandom
+	// the kernel's generator blocks only until it has been seeded after boot
+	while (count > 0) {
+		n = syscall(SYS_getrandom, bytes, count, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// older kernels don't support the call
+			if (errno == ENOSYS)
+				break;
+			return OPDI_DEVICE_ERROR;
+		}
+		bytes += n;
+		count -= (uint16_t)n;
+	}
+	if (count == 0)
+		return OPDI_STATUS_OK;
+#endif
 
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		return OPDI_DEVICE_ERROR;
+	while (count > 0) {
+		n = read(fd, bytes, count);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			close(fd);
+			return OPDI_DEVICE_ERROR;
+		}
+		bytes += n;
+		count -= (uint16_t)n;
+	}
+	close(fd);
+	return OPDI_STATUS_OK;
+}
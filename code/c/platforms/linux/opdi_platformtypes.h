@@ -30,6 +30,9 @@
 #error "Not implemented; please define channel number data type"
 #endif
 
+// storage class of variables that have one instance per thread
+#define OPDI_THREAD_LOCAL	__thread
+
 
 #endif		// __OPDI_PLATFORMTYPES_H
 
@@ -91,6 +91,12 @@ extern int8_t opdi_string_cmp(const char *s1, const char *s2);
 */
 extern uint64_t opdi_get_time_ms(void);
 
+/** Fills bytes with count bytes from a cryptographically secure random number generator.
+*   Returns OPDI_STATUS_OK or an error code if no secure random bytes are available.
+*   Required only if the counter modes of the encryption (OPDI_ENCRYPTION_CTR) are used.
+*/
+extern uint8_t opdi_random_bytes(uint8_t *bytes, uint16_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,7 @@
 
 #include <stdlib.h>
 #include <windows.h>
+#include <bcrypt.h>
 
 #include "opdi_constants.h"
 #include "opdi_platformfuncs.h"
@@ -146,3 +147,10 @@ int8_t opdi_string_cmp(const char *s1, const char *s2) {
 uint64_t opdi_get_time_ms(void) {
    	return GetTickCount64();
 }
+
+uint8_t opdi_random_bytes(uint8_t *bytes, uint16_t count) {
+	// the system preferred generator is a cryptographically secure generator
+	if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, bytes, count, BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+		return OPDI_DEVICE_ERROR;
+	return OPDI_STATUS_OK;
+}
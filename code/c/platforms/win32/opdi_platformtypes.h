@@ -44,5 +44,8 @@
 #error "Not implemented; please define channel number data type"
 #endif
 
+// storage class of variables that have one instance per thread
+#define OPDI_THREAD_LOCAL	__declspec(thread)
+
 
 #endif		// __OPDI_PLATFORMTYPES_H
\ No newline at end of file